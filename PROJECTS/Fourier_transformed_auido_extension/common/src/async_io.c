@@ -0,0 +1,507 @@
+// fileno/ftello/posix_memalign need POSIX declarations under -std=c99, and
+// syscall() the default (BSD/SVID) ones
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include "dfta_common.h"
+
+// io_uring is driven through its two system calls directly, so only the
+// kernel header is needed (not liburing). IORING_FEAT_RW_CUR_POS came with
+// IORING_OP_READ/WRITE in Linux 5.6 and doubles as the check for them.
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#if defined(IORING_FEAT_RW_CUR_POS) && defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define DFTA_HAVE_IO_URING 1
+#endif
+#endif
+#endif
+
+// Buffers kept in flight and the size of each. Page-aligned so the kernel
+// can copy whole pages; four 1 MB buffers keep a disk busy while the caller
+// converts the one it holds.
+#define ASYNC_IO_BUFFERS 4
+#define ASYNC_IO_BUFFER_BYTES (1 << 20)
+#define ASYNC_IO_ALIGNMENT 4096
+
+#define BACKEND_SYNC     0      // No helper thread could be started: I/O runs in the caller
+#define BACKEND_THREAD   1      // stdio on a helper thread (pipes, other platforms)
+#define BACKEND_IO_URING 2      // io_uring with explicit offsets (regular files on Linux)
+
+#define SLOT_READY   0          // Transfer finished (or none started); done and error are final
+#define SLOT_PENDING 1          // Submitted, transfer in progress
+
+typedef struct {
+    uint8_t* data;
+    size_t size;                // Bytes to transfer
+    size_t done;                // Bytes transferred; less than size at the end of the input
+    uint64_t offset;            // File offset of data[0] (io_uring)
+    int state;                  // Shared with the helper thread, under the lock
+    int error;
+    int submitted;              // Caller side: handed out and not yet waited for
+} IOSlot;
+
+#ifdef DFTA_HAVE_IO_URING
+typedef struct {
+    int fd;
+    void* sq_ring;
+    void* cq_ring;
+    size_t sq_ring_bytes;
+    size_t cq_ring_bytes;
+    struct io_uring_sqe* sqes;
+    size_t sqe_bytes;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_cqe* cqes;
+} IORing;
+#endif
+
+struct AsyncIO {
+    FILE* file;
+    int fd;
+    int writing;
+    int backend;
+    IOSlot slots[ASYNC_IO_BUFFERS];
+    size_t buffer_bytes;
+    int current;                // Slot the caller is filling (writer) or draining (reader)
+    size_t position;            // Bytes of the current slot filled or drained
+    uint64_t offset;            // File offset of the next submission (io_uring)
+    uint64_t remaining;         // Reader: bytes left to submit
+    int error;                  // First failed transfer
+    double wait_seconds;        // Time the caller spent blocked on transfers
+    
+    // Helper thread: works through submitted slots in ring order
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;     // A slot was submitted or finished, or shutdown was requested
+    int next_io;
+    int shutdown;
+    
+#ifdef DFTA_HAVE_IO_URING
+    IORing ring;
+#endif
+};
+
+static double monotonic_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Blocking transfer of one slot through stdio, for the thread and sync
+// backends. Writes are flushed so a stream reader sees each block as soon
+// as it is handed over.
+static void transfer_slot(AsyncIO* io, IOSlot* slot) {
+    if (io->writing) {
+        slot->done = fwrite(slot->data, 1, slot->size, io->file);
+        slot->error = slot->done != slot->size || fflush(io->file) != 0;
+    } else {
+        slot->done = fread(slot->data, 1, slot->size, io->file);
+        slot->error = slot->done != slot->size && ferror(io->file);
+    }
+}
+
+static void* io_thread(void* arg) {
+    AsyncIO* io = arg;
+    
+    pthread_mutex_lock(&io->lock);
+    for (;;) {
+        IOSlot* slot = &io->slots[io->next_io];
+        while (slot->state != SLOT_PENDING && !io->shutdown) {
+            pthread_cond_wait(&io->changed, &io->lock);
+        }
+        if (slot->state != SLOT_PENDING) break;
+        pthread_mutex_unlock(&io->lock);
+        
+        transfer_slot(io, slot);
+        
+        pthread_mutex_lock(&io->lock);
+        slot->state = SLOT_READY;
+        io->next_io = (io->next_io + 1) % ASYNC_IO_BUFFERS;
+        pthread_cond_broadcast(&io->changed);
+    }
+    pthread_mutex_unlock(&io->lock);
+    return NULL;
+}
+
+#ifdef DFTA_HAVE_IO_URING
+static int ring_init(IORing* ring, unsigned entries) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    memset(ring, 0, sizeof(IORing));
+    ring->fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd < 0) return 0;
+    if (!(params.features & IORING_FEAT_RW_CUR_POS)) {
+        close(ring->fd);
+        return 0;
+    }
+    
+    ring->sq_ring_bytes = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_bytes = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        // Both rings share one mapping
+        if (ring->cq_ring_bytes > ring->sq_ring_bytes) ring->sq_ring_bytes = ring->cq_ring_bytes;
+        ring->cq_ring_bytes = 0;
+    }
+    ring->sq_ring = mmap(NULL, ring->sq_ring_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         ring->fd, IORING_OFF_SQ_RING);
+    ring->cq_ring = ring->sq_ring;
+    if (ring->sq_ring != MAP_FAILED && ring->cq_ring_bytes > 0) {
+        ring->cq_ring = mmap(NULL, ring->cq_ring_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                             ring->fd, IORING_OFF_CQ_RING);
+    }
+    ring->sqe_bytes = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = MAP_FAILED;
+    if (ring->sq_ring != MAP_FAILED && ring->cq_ring != MAP_FAILED) {
+        ring->sqes = mmap(NULL, ring->sqe_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                          ring->fd, IORING_OFF_SQES);
+    }
+    if (ring->sq_ring == MAP_FAILED || ring->cq_ring == MAP_FAILED || ring->sqes == MAP_FAILED) {
+        if (ring->sq_ring != MAP_FAILED) munmap(ring->sq_ring, ring->sq_ring_bytes);
+        if (ring->cq_ring_bytes > 0 && ring->cq_ring != MAP_FAILED) munmap(ring->cq_ring, ring->cq_ring_bytes);
+        close(ring->fd);
+        return 0;
+    }
+    
+    uint8_t* sq = ring->sq_ring;
+    uint8_t* cq = ring->cq_ring;
+    ring->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned*)(sq + params.sq_off.array);
+    ring->cq_head = (unsigned*)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+    return 1;
+}
+
+static void ring_free(IORing* ring) {
+    munmap(ring->sqes, ring->sqe_bytes);
+    if (ring->cq_ring_bytes > 0) munmap(ring->cq_ring, ring->cq_ring_bytes);
+    munmap(ring->sq_ring, ring->sq_ring_bytes);
+    close(ring->fd);
+}
+
+// Queue the untransferred part of a slot. The ring has an entry per slot,
+// so the submission queue is never full.
+static int ring_submit(AsyncIO* io, int index) {
+    IORing* ring = &io->ring;
+    IOSlot* slot = &io->slots[index];
+    unsigned tail = *ring->sq_tail;
+    unsigned entry = tail & *ring->sq_mask;
+    struct io_uring_sqe* sqe = &ring->sqes[entry];
+    
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->opcode = io->writing ? IORING_OP_WRITE : IORING_OP_READ;
+    sqe->fd = io->fd;
+    sqe->off = slot->offset + slot->done;
+    sqe->addr = (uint64_t)(uintptr_t)(slot->data + slot->done);
+    sqe->len = (uint32_t)(slot->size - slot->done);
+    sqe->user_data = (uint64_t)index;
+    ring->sq_array[entry] = entry;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    
+    while (syscall(__NR_io_uring_enter, ring->fd, 1, 0, 0, NULL, 0) < 0) {
+        if (errno != EINTR) return 0;
+    }
+    return 1;
+}
+
+// Wait for and handle one completion. Short transfers are resubmitted for
+// the rest; a read of 0 bytes is the end of the file.
+static void ring_complete(AsyncIO* io) {
+    IORing* ring = &io->ring;
+    unsigned head = *ring->cq_head;
+    while (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+        if (syscall(__NR_io_uring_enter, ring->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 &&
+            errno != EINTR) {
+            // The ring is unusable: fail everything still in flight
+            for (int i = 0; i < ASYNC_IO_BUFFERS; i++) {
+                if (io->slots[i].state == SLOT_PENDING) {
+                    io->slots[i].error = 1;
+                    io->slots[i].state = SLOT_READY;
+                }
+            }
+            return;
+        }
+    }
+    
+    struct io_uring_cqe* cqe = &ring->cqes[head & *ring->cq_mask];
+    int index = (int)cqe->user_data;
+    int res = cqe->res;
+    __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+    
+    IOSlot* slot = &io->slots[index];
+    if (res == -EINTR || res == -EAGAIN) {
+        if (ring_submit(io, index)) return;
+        slot->error = 1;
+    } else if (res < 0 || (res == 0 && io->writing)) {
+        slot->error = 1;
+    } else if (res > 0) {
+        slot->done += (size_t)res;
+        if (slot->done < slot->size) {
+            if (ring_submit(io, index)) return;
+            slot->error = 1;
+        }
+    }
+    slot->state = SLOT_READY;
+}
+#endif
+
+// Hand a slot of size bytes to the backend
+static void submit_slot(AsyncIO* io, int index, size_t size) {
+    IOSlot* slot = &io->slots[index];
+    slot->size = size;
+    slot->done = 0;
+    slot->error = 0;
+    slot->offset = io->offset;
+    slot->submitted = 1;
+    io->offset += size;
+    
+    switch (io->backend) {
+#ifdef DFTA_HAVE_IO_URING
+        case BACKEND_IO_URING:
+            slot->state = SLOT_PENDING;
+            if (!ring_submit(io, index)) {
+                slot->error = 1;
+                slot->state = SLOT_READY;
+            }
+            break;
+#endif
+        case BACKEND_THREAD:
+            pthread_mutex_lock(&io->lock);
+            slot->state = SLOT_PENDING;
+            pthread_cond_broadcast(&io->changed);
+            pthread_mutex_unlock(&io->lock);
+            break;
+        default:
+            transfer_slot(io, slot);
+            slot->state = SLOT_READY;
+            break;
+    }
+}
+
+// Block until a submitted slot has finished and take it back
+static void wait_slot(AsyncIO* io, int index) {
+    IOSlot* slot = &io->slots[index];
+    if (!slot->submitted) return;
+    slot->submitted = 0;
+    
+    double start = monotonic_seconds();
+    if (io->backend == BACKEND_THREAD) {
+        pthread_mutex_lock(&io->lock);
+        while (slot->state == SLOT_PENDING) {
+            pthread_cond_wait(&io->changed, &io->lock);
+        }
+        pthread_mutex_unlock(&io->lock);
+    }
+#ifdef DFTA_HAVE_IO_URING
+    if (io->backend == BACKEND_IO_URING) {
+        while (slot->state == SLOT_PENDING) {
+            ring_complete(io);
+        }
+    }
+#endif
+    io->wait_seconds += monotonic_seconds() - start;
+    
+    if (slot->error && !io->error) io->error = 1;
+}
+
+static AsyncIO* async_io_open(FILE* file, int writing, size_t block_bytes) {
+    AsyncIO* io = calloc(1, sizeof(AsyncIO));
+    if (!io) return NULL;
+    io->file = file;
+    io->fd = fileno(file);
+    io->writing = writing;
+    io->buffer_bytes = block_bytes > ASYNC_IO_BUFFER_BYTES ? block_bytes : ASYNC_IO_BUFFER_BYTES;
+    
+    for (int i = 0; i < ASYNC_IO_BUFFERS; i++) {
+        void* data;
+        if (posix_memalign(&data, ASYNC_IO_ALIGNMENT, io->buffer_bytes) != 0) {
+            for (int j = 0; j < i; j++) free(io->slots[j].data);
+            free(io);
+            return NULL;
+        }
+        io->slots[i].data = data;
+    }
+    
+    // Pending stdio data goes out before any transfer of ours. Regular files
+    // are then addressed by offset, which leaves the stdio position alone;
+    // appends ignore offsets and could land out of order, so those (and
+    // pipes) go through the helper thread in order.
+    if (writing) fflush(file);
+    struct stat info;
+    off_t position = ftello(file);
+    io->backend = BACKEND_SYNC;
+#ifdef DFTA_HAVE_IO_URING
+    if (io->fd >= 0 && position >= 0 && fstat(io->fd, &info) == 0 && S_ISREG(info.st_mode) &&
+        !(fcntl(io->fd, F_GETFL) & O_APPEND) && ring_init(&io->ring, ASYNC_IO_BUFFERS)) {
+        io->backend = BACKEND_IO_URING;
+        io->offset = (uint64_t)position;
+    }
+#else
+    (void)info;
+    (void)position;
+#endif
+    if (io->backend == BACKEND_SYNC) {
+        pthread_mutex_init(&io->lock, NULL);
+        pthread_cond_init(&io->changed, NULL);
+        if (pthread_create(&io->thread, NULL, io_thread, io) == 0) {
+            io->backend = BACKEND_THREAD;
+        } else {
+            pthread_mutex_destroy(&io->lock);
+            pthread_cond_destroy(&io->changed);
+        }
+    }
+    return io;
+}
+
+// Read up to bytes from the current position of file ahead of the caller.
+// The file must not be used directly until async_io_close.
+AsyncIO* async_reader_open(FILE* file, uint64_t bytes) {
+    AsyncIO* io = async_io_open(file, 0, 0);
+    if (!io) return NULL;
+    
+    // Prefetch: every buffer is reading before the caller asks for any data
+    io->remaining = bytes;
+    for (int i = 0; i < ASYNC_IO_BUFFERS && io->remaining > 0; i++) {
+        size_t size = io->remaining < io->buffer_bytes ? (size_t)io->remaining : io->buffer_bytes;
+        io->remaining -= size;
+        submit_slot(io, i, size);
+    }
+    return io;
+}
+
+// Copy the next bytes of input into buffer, like fread. Returns fewer at the
+// end of the data or after a read error (which async_io_close reports).
+size_t async_read(AsyncIO* io, void* buffer, size_t bytes) {
+    uint8_t* out = buffer;
+    size_t copied = 0;
+    while (copied < bytes) {
+        IOSlot* slot = &io->slots[io->current];
+        wait_slot(io, io->current);
+        
+        size_t available = slot->done - io->position;
+        if (available == 0) {
+            // An empty or short buffer ends the input (end of the data, end
+            // of the file or a read error)
+            if (slot->size == 0 || slot->done < slot->size || slot->error) break;
+            
+            // Drained: refill it behind the others and move on
+            slot->size = 0;
+            slot->done = 0;
+            if (io->remaining > 0) {
+                size_t size = io->remaining < io->buffer_bytes ? (size_t)io->remaining : io->buffer_bytes;
+                io->remaining -= size;
+                submit_slot(io, io->current, size);
+            }
+            io->current = (io->current + 1) % ASYNC_IO_BUFFERS;
+            io->position = 0;
+            continue;
+        }
+        
+        size_t n = bytes - copied < available ? bytes - copied : available;
+        memcpy(out + copied, slot->data + io->position, n);
+        io->position += n;
+        copied += n;
+    }
+    return copied;
+}
+
+// Write to file behind the caller, in buffers of at least block_bytes. The
+// file must not be used directly until async_io_close.
+AsyncIO* async_writer_open(FILE* file, size_t block_bytes) {
+    return async_io_open(file, 1, block_bytes);
+}
+
+// Space for the next bytes of output, to be filled and then committed.
+// NULL once a write has failed.
+uint8_t* async_write_reserve(AsyncIO* io, size_t bytes) {
+    if (bytes > io->buffer_bytes) return NULL;
+    if (io->position + bytes > io->buffer_bytes) {
+        async_write_flush(io);
+    }
+    
+    // The slot may still be writing from the previous pass around the ring.
+    // Once a write has failed no more space is handed out.
+    wait_slot(io, io->current);
+    if (io->error) return NULL;
+    return io->slots[io->current].data + io->position;
+}
+
+void async_write_commit(AsyncIO* io, size_t bytes) {
+    io->position += bytes;
+}
+
+// Start writing what was committed without waiting for the buffer to fill
+int async_write_flush(AsyncIO* io) {
+    if (io->position > 0) {
+        submit_slot(io, io->current, io->position);
+        io->current = (io->current + 1) % ASYNC_IO_BUFFERS;
+        io->position = 0;
+    }
+    return io->error ? DFTA_ERROR_FILE_WRITE : DFTA_SUCCESS;
+}
+
+// Finish all transfers and free io. Returns DFTA_ERROR_FILE_READ or
+// DFTA_ERROR_FILE_WRITE if any failed.
+int async_io_close(AsyncIO* io) {
+    if (!io) return DFTA_SUCCESS;
+    if (io->writing) async_write_flush(io);
+    
+    for (int i = 0; i < ASYNC_IO_BUFFERS; i++) {
+        wait_slot(io, i);
+    }
+    if (io->backend == BACKEND_THREAD) {
+        pthread_mutex_lock(&io->lock);
+        io->shutdown = 1;
+        pthread_cond_broadcast(&io->changed);
+        pthread_mutex_unlock(&io->lock);
+        pthread_join(io->thread, NULL);
+        pthread_mutex_destroy(&io->lock);
+        pthread_cond_destroy(&io->changed);
+    }
+#ifdef DFTA_HAVE_IO_URING
+    if (io->backend == BACKEND_IO_URING) {
+        // Leave the stdio position after what was transferred
+        ring_free(&io->ring);
+        fseeko(io->file, (off_t)io->offset, SEEK_SET);
+    }
+#endif
+    
+    int result = DFTA_SUCCESS;
+    if (io->error) result = io->writing ? DFTA_ERROR_FILE_WRITE : DFTA_ERROR_FILE_READ;
+    for (int i = 0; i < ASYNC_IO_BUFFERS; i++) {
+        free(io->slots[i].data);
+    }
+    free(io);
+    return result;
+}
+
+const char* async_io_backend(const AsyncIO* io) {
+    switch (io->backend) {
+        case BACKEND_IO_URING: return "io_uring";
+        case BACKEND_THREAD: return "I/O thread";
+        default: return "synchronous";
+    }
+}
+
+double async_io_wait_seconds(const AsyncIO* io) {
+    return io->wait_seconds;
+}
@@ -0,0 +1,70 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "dfta_common.h"
+
+#ifdef __SSE4_2__
+#include <nmmintrin.h>
+#endif
+
+// CRC-32C (Castagnoli), reflected polynomial
+#define CRC32C_POLY 0x82F63B78u
+
+// Slicing-by-8 tables: table[k][b] is the CRC of byte b followed by k zero bytes
+static uint32_t crc32c_table[8][256];
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+static void fill_crc32c_tables(void) {
+    for (uint32_t b = 0; b < 256; b++) {
+        uint32_t crc = b;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (CRC32C_POLY & (0u - (crc & 1)));
+        }
+        crc32c_table[0][b] = crc;
+    }
+    for (uint32_t b = 0; b < 256; b++) {
+        for (int k = 1; k < 8; k++) {
+            uint32_t prev = crc32c_table[k - 1][b];
+            crc32c_table[k][b] = (prev >> 8) ^ crc32c_table[0][prev & 0xFF];
+        }
+    }
+}
+
+void crc32c_init(void) {
+    pthread_once(&crc32c_once, fill_crc32c_tables);
+}
+
+uint32_t crc32c(uint32_t crc, const void* data, size_t size) {
+    const uint8_t* bytes = data;
+    crc = ~crc;
+    
+#ifdef __SSE4_2__
+    for (; size >= 8; size -= 8, bytes += 8) {
+        uint64_t word;
+        memcpy(&word, bytes, 8);
+        crc = (uint32_t)_mm_crc32_u64(crc, word);
+    }
+    for (; size > 0; size--) {
+        crc = _mm_crc32_u8(crc, *bytes++);
+    }
+#else
+    crc32c_init();
+    
+    // Eight bytes per step, folding the CRC into the first four
+    for (; size >= 8; size -= 8, bytes += 8) {
+        uint32_t lo = crc ^ ((uint32_t)bytes[0] | (uint32_t)bytes[1] << 8 |
+                             (uint32_t)bytes[2] << 16 | (uint32_t)bytes[3] << 24);
+        crc = crc32c_table[7][lo & 0xFF] ^ crc32c_table[6][(lo >> 8) & 0xFF] ^
+              crc32c_table[5][(lo >> 16) & 0xFF] ^ crc32c_table[4][lo >> 24] ^
+              crc32c_table[3][bytes[4]] ^ crc32c_table[2][bytes[5]] ^
+              crc32c_table[1][bytes[6]] ^ crc32c_table[0][bytes[7]];
+    }
+    for (; size > 0; size--) {
+        crc = (crc >> 8) ^ crc32c_table[0][(crc ^ *bytes++) & 0xFF];
+    }
+#endif
+    
+    return ~crc;
+}
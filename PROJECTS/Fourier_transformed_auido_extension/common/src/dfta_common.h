@@ -0,0 +1,50 @@
+
+#ifndef DFTA_COMMON_H
+#define DFTA_COMMON_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+// Declarations for the sources in common/src, which the encoder, the decoder
+// and libdfta all compile from this one directory. dfta.h in each tree
+// includes this header.
+
+// Error codes
+#define DFTA_SUCCESS           0
+#define DFTA_ERROR_FILE_READ   1
+#define DFTA_ERROR_FILE_WRITE  2
+#define DFTA_ERROR_MEMORY      3
+#define DFTA_ERROR_FORMAT      4
+
+// Upper bound for worker pool threads
+#define DFTA_MAX_THREADS       64
+
+// Fixed set of threads that runs batches of tasks (see workers.c)
+typedef struct WorkerPool WorkerPool;
+
+// Buffered file I/O kept in flight behind the caller (see async_io.c)
+typedef struct AsyncIO AsyncIO;
+
+// Worker pool functions
+WorkerPool* worker_pool_create(int threads);
+void worker_pool_destroy(WorkerPool* pool);
+int worker_pool_size(const WorkerPool* pool);
+void worker_pool_run(WorkerPool* pool, void* (*task)(void*), void* args, size_t arg_size, int count);
+
+// Asynchronous I/O functions
+AsyncIO* async_reader_open(FILE* file, uint64_t bytes);
+size_t async_read(AsyncIO* io, void* buffer, size_t bytes);
+AsyncIO* async_writer_open(FILE* file, size_t block_bytes);
+uint8_t* async_write_reserve(AsyncIO* io, size_t bytes);
+void async_write_commit(AsyncIO* io, size_t bytes);
+int async_write_flush(AsyncIO* io);
+int async_io_close(AsyncIO* io);
+const char* async_io_backend(const AsyncIO* io);
+double async_io_wait_seconds(const AsyncIO* io);
+
+// Checksum functions
+void crc32c_init(void);
+uint32_t crc32c(uint32_t crc, const void* data, size_t size);
+
+#endif // DFTA_COMMON_H
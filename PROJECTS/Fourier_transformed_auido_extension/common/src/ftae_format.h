@@ -0,0 +1,170 @@
+
+#ifndef FTAE_FORMAT_H
+#define FTAE_FORMAT_H
+
+#include <stdint.h>
+
+// The FTAE file layout: versions, field widths, flags and the on-disk
+// structs. The encoder's and the decoder's ftae_io.c both include this
+// header, so the writer and the reader cannot drift apart.
+
+// FTAE format versions
+#define FTAE_VERSION_RAW       1   // Unordered SineWave records
+#define FTAE_VERSION_SEEKABLE  2   // Records sorted by start_time + seek table
+#define FTAE_VERSION_PACKED    3   // Per-window frames of bit-packed components + frame index
+#define FTAE_VERSION_FRAMED    4   // Checksummed frames appended as they are coded + trailer index
+#define FTAE_VERSION_SAMPLED   5   // v4 with 64-bit sample positions in place of float seconds
+
+// Packed component fields
+#define FTAE_AMPLITUDE_BITS    11  // log2(amplitude) in 1/64-octave steps (~0.09 dB)
+#define FTAE_AMPLITUDE_STEPS   64
+#define FTAE_PHASE_BITS        9   // Phase in whole degrees, stored exactly
+#define FTAE_FRAME_MAX_COMPONENTS 65535
+
+// Frame flags
+#define FTAE_FRAME_BIN_FREQUENCIES 0x0001  // Frequencies coded as FFT bin indices
+#define FTAE_FRAME_COLUMNAR        0x0002  // Payload holds the frequency, amplitude and phase columns in turn
+#define FTAE_FRAME_LAYERED         0x0004  // Components in importance layers, each sorted by frequency
+#define FTAE_FRAME_REPEAT          0x0008  // Back-reference: earlier frames sound again here
+#define FTAE_FRAME_CHANNEL_SHIFT   8       // Upper byte: channel the frame belongs to
+
+// Header flags (v3)
+#define FTAE_FLAG_RANGE_CODED  0x0001  // Frame payloads are range coded with the models after the header
+
+// Range coder context models. Each field value is split into a modelled
+// symbol and low bits that are coded as uniform symbols.
+#define FTAE_FREQUENCY_SYMBOLS 33  // Exp-Golomb length class of the frequency code
+#define FTAE_AMPLITUDE_RAW_BITS 3
+#define FTAE_AMPLITUDE_SYMBOLS (1 << (FTAE_AMPLITUDE_BITS - FTAE_AMPLITUDE_RAW_BITS))
+#define FTAE_AMPLITUDE_CONTEXT_SHIFT 7  // Context: previous component's amplitude code >> shift
+#define FTAE_AMPLITUDE_CONTEXTS_MAX  17 // First component + one per two octaves
+#define FTAE_PHASE_RAW_BITS    2
+#define FTAE_PHASE_SYMBOLS     (360 >> FTAE_PHASE_RAW_BITS)
+
+// Layered frames: components sorted by amplitude, strongest first, are split
+// into layers ending at 1/8, 1/4, 1/2 and all of the frame (rounded up). The
+// payload starts with one byte per layer but the last giving the share of the
+// frame's energy (amplitude squared) up to that layer's end, in 1/255 steps;
+// then each layer follows as its own columns, its first frequency absolute.
+// A decoder can stop after the layers it needs.
+#define FTAE_LAYER_COUNT       4
+#define FTAE_LAYER_MARKER_BITS 8
+#define FTAE_LAYER_MARKER_MAX  255
+
+// FTAE file format header
+typedef struct {
+    char magic[4];           // "FTAE"
+    uint32_t version;        // Format version
+    uint32_t sample_rate;    // Original sample rate
+    uint32_t wave_count;     // Number of SineWave structs
+    uint32_t compression_level; // Compression level used
+    float amplitude_threshold;  // Amplitude threshold used
+    float duration;          // Total duration in seconds
+    uint32_t seek_entry_count;  // v2: Number of FTAESeekEntry records; v3: number of frames
+    float seek_interval;     // v2: Seconds between seek entries
+    float max_duration;      // v2+: Longest component duration in seconds
+    uint32_t index_offset;   // v3: Byte offset of the frame index
+    uint32_t flags;          // v3+: FTAE_FLAG_* bits
+    uint32_t model_size;     // v3+: Bytes of entropy models between the header and the first frame
+    uint16_t channels;       // v4: Coded channels (0 in older files = mono)
+    uint16_t mid_side_pairs; // v4: Bit k set when channels 2k/2k+1 hold mid/side
+    uint32_t reserved;       // Reserved for future use
+} FTAEHeader;
+
+// v1/v2 component record: the SineWave layout of those versions, with
+// float times
+typedef struct {
+    int phase;
+    int amplitude;
+    int frequency;
+    float start_time;        // Seconds
+    float duration;
+} FTAERecord;
+
+// Seek table entry: entry i holds the index of the first record whose
+// start_time is >= i * seek_interval
+typedef struct {
+    float time;              // Seek point in seconds
+    uint32_t record_index;   // Index of the first SineWave at or after time
+} FTAESeekEntry;
+
+// v3 frame header: one analysis window. The payload holds component_count
+// frequency deltas, amplitude codes and phases sorted by frequency, either
+// as one column per field (FTAE_FRAME_COLUMNAR) or interleaved per component,
+// or as importance layers of columns (FTAE_FRAME_LAYERED).
+typedef struct {
+    float start_time;        // Shared by every component in the frame
+    float duration;
+    uint16_t component_count;
+    uint16_t flags;          // FTAE_FRAME_* bits
+    uint32_t payload_size;   // Bytes of bit-packed payload following the header
+} FTAEFrameHeader;
+
+// v4 frame header: the v3 fields followed by a checksum, so every frame can
+// be verified (and skipped if damaged) on its own
+typedef struct {
+    FTAEFrameHeader frame;
+    uint32_t crc;            // CRC32C of frame and the payload
+} FTAECheckedFrameHeader;
+
+// Payload of an FTAE_FRAME_REPEAT frame: the components of the same
+// channel's frames in [first_frame, end_frame) of the file sound again as
+// they are, starting shift samples later. The header's start_time is that of
+// the first copy and its duration spans the whole group.
+typedef struct {
+    uint32_t first_frame;    // Index position of the group's first frame
+    uint32_t end_frame;      // One past its last frame
+    int32_t shift;           // Samples at the file's rate from the group to the copy
+} FTAERepeatPayload;
+
+// v3+ frame index entry, one per frame, written after the last frame
+typedef struct {
+    float start_time;        // Frame start in seconds
+    uint32_t offset;         // Byte offset of the frame header
+} FTAEFrameIndexEntry;
+
+// v4 trailer: the last bytes of the file. The header is written before any
+// frame, so everything only known at the end lives here instead.
+typedef struct {
+    uint32_t frame_count;
+    uint32_t wave_count;
+    uint32_t index_offset;   // Byte offset of the frame index
+    uint32_t index_crc;      // CRC32C of the frame index
+    float duration;          // Total duration in seconds
+    float max_duration;      // Longest component duration in seconds
+    uint32_t crc;            // CRC32C of the fields above
+    char magic[4];           // "FTAX"
+} FTAETrailer;
+
+// v5 frame header: v4 with the start and duration as samples at the file's
+// rate, so positions stay exact however long the file is
+typedef struct {
+    uint64_t start_sample;   // First sample, shared by every component in the frame
+    uint32_t duration;       // Samples
+    uint16_t component_count;
+    uint16_t flags;          // FTAE_FRAME_* bits
+    uint32_t payload_size;
+    uint32_t crc;            // CRC32C of the fields above and the payload
+} FTAESampledFrameHeader;
+
+// v5 frame index entry
+typedef struct {
+    uint64_t start_sample;
+    uint64_t offset;         // Byte offset of the frame header
+} FTAESampledIndexEntry;
+
+// v5 trailer: the v4 fields with 64-bit counts and offsets, the length in
+// samples instead of a float duration
+typedef struct {
+    uint64_t sample_count;   // Total length in samples
+    uint64_t wave_count;
+    uint64_t index_offset;   // Byte offset of the frame index
+    uint32_t frame_count;
+    uint32_t index_crc;      // CRC32C of the frame index
+    uint32_t max_duration;   // Longest component duration in samples
+    uint32_t reserved;
+    uint32_t crc;            // CRC32C of the fields above
+    char magic[4];           // "FTAX"
+} FTAESampledTrailer;
+
+#endif // FTAE_FORMAT_H
@@ -0,0 +1,130 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "dfta_common.h"
+
+struct WorkerPool {
+    pthread_mutex_t lock;
+    pthread_cond_t wake;        // A batch was posted, or the pool is shutting down
+    pthread_cond_t done;        // The last task of the batch finished
+    pthread_t threads[DFTA_MAX_THREADS];
+    int thread_count;           // Threads started; the caller of worker_pool_run makes one more
+    void* (*task)(void*);
+    char* args;
+    size_t arg_size;
+    int next;                   // Next task of the batch to hand out
+    int count;                  // Tasks in the batch
+    int finished;
+    int shutdown;
+};
+
+// Hand out tasks of the current batch until none are left. Called with the
+// lock held and returns with it held.
+static void run_batch_tasks(WorkerPool* pool) {
+    while (pool->next < pool->count) {
+        int n = pool->next++;
+        pthread_mutex_unlock(&pool->lock);
+        pool->task(pool->args + (size_t)n * pool->arg_size);
+        pthread_mutex_lock(&pool->lock);
+        if (++pool->finished == pool->count) {
+            pthread_cond_signal(&pool->done);
+        }
+    }
+}
+
+static void* worker_thread(void* arg) {
+    WorkerPool* pool = arg;
+    
+    pthread_mutex_lock(&pool->lock);
+    while (!pool->shutdown) {
+        if (pool->next < pool->count) {
+            run_batch_tasks(pool);
+        } else {
+            pthread_cond_wait(&pool->wake, &pool->lock);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+WorkerPool* worker_pool_create(int threads) {
+    if (threads < 1) threads = 1;
+    if (threads > DFTA_MAX_THREADS) threads = DFTA_MAX_THREADS;
+    
+    WorkerPool* pool = calloc(1, sizeof(WorkerPool));
+    if (!pool) return NULL;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    
+    // A pool that could not start every thread still works with fewer
+    while (pool->thread_count < threads - 1 &&
+           pthread_create(&pool->threads[pool->thread_count], NULL, worker_thread, pool) == 0) {
+        pool->thread_count++;
+    }
+    return pool;
+}
+
+void worker_pool_destroy(WorkerPool* pool) {
+    if (!pool) return;
+    
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+    for (int t = 0; t < pool->thread_count; t++) {
+        pthread_join(pool->threads[t], NULL);
+    }
+    
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->wake);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+}
+
+int worker_pool_size(const WorkerPool* pool) {
+    return pool ? pool->thread_count + 1 : 1;
+}
+
+void worker_pool_run(WorkerPool* pool, void* (*task)(void*), void* args, size_t arg_size, int count) {
+    if (count <= 0) return;
+    
+    if (!pool) {
+        // No pool: start a thread per task beyond the first and run the first
+        // here; a task whose thread cannot be started runs here too
+        pthread_t threads[DFTA_MAX_THREADS];
+        int started[DFTA_MAX_THREADS] = {0};
+        char* base = args;
+        for (int n = 1; n < count && n < DFTA_MAX_THREADS; n++) {
+            started[n] = pthread_create(&threads[n], NULL, task, base + (size_t)n * arg_size) == 0;
+        }
+        task(base);
+        for (int n = 1; n < count; n++) {
+            if (n < DFTA_MAX_THREADS && started[n]) {
+                pthread_join(threads[n], NULL);
+            } else {
+                task(base + (size_t)n * arg_size);
+            }
+        }
+        return;
+    }
+    
+    // One batch at a time: the caller posts it, works through it alongside
+    // the pool threads and returns once every task has finished
+    pthread_mutex_lock(&pool->lock);
+    pool->task = task;
+    pool->args = args;
+    pool->arg_size = arg_size;
+    pool->next = 0;
+    pool->count = count;
+    pool->finished = 0;
+    pthread_cond_broadcast(&pool->wake);
+    run_batch_tasks(pool);
+    while (pool->finished < pool->count) {
+        pthread_cond_wait(&pool->done, &pool->lock);
+    }
+    pool->count = 0;
+    pool->next = 0;
+    pthread_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,49 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "dfta.h"
+
+void bitreader_init(BitReader* reader, const uint8_t* data, size_t size) {
+    memset(reader, 0, sizeof(BitReader));
+    reader->data = data;
+    reader->size = size;
+}
+
+static void bitreader_refill(BitReader* reader) {
+    while (reader->bit_count <= 56 && reader->position < reader->size) {
+        reader->accumulator |= (uint64_t)reader->data[reader->position++] << reader->bit_count;
+        reader->bit_count += 8;
+    }
+}
+
+uint32_t bitreader_get(BitReader* reader, int bits) {
+    if (bits <= 0) return 0;
+    
+    if (reader->bit_count < bits) {
+        bitreader_refill(reader);
+        if (reader->bit_count < bits) {
+            reader->overrun = 1;
+            return 0;
+        }
+    }
+    
+    uint32_t value = (uint32_t)(reader->accumulator & ((1ull << bits) - 1));
+    reader->accumulator >>= bits;
+    reader->bit_count -= bits;
+    return value;
+}
+
+uint32_t bitreader_get_expgolomb(BitReader* reader) {
+    // Order-0 exp-Golomb: count leading zero bits, then read that many more
+    int length = 0;
+    while (bitreader_get(reader, 1) == 0) {
+        if (reader->overrun || ++length > 32) {
+            reader->overrun = 1;
+            return 0;
+        }
+    }
+    
+    uint64_t coded = (1ull << length) | bitreader_get(reader, length);
+    return (uint32_t)(coded - 1);
+}
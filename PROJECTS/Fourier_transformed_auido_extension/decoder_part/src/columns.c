@@ -0,0 +1,204 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "dfta.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+int alloc_component_columns(ComponentColumns* columns, uint32_t count) {
+    memset(columns, 0, sizeof(ComponentColumns));
+    
+    // The 8-byte start column and seven 4-byte columns in one block, each
+    // starting on a 16-byte boundary
+    size_t stride = ((size_t)(count > 0 ? count : 1) + 3) & ~(size_t)3;
+    float* storage = malloc(stride * 9 * sizeof(float));
+    if (!storage) {
+        return DFTA_ERROR_MEMORY;
+    }
+    
+    columns->storage = storage;
+    columns->count = count;
+    columns->start = (int64_t*)storage;
+    columns->length = (uint32_t*)(storage + 2 * stride);
+    columns->frequency = (int32_t*)(storage + 3 * stride);
+    columns->stored_amplitude = (int32_t*)(storage + 4 * stride);
+    columns->stored_phase = (int32_t*)(storage + 5 * stride);
+    columns->amplitude = storage + 6 * stride;
+    columns->phase = storage + 7 * stride;
+    columns->phase_turns = (uint32_t*)(storage + 8 * stride);
+    return DFTA_SUCCESS;
+}
+
+void free_component_columns(ComponentColumns* columns) {
+    if (!columns) return;
+    free(columns->storage);
+    free(columns->repeats);
+    memset(columns, 0, sizeof(ComponentColumns));
+}
+
+uint32_t channel_component_count(const ChannelComponents* components) {
+    uint32_t count = 0;
+    for (uint32_t c = 0; c < components->channel_count; c++) {
+        count += components->channels[c].count;
+    }
+    return count;
+}
+
+void free_channel_components(ChannelComponents* components) {
+    if (!components) return;
+    for (int c = 0; c < DFTA_MAX_CHANNELS; c++) {
+        free_component_columns(&components->channels[c]);
+    }
+    components->channel_count = 0;
+    components->mid_side_pairs = 0;
+}
+
+// Convert the stored amplitude and phase columns into what the oscillators
+// use. Results are bit-identical to the per-component scalar expressions
+// (amplitude / 1000.0f in float, degrees to radians in double), so SSE2 can
+// dequantize eight components per iteration.
+void dequantize_component_columns(ComponentColumns* columns) {
+    const int32_t* restrict stored_amplitude = columns->stored_amplitude;
+    const int32_t* restrict stored_phase = columns->stored_phase;
+    float* restrict amplitude = columns->amplitude;
+    float* restrict phase = columns->phase;
+    int count = (int)columns->count;
+    int i = 0;
+    
+#ifdef __SSE2__
+    const __m128 v_scale = _mm_set1_ps(1000.0f);
+    const __m128d v_pi = _mm_set1_pd(M_PI);
+    const __m128d v_degrees = _mm_set1_pd(180.0);
+    
+    for (; i + 8 <= count; i += 8) {
+        for (int half = 0; half < 8; half += 4) {
+            __m128 a = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)(stored_amplitude + i + half)));
+            _mm_storeu_ps(amplitude + i + half, _mm_div_ps(a, v_scale));
+            
+            __m128 p = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)(stored_phase + i + half)));
+            __m128d p_lo = _mm_div_pd(_mm_mul_pd(_mm_cvtps_pd(p), v_pi), v_degrees);
+            __m128d p_hi = _mm_div_pd(_mm_mul_pd(_mm_cvtps_pd(_mm_movehl_ps(p, p)), v_pi), v_degrees);
+            _mm_storeu_ps(phase + i + half, _mm_movelh_ps(_mm_cvtpd_ps(p_lo), _mm_cvtpd_ps(p_hi)));
+        }
+    }
+#endif
+    
+    for (; i < count; i++) {
+        amplitude[i] = (float)stored_amplitude[i] / 1000.0f;
+        phase[i] = (float)stored_phase[i] * M_PI / 180.0f;
+    }
+    
+    // Fixed-point phase offsets need an integer division per component
+    for (i = 0; i < count; i++) {
+        uint64_t degrees = (uint64_t)(stored_phase[i] % 360 + 360) % 360;
+        columns->phase_turns[i] = (uint32_t)((degrees << 32) / 360);
+    }
+}
+
+// Sample at output_rate, stretched by time_scale, that position at file_rate
+// maps to: exact in integers unless the time scale is in play
+int64_t scale_sample_position(int64_t position, uint32_t file_rate, uint32_t output_rate, float time_scale) {
+    if (time_scale == 1.0f) {
+        return position * output_rate / file_rate;
+    }
+    return (int64_t)((double)position * time_scale * output_rate / file_rate);
+}
+
+// Move the columns from the file's timeline to the output's and apply
+// time-stretch and pitch-shift in the parameter domain: positions in samples
+// at file_rate become samples at output_rate scaled by time_scale, and
+// frequencies are scaled by pitch_scale. Each component ends where its end
+// maps to, so abutting components still abut. The oscillators apply stored
+// phases against absolute time, so overlapping frames of a partial keep the
+// phase relation they have unscaled and no phase needs rewriting. Repeats
+// move with the time scale.
+void scale_component_columns(ComponentColumns* columns, uint32_t file_rate, uint32_t output_rate,
+                             float time_scale, float pitch_scale) {
+    int64_t* restrict start = columns->start;
+    uint32_t* restrict length = columns->length;
+    int32_t* restrict frequency = columns->frequency;
+    uint32_t count = columns->count;
+    
+    if (time_scale != 1.0f || output_rate != file_rate) {
+        for (uint32_t i = 0; i < count; i++) {
+            if (start[i] < 0) continue;
+            int64_t end = scale_sample_position(start[i] + length[i], file_rate, output_rate, time_scale);
+            start[i] = scale_sample_position(start[i], file_rate, output_rate, time_scale);
+            length[i] = end - start[i] < INT32_MAX ? (uint32_t)(end - start[i]) : INT32_MAX;
+        }
+        double factor = (double)time_scale * output_rate / file_rate;
+        for (uint32_t r = 0; r < columns->repeat_count; r++) {
+            columns->repeats[r].shift = llround((double)columns->repeats[r].shift * factor);
+        }
+    }
+    if (pitch_scale != 1.0f) {
+        for (uint32_t i = 0; i < count; i++) {
+            frequency[i] = (int32_t)lrintf((float)frequency[i] * pitch_scale);
+        }
+    }
+}
+
+int add_component_repeat(ComponentColumns* columns, uint32_t first, uint32_t count, int64_t shift) {
+    if (columns->repeat_count == columns->repeat_capacity) {
+        uint32_t capacity = columns->repeat_capacity ? columns->repeat_capacity * 2 : 64;
+        ComponentRepeat* repeats = realloc(columns->repeats, capacity * sizeof(ComponentRepeat));
+        if (!repeats) return DFTA_ERROR_MEMORY;
+        columns->repeats = repeats;
+        columns->repeat_capacity = capacity;
+    }
+    ComponentRepeat* repeat = &columns->repeats[columns->repeat_count++];
+    repeat->first = first;
+    repeat->count = count;
+    repeat->shift = shift;
+    return DFTA_SUCCESS;
+}
+
+// Turn every repeat into copies of its components, for synthesis that
+// renders block by block and so has no earlier output to copy from. Each
+// copy starts shift samples after its component, as when rendering repeats.
+int expand_component_repeats(ComponentColumns* columns) {
+    if (columns->repeat_count == 0) return DFTA_SUCCESS;
+    
+    uint64_t total = columns->count;
+    for (uint32_t r = 0; r < columns->repeat_count; r++) {
+        total += columns->repeats[r].count;
+    }
+    if (total > UINT32_MAX) return DFTA_ERROR_MEMORY;
+    
+    ComponentColumns expanded;
+    if (alloc_component_columns(&expanded, (uint32_t)total) != DFTA_SUCCESS) {
+        return DFTA_ERROR_MEMORY;
+    }
+    uint32_t count = columns->count;
+    memcpy(expanded.start, columns->start, count * sizeof(int64_t));
+    memcpy(expanded.length, columns->length, count * sizeof(uint32_t));
+    memcpy(expanded.frequency, columns->frequency, count * sizeof(int32_t));
+    memcpy(expanded.stored_amplitude, columns->stored_amplitude, count * sizeof(int32_t));
+    memcpy(expanded.stored_phase, columns->stored_phase, count * sizeof(int32_t));
+    memcpy(expanded.amplitude, columns->amplitude, count * sizeof(float));
+    memcpy(expanded.phase, columns->phase, count * sizeof(float));
+    memcpy(expanded.phase_turns, columns->phase_turns, count * sizeof(uint32_t));
+    
+    uint32_t out = count;
+    for (uint32_t r = 0; r < columns->repeat_count; r++) {
+        const ComponentRepeat* repeat = &columns->repeats[r];
+        for (uint32_t i = repeat->first; i < repeat->first + repeat->count; i++) {
+            expanded.start[out] = columns->start[i] < 0 ? -1 : columns->start[i] + repeat->shift;
+            expanded.length[out] = columns->length[i];
+            expanded.frequency[out] = columns->frequency[i];
+            expanded.stored_amplitude[out] = columns->stored_amplitude[i];
+            expanded.stored_phase[out] = columns->stored_phase[i];
+            expanded.amplitude[out] = columns->amplitude[i];
+            expanded.phase[out] = columns->phase[i];
+            expanded.phase_turns[out] = columns->phase_turns[i];
+            out++;
+        }
+    }
+    
+    free_component_columns(columns);
+    *columns = expanded;
+    return DFTA_SUCCESS;
+}
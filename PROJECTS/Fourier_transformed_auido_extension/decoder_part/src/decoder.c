@@ -3,131 +3,733 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <pthread.h>
 #include "dfta.h"
 
-int decode_audio_file(const char* input_file, const char* output_file) {
+int decode_audio_file(const char* input_file, const char* output_file, const DecodingConfig* config) {
     if (!input_file || !output_file) {
         return DFTA_ERROR_FILE_READ;
     }
     
-    printf("Input:  %s\n", input_file);
-    printf("Output: %s\n", output_file);
-    printf("\nStarting decompression...\n");
+    dfta_progress("Input:  %s\n", input_file);
+    dfta_progress("Output: %s\n", output_file);
+    dfta_progress("\nStarting decompression...\n");
     
-    SineWaveQueue* wave_queue = NULL;
+    ChannelComponents components = {0};
     AudioData audio_info = {0};
     int result = DFTA_SUCCESS;
     
     // Read FTAE file
-    printf("Reading FTAE file...\n");
-    result = read_ftae_file(input_file, &wave_queue, &audio_info);
+    dfta_progress("Reading FTAE file...\n");
+    result = read_ftae_file(input_file, &components, &audio_info, config);
     if (result != DFTA_SUCCESS) {
         fprintf(stderr, "Error: Failed to read FTAE file\n");
         goto cleanup;
     }
     
-    printf("Loaded %d frequency components\n", wave_queue->count);
-    printf("Audio properties: %u Hz, %.2f seconds\n", 
-           audio_info.sample_rate, 
-           (float)audio_info.sample_count / audio_info.sample_rate);
+    dfta_progress("Loaded %u frequency components\n", channel_component_count(&components));
+    dfta_progress("Audio properties: %u Hz, %.2f seconds", 
+                  audio_info.sample_rate, 
+                  (double)audio_info.sample_count / audio_info.sample_rate);
+    if (audio_info.channels > 1) {
+        dfta_progress(", %u channels", audio_info.channels);
+    }
+    dfta_progress("\n");
+    if (audio_info.start_offset > 0) {
+        dfta_progress("Decoding range starts at %.2f seconds\n",
+                      (double)audio_info.start_offset / audio_info.sample_rate);
+    }
     
-    // Synthesize audio from SineWave components
-    printf("\nSynthesizing audio...\n");
-    result = synthesize_audio_from_sinewaves(wave_queue, &audio_info);
+    // Synthesize audio from the component columns
+    dfta_progress("\nSynthesizing audio...\n");
+    result = synthesize_audio_channels(&components, &audio_info,
+                                       config ? config->synthesis_mode : SYNTHESIS_ACCURATE,
+                                       config ? config->pool : NULL);
     if (result != DFTA_SUCCESS) {
         fprintf(stderr, "Error: Failed to synthesize audio\n");
         goto cleanup;
     }
     
     // Write output WAV file
-    printf("Writing WAV file...\n");
-    result = write_wav_file(output_file, &audio_info);
+    dfta_progress("Writing WAV file...\n");
+    result = write_wav_file(output_file, &audio_info, config ? config->dither : 0);
     if (result != DFTA_SUCCESS) {
         fprintf(stderr, "Error: Failed to write WAV file\n");
         goto cleanup;
     }
     
-    printf("Successfully reconstructed %u samples at %u Hz\n", 
-           audio_info.sample_count, audio_info.sample_rate);
+    dfta_progress("Successfully reconstructed %llu samples at %u Hz\n", 
+                  (unsigned long long)audio_info.sample_count, audio_info.sample_rate);
     
 cleanup:
-    if (wave_queue) {
-        free_sinewave_queue(wave_queue);
-    }
+    free_channel_components(&components);
     free_audio_data(&audio_info);
     
     return result;
 }
 
-int synthesize_audio_from_sinewaves(SineWaveQueue* queue, AudioData* output_audio) {
-    if (!queue || !output_audio || queue->count == 0) {
+// Fast synthesis wavetable: one sine period in 2^WAVETABLE_BITS entries, plus
+// a guard entry so interpolation never has to wrap the index
+#define WAVETABLE_BITS  12
+#define WAVETABLE_SIZE  (1 << WAVETABLE_BITS)
+#define PHASE_FRAC_BITS (32 - WAVETABLE_BITS)
+
+static float sine_wavetable[WAVETABLE_SIZE + 1];
+static pthread_once_t sine_wavetable_once = PTHREAD_ONCE_INIT;
+
+static void fill_sine_wavetable(void) {
+    for (int i = 0; i <= WAVETABLE_SIZE; i++) {
+        sine_wavetable[i] = (float)sin(2.0 * M_PI * i / WAVETABLE_SIZE);
+    }
+}
+
+// Decoders in different threads (libdfta) may ask for the table at once
+static void init_sine_wavetable(void) {
+    pthread_once(&sine_wavetable_once, fill_sine_wavetable);
+}
+
+// Reference oscillator: evaluates sinf() at every sample. The position in
+// the cycle is kept as the integer f * n mod sample_rate, so the phase is
+// exact at any sample index n instead of drifting with a float time value.
+static void render_wave_accurate(float* output, int start_sample, int end_sample,
+                                 uint64_t start_offset, uint32_t sample_rate,
+                                 int32_t frequency, float amplitude, float phase_rad) {
+    if (sample_rate == 0 || frequency < 0) return;
+    
+    uint64_t first_index = start_offset + (uint64_t)start_sample;
+    uint32_t step = (uint32_t)frequency % sample_rate;
+    uint32_t cycle = (uint32_t)((uint64_t)step * (first_index % sample_rate) % sample_rate);
+    const float radians_per_step = 2.0f * (float)M_PI / sample_rate;
+    
+    // Generate sine wave and add to output
+    for (int i = start_sample; i < end_sample; i++) {
+        float sample_value = amplitude * sinf((float)cycle * radians_per_step + phase_rad);
+        
+        // Add to existing signal (additive synthesis)
+        output[i] += sample_value;
+        cycle += step;
+        if (cycle >= sample_rate) cycle -= sample_rate;
+    }
+}
+
+// Fast oscillator: a 32-bit phase accumulator where 2^32 is one full cycle.
+// Frequency, phase and the start position are integers, so the starting
+// phase is computed exactly instead of drifting with a float time value.
+static void render_wave_fast(float* output, int start_sample, int end_sample,
+                             uint64_t start_offset, uint32_t sample_rate,
+                             int32_t wave_frequency, float amplitude, uint32_t phase_turns,
+                             int interpolate) {
+    if (sample_rate == 0 || wave_frequency < 0) return;
+    
+    uint64_t frequency = (uint64_t)wave_frequency;
+    uint32_t increment = (uint32_t)((frequency << 32) / sample_rate);
+    
+    // Phase at the first sample: frac(f * n / sr) + phase / 360, in 2^32 units
+    uint64_t first_index = start_offset + (uint64_t)start_sample;
+    uint64_t cycle_pos = (frequency * (first_index % sample_rate)) % sample_rate;
+    uint32_t phase = (uint32_t)((cycle_pos << 32) / sample_rate) + phase_turns;
+    
+    if (interpolate) {
+        const float frac_scale = 1.0f / (float)(1u << PHASE_FRAC_BITS);
+        for (int i = start_sample; i < end_sample; i++) {
+            uint32_t index = phase >> PHASE_FRAC_BITS;
+            float frac = (float)(phase & ((1u << PHASE_FRAC_BITS) - 1)) * frac_scale;
+            float a = sine_wavetable[index];
+            float b = sine_wavetable[index + 1];
+            output[i] += amplitude * (a + (b - a) * frac);
+            phase += increment;
+        }
+    } else {
+        for (int i = start_sample; i < end_sample; i++) {
+            output[i] += amplitude * sine_wavetable[phase >> PHASE_FRAC_BITS];
+            phase += increment;
+        }
+    }
+}
+
+// Running absolute peak over samples[start, end)
+static float track_peak(const float* samples, int start, int end, float peak) {
+    for (int i = start; i < end; i++) {
+        float abs_sample = fabsf(samples[i]);
+        peak = abs_sample > peak ? abs_sample : peak;
+    }
+    return peak;
+}
+
+// Reject records whose timing could not be mapped to sample indices (corrupt
+// or hostile files) so the index arithmetic below cannot overflow
+static int component_is_valid(const ComponentColumns* columns, uint32_t n) {
+    return columns->start[n] >= 0 && columns->start[n] < COMPONENT_MAX_START &&
+           columns->length[n] <= INT32_MAX && columns->frequency[n] >= 0;
+}
+
+// Add component n to output[start_sample, end_sample)
+static void render_component(const ComponentColumns* columns, uint32_t n, float* output,
+                             int start_sample, int end_sample, uint64_t start_offset,
+                             uint32_t sample_rate, int synthesis_mode) {
+    if (synthesis_mode == SYNTHESIS_ACCURATE) {
+        render_wave_accurate(output, start_sample, end_sample, start_offset, sample_rate,
+                             columns->frequency[n], columns->amplitude[n], columns->phase[n]);
+    } else {
+        render_wave_fast(output, start_sample, end_sample, start_offset, sample_rate,
+                         columns->frequency[n], columns->amplitude[n], columns->phase_turns[n],
+                         synthesis_mode == SYNTHESIS_FAST);
+    }
+}
+
+// One distinct group of repeated components. An owned group overlaps no
+// earlier group, so its components are left out of the main pass and it is
+// rendered at its own place along with its repeats; the others still sound
+// through the main pass and are rendered again for their repeats.
+typedef struct {
+    uint32_t first;
+    uint32_t count;
+    int owned;
+    uint32_t shift_first;       // Its repeats are shifts[shift_first, shift_end), in samples
+    uint32_t shift_end;
+} RepeatGroup;
+
+typedef struct {
+    RepeatGroup* groups;        // By first component
+    uint32_t group_count;
+    int64_t* shifts;
+    uint8_t* copyable;          // Per shift: whether the group's output is copied there
+    float* scratch;             // Output of the group being copied
+    size_t scratch_capacity;
+} RepeatPlan;
+
+static int compare_repeats(const void* a, const void* b) {
+    const ComponentRepeat* ra = a;
+    const ComponentRepeat* rb = b;
+    if (ra->first != rb->first) return (ra->first > rb->first) - (ra->first < rb->first);
+    return (ra->count > rb->count) - (ra->count < rb->count);
+}
+
+static void free_repeat_plan(RepeatPlan* plan) {
+    free(plan->groups);
+    free(plan->shifts);
+    free(plan->copyable);
+    free(plan->scratch);
+    memset(plan, 0, sizeof(RepeatPlan));
+}
+
+// Gather the columns' repeats into groups with their shifts
+static int plan_repeats(const ComponentColumns* columns, RepeatPlan* plan) {
+    memset(plan, 0, sizeof(RepeatPlan));
+    uint32_t count = columns->repeat_count;
+    if (count == 0) return DFTA_SUCCESS;
+    
+    ComponentRepeat* sorted = malloc(count * sizeof(ComponentRepeat));
+    plan->groups = malloc(count * sizeof(RepeatGroup));
+    plan->shifts = malloc(count * sizeof(int64_t));
+    plan->copyable = malloc(count);
+    if (!sorted || !plan->groups || !plan->shifts || !plan->copyable) {
+        free(sorted);
+        free_repeat_plan(plan);
+        return DFTA_ERROR_MEMORY;
+    }
+    memcpy(sorted, columns->repeats, count * sizeof(ComponentRepeat));
+    qsort(sorted, count, sizeof(ComponentRepeat), compare_repeats);
+    
+    uint32_t owned_end = 0;
+    for (uint32_t r = 0; r < count; r++) {
+        if (r == 0 || sorted[r].first != sorted[r - 1].first || sorted[r].count != sorted[r - 1].count) {
+            RepeatGroup* group = &plan->groups[plan->group_count++];
+            group->first = sorted[r].first;
+            group->count = sorted[r].count;
+            group->owned = group->count > 0 && group->first >= owned_end &&
+                           (uint64_t)group->first + group->count <= columns->count;
+            if (group->owned) owned_end = group->first + group->count;
+            group->shift_first = r;
+        }
+        plan->shifts[r] = sorted[r].shift;
+        plan->groups[plan->group_count - 1].shift_end = r + 1;
+    }
+    free(sorted);
+    return DFTA_SUCCESS;
+}
+
+// First owned group at or after group g
+static uint32_t next_owned_group(const RepeatPlan* plan, uint32_t g) {
+    while (g < plan->group_count && !plan->groups[g].owned) g++;
+    return g;
+}
+
+// Whether shift samples are a whole number of cycles of every component of
+// the group, so that its output can be copied there
+static int shift_is_whole_cycles(const ComponentColumns* columns, const RepeatGroup* group, int64_t shift,
+                                 uint32_t sample_rate) {
+    for (uint32_t n = group->first; n < group->first + group->count; n++) {
+        if ((int64_t)columns->frequency[n] * shift % sample_rate != 0) return 0;
+    }
+    return 1;
+}
+
+// Render the group's components straight into the output, shift samples later
+static void render_group_at(const ComponentColumns* columns, const RepeatGroup* group, int64_t shift,
+                            AudioData* output_audio, int synthesis_mode) {
+    uint32_t sample_rate = output_audio->sample_rate;
+    int64_t sample_count = (int64_t)output_audio->sample_count;
+    for (uint32_t n = group->first; n < group->first + group->count; n++) {
+        if (!component_is_valid(columns, n)) continue;
+        int64_t start = columns->start[n] + shift - (int64_t)output_audio->start_offset;
+        int64_t end = start + columns->length[n];
+        if (start < 0) start = 0;
+        if (end > sample_count) end = sample_count;
+        if (start >= end) continue;
+        render_component(columns, n, output_audio->samples, (int)start, (int)end, output_audio->start_offset,
+                         sample_rate, synthesis_mode);
+    }
+}
+
+// Render a group at each of its places: once into the scratch buffer, over
+// just the samples that land in the output, for the places it can be copied
+// to, and directly at the others. An owned group's own place comes first,
+// with no shift.
+static int render_repeat_group(const ComponentColumns* columns, RepeatPlan* plan, const RepeatGroup* group,
+                               AudioData* output_audio, int synthesis_mode, uint32_t* skipped_count) {
+    if ((uint64_t)group->first + group->count > columns->count) return DFTA_SUCCESS;
+    uint32_t sample_rate = output_audio->sample_rate;
+    int64_t output_start = (int64_t)output_audio->start_offset;
+    int64_t output_end = output_start + (int64_t)output_audio->sample_count;
+    int64_t places = group->shift_end - group->shift_first;
+    
+    // Span of the group in absolute samples
+    int64_t low = INT64_MAX;
+    int64_t high = INT64_MIN;
+    for (uint32_t n = group->first; n < group->first + group->count; n++) {
+        if (!component_is_valid(columns, n)) {
+            if (group->owned) (*skipped_count)++;
+            continue;
+        }
+        int64_t start = columns->start[n];
+        int64_t end = start + columns->length[n];
+        if (start < low) low = start;
+        if (end > high) high = end;
+    }
+    if (low >= high) return DFTA_SUCCESS;
+    
+    // Part of the span [from, to) that the places it can be copied to need
+    int64_t from = high;
+    int64_t to = low;
+    uint32_t copies = 0;
+    for (int64_t s = group->owned ? -1 : 0; s < places; s++) {
+        int64_t shift = s < 0 ? 0 : plan->shifts[group->shift_first + s];
+        int64_t begin = low + shift < output_start ? output_start - shift : low;
+        int64_t end = high + shift > output_end ? output_end - shift : high;
+        if (s >= 0) plan->copyable[group->shift_first + s] = 0;
+        if (begin >= end) continue;
+        if (s >= 0 && !shift_is_whole_cycles(columns, group, shift, sample_rate)) {
+            render_group_at(columns, group, shift, output_audio, synthesis_mode);
+            continue;
+        }
+        if (s >= 0) plan->copyable[group->shift_first + s] = 1;
+        if (begin < from) from = begin;
+        if (end > to) to = end;
+        copies++;
+    }
+    
+    // A single place is cheaper to render where it is
+    if (copies <= 1) {
+        for (int64_t s = group->owned ? -1 : 0; s < places; s++) {
+            if (s < 0 || plan->copyable[group->shift_first + s]) {
+                render_group_at(columns, group, s < 0 ? 0 : plan->shifts[group->shift_first + s], output_audio,
+                                synthesis_mode);
+            }
+        }
+        return DFTA_SUCCESS;
+    }
+    
+    size_t length = (size_t)(to - from);
+    if (length > plan->scratch_capacity) {
+        float* scratch = realloc(plan->scratch, length * sizeof(float));
+        if (!scratch) return DFTA_ERROR_MEMORY;
+        plan->scratch = scratch;
+        plan->scratch_capacity = length;
+    }
+    memset(plan->scratch, 0, length * sizeof(float));
+    
+    for (uint32_t n = group->first; n < group->first + group->count; n++) {
+        if (!component_is_valid(columns, n)) continue;
+        int64_t start = columns->start[n];
+        int64_t end = start + columns->length[n];
+        if (start < from) start = from;
+        if (end > to) end = to;
+        if (start >= end) continue;
+        render_component(columns, n, plan->scratch, (int)(start - from), (int)(end - from), (uint64_t)from,
+                         sample_rate, synthesis_mode);
+    }
+    
+    for (int64_t s = group->owned ? -1 : 0; s < places; s++) {
+        if (s >= 0 && !plan->copyable[group->shift_first + s]) continue;
+        int64_t shift = s < 0 ? 0 : plan->shifts[group->shift_first + s];
+        int64_t begin = from + shift < output_start ? output_start - shift : from;
+        int64_t end = to + shift > output_end ? output_end - shift : to;
+        float* target = output_audio->samples + (begin + shift - output_start);
+        const float* copy = plan->scratch + (begin - from);
+        for (int64_t i = 0; i < end - begin; i++) {
+            target[i] += copy[i];
+        }
+    }
+    return DFTA_SUCCESS;
+}
+
+int decode_audio_stream(const char* input_file, FILE* output, const DecodingConfig* config) {
+    if (!input_file || !output || !config) {
+        return DFTA_ERROR_FILE_READ;
+    }
+    
+    dfta_progress("Input:  %s\n", input_file);
+    dfta_progress("\nStarting streaming decompression...\n");
+    
+    ChannelComponents components = {0};
+    AudioData audio_info = {0};
+    
+    int result = read_ftae_file(input_file, &components, &audio_info, config);
+    if (result != DFTA_SUCCESS) {
+        fprintf(stderr, "Error: Failed to read FTAE file\n");
+        return result;
+    }
+    
+    result = stream_decode_audio(&components, &audio_info, output, config);
+    
+    free_channel_components(&components);
+    free_audio_data(&audio_info);
+    return result;
+}
+
+// Render one channel into output_audio->samples and record its peak. Only
+// a verbose call reports progress, so parallel channels do not interleave.
+static int synthesize_channel(const ComponentColumns* columns, AudioData* output_audio,
+                              int synthesis_mode, int verbose) {
+    if (!columns || !output_audio || !output_audio->samples) {
         return DFTA_ERROR_MEMORY;
     }
+    uint32_t count = columns->count;
     
     // Initialize output buffer with zeros
     memset(output_audio->samples, 0, output_audio->sample_count * sizeof(float));
     
-    printf("Processing %d frequency components...\n", queue->count);
+    if (synthesis_mode != SYNTHESIS_ACCURATE) {
+        init_sine_wavetable();
+    }
+    
+    if (verbose) {
+        dfta_progress("Processing %u frequency components (%s synthesis)...\n", count,
+                      synthesis_mode == SYNTHESIS_ACCURATE ? "accurate" : "fast");
+    }
+    
+    uint32_t skipped_count = 0;
+    
+    RepeatPlan plan;
+    if (plan_repeats(columns, &plan) != DFTA_SUCCESS) {
+        return DFTA_ERROR_MEMORY;
+    }
+    uint32_t next_owned = next_owned_group(&plan, 0);
     
-    SineWaveNode* current = queue->head;
-    int component_count = 0;
+    // Time-sorted components never touch samples before their own start, so
+    // everything below the current start is final and its peak can be taken
+    // while it is still in cache. Unsorted (v1) input falls back to a full
+    // scan, as do repeats, which are added at the end.
+    float max_amplitude = 0.0f;
+    int finalized = 0;
+    int in_order = columns->repeat_count == 0;
     
-    while (current) {
-        SineWave* wave = &current->wave;
+    for (uint32_t n = 0; n < count; n++) {
+        // Owned repeat groups are rendered below along with their repeats
+        if (next_owned < plan.group_count && n == plan.groups[next_owned].first) {
+            n += plan.groups[next_owned].count - 1;
+            next_owned = next_owned_group(&plan, next_owned + 1);
+            continue;
+        }
+        if (!component_is_valid(columns, n)) {
+            skipped_count++;
+            continue;
+        }
         
-        // Calculate sample indices for this wave's duration
-        int start_sample = (int)(wave->start_time * output_audio->sample_rate);
-        int duration_samples = (int)(wave->duration * output_audio->sample_rate);
-        int end_sample = start_sample + duration_samples;
+        // Sample indices of this wave relative to the first rendered
+        // sample, clamped to the audio bounds
+        int64_t start = columns->start[n] - (int64_t)output_audio->start_offset;
+        int64_t end = start + columns->length[n];
+        int64_t sample_count = (int64_t)output_audio->sample_count;
+        int start_sample = (int)(start < 0 ? 0 : start > sample_count ? sample_count : start);
+        int end_sample = (int)(end > sample_count ? sample_count : end < 0 ? 0 : end);
         
-        // Clamp to audio bounds
-        if (start_sample < 0) start_sample = 0;
-        if (end_sample > (int)output_audio->sample_count) {
-            end_sample = output_audio->sample_count;
+        if (in_order && start_sample > finalized) {
+            max_amplitude = track_peak(output_audio->samples, finalized, start_sample, max_amplitude);
+            finalized = start_sample;
+        } else if (start_sample < finalized) {
+            in_order = 0;
         }
         
-        // Convert scaled amplitude back to float
-        float amplitude = (float)wave->amplitude / 1000.0f;
+        render_component(columns, n, output_audio->samples, start_sample, end_sample,
+                         output_audio->start_offset, output_audio->sample_rate, synthesis_mode);
         
-        // Convert phase from degrees to radians
-        float phase_rad = (float)wave->phase * M_PI / 180.0f;
-        
-        // Generate sine wave and add to output
-        for (int i = start_sample; i < end_sample; i++) {
-            float t = (float)i / output_audio->sample_rate;
-            float sample_value = amplitude * sinf(2.0f * M_PI * wave->frequency * t + phase_rad);
-            
-            // Add to existing signal (additive synthesis)
-            output_audio->samples[i] += sample_value;
+        if (verbose && (n + 1) % 500 == 0) {
+            dfta_progress("  Progress: %u/%u components (%.1f%%)\n", 
+                          n + 1, count, 
+                          (float)(n + 1) / count * 100);
         }
-        
-        component_count++;
-        if (component_count % 500 == 0) {
-            printf("  Progress: %d/%d components (%.1f%%)\n", 
-                   component_count, queue->count, 
-                   (float)component_count / queue->count * 100);
+    }
+    
+    if (verbose && plan.group_count > 0) {
+        dfta_progress("Rendering %u component groups at %u repeats...\n", plan.group_count, columns->repeat_count);
+    }
+    int result = DFTA_SUCCESS;
+    for (uint32_t g = 0; g < plan.group_count && result == DFTA_SUCCESS; g++) {
+        result = render_repeat_group(columns, &plan, &plan.groups[g], output_audio, synthesis_mode, &skipped_count);
+    }
+    free_repeat_plan(&plan);
+    if (result != DFTA_SUCCESS) return result;
+    
+    if (skipped_count > 0) {
+        fprintf(stderr, "Warning: Skipped %u components with invalid timing\n", skipped_count);
+    }
+    
+    if (in_order) {
+        max_amplitude = track_peak(output_audio->samples, finalized,
+                                   (int)output_audio->sample_count, max_amplitude);
+    } else {
+        max_amplitude = track_peak(output_audio->samples, 0,
+                                   (int)output_audio->sample_count, 0.0f);
+    }
+    
+    output_audio->peak_amplitude = max_amplitude;
+    return DFTA_SUCCESS;
+}
+
+int synthesize_audio_from_columns(const ComponentColumns* columns, AudioData* output_audio, int synthesis_mode) {
+    int result = synthesize_channel(columns, output_audio, synthesis_mode, 1);
+    if (result != DFTA_SUCCESS) {
+        return result;
+    }
+    
+    // Normalization to prevent clipping is applied by the output writer
+    // in the same pass as the PCM conversion
+    if (output_audio->peak_amplitude > 1.0f) {
+        dfta_progress("Normalizing audio (peak: %.3f)\n", output_audio->peak_amplitude);
+    }
+    
+    dfta_progress("Audio synthesis complete!\n");
+    return DFTA_SUCCESS;
+}
+
+// One channel of a multichannel synthesis, rendered on its own thread
+typedef struct {
+    const ComponentColumns* columns;
+    AudioData plane;            // View of the channel's plane in the output
+    int synthesis_mode;
+    int verbose;
+    int result;
+} ChannelSynthesis;
+
+static void* synthesize_channel_thread(void* arg) {
+    ChannelSynthesis* job = arg;
+    job->result = synthesize_channel(job->columns, &job->plane, job->synthesis_mode, job->verbose);
+    return NULL;
+}
+
+// Turn a mid/side pair back into left = mid + side and right = mid - side in
+// place, returning the peak of the result
+static float unmix_mid_side(float* mid, float* side, uint32_t count) {
+    float peak = 0.0f;
+    for (uint32_t i = 0; i < count; i++) {
+        float left = mid[i] + side[i];
+        float right = mid[i] - side[i];
+        mid[i] = left;
+        side[i] = right;
+        float abs_left = fabsf(left);
+        float abs_right = fabsf(right);
+        peak = abs_left > peak ? abs_left : peak;
+        peak = abs_right > peak ? abs_right : peak;
+    }
+    return peak;
+}
+
+int synthesize_audio_channels(const ChannelComponents* components, AudioData* output_audio, int synthesis_mode,
+                              WorkerPool* pool) {
+    if (!components || !output_audio || !output_audio->samples) {
+        return DFTA_ERROR_MEMORY;
+    }
+    uint32_t channel_count = components->channel_count;
+    if (channel_count <= 1) {
+        return synthesize_audio_from_columns(&components->channels[0], output_audio, synthesis_mode);
+    }
+    
+    dfta_progress("Processing %u frequency components in %u channels (%s synthesis, one thread per channel)...\n",
+                  channel_component_count(components), channel_count,
+                  synthesis_mode == SYNTHESIS_ACCURATE ? "accurate" : "fast");
+    if (synthesis_mode != SYNTHESIS_ACCURATE) {
+        init_sine_wavetable();
+    }
+    
+    // Channels share nothing but the read-only wavetable, so each one is a
+    // separate worker task
+    ChannelSynthesis jobs[DFTA_MAX_CHANNELS];
+    for (uint32_t c = 0; c < channel_count; c++) {
+        jobs[c].columns = &components->channels[c];
+        jobs[c].plane = *output_audio;
+        jobs[c].plane.samples = output_audio->samples + (size_t)c * output_audio->sample_count;
+        jobs[c].plane.channels = 1;
+        jobs[c].synthesis_mode = synthesis_mode;
+        jobs[c].verbose = 0;
+        jobs[c].result = DFTA_SUCCESS;
+    }
+    worker_pool_run(pool, synthesize_channel_thread, jobs, sizeof(ChannelSynthesis), (int)channel_count);
+    
+    int result = DFTA_SUCCESS;
+    for (uint32_t c = 0; c < channel_count; c++) {
+        if (jobs[c].result != DFTA_SUCCESS) {
+            result = jobs[c].result;
         }
-        
-        current = current->next;
+    }
+    if (result != DFTA_SUCCESS) {
+        return result;
     }
     
-    // Normalize the output to prevent clipping
+    // Mid/side pairs change their peak when unmixed, so it is taken again
+    // in the same pass
     float max_amplitude = 0.0f;
-    for (uint32_t i = 0; i < output_audio->sample_count; i++) {
-        float abs_sample = fabsf(output_audio->samples[i]);
-        if (abs_sample > max_amplitude) {
-            max_amplitude = abs_sample;
+    for (uint32_t c = 0; c < channel_count; c++) {
+        float peak = jobs[c].plane.peak_amplitude;
+        if (c % 2 == 0 && c + 1 < channel_count && (components->mid_side_pairs >> (c / 2)) & 1) {
+            peak = unmix_mid_side(jobs[c].plane.samples, jobs[c + 1].plane.samples,
+                                  output_audio->sample_count);
+            c++;
         }
+        max_amplitude = peak > max_amplitude ? peak : max_amplitude;
     }
     
+    output_audio->peak_amplitude = max_amplitude;
     if (max_amplitude > 1.0f) {
-        printf("Normalizing audio (peak: %.3f)\n", max_amplitude);
-        float scale_factor = 0.95f / max_amplitude;  // Leave some headroom
-        for (uint32_t i = 0; i < output_audio->sample_count; i++) {
-            output_audio->samples[i] *= scale_factor;
+        dfta_progress("Normalizing audio (peak: %.3f)\n", max_amplitude);
+    }
+    
+    dfta_progress("Audio synthesis complete!\n");
+    return DFTA_SUCCESS;
+}
+
+// Start and index of one component, for sorting unsorted (v1) input
+typedef struct {
+    int64_t start;
+    uint32_t index;
+} StartKey;
+
+static int compare_start_key(const void* a, const void* b) {
+    const StartKey* ka = a;
+    const StartKey* kb = b;
+    if (ka->start != kb->start) return (ka->start > kb->start) - (ka->start < kb->start);
+    return (ka->index > kb->index) - (ka->index < kb->index);
+}
+
+int init_block_synthesizer(BlockSynthesizer* synth, const ComponentColumns* columns,
+                           const AudioData* audio_info, int synthesis_mode) {
+    memset(synth, 0, sizeof(BlockSynthesizer));
+    synth->columns = columns;
+    synth->sample_rate = audio_info->sample_rate;
+    synth->start_offset = audio_info->start_offset;
+    synth->synthesis_mode = synthesis_mode;
+    
+    // Blocks are rendered in order, so components are visited by start time
+    uint32_t count = columns->count;
+    for (uint32_t i = 1; i < count; i++) {
+        if (columns->start[i] < columns->start[i - 1]) {
+            StartKey* keys = malloc((size_t)count * sizeof(StartKey));
+            synth->order = malloc((size_t)count * sizeof(uint32_t));
+            if (!keys || !synth->order) {
+                free(keys);
+                free(synth->order);
+                synth->order = NULL;
+                return DFTA_ERROR_MEMORY;
+            }
+            for (uint32_t k = 0; k < count; k++) {
+                keys[k].start = columns->start[k];
+                keys[k].index = k;
+            }
+            qsort(keys, count, sizeof(StartKey), compare_start_key);
+            for (uint32_t k = 0; k < count; k++) {
+                synth->order[k] = keys[k].index;
+            }
+            free(keys);
+            break;
         }
     }
     
-    printf("Audio synthesis complete!\n");
+    synth->active_capacity = 256;
+    synth->active = malloc(synth->active_capacity * sizeof(uint32_t));
+    if (!synth->active) {
+        free(synth->order);
+        synth->order = NULL;
+        return DFTA_ERROR_MEMORY;
+    }
+    
+    if (synthesis_mode != SYNTHESIS_ACCURATE) {
+        init_sine_wavetable();
+    }
     return DFTA_SUCCESS;
 }
+
+// Sample span [start, end) of component n relative to the first rendered sample
+static void component_span(const ComponentColumns* columns, uint32_t n, uint64_t start_offset,
+                           int64_t* start, int64_t* end) {
+    *start = columns->start[n] - (int64_t)start_offset;
+    *end = *start + columns->length[n];
+}
+
+void synthesize_block(BlockSynthesizer* synth, float* output, uint64_t block_start, uint32_t frames) {
+    const ComponentColumns* columns = synth->columns;
+    int64_t block_begin = (int64_t)block_start;
+    int64_t block_end = block_begin + frames;
+    
+    memset(output, 0, frames * sizeof(float));
+    
+    // Activate every component that starts before the end of this block
+    while (synth->next < columns->count) {
+        uint32_t n = synth->order ? synth->order[synth->next] : synth->next;
+        if (!component_is_valid(columns, n)) {
+            synth->next++;
+            continue;
+        }
+        
+        int64_t start, end;
+        component_span(columns, n, synth->start_offset, &start, &end);
+        if (start >= block_end) break;
+        
+        if (end > block_begin) {
+            if (synth->active_count == synth->active_capacity) {
+                uint32_t* grown = realloc(synth->active, synth->active_capacity * 2 * sizeof(uint32_t));
+                if (!grown) break;  // Render what is already active; retry next block
+                synth->active = grown;
+                synth->active_capacity *= 2;
+            }
+            synth->active[synth->active_count++] = n;
+        }
+        synth->next++;
+    }
+    
+    // Render the part of each active component that falls in this block and
+    // retire the ones that end inside it
+    uint32_t kept = 0;
+    for (uint32_t a = 0; a < synth->active_count; a++) {
+        uint32_t n = synth->active[a];
+        int64_t start, end;
+        component_span(columns, n, synth->start_offset, &start, &end);
+        
+        int from = (int)((start > block_begin ? start : block_begin) - block_begin);
+        int to = (int)((end < block_end ? end : block_end) - block_begin);
+        render_component(columns, n, output, from, to, synth->start_offset + block_start,
+                         synth->sample_rate, synth->synthesis_mode);
+        
+        if (end > block_end) {
+            synth->active[kept++] = n;
+        }
+    }
+    synth->active_count = kept;
+}
+
+void free_block_synthesizer(BlockSynthesizer* synth) {
+    if (!synth) return;
+    free(synth->active);
+    free(synth->order);
+    memset(synth, 0, sizeof(BlockSynthesizer));
+}
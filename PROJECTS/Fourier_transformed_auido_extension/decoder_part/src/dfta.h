@@ -2,20 +2,53 @@
 #ifndef DFTA_H
 #define DFTA_H
 
+#include <stdio.h>
 #include <stdint.h>
+#include <stddef.h>
+#include "dfta_common.h"
 
 #ifndef M_PI
 #define M_PI 3.14159265358979323846
 #endif
 
-// Error codes
-#define DFTA_SUCCESS           0
-#define DFTA_ERROR_FILE_READ   1
-#define DFTA_ERROR_FILE_WRITE  2
-#define DFTA_ERROR_MEMORY      3
-#define DFTA_ERROR_FORMAT      4
+// Synthesis modes
+#define SYNTHESIS_ACCURATE     0   // sinf() per sample
+#define SYNTHESIS_FAST         1   // Fixed-point phase accumulator + interpolated wavetable
+#define SYNTHESIS_FAST_NOINTERP 2  // Fixed-point phase accumulator + truncated wavetable lookup
 
-// SineWave structure for storing frequency components
+// Stream output formats
+#define STREAM_FORMAT_WAV      0   // WAV header with unknown (maximum) length, or RF64 past 4 GB
+#define STREAM_FORMAT_RAW      1   // Headerless little-endian samples in the output sample format
+
+// Output sample formats
+#define SAMPLE_FORMAT_S16      0   // 16-bit PCM
+#define SAMPLE_FORMAT_S24      1   // Packed 24-bit PCM
+#define SAMPLE_FORMAT_S32      2   // 32-bit PCM
+#define SAMPLE_FORMAT_F32      3   // 32-bit IEEE float
+
+// WAV format tags
+#define WAV_FORMAT_PCM         0x0001
+#define WAV_FORMAT_IEEE_FLOAT  0x0003
+
+// Seed for the TPDF dither generator
+#define DFTA_DITHER_SEED       0x9E3779B9u
+
+// Upper bound for coded channels
+#define DFTA_MAX_CHANNELS      8
+
+// Range coder models (see ftae_io.c for the fields they code)
+#define ENTROPY_PROB_BITS      12  // Model frequencies sum to 1 << ENTROPY_PROB_BITS
+#define ENTROPY_MAX_SYMBOLS    256
+
+// Progress messages. The command line decoder prints them; libdfta is built
+// with DFTA_LIBRARY and must not write to stdout.
+#ifdef DFTA_LIBRARY
+static inline void dfta_progress(const char* format, ...) { (void)format; }
+#else
+#define dfta_progress printf
+#endif
+
+// v1/v2 component record, as stored in the file
 typedef struct {
     int phase;           // Phase in degrees (0-359)
     int amplitude;       // Amplitude (scaled integer)
@@ -41,39 +74,194 @@ typedef struct {
     uint32_t data_size;
 } WAVHeader;
 
-// Audio data structure
+// ds64 chunk of an RF64 file (EBU Tech 3306), holding the 64-bit sizes
+// that the RIFF and data chunk sizes (0xFFFFFFFF) stand in for. The sizes
+// are split into 32-bit halves so the struct has the on-disk layout.
+typedef struct {
+    uint32_t riff_size_low;
+    uint32_t riff_size_high;
+    uint32_t data_size_low;
+    uint32_t data_size_high;
+    uint32_t sample_count_low;
+    uint32_t sample_count_high;
+    uint32_t table_length;      // Further 64-bit chunk sizes; none are written
+} DS64Chunk;
+
+// Audio data structure. Samples are planar: channel c occupies
+// samples[c * sample_count, (c + 1) * sample_count).
 typedef struct {
     float* samples;
-    uint32_t sample_count;
+    uint64_t sample_count;
     uint32_t sample_rate;
     uint16_t channels;
     uint16_t bits_per_sample;
+    int sample_format;          // SAMPLE_FORMAT_* written to the output
+    uint64_t start_offset;      // Source sample index of samples[0] (range decoding)
+    float peak_amplitude;       // Absolute peak of samples, tracked during synthesis
 } AudioData;
 
-// SineWave queue for managing frequency components
-typedef struct SineWaveNode {
-    SineWave wave;
-    struct SineWaveNode* next;
-} SineWaveNode;
+// Back-reference: components [first, first + count) sound again as they
+// are, shift samples later. Their phases are against absolute time, so the
+// group's rendered output can be copied wherever the shift is a whole number
+// of cycles of every component.
+typedef struct {
+    uint32_t first;
+    uint32_t count;
+    int64_t shift;              // Samples
+} ComponentRepeat;
+
+// Components starting this late are treated as damaged (2^40 samples is
+// over 16 days at 768 kHz), which keeps sample arithmetic far from overflow
+#define COMPONENT_MAX_START    ((int64_t)1 << 40)
+
+// Components loaded from an FTAE file, one contiguous column per field.
+// Times are whole samples: at the file's rate while loading, then at the
+// output rate once scale_component_columns has mapped them. A negative start
+// marks a component whose timing was unusable. The stored integer fields
+// are dequantized in bulk into the float and fixed-point columns the
+// oscillators read.
+typedef struct {
+    uint32_t count;
+    int64_t* start;             // First sample
+    uint32_t* length;           // Samples
+    int32_t* frequency;         // Hz
+    int32_t* stored_amplitude;  // Amplitude as stored (scaled by 1000)
+    int32_t* stored_phase;      // Phase as stored, in degrees
+    float* amplitude;           // Linear amplitude, for synthesis
+    float* phase;               // Radians, for the accurate oscillator
+    uint32_t* phase_turns;      // Phase in 1/2^32 cycles, for the fast oscillator
+    void* storage;              // Single allocation backing every column
+    ComponentRepeat* repeats;   // Groups of components that repeat, in file order
+    uint32_t repeat_count;
+    uint32_t repeat_capacity;
+} ComponentColumns;
+
+// Components of every coded channel. Pairs flagged in mid_side_pairs hold
+// mid and side, which synthesis turns back into left and right.
+typedef struct {
+    uint32_t channel_count;
+    uint32_t mid_side_pairs;    // Bit k set when channels 2k/2k+1 hold mid/side
+    ComponentColumns channels[DFTA_MAX_CHANNELS];
+} ChannelComponents;
+
+// Decoding configuration
+typedef struct {
+    float start_time;           // Start of the decoded range in seconds
+    float end_time;             // End of the decoded range in seconds (< 0 = end of file)
+    int synthesis_mode;         // SYNTHESIS_* oscillator implementation
+    int dither;                 // Apply TPDF dither when converting to PCM
+    int sample_format;          // SAMPLE_FORMAT_* of the output
+    int stream_output;          // Decode block by block through the ring buffer
+    int stream_format;          // STREAM_FORMAT_* when streaming
+    int block_frames;           // Frames per streamed block
+    int latency_ms;             // How far synthesis may run ahead of the output
+    int pace_realtime;          // Release blocks at playback speed
+    int threads;                // Frame decode threads (0 = one per online CPU)
+    uint32_t max_components_per_frame;  // Strongest components synthesized per frame (0 = all)
+    float cpu_budget;           // Share of each frame's components synthesized (0 = all)
+    uint32_t output_rate;       // Sample rate to synthesize at (0 = the file's rate)
+    float time_scale;           // Output duration over the original (0 or 1 = unchanged)
+    float pitch_scale;          // Frequency factor applied to every component (0 or 1 = unchanged)
+    WorkerPool* pool;           // Persistent threads for unpacking and synthesis (NULL = start threads per call)
+} DecodingConfig;
+
+// LSB-first bit reader over a packed FTAE frame payload
+typedef struct {
+    const uint8_t* data;
+    size_t size;
+    size_t position;            // Next byte to load into the accumulator
+    uint64_t accumulator;
+    int bit_count;
+    int overrun;                // Set when a read ran past the end of data
+} BitReader;
+
+// Static symbol distribution of one component field, read from the file
+typedef struct {
+    int symbol_count;
+    uint16_t freq[ENTROPY_MAX_SYMBOLS];
+    uint16_t start[ENTROPY_MAX_SYMBOLS];        // Cumulative frequency below each symbol
+    uint8_t symbol[1 << ENTROPY_PROB_BITS];     // Symbol owning each probability slot
+} EntropyModel;
+
+// Range decoder over one frame payload
+typedef struct {
+    const uint8_t* data;
+    size_t size;
+    size_t position;
+    uint32_t low;
+    uint32_t range;
+    uint32_t code;
+    int padding;                // Zero bytes supplied past the end of data
+    int overrun;                // Set on corrupt input or reads far past the end
+} RangeDecoder;
 
+// Incremental synthesizer: renders consecutive blocks from time-sorted
+// components, keeping only the components that overlap the current block
 typedef struct {
-    SineWaveNode* head;
-    SineWaveNode* tail;
-    int count;
-} SineWaveQueue;
+    const ComponentColumns* columns;
+    uint32_t next;              // Position in start order of the first component not yet started
+    uint32_t* active;           // Indices of components still sounding
+    uint32_t active_count;
+    uint32_t active_capacity;
+    uint32_t* order;            // Time-sorted component indices for unsorted (v1) input
+    uint32_t sample_rate;
+    uint64_t start_offset;
+    int synthesis_mode;
+} BlockSynthesizer;
 
 // Function declarations - DECODER ONLY
-int decode_audio_file(const char* input_file, const char* output_file);
-int read_ftae_file(const char* filename, SineWaveQueue** queue, AudioData* audio_info);
-int write_wav_file(const char* filename, const AudioData* audio_data);
+int decode_audio_file(const char* input_file, const char* output_file, const DecodingConfig* config);
+int decode_audio_stream(const char* input_file, FILE* output, const DecodingConfig* config);
+int read_ftae_file(const char* filename, ChannelComponents* components, AudioData* audio_info, const DecodingConfig* config);
+int read_ftae_stream(FILE* file, ChannelComponents* components, AudioData* audio_info, const DecodingConfig* config);
+int write_wav_file(const char* filename, const AudioData* audio_data, int dither);
+int write_wav_stream_header(FILE* file, uint32_t sample_rate, uint16_t channels, int sample_format,
+                            uint64_t frames);
+int sample_format_bytes(int sample_format);
+const char* sample_format_name(int sample_format);
+void convert_to_pcm16(const float* input, int16_t* output, uint32_t count, float scale,
+                      uint32_t* dither_state);
+void convert_samples(const float* input, uint8_t* output, uint32_t count, float scale,
+                     int sample_format, uint32_t* dither_state);
+void convert_planes(const float* input, size_t plane_stride, uint16_t channels, int sample_format,
+                    uint8_t* output, uint8_t* scratch, uint32_t frames, float scale,
+                    uint32_t* dither_state);
 void free_audio_data(AudioData* audio_data);
 
-// SineWave queue functions
-SineWaveQueue* create_sinewave_queue(void);
-void enqueue_sinewave(SineWaveQueue* queue, const SineWave* wave);
-void free_sinewave_queue(SineWaveQueue* queue);
+// Bit unpacking functions
+void bitreader_init(BitReader* reader, const uint8_t* data, size_t size);
+uint32_t bitreader_get(BitReader* reader, int bits);
+uint32_t bitreader_get_expgolomb(BitReader* reader);
+
+// Entropy decoding functions
+int entropy_model_read(EntropyModel* model, BitReader* reader, int symbol_count);
+void range_decoder_init(RangeDecoder* decoder, const uint8_t* data, size_t size);
+int range_decode_symbol(RangeDecoder* decoder, const EntropyModel* model);
+uint32_t range_decode_bits(RangeDecoder* decoder, int bits);
+
+// Component column functions
+int alloc_component_columns(ComponentColumns* columns, uint32_t count);
+void free_component_columns(ComponentColumns* columns);
+void dequantize_component_columns(ComponentColumns* columns);
+void scale_component_columns(ComponentColumns* columns, uint32_t file_rate, uint32_t output_rate,
+                             float time_scale, float pitch_scale);
+int64_t scale_sample_position(int64_t position, uint32_t file_rate, uint32_t output_rate, float time_scale);
+int add_component_repeat(ComponentColumns* columns, uint32_t first, uint32_t count, int64_t shift);
+int expand_component_repeats(ComponentColumns* columns);
+uint32_t channel_component_count(const ChannelComponents* components);
+void free_channel_components(ChannelComponents* components);
 
 // Synthesis functions
-int synthesize_audio_from_sinewaves(SineWaveQueue* queue, AudioData* output_audio);
+int synthesize_audio_from_columns(const ComponentColumns* columns, AudioData* output_audio, int synthesis_mode);
+int synthesize_audio_channels(const ChannelComponents* components, AudioData* output_audio, int synthesis_mode,
+                              WorkerPool* pool);
+int init_block_synthesizer(BlockSynthesizer* synth, const ComponentColumns* columns,
+                           const AudioData* audio_info, int synthesis_mode);
+void synthesize_block(BlockSynthesizer* synth, float* output, uint64_t block_start, uint32_t frames);
+void free_block_synthesizer(BlockSynthesizer* synth);
+
+// Streaming output
+int stream_decode_audio(const ChannelComponents* components, const AudioData* audio_info,
+                        FILE* output, const DecodingConfig* config);
 
 #endif // DFTA_H
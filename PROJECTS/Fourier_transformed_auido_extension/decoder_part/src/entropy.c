@@ -0,0 +1,111 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "dfta.h"
+
+// Carry-less range coder (Subbotin), mirroring the encoder
+#define RANGE_TOP (1u << 24)
+#define RANGE_BOT (1u << 16)
+
+// Reads past the payload return zeros; the encoder's shortest flush relies
+// on up to four of them
+#define RANGE_MAX_PADDING 4
+
+int entropy_model_read(EntropyModel* model, BitReader* reader, int symbol_count) {
+    memset(model, 0, sizeof(EntropyModel));
+    if (symbol_count <= 0 || symbol_count > ENTROPY_MAX_SYMBOLS) return 0;
+    model->symbol_count = symbol_count;
+    
+    // Frequencies as exp-Golomb; a zero is followed by the count of further zeros
+    uint32_t total = 0;
+    for (int s = 0; s < symbol_count;) {
+        uint32_t freq = bitreader_get_expgolomb(reader);
+        if (freq > (1u << ENTROPY_PROB_BITS) - total) return 0;
+        model->freq[s] = (uint16_t)freq;
+        model->start[s] = (uint16_t)total;
+        total += freq;
+        if (freq != 0) {
+            s++;
+            continue;
+        }
+        uint32_t run = bitreader_get_expgolomb(reader);
+        if (run > (uint32_t)(symbol_count - s - 1)) return 0;
+        for (uint32_t r = 1; r <= run; r++) {
+            model->start[s + r] = (uint16_t)total;
+        }
+        s += 1 + (int)run;
+    }
+    if (reader->overrun || total != (1u << ENTROPY_PROB_BITS)) return 0;
+    
+    // Slot -> symbol lookup so decoding a symbol is a single table read
+    for (int s = 0; s < symbol_count; s++) {
+        memset(model->symbol + model->start[s], s, model->freq[s]);
+    }
+    return 1;
+}
+
+static uint8_t range_next_byte(RangeDecoder* decoder) {
+    if (decoder->position < decoder->size) {
+        return decoder->data[decoder->position++];
+    }
+    if (++decoder->padding > RANGE_MAX_PADDING) {
+        decoder->overrun = 1;
+    }
+    return 0;
+}
+
+void range_decoder_init(RangeDecoder* decoder, const uint8_t* data, size_t size) {
+    memset(decoder, 0, sizeof(RangeDecoder));
+    decoder->data = data;
+    decoder->size = size;
+    decoder->range = 0xFFFFFFFFu;
+    for (int i = 0; i < 4; i++) {
+        decoder->code = (decoder->code << 8) | range_next_byte(decoder);
+    }
+}
+
+static void range_decode_update(RangeDecoder* decoder, uint32_t start, uint32_t freq) {
+    decoder->low += start * decoder->range;
+    decoder->range *= freq;
+    
+    for (;;) {
+        if ((decoder->low ^ (decoder->low + decoder->range)) >= RANGE_TOP) {
+            if (decoder->range >= RANGE_BOT) break;
+            decoder->range = (0u - decoder->low) & (RANGE_BOT - 1);
+        }
+        decoder->code = (decoder->code << 8) | range_next_byte(decoder);
+        decoder->low <<= 8;
+        decoder->range <<= 8;
+    }
+}
+
+int range_decode_symbol(RangeDecoder* decoder, const EntropyModel* model) {
+    decoder->range >>= ENTROPY_PROB_BITS;
+    uint32_t slot = (decoder->code - decoder->low) / decoder->range;
+    if (slot >= (1u << ENTROPY_PROB_BITS)) {
+        // Only reachable with corrupt input
+        decoder->overrun = 1;
+        slot = (1u << ENTROPY_PROB_BITS) - 1;
+    }
+    
+    int symbol = model->symbol[slot];
+    range_decode_update(decoder, model->start[symbol], model->freq[symbol]);
+    return symbol;
+}
+
+uint32_t range_decode_bits(RangeDecoder* decoder, int bits) {
+    uint32_t value = 0;
+    for (int shift = 0; shift < bits; shift += 8) {
+        int chunk = bits - shift > 8 ? 8 : bits - shift;
+        decoder->range >>= chunk;
+        uint32_t part = (decoder->code - decoder->low) / decoder->range;
+        if (part >= (1u << chunk)) {
+            decoder->overrun = 1;
+            part = (1u << chunk) - 1;
+        }
+        range_decode_update(decoder, part, 1);
+        value |= part << shift;
+    }
+    return value;
+}
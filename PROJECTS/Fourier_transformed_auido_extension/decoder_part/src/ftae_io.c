@@ -1,106 +1,1487 @@
 
 
+// mmap/sysconf need POSIX declarations under -std=c99
+#if defined(__unix__) || defined(__APPLE__)
+#define _POSIX_C_SOURCE 200809L
+#define DFTA_HAVE_MMAP 1
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
 #include "dfta.h"
+#include "ftae_format.h"
+
+#ifdef DFTA_HAVE_MMAP
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// Frames handed to a decode thread at a time
+#define FTAE_FRAME_BATCH       64
+
+// Damaged frames reported individually before only the total is given
+#define FTAE_DAMAGE_REPORT_MAX 8
+
+// What the reader needs of the header and trailer of any version, with
+// times as samples at the file's rate
+typedef struct {
+    uint64_t sample_count;   // Total length
+    uint64_t wave_count;
+    uint64_t index_offset;   // Byte offset of the frame index, where the frames end
+    uint32_t frame_count;    // v3+: frames in the index
+    uint32_t index_crc;      // v4+ with a trailer: CRC32C of the index
+    uint32_t max_length;     // Longest component
+    int have_trailer;
+} FTAELayout;
 
-// FTAE file format header
+// A frame header of any version, with its times in samples at the file's rate
 typedef struct {
-    char magic[4];           // "FTAE"
-    uint32_t version;        // Format version
-    uint32_t sample_rate;    // Original sample rate
-    uint32_t wave_count;     // Number of SineWave structs
-    uint32_t compression_level; // Compression level used
-    float amplitude_threshold;  // Amplitude threshold used
-    float duration;          // Total duration in seconds
-    uint32_t reserved[8];    // Reserved for future use
-} FTAEHeader;
-
-int read_ftae_file(const char* filename, SineWaveQueue** queue, AudioData* audio_info) {
-    if (!filename || !queue || !audio_info) {
+    int64_t start;           // First sample, -1 if the stored time is unusable
+    uint32_t length;         // Samples
+    long fft_size;           // Analysis window the bin frequencies refer to
+    uint16_t component_count;
+    uint16_t flags;          // FTAE_FRAME_* bits
+    uint32_t payload_size;
+} FrameInfo;
+
+// Frame index entry of any version
+typedef struct {
+    int64_t start;           // First sample of the frame
+    uint64_t offset;         // Byte offset of the frame header
+} FrameIndexEntry;
+
+// Static per-file models for range coded frames
+typedef struct {
+    EntropyModel frequency;
+    EntropyModel phase;
+    uint32_t amplitude_contexts;    // 1 or FTAE_AMPLITUDE_CONTEXTS_MAX
+    EntropyModel amplitude[FTAE_AMPLITUDE_CONTEXTS_MAX];
+} FTAEModels;
+
+// v1/v2 record region, mapped or read in one call
+typedef struct {
+    const SineWave* waves;
+    uint32_t count;
+    void* mapping;
+    size_t mapping_size;
+    SineWave* owned;
+} RecordRegion;
+
+// One frame located in the region read from disk
+typedef struct {
+    FrameInfo header;
+    size_t offset;           // Offset of the frame header within the region
+    size_t payload;          // Offset of the payload within the region
+    uint32_t crc;            // v4+: stored checksum
+    uint32_t channel;        // Channel from the frame flags
+    uint32_t first;          // First slot of the frame's components in its channel's columns
+    uint32_t kept;           // Components left after the decoding budget, from first on
+    float energy;            // Their share of the frame's energy
+    uint32_t column_first;   // Slot of the kept components after compaction
+    uint32_t column_count;
+    int repeat;              // Back-reference frame, with its payload below
+    FTAERepeatPayload source;
+    int verified;            // Checksum already verified while locating the frame
+    int damaged;             // Skipped: bad checksum, impossible size or malformed payload
+    int unused;              // Read for a back-reference in the range, but not one of its sources
+} FrameSlot;
+
+// Frames shared out to the decode threads in batches
+typedef struct {
+    const uint8_t* region;
+    FrameSlot* frames;
+    uint32_t frame_count;
+    int checked;             // v4+: verify each frame's checksum before unpacking
+    uint32_t sample_rate;
+    const FTAEModels* models;
+    const int* amplitude_table;
+    uint32_t max_components;        // Per-frame budget (0 = all)
+    float cpu_budget;               // Share of each frame's components (0 = all)
+    ComponentColumns* columns;      // One set per channel
+    pthread_mutex_t lock;
+    uint32_t next;           // First frame of the next unclaimed batch
+} UnpackJob;
+
+// Field decoder for one frame payload
+typedef struct {
+    const FTAEModels* models;       // NULL for bit-packed payloads
+    BitReader reader;
+    RangeDecoder decoder;
+} FieldReader;
+
+// Record index stored in the v2 seek table entry covering time, or fallback
+// when the file has no usable table
+static uint32_t seek_table_lookup(FILE* file, const FTAEHeader* header, uint32_t entry_index,
+                                  uint32_t fallback) {
+    if (header->version < FTAE_VERSION_SEEKABLE || header->seek_entry_count == 0) {
+        return fallback;
+    }
+    if (entry_index >= header->seek_entry_count) {
+        return header->wave_count;
+    }
+    
+    uint64_t table_offset = sizeof(FTAEHeader) + (uint64_t)header->wave_count * sizeof(SineWave);
+    FTAESeekEntry entry;
+    if (fseek(file, (long)(table_offset + (uint64_t)entry_index * sizeof(FTAESeekEntry)), SEEK_SET) != 0 ||
+        fread(&entry, sizeof(FTAESeekEntry), 1, file) != 1 ||
+        entry.record_index > header->wave_count) {
+        fprintf(stderr, "Warning: FTAE seek table unreadable, scanning all components\n");
+        return fallback;
+    }
+    
+    return entry.record_index;
+}
+
+// Map (or, without mmap, read in one call) records [first, last) of the
+// component region
+static int map_record_region(FILE* file, uint32_t first, uint32_t last, RecordRegion* region) {
+    uint64_t byte_offset = sizeof(FTAEHeader) + (uint64_t)first * sizeof(SineWave);
+    size_t byte_count = (size_t)(last - first) * sizeof(SineWave);
+    
+    region->count = last - first;
+    if (region->count == 0) return DFTA_SUCCESS;
+    
+#ifdef DFTA_HAVE_MMAP
+    // mmap offsets must be page aligned, so map from the page holding the first record
+    uint64_t page_size = (uint64_t)sysconf(_SC_PAGESIZE);
+    uint64_t map_offset = byte_offset - byte_offset % page_size;
+    size_t map_size = (size_t)(byte_offset - map_offset) + byte_count;
+    
+    void* mapping = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fileno(file), (off_t)map_offset);
+    if (mapping != MAP_FAILED) {
+        posix_madvise(mapping, map_size, POSIX_MADV_SEQUENTIAL);
+        region->mapping = mapping;
+        region->mapping_size = map_size;
+        region->waves = (const SineWave*)((const char*)mapping + (byte_offset - map_offset));
+        return DFTA_SUCCESS;
+    }
+    // Fall through to a bulk read (e.g. pipes or filesystems without mmap)
+#endif
+    
+    region->owned = malloc(byte_count);
+    if (!region->owned) {
+        return DFTA_ERROR_MEMORY;
+    }
+    if (fseek(file, (long)byte_offset, SEEK_SET) != 0 ||
+        fread(region->owned, 1, byte_count, file) != byte_count) {
+        fprintf(stderr, "Error: Failed to read SineWave data\n");
+        free(region->owned);
+        region->owned = NULL;
         return DFTA_ERROR_FILE_READ;
     }
+    region->waves = region->owned;
+    return DFTA_SUCCESS;
+}
+
+static void release_record_region(RecordRegion* region) {
+#ifdef DFTA_HAVE_MMAP
+    if (region->mapping) {
+        munmap(region->mapping, region->mapping_size);
+    }
+#endif
+    free(region->owned);
+    memset(region, 0, sizeof(RecordRegion));
+}
+
+// Sample at sample_rate that a v1-v4 time in seconds truncates to, as
+// decoders of those versions have always rendered it; -1 if the time is
+// negative or too large for a sample index
+static int64_t legacy_sample(float seconds, uint32_t sample_rate) {
+    if (!(seconds >= 0.0f) || seconds >= 1.0e9f / (float)sample_rate) return -1;
+    return (int)(seconds * sample_rate);
+}
+
+// Samples in a header or trailer duration, truncated as before; -1 if it is
+// NaN, negative or reaches COMPONENT_MAX_START
+static int64_t legacy_duration(float seconds, uint32_t sample_rate) {
+    float samples = seconds * (float)sample_rate;
+    if (!(samples >= 0.0f) || samples >= (float)COMPONENT_MAX_START) return -1;
+    return (int64_t)samples;
+}
+
+// Longest component in samples from a header or trailer max_duration,
+// rounded up; -1 if it is NaN, negative or does not fit 32 bits
+static int64_t legacy_max_length(float seconds, uint32_t sample_rate) {
+    double samples = ceil((double)seconds * sample_rate);
+    if (!(samples >= 0.0) || samples > (double)UINT32_MAX) return -1;
+    return (int64_t)samples;
+}
+
+static float decoding_time_scale(const DecodingConfig* config) {
+    return config && config->time_scale > 0.0f ? config->time_scale : 1.0f;
+}
+
+static float decoding_pitch_scale(const DecodingConfig* config) {
+    return config && config->pitch_scale > 0.0f ? config->pitch_scale : 1.0f;
+}
+
+// Stored frequencies at or above this reach half the output rate once
+// pitch-scaled, so they would alias; they are dropped while loading
+// (INT32_MAX = keep everything)
+static int32_t output_frequency_limit(const DecodingConfig* config, uint32_t file_rate) {
+    float pitch_scale = decoding_pitch_scale(config);
+    if (!config || (config->output_rate == 0 && pitch_scale == 1.0f)) return INT32_MAX;
+    uint32_t rate = config->output_rate > 0 ? config->output_rate : file_rate;
+    double limit = ceil(rate / (2.0 * pitch_scale));
+    return limit < (double)INT32_MAX ? (int32_t)limit : INT32_MAX;
+}
+
+static void report_frequency_limit(const DecodingConfig* config, uint32_t file_rate, uint64_t dropped) {
+    uint32_t rate = config->output_rate > 0 ? config->output_rate : file_rate;
+    dfta_progress("Skipped %llu components that would reach half the output rate (%u Hz at %u Hz)\n",
+                  (unsigned long long)dropped, rate / 2, rate);
+}
+
+// v1/v2: transpose records [first, last) into columns, leaving out those at or
+// above frequency_limit. The records are only needed until their fields have
+// been split out.
+static int load_record_region(FILE* file, uint32_t first, uint32_t last, uint32_t sample_rate,
+                              int32_t frequency_limit, ComponentColumns* components, uint64_t* dropped) {
+    RecordRegion region = {0};
+    int result = map_record_region(file, first, last, &region);
+    if (result != DFTA_SUCCESS) {
+        return result;
+    }
     
-    FILE* file = fopen(filename, "rb");
-    if (!file) {
-        fprintf(stderr, "Error: Cannot open FTAE file '%s'\n", filename);
+    result = alloc_component_columns(components, region.count);
+    if (result == DFTA_SUCCESS) {
+        uint32_t count = 0;
+        for (uint32_t i = 0; i < region.count; i++) {
+            const SineWave* wave = &region.waves[i];
+            if (wave->frequency >= frequency_limit) continue;
+            components->start[count] = legacy_sample(wave->start_time, sample_rate);
+            int64_t length = legacy_sample(wave->duration, sample_rate);
+            components->length[count] = length >= 0 ? (uint32_t)length : 0;
+            if (length < 0) components->start[count] = -1;
+            components->frequency[count] = wave->frequency;
+            components->stored_amplitude[count] = wave->amplitude;
+            components->stored_phase[count] = wave->phase;
+            count++;
+        }
+        *dropped = region.count - count;
+        components->count = count;
+        dequantize_component_columns(components);
+    }
+    release_record_region(&region);
+    return result;
+}
+
+// First frame in index[0, count) that starts at or after sample position
+static uint32_t frame_index_lower_bound(const FrameIndexEntry* index, uint32_t count, int64_t position) {
+    uint32_t low = 0;
+    uint32_t high = count;
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        if (index[mid].start < position) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+static int amplitude_context(const FTAEModels* models, uint32_t previous_code, uint32_t i) {
+    if (models->amplitude_contexts == 1 || i == 0) return 0;
+    return 1 + (int)(previous_code >> FTAE_AMPLITUDE_CONTEXT_SHIFT);
+}
+
+static int read_models(const uint8_t* data, size_t size, FTAEModels* models) {
+    BitReader reader;
+    bitreader_init(&reader, data, size);
+    
+    models->amplitude_contexts = bitreader_get_expgolomb(&reader);
+    if (models->amplitude_contexts != 1 && models->amplitude_contexts != FTAE_AMPLITUDE_CONTEXTS_MAX) {
+        return 0;
+    }
+    if (!entropy_model_read(&models->frequency, &reader, FTAE_FREQUENCY_SYMBOLS)) return 0;
+    for (uint32_t c = 0; c < models->amplitude_contexts; c++) {
+        if (!entropy_model_read(&models->amplitude[c], &reader, FTAE_AMPLITUDE_SYMBOLS)) return 0;
+    }
+    return entropy_model_read(&models->phase, &reader, FTAE_PHASE_SYMBOLS);
+}
+
+static uint32_t read_frequency_code(FieldReader* in) {
+    if (!in->models) return bitreader_get_expgolomb(&in->reader);
+    int length = range_decode_symbol(&in->decoder, &in->models->frequency);
+    return (uint32_t)((((uint64_t)1 << length) | range_decode_bits(&in->decoder, length)) - 1);
+}
+
+static uint32_t read_amplitude_code(FieldReader* in, uint32_t previous_code, uint32_t i) {
+    if (!in->models) return bitreader_get(&in->reader, FTAE_AMPLITUDE_BITS);
+    const EntropyModel* model = &in->models->amplitude[amplitude_context(in->models, previous_code, i)];
+    return ((uint32_t)range_decode_symbol(&in->decoder, model) << FTAE_AMPLITUDE_RAW_BITS) |
+           range_decode_bits(&in->decoder, FTAE_AMPLITUDE_RAW_BITS);
+}
+
+static uint32_t read_phase(FieldReader* in) {
+    if (!in->models) return bitreader_get(&in->reader, FTAE_PHASE_BITS);
+    return ((uint32_t)range_decode_symbol(&in->decoder, &in->models->phase) << FTAE_PHASE_RAW_BITS) |
+           range_decode_bits(&in->decoder, FTAE_PHASE_RAW_BITS);
+}
+
+static uint32_t read_energy_marker(FieldReader* in) {
+    if (!in->models) return bitreader_get(&in->reader, FTAE_LAYER_MARKER_BITS);
+    return range_decode_bits(&in->decoder, FTAE_LAYER_MARKER_BITS);
+}
+
+// Layer ends of a frame; a frame that is not layered is a single layer
+static int frame_layers(const FrameInfo* frame, uint32_t* end) {
+    uint32_t count = frame->component_count;
+    if (!(frame->flags & FTAE_FRAME_LAYERED)) {
+        end[0] = count;
+        return 1;
+    }
+    for (int layer = 0; layer < FTAE_LAYER_COUNT; layer++) {
+        int shift = FTAE_LAYER_COUNT - 1 - layer;
+        end[layer] = (count + (1u << shift) - 1) >> shift;
+    }
+    return FTAE_LAYER_COUNT;
+}
+
+static int compare_descending(const void* a, const void* b) {
+    uint32_t value_a = *(const uint32_t*)a;
+    uint32_t value_b = *(const uint32_t*)b;
+    return (value_a < value_b) - (value_a > value_b);
+}
+
+// Move the keep strongest of columns[start, start + n) to its front, still in
+// frequency order, and return their share of the group's energy. Of equal
+// amplitudes at the cut the lower frequencies stay. phase_turns is scratch.
+static double keep_strongest(ComponentColumns* columns, uint32_t start, uint32_t n, uint32_t keep) {
+    int32_t* amplitude = columns->stored_amplitude + start;
+    int32_t* frequency = columns->frequency + start;
+    int32_t* phase = columns->stored_phase + start;
+    uint32_t* sorted = columns->phase_turns + start;
+    for (uint32_t i = 0; i < n; i++) {
+        sorted[i] = (uint32_t)amplitude[i];
+    }
+    qsort(sorted, n, sizeof(uint32_t), compare_descending);
+    uint32_t cut = sorted[keep - 1];
+    uint32_t ties = 0;
+    for (uint32_t i = 0; i < keep; i++) {
+        ties += sorted[i] == cut;
+    }
+    
+    double total = 0.0;
+    double kept = 0.0;
+    uint32_t out = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        double energy = (double)amplitude[i] * amplitude[i];
+        total += energy;
+        int take = (uint32_t)amplitude[i] > cut;
+        if (!take && (uint32_t)amplitude[i] == cut && ties > 0) {
+            take = 1;
+            ties--;
+        }
+        if (!take) continue;
+        kept += energy;
+        frequency[out] = frequency[i];
+        amplitude[out] = amplitude[i];
+        phase[out] = phase[i];
+        out++;
+    }
+    return total > 0.0 ? kept / total : 1.0;
+}
+
+// Unpack one frame payload into columns[first, first + component_count),
+// returning 0 if it is malformed. models is NULL for bit-packed payloads.
+// Decoding stops after the layers that hold the keep strongest components,
+// which end up in columns[first, first + keep); energy receives their share
+// of the frame's energy.
+static int unpack_frame(const FrameInfo* frame, const uint8_t* payload, uint32_t sample_rate,
+                        const FTAEModels* models, const int* amplitude_table, uint32_t keep,
+                        ComponentColumns* columns, uint32_t first, float* energy) {
+    int use_bins = (frame->flags & FTAE_FRAME_BIN_FREQUENCIES) != 0;
+    if (use_bins && frame->fft_size <= 0) return 0;
+    float freq_resolution = use_bins ? (float)sample_rate / frame->fft_size : 0.0f;
+    
+    FieldReader in;
+    in.models = models;
+    if (models) {
+        range_decoder_init(&in.decoder, payload, frame->payload_size);
+    } else {
+        bitreader_init(&in.reader, payload, frame->payload_size);
+    }
+    
+    uint32_t end[FTAE_LAYER_COUNT];
+    uint32_t marker[FTAE_LAYER_COUNT];
+    int layers = frame_layers(frame, end);
+    for (int layer = 0; layer < layers - 1; layer++) {
+        marker[layer] = read_energy_marker(&in);
+    }
+    marker[layers - 1] = FTAE_LAYER_MARKER_MAX;
+    
+    uint32_t begin = 0;
+    int layer = 0;
+    for (; layer < layers && begin < keep; layer++) {
+        // Frequency codes are parked in phase_turns, which dequantizing fills later
+        uint32_t count = end[layer] - begin;
+        uint32_t* codes = columns->phase_turns + first + begin;
+        int32_t* amplitude = columns->stored_amplitude + first + begin;
+        int32_t* phase = columns->stored_phase + first + begin;
+        uint32_t amplitude_code = 0;
+        
+        if (frame->flags & FTAE_FRAME_COLUMNAR) {
+            for (uint32_t i = 0; i < count; i++) {
+                codes[i] = read_frequency_code(&in);
+            }
+            for (uint32_t i = 0; i < count; i++) {
+                amplitude_code = read_amplitude_code(&in, amplitude_code, i);
+                amplitude[i] = amplitude_table[amplitude_code];
+            }
+            for (uint32_t i = 0; i < count; i++) {
+                phase[i] = (int32_t)read_phase(&in);
+            }
+        } else {
+            for (uint32_t i = 0; i < count; i++) {
+                codes[i] = read_frequency_code(&in);
+                amplitude_code = read_amplitude_code(&in, amplitude_code, i);
+                amplitude[i] = amplitude_table[amplitude_code];
+                phase[i] = (int32_t)read_phase(&in);
+            }
+        }
+        
+        // Rebuild absolute frequencies from the layer's first value and the deltas
+        int64_t value = 0;
+        for (uint32_t i = 0; i < count; i++) {
+            if (i == 0) {
+                value = (codes[0] & 1) ? -(int64_t)(codes[0] >> 1) - 1 : (int64_t)(codes[0] >> 1);
+            } else {
+                value += codes[i];
+            }
+            if (value > INT32_MAX || value < INT32_MIN) return 0;
+            
+            // Same float expression the encoder's analysis used to name the bin
+            columns->frequency[first + begin + i] = use_bins ? (int)((int)value * freq_resolution) : (int)value;
+            columns->start[first + begin + i] = frame->start;
+            columns->length[first + begin + i] = frame->length;
+        }
+        begin = end[layer];
+    }
+    
+    // Within the last layer decoded only the strongest make the budget; its
+    // energy markers bracket their share of the frame
+    double share = 1.0;
+    if (layer > 0) {
+        uint32_t layer_begin = layer > 1 ? end[layer - 2] : 0;
+        double below = layer > 1 ? marker[layer - 2] : 0.0;
+        double above = marker[layer - 1];
+        double fraction = 1.0;
+        if (keep < begin) {
+            fraction = keep_strongest(columns, first + layer_begin, begin - layer_begin, keep - layer_begin);
+        }
+        share = (below + (above - below) * fraction) / FTAE_LAYER_MARKER_MAX;
+    }
+    *energy = (float)share;
+    
+    return models ? !in.decoder.overrun : !in.reader.overrun;
+}
+
+static double monotonic_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+// v4/v5: take the counts and index location from the trailer. Returns 0 if
+// the trailer is missing or damaged, e.g. because the encoder was interrupted.
+static int read_frame_trailer(FILE* file, uint64_t file_size, const FTAEHeader* header, FTAELayout* layout) {
+    uint64_t frames_start = sizeof(FTAEHeader) + (uint64_t)header->model_size;
+    
+    if (header->version == FTAE_VERSION_SAMPLED) {
+        FTAESampledTrailer trailer;
+        if (file_size < frames_start + sizeof(FTAESampledTrailer) ||
+            fseek(file, (long)(file_size - sizeof(FTAESampledTrailer)), SEEK_SET) != 0 ||
+            fread(&trailer, sizeof(FTAESampledTrailer), 1, file) != 1 ||
+            memcmp(trailer.magic, "FTAX", 4) != 0 ||
+            crc32c(0, &trailer, offsetof(FTAESampledTrailer, crc)) != trailer.crc ||
+            trailer.index_offset < frames_start || trailer.index_offset > file_size ||
+            trailer.index_offset + (uint64_t)trailer.frame_count * sizeof(FTAESampledIndexEntry) +
+                sizeof(FTAESampledTrailer) != file_size) {
+            return 0;
+        }
+        layout->sample_count = trailer.sample_count;
+        layout->wave_count = trailer.wave_count;
+        layout->index_offset = trailer.index_offset;
+        layout->frame_count = trailer.frame_count;
+        layout->index_crc = trailer.index_crc;
+        layout->max_length = trailer.max_duration;
+        return 1;
+    }
+    
+    FTAETrailer trailer;
+    if (file_size < frames_start + sizeof(FTAETrailer) ||
+        fseek(file, (long)(file_size - sizeof(FTAETrailer)), SEEK_SET) != 0 ||
+        fread(&trailer, sizeof(FTAETrailer), 1, file) != 1 ||
+        memcmp(trailer.magic, "FTAX", 4) != 0 ||
+        crc32c(0, &trailer, offsetof(FTAETrailer, crc)) != trailer.crc ||
+        trailer.index_offset < frames_start ||
+        (uint64_t)trailer.index_offset + (uint64_t)trailer.frame_count * sizeof(FTAEFrameIndexEntry) +
+            sizeof(FTAETrailer) != file_size) {
+        return 0;
+    }
+    int64_t sample_count = legacy_duration(trailer.duration, header->sample_rate);
+    int64_t max_length = legacy_max_length(trailer.max_duration, header->sample_rate);
+    if (sample_count < 0 || max_length < 0) {
+        return 0;
+    }
+    layout->sample_count = (uint64_t)sample_count;
+    layout->wave_count = trailer.wave_count;
+    layout->index_offset = trailer.index_offset;
+    layout->frame_count = trailer.frame_count;
+    layout->index_crc = trailer.index_crc;
+    layout->max_length = (uint32_t)max_length;
+    return 1;
+}
+
+// Read and check the frame index; NULL if it is missing or damaged. Only an
+// index listed in a trailer has a checksum.
+static FrameIndexEntry* read_frame_index(FILE* file, const FTAEHeader* header, const FTAELayout* layout,
+                                         uint64_t file_size) {
+    int sampled = header->version == FTAE_VERSION_SAMPLED;
+    size_t entry_size = sampled ? sizeof(FTAESampledIndexEntry) : sizeof(FTAEFrameIndexEntry);
+    uint32_t frame_count = layout->frame_count;
+    uint64_t index_bytes = (uint64_t)frame_count * entry_size;
+    if (frame_count == 0 || layout->index_offset + index_bytes > file_size) return NULL;
+    
+    FrameIndexEntry* index = malloc((size_t)frame_count * sizeof(FrameIndexEntry));
+    uint8_t* raw = malloc((size_t)index_bytes);
+    if (!index || !raw || fseek(file, (long)layout->index_offset, SEEK_SET) != 0 ||
+        fread(raw, entry_size, frame_count, file) != frame_count ||
+        (layout->have_trailer && crc32c(0, raw, (size_t)index_bytes) != layout->index_crc)) {
+        free(index);
+        free(raw);
+        return NULL;
+    }
+    for (uint32_t i = 0; i < frame_count; i++) {
+        if (sampled) {
+            FTAESampledIndexEntry entry;
+            memcpy(&entry, raw + (size_t)i * entry_size, sizeof(entry));
+            index[i].start = entry.start_sample < (uint64_t)COMPONENT_MAX_START ? (int64_t)entry.start_sample : -1;
+            index[i].offset = entry.offset;
+        } else {
+            FTAEFrameIndexEntry entry;
+            memcpy(&entry, raw + (size_t)i * entry_size, sizeof(entry));
+            index[i].start = legacy_sample(entry.start_time, header->sample_rate);
+            index[i].offset = entry.offset;
+        }
+    }
+    free(raw);
+    return index;
+}
+
+// Parse the frame header at region[offset] of a version-version file. A
+// frame that does not fit in [offset, end) is returned damaged.
+static FrameSlot parse_frame_slot(const uint8_t* region, size_t offset, size_t end, uint32_t version,
+                                  uint32_t sample_rate) {
+    FrameSlot slot;
+    memset(&slot, 0, sizeof(FrameSlot));
+    slot.offset = offset;
+    
+    size_t header_size = version == FTAE_VERSION_SAMPLED ? sizeof(FTAESampledFrameHeader) :
+                         version == FTAE_VERSION_FRAMED ? sizeof(FTAECheckedFrameHeader) : sizeof(FTAEFrameHeader);
+    if (end - offset < header_size) {
+        slot.damaged = 1;
+        return slot;
+    }
+    FrameInfo* info = &slot.header;
+    if (version == FTAE_VERSION_SAMPLED) {
+        FTAESampledFrameHeader sampled;
+        memcpy(&sampled, region + offset, sizeof(FTAESampledFrameHeader));
+        info->start = sampled.start_sample < (uint64_t)COMPONENT_MAX_START ? (int64_t)sampled.start_sample : -1;
+        info->length = sampled.duration;
+        info->fft_size = (long)sampled.duration;
+        info->component_count = sampled.component_count;
+        info->flags = sampled.flags;
+        info->payload_size = sampled.payload_size;
+        slot.crc = sampled.crc;
+    } else {
+        FTAEFrameHeader frame;
+        memcpy(&frame, region + offset, sizeof(FTAEFrameHeader));
+        int64_t length = legacy_sample(frame.duration, sample_rate);
+        info->start = length >= 0 ? legacy_sample(frame.start_time, sample_rate) : -1;
+        info->length = length >= 0 ? (uint32_t)length : 0;
+        info->fft_size = length >= 0 ? lrintf(frame.duration * sample_rate) : 0;
+        info->component_count = frame.component_count;
+        info->flags = frame.flags;
+        info->payload_size = frame.payload_size;
+        if (version == FTAE_VERSION_FRAMED) {
+            memcpy(&slot.crc, region + offset + offsetof(FTAECheckedFrameHeader, crc), sizeof(uint32_t));
+        }
+    }
+    slot.payload = offset + header_size;
+    slot.damaged = info->payload_size > end - slot.payload;
+    return slot;
+}
+
+// The checksum is the last field of the frame header and covers the fields
+// before it and the payload
+static int frame_checksum_matches(const uint8_t* region, const FrameSlot* slot) {
+    uint32_t crc = crc32c(0, region + slot->offset, slot->payload - slot->offset - sizeof(uint32_t));
+    return crc32c(crc, region + slot->payload, slot->header.payload_size) == slot->crc;
+}
+
+// Walk the frames in region[0, size) by their headers. v4+ frames are
+// checksummed, so after damage the walk resumes at the next byte where a
+// frame verifies; v3 frames have no checksum and damage ends the walk.
+static FrameSlot* scan_frames(const uint8_t* region, size_t size, uint32_t version, uint32_t sample_rate,
+                              uint32_t* frame_count, uint64_t* skipped_bytes) {
+    int checked = version >= FTAE_VERSION_FRAMED;
+    uint32_t count = 0;
+    uint32_t capacity = 256;
+    FrameSlot* frames = malloc(capacity * sizeof(FrameSlot));
+    *skipped_bytes = 0;
+    
+    for (size_t pos = 0; frames && pos < size;) {
+        FrameSlot slot = parse_frame_slot(region, pos, size, version, sample_rate);
+        if (!slot.damaged && checked) {
+            slot.damaged = !frame_checksum_matches(region, &slot);
+            slot.verified = 1;
+        }
+        if (slot.damaged) {
+            if (!checked) {
+                free(frames);
+                return NULL;
+            }
+            pos++;
+            (*skipped_bytes)++;
+            continue;
+        }
+        
+        if (count == capacity) {
+            FrameSlot* grown = realloc(frames, capacity * 2 * sizeof(FrameSlot));
+            if (!grown) break;
+            frames = grown;
+            capacity *= 2;
+        }
+        frames[count++] = slot;
+        pos = slot.payload + slot.header.payload_size;
+    }
+    
+    *frame_count = count;
+    return frames;
+}
+
+// End in samples of the last intact frame in [start, end) of the file, for a
+// live stream cut off before its trailer: only the trailer holds its length
+static uint64_t scanned_length(FILE* file, const FTAEHeader* header, uint64_t start, uint64_t end) {
+    size_t size = end > start ? (size_t)(end - start) : 0;
+    uint8_t* region = malloc(size > 0 ? size : 1);
+    if (!region || fseek(file, (long)start, SEEK_SET) != 0 || fread(region, 1, size, file) != size) {
+        free(region);
+        return 0;
+    }
+    
+    uint32_t frame_count = 0;
+    uint64_t skipped_bytes = 0;
+    FrameSlot* frames = scan_frames(region, size, header->version, header->sample_rate, &frame_count, &skipped_bytes);
+    uint64_t length = 0;
+    for (uint32_t f = 0; frames && f < frame_count; f++) {
+        if (frames[f].header.start < 0) continue;
+        uint64_t frame_end = (uint64_t)frames[f].header.start + frames[f].header.length;
+        if (frame_end > length) length = frame_end;
+    }
+    free(frames);
+    free(region);
+    return length;
+}
+
+// Frames [first, last) of the index, each bounded by the next frame's offset
+static FrameSlot* index_frames(const uint8_t* region, const FrameIndexEntry* index,
+                               uint32_t first, uint32_t last, uint64_t region_start,
+                               uint64_t region_end, uint32_t version, uint32_t sample_rate) {
+    FrameSlot* frames = malloc((size_t)(last > first ? last - first : 1) * sizeof(FrameSlot));
+    if (!frames) return NULL;
+    
+    for (uint32_t i = first; i < last; i++) {
+        uint64_t start = index[i].offset;
+        uint64_t end = i + 1 < last ? index[i + 1].offset : region_end;
+        FrameSlot* slot = &frames[i - first];
+        if (start < region_start || end > region_end || end < start) {
+            memset(slot, 0, sizeof(FrameSlot));
+            slot->damaged = 1;
+            continue;
+        }
+        *slot = parse_frame_slot(region, (size_t)(start - region_start), (size_t)(end - region_start),
+                                 version, sample_rate);
+        // The next frame starts where this one's payload must end
+        if (!slot->damaged && slot->payload + slot->header.payload_size != end - region_start) {
+            slot->damaged = 1;
+        }
+    }
+    return frames;
+}
+
+// Components of a frame left to synthesize under the decoding budget
+static uint32_t frame_budget(const UnpackJob* job, uint32_t count) {
+    uint32_t keep = count;
+    if (job->cpu_budget > 0.0f && job->cpu_budget < 1.0f) {
+        keep = (uint32_t)ceil((double)job->cpu_budget * count);
+    }
+    if (job->max_components > 0 && keep > job->max_components) {
+        keep = job->max_components;
+    }
+    return keep;
+}
+
+static void* unpack_frames_thread(void* arg) {
+    UnpackJob* job = arg;
+    
+    for (;;) {
+        pthread_mutex_lock(&job->lock);
+        uint32_t first = job->next;
+        job->next += FTAE_FRAME_BATCH;
+        pthread_mutex_unlock(&job->lock);
+        if (first >= job->frame_count) break;
+        
+        uint32_t last = first + FTAE_FRAME_BATCH < job->frame_count ? first + FTAE_FRAME_BATCH : job->frame_count;
+        for (uint32_t f = first; f < last; f++) {
+            FrameSlot* slot = &job->frames[f];
+            if (slot->damaged || slot->unused) continue;
+            if (job->checked && !slot->verified && !frame_checksum_matches(job->region, slot)) {
+                slot->damaged = 1;
+                continue;
+            }
+            if (slot->repeat) continue;
+            slot->kept = frame_budget(job, slot->header.component_count);
+            slot->damaged = !unpack_frame(&slot->header, job->region + slot->payload, job->sample_rate,
+                                          job->models, job->amplitude_table, slot->kept,
+                                          &job->columns[slot->channel], slot->first, &slot->energy);
+        }
+    }
+    return NULL;
+}
+
+// Close the gaps left by damaged frames, by components over the decoding
+// budget and by those at or above frequency_limit, so one channel's columns
+// hold only the good components to synthesize. Each frame's slots in the
+// result are noted for the back-references. Returns how many components the
+// frequency limit dropped.
+static uint64_t compact_frames(ComponentColumns* columns, FrameSlot* frames, uint32_t frame_count,
+                               uint32_t channel, int32_t frequency_limit) {
+    uint32_t count = 0;
+    uint64_t dropped = 0;
+    for (uint32_t f = 0; f < frame_count; f++) {
+        if (frames[f].damaged || frames[f].unused || frames[f].channel != channel) continue;
+        uint32_t n = frames[f].kept;
+        uint32_t from = frames[f].first;
+        frames[f].column_first = count;
+        if (frequency_limit != INT32_MAX) {
+            for (uint32_t i = from; i < from + n; i++) {
+                if (columns->frequency[i] >= frequency_limit) {
+                    dropped++;
+                    continue;
+                }
+                columns->start[count] = columns->start[i];
+                columns->length[count] = columns->length[i];
+                columns->frequency[count] = columns->frequency[i];
+                columns->stored_amplitude[count] = columns->stored_amplitude[i];
+                columns->stored_phase[count] = columns->stored_phase[i];
+                count++;
+            }
+            frames[f].column_count = count - frames[f].column_first;
+            continue;
+        }
+        if (from != count) {
+            memmove(columns->start + count, columns->start + from, n * sizeof(int64_t));
+            memmove(columns->length + count, columns->length + from, n * sizeof(uint32_t));
+            memmove(columns->frequency + count, columns->frequency + from, n * sizeof(int32_t));
+            memmove(columns->stored_amplitude + count, columns->stored_amplitude + from, n * sizeof(int32_t));
+            memmove(columns->stored_phase + count, columns->stored_phase + from, n * sizeof(int32_t));
+        }
+        frames[f].column_count = n;
+        count += n;
+    }
+    columns->count = count;
+    return dropped;
+}
+
+static int decode_thread_count(const DecodingConfig* config, uint32_t frame_count) {
+    long threads = config && config->threads > 0 ? config->threads : 1;
+#ifdef DFTA_HAVE_MMAP
+    if (!config || config->threads <= 0) {
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+#endif
+    if (config && config->pool) {
+        threads = worker_pool_size(config->pool);
+    }
+    long batches = (long)((frame_count + FTAE_FRAME_BATCH - 1) / FTAE_FRAME_BATCH);
+    if (threads > batches) threads = batches;
+    if (threads > DFTA_MAX_THREADS) threads = DFTA_MAX_THREADS;
+    return threads < 1 ? 1 : (int)threads;
+}
+
+// Take the payload of each back-reference frame; frames[f] is frame base + f
+// of the file, and a back-reference may only name frames before its own
+static void parse_repeat_frames(const uint8_t* region, FrameSlot* frames, uint32_t frame_count, uint32_t base) {
+    for (uint32_t f = 0; f < frame_count; f++) {
+        FrameSlot* slot = &frames[f];
+        if (slot->damaged || !(slot->header.flags & FTAE_FRAME_REPEAT)) continue;
+        slot->repeat = 1;
+        if (slot->header.component_count != 0 || slot->header.payload_size != sizeof(FTAERepeatPayload)) {
+            slot->damaged = 1;
+            continue;
+        }
+        memcpy(&slot->source, region + slot->payload, sizeof(FTAERepeatPayload));
+        if (slot->source.first_frame >= slot->source.end_frame || slot->source.end_frame > base + f ||
+            slot->source.shift <= 0) {
+            slot->damaged = 1;
+        }
+    }
+}
+
+// Earliest frame of the file that a back-reference in frames repeats
+static uint32_t earliest_repeat_source(const FrameSlot* frames, uint32_t frame_count, uint32_t base) {
+    uint32_t earliest = base;
+    for (uint32_t f = 0; f < frame_count; f++) {
+        if (frames[f].repeat && !frames[f].damaged && frames[f].source.first_frame < earliest) {
+            earliest = frames[f].source.first_frame;
+        }
+    }
+    return earliest;
+}
+
+// frames[0, extension) were only read for the back-references after them;
+// leave out all but the frames those repeat
+static void mark_unused_frames(FrameSlot* frames, uint32_t frame_count, uint32_t extension, uint32_t base) {
+    for (uint32_t f = 0; f < extension; f++) {
+        frames[f].unused = 1;
+    }
+    for (uint32_t f = extension; f < frame_count; f++) {
+        const FrameSlot* slot = &frames[f];
+        if (!slot->repeat || slot->damaged || slot->source.first_frame < base) continue;
+        uint32_t channel = slot->header.flags >> FTAE_FRAME_CHANNEL_SHIFT;
+        for (uint32_t g = slot->source.first_frame - base; g < slot->source.end_frame - base && g < extension; g++) {
+            if ((frames[g].header.flags >> FTAE_FRAME_CHANNEL_SHIFT) == channel) {
+                frames[g].unused = 0;
+            }
+        }
+    }
+}
+
+// Attach each back-reference to its channel's columns as the range of its
+// group's components, once compaction has placed them. One whose group was
+// not read or does not line up with it is dropped and counted.
+static int collect_repeats(ChannelComponents* components, const FrameSlot* frames, uint32_t frame_count,
+                           uint32_t base, uint32_t* dropped) {
+    for (uint32_t f = 0; f < frame_count; f++) {
+        const FrameSlot* slot = &frames[f];
+        if (!slot->repeat || slot->damaged || slot->unused) continue;
+        const FTAERepeatPayload* source = &slot->source;
+        int valid = source->first_frame >= base && source->end_frame - base <= f;
+        
+        // Without an index frames are numbered as found, so the group's first
+        // frame has to start where the copy says it did
+        if (valid && !frames[source->first_frame - base].damaged) {
+            const FrameSlot* first = &frames[source->first_frame - base];
+            valid = (first->header.flags >> FTAE_FRAME_CHANNEL_SHIFT) == slot->channel && !first->repeat &&
+                    first->header.start >= 0 && slot->header.start == first->header.start + source->shift;
+        }
+        
+        uint32_t column_first = UINT32_MAX;
+        uint32_t column_end = 0;
+        for (uint32_t g = source->first_frame - base; valid && g < source->end_frame - base; g++) {
+            const FrameSlot* member = &frames[g];
+            if (member->damaged || member->unused || member->channel != slot->channel) continue;
+            if (member->repeat) {
+                valid = 0;
+            } else if (member->column_count > 0) {
+                if (column_first == UINT32_MAX) column_first = member->column_first;
+                column_end = member->column_first + member->column_count;
+            }
+        }
+        if (!valid) {
+            (*dropped)++;
+            continue;
+        }
+        if (column_first == UINT32_MAX) continue;  // Nothing of the group is left to repeat
+        
+        if (add_component_repeat(&components->channels[slot->channel], column_first, column_end - column_first,
+                                 source->shift) != DFTA_SUCCESS) {
+            return DFTA_ERROR_MEMORY;
+        }
+    }
+    return DFTA_SUCCESS;
+}
+
+// Read bytes [start, end) of the file
+static int read_frame_region(FILE* file, uint64_t start, uint64_t end, uint8_t** region) {
+    size_t size = (size_t)(end - start);
+    *region = malloc(size > 0 ? size : 1);
+    if (!*region) {
+        return DFTA_ERROR_MEMORY;
+    }
+    if (fseek(file, (long)start, SEEK_SET) != 0 || fread(*region, 1, size, file) != size) {
+        fprintf(stderr, "Error: Failed to read FTAE frames\n");
+        free(*region);
+        *region = NULL;
+        return DFTA_ERROR_FILE_READ;
+    }
+    return DFTA_SUCCESS;
+}
+
+// v3+: read the frames overlapping samples [range_start, range_end) of the
+// file in one call and unpack them on worker threads straight into each
+// channel's columns. Damaged v4+ frames are skipped.
+static int load_packed_frames(FILE* file, const FTAEHeader* header, const FTAELayout* layout,
+                              uint64_t file_size, int64_t range_start, int64_t range_end,
+                              int partial, const DecodingConfig* config, ChannelComponents* components) {
+    int checked = header->version >= FTAE_VERSION_FRAMED;
+    uint32_t version = header->version;
+    uint32_t sample_rate = header->sample_rate;
+    uint64_t frames_start = sizeof(FTAEHeader) + (uint64_t)header->model_size;
+    if (layout->index_offset < frames_start) {
+        fprintf(stderr, "Error: Invalid FTAE frame index offset %llu\n", (unsigned long long)layout->index_offset);
+        return DFTA_ERROR_FORMAT;
+    }
+    if (layout->index_offset > file_size) {
+        fprintf(stderr, "Error: FTAE file is truncated (frames end at byte %llu, file has %llu)\n",
+                (unsigned long long)layout->index_offset, (unsigned long long)file_size);
+        return DFTA_ERROR_FILE_READ;
+    }
+    
+    // Range coded files carry their models between the header and the first frame
+    FTAEModels* models = NULL;
+    if (header->flags & FTAE_FLAG_RANGE_CODED) {
+        models = malloc(sizeof(FTAEModels));
+        uint8_t* model_data = malloc(header->model_size > 0 ? header->model_size : 1);
+        if (!models || !model_data) {
+            free(models);
+            free(model_data);
+            return DFTA_ERROR_MEMORY;
+        }
+        int valid = fseek(file, (long)sizeof(FTAEHeader), SEEK_SET) == 0 &&
+                    fread(model_data, 1, header->model_size, file) == header->model_size &&
+                    read_models(model_data, header->model_size, models);
+        free(model_data);
+        if (!valid) {
+            fprintf(stderr, "Error: FTAE entropy models are corrupt\n");
+            free(models);
+            return DFTA_ERROR_FORMAT;
+        }
+    }
+    
+    // Use the frame index to pick the byte region and, for v4+, to locate
+    // each frame; without it, walk every frame
+    uint64_t region_start = frames_start;
+    uint64_t region_end = layout->index_offset;
+    uint32_t index_first = 0;
+    uint32_t index_last = 0;
+    FrameIndexEntry* index = NULL;
+    
+    if (partial || layout->have_trailer) {
+        index = read_frame_index(file, header, layout, file_size);
+        if (index) {
+            uint32_t frame_count = layout->frame_count;
+            index_last = frame_count;
+            if (partial) {
+                // Frames starting up to the longest component earlier still sound inside the range
+                index_first = frame_index_lower_bound(index, frame_count, range_start - (int64_t)layout->max_length);
+                index_last = frame_index_lower_bound(index, frame_count, range_end);
+                if (index_last < index_first) index_last = index_first;
+            }
+            if (index_first < frame_count) region_start = index[index_first].offset;
+            region_end = index_last < frame_count ? index[index_last].offset : layout->index_offset;
+            if (region_start < frames_start || region_end > layout->index_offset || region_end < region_start) {
+                fprintf(stderr, "Warning: FTAE frame index is inconsistent, unpacking all frames\n");
+                region_start = frames_start;
+                region_end = layout->index_offset;
+                free(index);
+                index = NULL;
+            }
+        } else {
+            fprintf(stderr, "Warning: FTAE frame index missing or damaged, unpacking all frames\n");
+        }
+    }
+    if (index && !checked) {
+        // v3 frames are still walked by their headers within the region
+        free(index);
+        index = NULL;
+    }
+    
+    // Locate the frames; without an index they are numbered as found
+    uint8_t* region = NULL;
+    uint32_t frame_count = 0;
+    uint64_t skipped_bytes = 0;
+    FrameSlot* frames = NULL;
+    int result = read_frame_region(file, region_start, region_end, &region);
+    if (result == DFTA_SUCCESS) {
+        if (index) {
+            frame_count = index_last - index_first;
+            frames = index_frames(region, index, index_first, index_last, region_start, region_end,
+                                  version, sample_rate);
+        } else {
+            frames = scan_frames(region, (size_t)(region_end - region_start), version, sample_rate,
+                                 &frame_count, &skipped_bytes);
+        }
+        if (frames) parse_repeat_frames(region, frames, frame_count, index_first);
+    }
+    
+    // A back-reference in the range may repeat frames from before it; read
+    // again from the earliest of those
+    uint32_t earliest = index && frames ? earliest_repeat_source(frames, frame_count, index_first) : index_first;
+    if (result == DFTA_SUCCESS && earliest < index_first && index[earliest].offset >= frames_start &&
+        index[earliest].offset <= region_start) {
+        uint32_t extension = index_first - earliest;
+        free(frames);
+        free(region);
+        frames = NULL;
+        index_first = earliest;
+        region_start = index[earliest].offset;
+        frame_count = index_last - index_first;
+        result = read_frame_region(file, region_start, region_end, &region);
+        if (result == DFTA_SUCCESS) {
+            frames = index_frames(region, index, index_first, index_last, region_start, region_end,
+                                  version, sample_rate);
+        }
+        if (frames) {
+            parse_repeat_frames(region, frames, frame_count, index_first);
+            mark_unused_frames(frames, frame_count, extension, index_first);
+        }
+    }
+    free(index);
+    if (result != DFTA_SUCCESS) {
+        free(models);
+        return result;
+    }
+    size_t region_size = (size_t)(region_end - region_start);
+    
+    // Frames name their channel in the upper flag bits; one naming a channel
+    // the file does not have is damaged. Each frame gets its slots in the
+    // columns.
+    uint64_t channel_components[DFTA_MAX_CHANNELS] = {0};
+    uint64_t total_components = 0;
+    for (uint32_t f = 0; frames && f < frame_count; f++) {
+        uint32_t channel = frames[f].header.flags >> FTAE_FRAME_CHANNEL_SHIFT;
+        if (channel >= components->channel_count) {
+            frames[f].damaged = 1;
+        }
+        if (frames[f].damaged) continue;
+        frames[f].channel = channel;
+        if (frames[f].unused) continue;
+        frames[f].first = (uint32_t)channel_components[channel];
+        channel_components[channel] += frames[f].header.component_count;
+        total_components += frames[f].header.component_count;
+    }
+    if (!frames || (!checked && total_components > layout->wave_count) || total_components > UINT32_MAX) {
+        fprintf(stderr, "Error: FTAE frame data is corrupt\n");
+        free(frames);
+        free(region);
+        free(models);
+        return DFTA_ERROR_FORMAT;
+    }
+    
+    for (uint32_t c = 0; c < components->channel_count; c++) {
+        if (alloc_component_columns(&components->channels[c], (uint32_t)channel_components[c]) != DFTA_SUCCESS) {
+            free(frames);
+            free(region);
+            free(models);
+            return DFTA_ERROR_MEMORY;
+        }
+    }
+    
+    int amplitude_table[1 << FTAE_AMPLITUDE_BITS];
+    for (int code = 0; code < (1 << FTAE_AMPLITUDE_BITS); code++) {
+        double amplitude = floor(pow(2.0, (double)code / FTAE_AMPLITUDE_STEPS) + 0.5);
+        amplitude_table[code] = amplitude > INT32_MAX ? INT32_MAX : (int)amplitude;
+    }
+    
+    // Frames are independent, so batches of them are unpacked in parallel;
+    // every task pulls batches from the same job
+    UnpackJob job;
+    job.region = region;
+    job.frames = frames;
+    job.frame_count = frame_count;
+    job.checked = checked;
+    job.sample_rate = sample_rate;
+    job.models = models;
+    job.amplitude_table = amplitude_table;
+    job.max_components = config ? config->max_components_per_frame : 0;
+    job.cpu_budget = config ? config->cpu_budget : 0.0f;
+    job.columns = components->channels;
+    job.next = 0;
+    pthread_mutex_init(&job.lock, NULL);
+    crc32c_init();
+    
+    double unpack_start = monotonic_seconds();
+    int thread_count = decode_thread_count(config, frame_count);
+    worker_pool_run(config ? config->pool : NULL, unpack_frames_thread, &job, 0, thread_count);
+    pthread_mutex_destroy(&job.lock);
+    double unpack_seconds = monotonic_seconds() - unpack_start;
+    
+    uint32_t damaged_frames = 0;
+    uint32_t coded_frames = 0;
+    uint32_t repeat_frames = 0;
+    uint64_t lost_components = 0;
+    uint64_t good_components = 0;
+    uint64_t kept_components = 0;
+    double kept_energy = 0.0;
+    for (uint32_t f = 0; f < frame_count; f++) {
+        if (frames[f].unused) continue;
+        if (!frames[f].damaged && frames[f].repeat) {
+            repeat_frames++;
+            continue;
+        }
+        if (!frames[f].damaged) {
+            coded_frames++;
+            good_components += frames[f].header.component_count;
+            kept_components += frames[f].kept;
+            kept_energy += frames[f].energy;
+            continue;
+        }
+        if (damaged_frames < FTAE_DAMAGE_REPORT_MAX) {
+            fprintf(stderr, "Warning: FTAE frame at byte %llu is damaged, skipping it\n",
+                    (unsigned long long)(region_start + frames[f].offset));
+        }
+        damaged_frames++;
+        lost_components += frames[f].header.component_count;
+    }
+    int32_t frequency_limit = output_frequency_limit(config, sample_rate);
+    uint64_t dropped_components = 0;
+    for (uint32_t c = 0; c < components->channel_count; c++) {
+        dropped_components += compact_frames(&components->channels[c], frames, frame_count, c, frequency_limit);
+    }
+    uint32_t dropped_repeats = 0;
+    result = collect_repeats(components, frames, frame_count, index_first, &dropped_repeats);
+    free(frames);
+    free(region);
+    free(models);
+    if (result != DFTA_SUCCESS) {
+        return result;
+    }
+    
+    if (damaged_frames > 0) {
+        fprintf(stderr, "Warning: skipped %u damaged frames (about %llu components)\n",
+                damaged_frames, (unsigned long long)lost_components);
+    }
+    if (skipped_bytes > 0) {
+        fprintf(stderr, "Warning: skipped %llu bytes that are not part of an intact frame\n",
+                (unsigned long long)skipped_bytes);
+    }
+    if (kept_components < good_components) {
+        dfta_progress("Decoding budget: synthesizing the strongest %llu of %llu components "
+                      "(%.1f%% of the energy per frame on average)\n",
+                      (unsigned long long)kept_components, (unsigned long long)good_components,
+                      100.0 * kept_energy / coded_frames);
+    }
+    if (frequency_limit != INT32_MAX) {
+        report_frequency_limit(config, sample_rate, dropped_components);
+    }
+    if (dropped_repeats > 0) {
+        fprintf(stderr, "Warning: skipped %u back-references whose frames are missing\n", dropped_repeats);
+    }
+    if (repeat_frames > 0) {
+        dfta_progress("Back-references: %u repeated frame groups\n",
+                      repeat_frames - dropped_repeats);
+    }
+    
+    double dequantize_start = monotonic_seconds();
+    for (uint32_t c = 0; c < components->channel_count; c++) {
+        dequantize_component_columns(&components->channels[c]);
+    }
+    double dequantize_seconds = monotonic_seconds() - dequantize_start;
+    
+    uint32_t count = channel_component_count(components);
+    dfta_progress("Unpacked %u %sframes on %d thread%s (%zu bytes read for %u components) in %.2f ms",
+                  coded_frames, (header->flags & FTAE_FLAG_RANGE_CODED) ? "range coded " : "",
+                  thread_count, thread_count > 1 ? "s" : "", region_size, count, unpack_seconds * 1000.0);
+    if (unpack_seconds > 0.0) {
+        dfta_progress(", %.1f M components/s", count / unpack_seconds / 1e6);
+    }
+    dfta_progress("; dequantized in %.2f ms\n", dequantize_seconds * 1000.0);
+    return DFTA_SUCCESS;
+}
+
+// Setup audio info for reconstructing samples [range_start, range_end) of
+// the file, stretched by the time scale and rendered at the output rate
+static int finish_audio_info(const FTAEHeader* header, const FTAELayout* layout, int64_t range_start,
+                             int64_t range_end, ChannelComponents* components, AudioData* audio_info,
+                             const DecodingConfig* config) {
+    uint32_t file_rate = header->sample_rate;
+    uint32_t count = channel_component_count(components);
+    if (range_start > 0 || (uint64_t)range_end < layout->sample_count) {
+        dfta_progress("Range %.2f-%.2f s: loaded %u of %llu components\n",
+                      (double)range_start / file_rate, (double)range_end / file_rate, count,
+                      (unsigned long long)layout->wave_count);
+    }
+    
+    // Components are positions and frequencies, so any rate can be rendered
+    // directly. Time-stretch and pitch-shift act on the components themselves,
+    // so no separate pass over the rendered samples is needed.
+    float time_scale = decoding_time_scale(config);
+    float pitch_scale = decoding_pitch_scale(config);
+    uint32_t sample_rate = config && config->output_rate > 0 ? config->output_rate : file_rate;
+    for (uint32_t c = 0; c < components->channel_count; c++) {
+        scale_component_columns(&components->channels[c], file_rate, sample_rate, time_scale, pitch_scale);
+    }
+    if (time_scale != 1.0f || pitch_scale != 1.0f) {
+        dfta_progress("Scaled %u components: time x%.3f, pitch x%.3f\n", count, time_scale, pitch_scale);
+    }
+    
+    // The range is given on the output timeline in seconds
+    uint64_t total = (uint64_t)scale_sample_position((int64_t)layout->sample_count, file_rate, sample_rate, time_scale);
+    uint64_t start_offset = config ? (uint64_t)((double)config->start_time * sample_rate) : 0;
+    uint64_t end_offset = total;
+    if (config && config->end_time > 0.0f && (double)config->end_time * sample_rate < (double)total) {
+        end_offset = (uint64_t)((double)config->end_time * sample_rate);
+    }
+    if (start_offset >= end_offset) {
+        fprintf(stderr, "Error: Requested range is outside the file duration (%.2f s)\n",
+                (double)total / sample_rate);
+        free_channel_components(components);
+        return DFTA_ERROR_FORMAT;
+    }
+    audio_info->sample_rate = sample_rate;
+    audio_info->start_offset = start_offset;
+    audio_info->sample_count = end_offset - start_offset;
+    audio_info->channels = (uint16_t)components->channel_count;
+    audio_info->sample_format = config ? config->sample_format : SAMPLE_FORMAT_S16;
+    audio_info->bits_per_sample = (uint16_t)(8 * sample_format_bytes(audio_info->sample_format));
+    
+    // Allocate memory for samples (streaming renders into its own small blocks,
+    // too short to copy repeats between, so those become components again)
+    if (config && config->stream_output) {
+        for (uint32_t c = 0; c < components->channel_count; c++) {
+            if (expand_component_repeats(&components->channels[c]) != DFTA_SUCCESS) {
+                free_channel_components(components);
+                return DFTA_ERROR_MEMORY;
+            }
+        }
+        count = channel_component_count(components);
+        dfta_progress("Successfully loaded %u frequency components\n", count);
+        return DFTA_SUCCESS;
+    }
+    
+    // Rendering in memory indexes the samples with int
+    if (audio_info->sample_count > INT32_MAX) {
+        fprintf(stderr, "Error: %llu samples at %u Hz are too many to render in memory, use --stream\n",
+                (unsigned long long)audio_info->sample_count, sample_rate);
+        free_channel_components(components);
+        return DFTA_ERROR_FORMAT;
+    }
+    audio_info->samples = calloc((size_t)audio_info->sample_count * audio_info->channels, sizeof(float));
+    if (!audio_info->samples) {
+        free_channel_components(components);
+        return DFTA_ERROR_MEMORY;
+    }
+    
+    dfta_progress("Successfully loaded %u frequency components\n", count);
+    return DFTA_SUCCESS;
+}
+
+// Read an FTAE image from an open, seekable stream: a file, or a memory
+// buffer opened with fmemopen (libdfta). The stream stays open.
+int read_ftae_stream(FILE* file, ChannelComponents* components, AudioData* audio_info, const DecodingConfig* config) {
+    if (!file || !components || !audio_info) {
         return DFTA_ERROR_FILE_READ;
     }
+    memset(components, 0, sizeof(ChannelComponents));
     
     // Read FTAE header
     FTAEHeader header;
     if (fread(&header, sizeof(FTAEHeader), 1, file) != 1) {
-        fprintf(stderr, "Error: Failed to read FTAE header\n");
-        fclose(file);
+        fprintf(stderr, "Error: Failed to read FTAE header (file too short)\n");
         return DFTA_ERROR_FILE_READ;
     }
     
     // Validate FTAE format
     if (strncmp(header.magic, "FTAE", 4) != 0) {
         fprintf(stderr, "Error: Invalid FTAE file format (not an FTAE file)\n");
-        fclose(file);
         return DFTA_ERROR_FORMAT;
     }
     
-    if (header.version != 1) {
-        fprintf(stderr, "Error: Unsupported FTAE version %u (expected version 1)\n", header.version);
-        fclose(file);
+    if (header.version < FTAE_VERSION_RAW || header.version > FTAE_VERSION_SAMPLED) {
+        fprintf(stderr, "Error: Unsupported FTAE version %u (expected version 1 to 5)\n", header.version);
+        return DFTA_ERROR_FORMAT;
+    }
+    if (header.sample_rate == 0) {
+        fprintf(stderr, "Error: Invalid FTAE header (sample rate 0 Hz)\n");
         return DFTA_ERROR_FORMAT;
     }
     
-    printf("\nFTAE File Information:\n");
-    printf("  Format Version: %u\n", header.version);
-    printf("  Sample Rate: %u Hz\n", header.sample_rate);
-    printf("  Duration: %.2f seconds\n", header.duration);
-    printf("  Frequency Components: %u\n", header.wave_count);
-    printf("  Compression Level: %u\n", header.compression_level);
-    printf("  Amplitude Threshold: %.4f\n", header.amplitude_threshold);
+    if (fseek(file, 0, SEEK_END) != 0) {
+        fprintf(stderr, "Error: Cannot determine FTAE file size\n");
+        return DFTA_ERROR_FILE_READ;
+    }
+    uint64_t file_size = (uint64_t)ftell(file);
     
-    // Create SineWave queue
-    *queue = create_sinewave_queue();
-    if (!*queue) {
-        fclose(file);
-        return DFTA_ERROR_MEMORY;
+    // Up to v3 the header holds the counts and times; v4+ keep them in the
+    // trailer. Without it (an interrupted encode) the frames are recovered
+    // by scanning up to the end of the file.
+    int64_t sample_count = legacy_duration(header.duration, header.sample_rate);
+    int64_t max_length = legacy_max_length(header.max_duration, header.sample_rate);
+    if (sample_count < 0 || max_length < 0) {
+        fprintf(stderr, "Error: Invalid FTAE header (duration %g s, longest component %g s)\n",
+                header.duration, header.max_duration);
+        return DFTA_ERROR_FORMAT;
+    }
+    FTAELayout layout;
+    memset(&layout, 0, sizeof(FTAELayout));
+    layout.sample_count = (uint64_t)sample_count;
+    layout.wave_count = header.wave_count;
+    layout.index_offset = header.index_offset;
+    layout.frame_count = header.seek_entry_count;
+    layout.max_length = (uint32_t)max_length;
+    int framed = header.version >= FTAE_VERSION_FRAMED;
+    if (framed) {
+        layout.have_trailer = read_frame_trailer(file, file_size, &header, &layout);
+        if (!layout.have_trailer) {
+            fprintf(stderr, "Warning: FTAE trailer missing or damaged, scanning frames\n");
+            layout.index_offset = file_size;
+            layout.frame_count = 0;
+            // A v5 header's duration is only a float (and 0 when streamed live)
+            if (header.duration == 0.0f || header.version == FTAE_VERSION_SAMPLED) {
+                layout.sample_count = scanned_length(file, &header, sizeof(FTAEHeader) + (uint64_t)header.model_size,
+                                                     layout.index_offset);
+            }
+        }
     }
+    int packed = header.version >= FTAE_VERSION_PACKED;
     
-    // Read SineWave data
-    printf("Loading frequency components...\n");
-    for (uint32_t i = 0; i < header.wave_count; i++) {
-        SineWave wave;
-        if (fread(&wave, sizeof(SineWave), 1, file) != 1) {
-            fprintf(stderr, "Error: Failed to read SineWave data at index %u\n", i);
-            fclose(file);
-            free_sinewave_queue(*queue);
-            *queue = NULL;
-            return DFTA_ERROR_FILE_READ;
+    // Only v4+ frames carry a channel; everything older is mono
+    components->channel_count = 1;
+    if (framed) {
+        if (header.channels > DFTA_MAX_CHANNELS) {
+            fprintf(stderr, "Error: FTAE file has %u channels (at most %d are supported)\n",
+                    header.channels, DFTA_MAX_CHANNELS);
+            return DFTA_ERROR_FORMAT;
         }
-        
-        enqueue_sinewave(*queue, &wave);
-        
-        // Progress indicator
-        if ((i + 1) % 1000 == 0) {
-            printf("  Loaded %u/%u components\n", i + 1, header.wave_count);
+        if (header.channels > 0) {
+            components->channel_count = header.channels;
         }
+        components->mid_side_pairs = header.mid_side_pairs & ((1u << (components->channel_count / 2)) - 1);
     }
     
-    fclose(file);
+    double duration = (double)layout.sample_count / header.sample_rate;
+    if (layout.sample_count == 0 || layout.sample_count >= (uint64_t)COMPONENT_MAX_START) {
+        fprintf(stderr, "Error: Invalid FTAE header (sample rate %u Hz, duration %.2f s)\n",
+                header.sample_rate, duration);
+        return DFTA_ERROR_FORMAT;
+    }
     
-    // Setup audio info for reconstruction
-    audio_info->sample_rate = header.sample_rate;
-    audio_info->sample_count = (uint32_t)(header.duration * header.sample_rate);
-    audio_info->channels = 1;  // FTAE format stores mono
-    audio_info->bits_per_sample = 16;
+    // Validate the payload sizes against the actual file size
+    uint64_t records_end = sizeof(FTAEHeader) + (uint64_t)header.wave_count * sizeof(SineWave);
+    if (!packed && file_size < records_end) {
+        fprintf(stderr, "Error: FTAE file is truncated (%llu of %u components present)\n",
+                (unsigned long long)((file_size - sizeof(FTAEHeader)) / sizeof(SineWave)),
+                header.wave_count);
+        return DFTA_ERROR_FILE_READ;
+    }
+    if (header.version == FTAE_VERSION_SEEKABLE &&
+        (header.seek_interval <= 0.0f ||
+         file_size < records_end + (uint64_t)header.seek_entry_count * sizeof(FTAESeekEntry))) {
+        fprintf(stderr, "Warning: FTAE seek table missing or truncated, scanning all components\n");
+        header.seek_entry_count = 0;
+    }
     
-    // Allocate memory for samples
-    audio_info->samples = calloc(audio_info->sample_count, sizeof(float));
-    if (!audio_info->samples) {
-        free_sinewave_queue(*queue);
-        *queue = NULL;
-        return DFTA_ERROR_MEMORY;
+    // Resolve the requested time range against the file's samples. The range
+    // is given on the output timeline, which the time scale stretches.
+    float time_scale = decoding_time_scale(config);
+    double start_seconds = config ? (double)config->start_time / time_scale : 0.0;
+    double end_seconds = config && config->end_time > 0.0f ? (double)config->end_time / time_scale : duration;
+    int64_t range_start = (int64_t)floor(start_seconds * header.sample_rate);
+    int64_t range_end = end_seconds < duration ? (int64_t)ceil(end_seconds * header.sample_rate)
+                                               : (int64_t)layout.sample_count;
+    if (range_end > (int64_t)layout.sample_count) range_end = (int64_t)layout.sample_count;
+    
+    if (start_seconds >= duration || range_start >= range_end) {
+        fprintf(stderr, "Error: Requested range %.2f-%.2f s is outside the file duration (%.2f s)\n",
+                start_seconds * time_scale, end_seconds * time_scale, duration * time_scale);
+        return DFTA_ERROR_FORMAT;
     }
     
-    printf("Successfully loaded %u frequency components\n", header.wave_count);
-    return DFTA_SUCCESS;
+    dfta_progress("\nFTAE File Information:\n");
+    dfta_progress("  Format Version: %u\n", header.version);
+    dfta_progress("  Sample Rate: %u Hz\n", header.sample_rate);
+    if (config && config->output_rate > 0 && config->output_rate != header.sample_rate) {
+        dfta_progress("  Output Rate: %u Hz\n", config->output_rate);
+    }
+    if (components->channel_count > 1) {
+        dfta_progress("  Channels: %u%s\n", components->channel_count,
+                      components->mid_side_pairs ? " (mid/side coded pairs)" : "");
+    }
+    dfta_progress("  Duration: %.2f seconds\n", duration);
+    if (framed && !layout.have_trailer) {
+        dfta_progress("  Frequency Components: unknown (no trailer)\n");
+    } else {
+        dfta_progress("  Frequency Components: %llu\n", (unsigned long long)layout.wave_count);
+    }
+    dfta_progress("  Compression Level: %u\n", header.compression_level);
+    dfta_progress("  Amplitude Threshold: %.4f\n", header.amplitude_threshold);
+    if (packed && (header.version == FTAE_VERSION_PACKED || layout.have_trailer)) {
+        dfta_progress("  Packed Frames: %u%s\n", layout.frame_count, framed ? " (CRC32C checked)" : "");
+    }
+    
+    // Narrow the record region to the requested range using the seek table.
+    // Components starting up to max_duration earlier still sound inside the range.
+    int partial = range_start > 0 || range_end < (int64_t)layout.sample_count;
+    int result;
+    if (packed) {
+        dfta_progress("Unpacking frequency components...\n");
+        result = load_packed_frames(file, &header, &layout, file_size, range_start, range_end,
+                                    partial, config, components);
+        if (result != DFTA_SUCCESS) {
+            free_channel_components(components);
+            return result;
+        }
+        return finish_audio_info(&header, &layout, range_start, range_end, components, audio_info, config);
+    }
+    
+    uint32_t first_record = 0;
+    uint32_t last_record = header.wave_count;
+    if (partial && header.seek_entry_count > 0) {
+        float lookback = (float)start_seconds - header.max_duration;
+        if (lookback > 0.0f) {
+            first_record = seek_table_lookup(file, &header, (uint32_t)(lookback / header.seek_interval), 0);
+        }
+        last_record = seek_table_lookup(file, &header, (uint32_t)ceil((double)range_end / header.sample_rate /
+                                                                      header.seek_interval), header.wave_count);
+        if (last_record < first_record) last_record = first_record;
+    } else if (partial) {
+        dfta_progress("Note: No seek table, loading all components for the range\n");
+    }
+    
+    if (config && (config->max_components_per_frame > 0 ||
+                   (config->cpu_budget > 0.0f && config->cpu_budget < 1.0f))) {
+        fprintf(stderr, "Warning: v%u files have no frames, decoding every component\n", header.version);
+    }
+    
+    // Load the component region in one mapping or one read and split it into columns
+    dfta_progress("Loading frequency components...\n");
+    int32_t frequency_limit = output_frequency_limit(config, header.sample_rate);
+    uint64_t dropped_components = 0;
+    result = load_record_region(file, first_record, last_record, header.sample_rate, frequency_limit,
+                                &components->channels[0], &dropped_components);
+    if (result != DFTA_SUCCESS) {
+        free_channel_components(components);
+        return result;
+    }
+    if (frequency_limit != INT32_MAX) {
+        report_frequency_limit(config, header.sample_rate, dropped_components);
+    }
+    
+    return finish_audio_info(&header, &layout, range_start, range_end, components, audio_info, config);
+}
+
+int read_ftae_file(const char* filename, ChannelComponents* components, AudioData* audio_info, const DecodingConfig* config) {
+    if (!filename) {
+        return DFTA_ERROR_FILE_READ;
+    }
+    
+    FILE* file = fopen(filename, "rb");
+    if (!file) {
+        fprintf(stderr, "Error: Cannot open FTAE file '%s'\n", filename);
+        return DFTA_ERROR_FILE_READ;
+    }
+    
+    int result = read_ftae_stream(file, components, audio_info, config);
+    fclose(file);
+    return result;
 }
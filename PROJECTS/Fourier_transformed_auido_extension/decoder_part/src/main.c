@@ -1,17 +1,60 @@
 
+// dup/fdopen need POSIX declarations under -std=c99
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <getopt.h>
+#include <unistd.h>
 #include "dfta.h"
 
 void print_usage(const char* program_name) {
     printf("Dynamic Fourier Transform Audio Decoder (D-FTA)\n");
-    printf("Usage: %s input.ftae output.wav\n\n", program_name);
+    printf("Usage: %s input.ftae output.wav [OPTIONS]\n", program_name);
+    printf("       %s input.ftae - [OPTIONS]       (stream to stdout)\n\n", program_name);
     printf("Description:\n");
     printf("  Converts compressed FTAE files back to WAV audio format\n\n");
+    printf("Options:\n");
+    printf("  --start SECONDS              Start of the range to decode (default: 0)\n");
+    printf("  --end SECONDS                End of the range to decode (default: end of file)\n");
+    printf("  --synthesis MODE             Oscillator: accurate, fast, fast-nointerp (default: accurate)\n");
+    printf("  --dither                     Apply TPDF dither when converting to integer PCM\n");
+    printf("  --sample-format FORMAT       Output samples: s16, s24, s32, f32 (default: s16)\n");
+    printf("  --output-rate HZ             Synthesize at this sample rate (default: the file's rate)\n");
+    printf("  --time-scale FACTOR          Stretch the duration, 0.25-4 (0.5 plays twice as fast)\n");
+    printf("  --pitch-scale FACTOR         Multiply every frequency, 0.25-4 (2 is an octave up)\n");
+    printf("  --stream                     Decode block by block through a ring buffer (implied by '-')\n");
+    printf("  --raw                        Stream headerless PCM instead of WAV\n");
+    printf("  --block-size FRAMES          Frames per streamed block (default: 1024)\n");
+    printf("  --latency MS                 How far synthesis may run ahead of output (default: 200)\n");
+    printf("  --realtime                   Release streamed blocks at playback speed\n");
+    printf("  --threads N                  Threads for unpacking frames (default: one per CPU)\n");
+    printf("  --max-components-per-frame N Synthesize only the N strongest components of each frame\n");
+    printf("  --cpu-budget PERCENT         Synthesize only the strongest PERCENT of each frame's components\n");
+    printf("  --help                       Show this help message\n\n");
     printf("Examples:\n");
     printf("  %s compressed.ftae restored.wav\n", program_name);
-    printf("  %s music.ftae output.wav\n", program_name);
+    printf("  %s music.ftae preview.wav --start 60 --end 70\n", program_name);
+    printf("  %s music.ftae draft.wav --cpu-budget 25\n", program_name);
+    printf("  %s speech.ftae speech16k.wav --output-rate 16000\n", program_name);
+    printf("  %s lecture.ftae fast.wav --time-scale 0.5\n", program_name);
+    printf("  %s music.ftae - --raw --latency 100 | aplay -f S16_LE -r 44100\n", program_name);
+}
+
+int parse_synthesis_mode(const char* mode_str) {
+    if (strcmp(mode_str, "accurate") == 0) return SYNTHESIS_ACCURATE;
+    if (strcmp(mode_str, "fast") == 0) return SYNTHESIS_FAST;
+    if (strcmp(mode_str, "fast-nointerp") == 0) return SYNTHESIS_FAST_NOINTERP;
+    return -1;
+}
+
+int parse_sample_format(const char* format_str) {
+    if (strcmp(format_str, "s16") == 0) return SAMPLE_FORMAT_S16;
+    if (strcmp(format_str, "s24") == 0) return SAMPLE_FORMAT_S24;
+    if (strcmp(format_str, "s32") == 0) return SAMPLE_FORMAT_S32;
+    if (strcmp(format_str, "f32") == 0) return SAMPLE_FORMAT_F32;
+    return -1;
 }
 
 int main(int argc, char* argv[]) {
@@ -22,7 +65,7 @@ int main(int argc, char* argv[]) {
     }
     
     // Check argument count
-    if (argc != 3) {
+    if (argc < 3) {
         fprintf(stderr, "Error: Invalid number of arguments\n");
         print_usage(argv[0]);
         return 1;
@@ -31,6 +74,177 @@ int main(int argc, char* argv[]) {
     const char* input_file = argv[1];
     const char* output_file = argv[2];
     
+    // Default settings: decode the whole file
+    DecodingConfig config = {
+        .start_time = 0.0f,
+        .end_time = -1.0f,
+        .synthesis_mode = SYNTHESIS_ACCURATE,
+        .dither = 0,
+        .sample_format = SAMPLE_FORMAT_S16,
+        .stream_output = 0,
+        .stream_format = STREAM_FORMAT_WAV,
+        .block_frames = 1024,
+        .latency_ms = 200,
+        .pace_realtime = 0,
+        .threads = 0,
+        .max_components_per_frame = 0,
+        .cpu_budget = 0.0f,
+        .output_rate = 0,
+        .time_scale = 1.0f,
+        .pitch_scale = 1.0f
+    };
+    
+    // Parse command line options
+    static struct option long_options[] = {
+        {"start", required_argument, 0, 's'},
+        {"end", required_argument, 0, 'e'},
+        {"synthesis", required_argument, 0, 'y'},
+        {"dither", no_argument, 0, 'd'},
+        {"sample-format", required_argument, 0, 'F'},
+        {"output-rate", required_argument, 0, 'o'},
+        {"time-scale", required_argument, 0, 'T'},
+        {"pitch-scale", required_argument, 0, 'P'},
+        {"stream", no_argument, 0, 'S'},
+        {"raw", no_argument, 0, 'r'},
+        {"block-size", required_argument, 0, 'b'},
+        {"latency", required_argument, 0, 'l'},
+        {"realtime", no_argument, 0, 'R'},
+        {"threads", required_argument, 0, 't'},
+        {"max-components-per-frame", required_argument, 0, 'm'},
+        {"cpu-budget", required_argument, 0, 'c'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+    
+    int opt;
+    int option_index = 0;
+    
+    while ((opt = getopt_long(argc - 2, argv + 2, "s:e:y:dF:o:T:P:Srb:l:Rt:m:c:h", long_options, &option_index)) != -1) {
+        switch (opt) {
+            case 's':
+                config.start_time = atof(optarg);
+                if (config.start_time < 0) {
+                    fprintf(stderr, "Error: Start time must not be negative\n");
+                    return 1;
+                }
+                break;
+            case 'e':
+                config.end_time = atof(optarg);
+                if (config.end_time <= 0) {
+                    fprintf(stderr, "Error: End time must be positive\n");
+                    return 1;
+                }
+                break;
+            case 'y': {
+                int mode = parse_synthesis_mode(optarg);
+                if (mode == -1) {
+                    fprintf(stderr, "Error: Invalid synthesis mode '%s'\n", optarg);
+                    return 1;
+                }
+                config.synthesis_mode = mode;
+                break;
+            }
+            case 'd':
+                config.dither = 1;
+                break;
+            case 'F':
+                config.sample_format = parse_sample_format(optarg);
+                if (config.sample_format == -1) {
+                    fprintf(stderr, "Error: Invalid sample format '%s'\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'o': {
+                long rate = atol(optarg);
+                if (rate < 1000 || rate > 768000) {
+                    fprintf(stderr, "Error: Output rate must be between 1000 and 768000 Hz\n");
+                    return 1;
+                }
+                config.output_rate = (uint32_t)rate;
+                break;
+            }
+            case 'T':
+                config.time_scale = atof(optarg);
+                if (!(config.time_scale >= 0.25f) || config.time_scale > 4.0f) {
+                    fprintf(stderr, "Error: Time scale must be between 0.25 and 4\n");
+                    return 1;
+                }
+                break;
+            case 'P':
+                config.pitch_scale = atof(optarg);
+                if (!(config.pitch_scale >= 0.25f) || config.pitch_scale > 4.0f) {
+                    fprintf(stderr, "Error: Pitch scale must be between 0.25 and 4\n");
+                    return 1;
+                }
+                break;
+            case 'S':
+                config.stream_output = 1;
+                break;
+            case 'r':
+                config.stream_format = STREAM_FORMAT_RAW;
+                break;
+            case 'b':
+                config.block_frames = atoi(optarg);
+                if (config.block_frames <= 0 || config.block_frames > 1 << 20) {
+                    fprintf(stderr, "Error: Block size must be between 1 and 1048576 frames\n");
+                    return 1;
+                }
+                break;
+            case 'l':
+                config.latency_ms = atoi(optarg);
+                if (config.latency_ms < 0) {
+                    fprintf(stderr, "Error: Latency must not be negative\n");
+                    return 1;
+                }
+                break;
+            case 'R':
+                config.pace_realtime = 1;
+                break;
+            case 't':
+                config.threads = atoi(optarg);
+                if (config.threads <= 0 || config.threads > DFTA_MAX_THREADS) {
+                    fprintf(stderr, "Error: Thread count must be between 1 and %d\n", DFTA_MAX_THREADS);
+                    return 1;
+                }
+                break;
+            case 'm': {
+                long max_components = atol(optarg);
+                if (max_components <= 0 || max_components > 65535) {
+                    fprintf(stderr, "Error: Components per frame must be between 1 and 65535\n");
+                    return 1;
+                }
+                config.max_components_per_frame = (uint32_t)max_components;
+                break;
+            }
+            case 'c': {
+                float percent = atof(optarg);
+                if (!(percent > 0.0f) || percent > 100.0f) {
+                    fprintf(stderr, "Error: CPU budget must be above 0 and at most 100 percent\n");
+                    return 1;
+                }
+                config.cpu_budget = percent / 100.0f;
+                break;
+            }
+            case 'h':
+                print_usage(argv[0]);
+                return 0;
+            default:
+                print_usage(argv[0]);
+                return 1;
+        }
+    }
+    
+    if (config.end_time > 0 && config.end_time <= config.start_time) {
+        fprintf(stderr, "Error: End time must be after start time\n");
+        return 1;
+    }
+    
+    // Writing to '-' streams to stdout; raw PCM only makes sense as a stream
+    int to_stdout = strcmp(output_file, "-") == 0;
+    if (to_stdout || config.stream_format == STREAM_FORMAT_RAW) {
+        config.stream_output = 1;
+    }
+    
     // Validate file extensions
     const char* input_ext = strrchr(input_file, '.');
     const char* output_ext = strrchr(output_file, '.');
@@ -39,19 +253,46 @@ int main(int argc, char* argv[]) {
         fprintf(stderr, "Warning: Input file should have .ftae extension\n");
     }
     
-    if (!output_ext || strcmp(output_ext, ".wav") != 0) {
+    if (!to_stdout && config.stream_format == STREAM_FORMAT_WAV &&
+        (!output_ext || strcmp(output_ext, ".wav") != 0)) {
         fprintf(stderr, "Warning: Output file should have .wav extension\n");
     }
     
+    // Keep the real stdout for audio and send all progress output to stderr
+    FILE* stream_file = NULL;
+    if (to_stdout) {
+        fflush(stdout);
+        int audio_fd = dup(STDOUT_FILENO);
+        if (audio_fd < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0 ||
+            !(stream_file = fdopen(audio_fd, "wb"))) {
+            fprintf(stderr, "Error: Cannot set up standard output for streaming\n");
+            return 1;
+        }
+    } else if (config.stream_output) {
+        stream_file = fopen(output_file, "wb");
+        if (!stream_file) {
+            fprintf(stderr, "Error: Cannot create output file '%s'\n", output_file);
+            return 1;
+        }
+    }
+    
     printf("D-FTA Decoder v1.0\n");
     printf("==================\n");
     
     // Perform decoding
-    int result = decode_audio_file(input_file, output_file);
+    int result;
+    if (config.stream_output) {
+        result = decode_audio_stream(input_file, stream_file, &config);
+        if (fclose(stream_file) != 0 && result == DFTA_SUCCESS) {
+            result = DFTA_ERROR_FILE_WRITE;
+        }
+    } else {
+        result = decode_audio_file(input_file, output_file, &config);
+    }
     
     if (result == DFTA_SUCCESS) {
         printf("\n✓ Decoding completed successfully!\n");
-        printf("Output file: %s\n", output_file);
+        printf("Output file: %s\n", to_stdout ? "(standard output)" : output_file);
     } else {
         fprintf(stderr, "\n✗ Decoding failed with error code: %d\n", result);
         
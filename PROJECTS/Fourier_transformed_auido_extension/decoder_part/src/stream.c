@@ -0,0 +1,323 @@
+// clock_gettime/nanosleep need POSIX declarations under -std=c99
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include "dfta.h"
+
+// Ring buffer shared between the synthesis thread (producer) and the
+// output thread (consumer). Each slot holds one block of float samples per
+// channel, channel planes block_frames apart.
+typedef struct {
+    float* samples;             // slot_count * channels * block_frames floats
+    uint32_t* frames;           // Valid frames per slot
+    int slot_count;
+    int block_frames;
+    int channels;
+    uint32_t mid_side_pairs;    // Bit k set when channels 2k/2k+1 hold mid/side
+    
+    int head;                   // Next slot the producer fills
+    int tail;                   // Next slot the consumer drains
+    int filled;                 // Slots ready for the consumer
+    int done;                   // Producer has rendered the last block
+    float peak;                 // Running peak over everything produced so far
+    
+    pthread_mutex_t lock;
+    pthread_cond_t not_full;
+    pthread_cond_t not_empty;
+    
+    // Producer context
+    BlockSynthesizer synth[DFTA_MAX_CHANNELS];
+    uint64_t total_frames;
+    double synthesis_seconds;   // Time spent rendering, excluding waits
+} StreamRing;
+
+static double monotonic_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static void sleep_seconds(double seconds) {
+    if (seconds <= 0.0) return;
+    struct timespec ts;
+    ts.tv_sec = (time_t)seconds;
+    ts.tv_nsec = (long)((seconds - (double)ts.tv_sec) * 1e9);
+    nanosleep(&ts, NULL);
+}
+
+static void* synthesis_thread(void* arg) {
+    StreamRing* ring = arg;
+    
+    for (uint64_t pos = 0; pos < ring->total_frames; pos += (uint64_t)ring->block_frames) {
+        uint64_t remaining = ring->total_frames - pos;
+        uint32_t frames = remaining < (uint64_t)ring->block_frames ? (uint32_t)remaining : (uint32_t)ring->block_frames;
+        
+        // Wait for a free slot: this is what bounds how far synthesis runs ahead
+        pthread_mutex_lock(&ring->lock);
+        while (ring->filled == ring->slot_count) {
+            pthread_cond_wait(&ring->not_full, &ring->lock);
+        }
+        int slot = ring->head;
+        pthread_mutex_unlock(&ring->lock);
+        
+        float* block = ring->samples + (size_t)slot * ring->channels * ring->block_frames;
+        double start = monotonic_seconds();
+        for (int c = 0; c < ring->channels; c++) {
+            synthesize_block(&ring->synth[c], block + (size_t)c * ring->block_frames, pos, frames);
+        }
+        
+        // Undo mid/side coding while taking the block peak
+        float peak = 0.0f;
+        for (int c = 0; c < ring->channels; c++) {
+            float* plane = block + (size_t)c * ring->block_frames;
+            if (c % 2 == 0 && c + 1 < ring->channels && (ring->mid_side_pairs >> (c / 2)) & 1) {
+                float* side = plane + ring->block_frames;
+                for (uint32_t i = 0; i < frames; i++) {
+                    float left = plane[i] + side[i];
+                    float right = plane[i] - side[i];
+                    plane[i] = left;
+                    side[i] = right;
+                    float abs_left = fabsf(left);
+                    float abs_right = fabsf(right);
+                    peak = abs_left > peak ? abs_left : peak;
+                    peak = abs_right > peak ? abs_right : peak;
+                }
+                c++;
+                continue;
+            }
+            for (uint32_t i = 0; i < frames; i++) {
+                float abs_sample = fabsf(plane[i]);
+                peak = abs_sample > peak ? abs_sample : peak;
+            }
+        }
+        ring->synthesis_seconds += monotonic_seconds() - start;
+        
+        pthread_mutex_lock(&ring->lock);
+        ring->frames[slot] = frames;
+        if (peak > ring->peak) ring->peak = peak;
+        ring->head = (ring->head + 1) % ring->slot_count;
+        ring->filled++;
+        pthread_cond_signal(&ring->not_empty);
+        pthread_mutex_unlock(&ring->lock);
+    }
+    
+    pthread_mutex_lock(&ring->lock);
+    ring->done = 1;
+    pthread_cond_signal(&ring->not_empty);
+    pthread_mutex_unlock(&ring->lock);
+    return NULL;
+}
+
+int stream_decode_audio(const ChannelComponents* components, const AudioData* audio_info,
+                        FILE* output, const DecodingConfig* config) {
+    if (!components || !audio_info || !output || !config || config->block_frames <= 0 ||
+        components->channel_count < 1 || components->channel_count > DFTA_MAX_CHANNELS) {
+        return DFTA_ERROR_FILE_WRITE;
+    }
+    
+    StreamRing ring;
+    memset(&ring, 0, sizeof(StreamRing));
+    ring.block_frames = config->block_frames;
+    ring.channels = (int)components->channel_count;
+    ring.mid_side_pairs = components->mid_side_pairs;
+    ring.total_frames = audio_info->sample_count;
+    
+    // The latency budget is the amount of audio synthesis may buffer ahead
+    uint64_t budget_frames = (uint64_t)audio_info->sample_rate * (uint64_t)config->latency_ms / 1000;
+    ring.slot_count = (int)((budget_frames + (uint64_t)ring.block_frames - 1) / (uint64_t)ring.block_frames);
+    if (ring.slot_count < 2) ring.slot_count = 2;
+    
+    ring.samples = malloc((size_t)ring.slot_count * ring.channels * ring.block_frames * sizeof(float));
+    ring.frames = calloc(ring.slot_count, sizeof(uint32_t));
+    size_t sample_bytes = (size_t)sample_format_bytes(config->sample_format);
+    uint8_t* scratch = malloc((size_t)ring.block_frames * sample_bytes);
+    if (!ring.samples || !ring.frames || !scratch) {
+        free(ring.samples);
+        free(ring.frames);
+        free(scratch);
+        return DFTA_ERROR_MEMORY;
+    }
+    
+    // Channels are rendered one after the other on the synthesis thread
+    int result = DFTA_SUCCESS;
+    for (int c = 0; c < ring.channels && result == DFTA_SUCCESS; c++) {
+        result = init_block_synthesizer(&ring.synth[c], &components->channels[c],
+                                        audio_info, config->synthesis_mode);
+    }
+    if (result != DFTA_SUCCESS) {
+        for (int c = 0; c < ring.channels; c++) {
+            free_block_synthesizer(&ring.synth[c]);
+        }
+        free(ring.samples);
+        free(ring.frames);
+        free(scratch);
+        return result;
+    }
+    
+    // Progress output shares stderr with the statistics when streaming to stdout
+    fflush(stdout);
+    
+    // Report a closed reader as a write error instead of dying on SIGPIPE
+    signal(SIGPIPE, SIG_IGN);
+    
+    pthread_mutex_init(&ring.lock, NULL);
+    pthread_cond_init(&ring.not_full, NULL);
+    pthread_cond_init(&ring.not_empty, NULL);
+    
+    fprintf(stderr, "Streaming %s %s%s: %d-frame blocks, %d-block buffer (%.0f ms latency budget)%s\n",
+            config->stream_format == STREAM_FORMAT_RAW ? "raw" : "WAV",
+            sample_format_name(config->sample_format),
+            ring.channels > 1 ? " (interleaved channels)" : "",
+            ring.block_frames, ring.slot_count,
+            1000.0 * ring.slot_count * ring.block_frames / audio_info->sample_rate,
+            config->pace_realtime ? ", paced to real time" : "");
+    
+    if (config->stream_format == STREAM_FORMAT_WAV) {
+        result = write_wav_stream_header(output, audio_info->sample_rate, (uint16_t)ring.channels,
+                                         config->sample_format, ring.total_frames);
+    }
+    
+    // Blocks are converted into the writer's buffers and written behind the
+    // consumer, so a slow reader or disk does not hold up conversion
+    AsyncIO* writer = NULL;
+    if (result == DFTA_SUCCESS) {
+        writer = async_writer_open(output, (size_t)ring.channels * ring.block_frames * sample_bytes);
+        if (!writer) result = DFTA_ERROR_MEMORY;
+    }
+    
+    double wall_start = monotonic_seconds();
+    pthread_t producer;
+    if (result == DFTA_SUCCESS && pthread_create(&producer, NULL, synthesis_thread, &ring) != 0) {
+        fprintf(stderr, "Error: Failed to start synthesis thread\n");
+        result = DFTA_ERROR_MEMORY;
+    }
+    if (result != DFTA_SUCCESS) {
+        for (int c = 0; c < ring.channels; c++) {
+            free_block_synthesizer(&ring.synth[c]);
+        }
+        async_io_close(writer);
+        free(ring.samples);
+        free(ring.frames);
+        free(scratch);
+        pthread_mutex_destroy(&ring.lock);
+        pthread_cond_destroy(&ring.not_full);
+        pthread_cond_destroy(&ring.not_empty);
+        return result;
+    }
+    
+    // Consumer: let the producer fill the latency budget, then drain one block
+    // at a time. A block that is not ready when it is due is an underrun.
+    pthread_mutex_lock(&ring.lock);
+    while (ring.filled < ring.slot_count && !ring.done) {
+        pthread_cond_wait(&ring.not_empty, &ring.lock);
+    }
+    pthread_mutex_unlock(&ring.lock);
+    
+    uint32_t dither_state = DFTA_DITHER_SEED;
+    uint32_t blocks_written = 0;
+    uint32_t underruns = 0;
+    uint64_t frames_written = 0;
+    double playback_start = monotonic_seconds();
+    
+    for (;;) {
+        if (config->pace_realtime) {
+            double due = playback_start + (double)frames_written / audio_info->sample_rate;
+            sleep_seconds(due - monotonic_seconds());
+        }
+        
+        pthread_mutex_lock(&ring.lock);
+        if (ring.filled == 0 && !ring.done) {
+            underruns++;
+            while (ring.filled == 0 && !ring.done) {
+                pthread_cond_wait(&ring.not_empty, &ring.lock);
+            }
+        }
+        if (ring.filled == 0 && ring.done) {
+            pthread_mutex_unlock(&ring.lock);
+            break;
+        }
+        int slot = ring.tail;
+        uint32_t frames = ring.frames[slot];
+        // Normalize against the loudest block synthesized so far, which
+        // includes everything buffered ahead of this one
+        float peak = ring.peak;
+        pthread_mutex_unlock(&ring.lock);
+        
+        float scale = peak > 1.0f ? 0.95f / peak : 1.0f;
+        size_t block_bytes = (size_t)frames * ring.channels * sample_bytes;
+        uint8_t* pcm = async_write_reserve(writer, block_bytes);
+        if (pcm) {
+            convert_planes(ring.samples + (size_t)slot * ring.channels * ring.block_frames,
+                           (size_t)ring.block_frames, (uint16_t)ring.channels, config->sample_format,
+                           pcm, scratch, frames, scale, config->dither ? &dither_state : NULL);
+            async_write_commit(writer, block_bytes);
+        }
+        
+        pthread_mutex_lock(&ring.lock);
+        ring.tail = (ring.tail + 1) % ring.slot_count;
+        ring.filled--;
+        pthread_cond_signal(&ring.not_full);
+        pthread_mutex_unlock(&ring.lock);
+        
+        // Each block is submitted whole so the reader gets it without waiting
+        // for the buffer to fill
+        if (!pcm || async_write_flush(writer) != DFTA_SUCCESS) {
+            fprintf(stderr, "Error: Failed to write audio stream (reader closed?)\n");
+            result = DFTA_ERROR_FILE_WRITE;
+            break;
+        }
+        frames_written += frames;
+        blocks_written++;
+    }
+    
+    // On a write error the producer may be blocked on a full ring: drain it
+    pthread_mutex_lock(&ring.lock);
+    while (!ring.done) {
+        ring.filled = 0;
+        pthread_cond_signal(&ring.not_full);
+        pthread_cond_wait(&ring.not_empty, &ring.lock);
+    }
+    pthread_mutex_unlock(&ring.lock);
+    pthread_join(producer, NULL);
+    
+    // Wait for the blocks still being written
+    const char* output_backend = async_io_backend(writer);
+    double write_wait_seconds = async_io_wait_seconds(writer);
+    if (async_io_close(writer) != DFTA_SUCCESS && result == DFTA_SUCCESS) {
+        fprintf(stderr, "Error: Failed to write audio stream (reader closed?)\n");
+        result = DFTA_ERROR_FILE_WRITE;
+    }
+    
+    double wall_seconds = monotonic_seconds() - wall_start;
+    double audio_seconds = (double)ring.total_frames / audio_info->sample_rate;
+    
+    fflush(stdout);
+    fprintf(stderr, "\nStream statistics:\n");
+    fprintf(stderr, "  Blocks written: %u (%llu frames)\n", blocks_written, (unsigned long long)frames_written);
+    fprintf(stderr, "  Underruns: %u (output was ready before synthesis)\n", underruns);
+    fprintf(stderr, "  Synthesis speed: %.1fx realtime (%.3f s for %.2f s of audio)\n",
+            ring.synthesis_seconds > 0.0 ? audio_seconds / ring.synthesis_seconds : 0.0,
+            ring.synthesis_seconds, audio_seconds);
+    fprintf(stderr, "  End-to-end: %.1fx realtime (%.3f s wall clock)\n",
+            wall_seconds > 0.0 ? audio_seconds / wall_seconds : 0.0, wall_seconds);
+    fprintf(stderr, "  Output: %s, %.3f s waiting for writes\n", output_backend, write_wait_seconds);
+    fprintf(stderr, "  Peak level: %.3f\n", ring.peak);
+    
+    for (int c = 0; c < ring.channels; c++) {
+        free_block_synthesizer(&ring.synth[c]);
+    }
+    free(ring.samples);
+    free(ring.frames);
+    free(scratch);
+    pthread_mutex_destroy(&ring.lock);
+    pthread_cond_destroy(&ring.not_full);
+    pthread_cond_destroy(&ring.not_empty);
+    
+    return result;
+}
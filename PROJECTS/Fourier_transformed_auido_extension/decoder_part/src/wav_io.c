@@ -3,9 +3,310 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <stddef.h>
+#include <math.h>
 #include "dfta.h"
 
-int write_wav_file(const char* filename, const AudioData* audio_data) {
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __SSSE3__
+#include <tmmintrin.h>
+#endif
+
+// Frames converted per output block; the block buffer is reused for the whole file
+#define OUTPUT_BLOCK_FRAMES 4096
+
+// Triangular (TPDF) dither of +/-1 LSB: the difference of two uniform values
+static void fill_tpdf_dither(float* dither, int count, uint32_t* state) {
+    uint32_t x = *state;
+    for (int i = 0; i < count; i++) {
+        x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+        float r1 = (float)(x >> 8) * (1.0f / 16777216.0f);
+        x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+        float r2 = (float)(x >> 8) * (1.0f / 16777216.0f);
+        dither[i] = r1 - r2;
+    }
+    *state = x;
+}
+
+// Scale, dither, clamp and round a block of float samples to 16-bit PCM in a
+// single pass. Rounding truncates a value offset to be positive, which is a
+// floor on every target; SSE2 handles eight samples per iteration.
+static void convert_block_to_pcm16(const float* restrict input, const float* restrict dither,
+                                   int16_t* restrict output, int count, float scale) {
+    const float gain = scale * 32767.0f;
+    int i = 0;
+    
+#ifdef __SSE2__
+    const __m128 v_gain = _mm_set1_ps(gain);
+    const __m128 v_max = _mm_set1_ps(32767.0f);
+    const __m128 v_min = _mm_set1_ps(-32767.0f);
+    const __m128 v_offset = _mm_set1_ps(32768.5f);
+    const __m128i v_bias = _mm_set1_epi32(32768);
+    
+    for (; i + 8 <= count; i += 8) {
+        __m128 lo = _mm_mul_ps(_mm_loadu_ps(input + i), v_gain);
+        __m128 hi = _mm_mul_ps(_mm_loadu_ps(input + i + 4), v_gain);
+        if (dither) {
+            lo = _mm_add_ps(lo, _mm_loadu_ps(dither + i));
+            hi = _mm_add_ps(hi, _mm_loadu_ps(dither + i + 4));
+        }
+        lo = _mm_add_ps(_mm_max_ps(_mm_min_ps(lo, v_max), v_min), v_offset);
+        hi = _mm_add_ps(_mm_max_ps(_mm_min_ps(hi, v_max), v_min), v_offset);
+        __m128i lo_i = _mm_sub_epi32(_mm_cvttps_epi32(lo), v_bias);
+        __m128i hi_i = _mm_sub_epi32(_mm_cvttps_epi32(hi), v_bias);
+        _mm_storeu_si128((__m128i*)(output + i), _mm_packs_epi32(lo_i, hi_i));
+    }
+#endif
+    
+    for (; i < count; i++) {
+        float v = input[i] * gain + (dither ? dither[i] : 0.0f);
+        v = v > 32767.0f ? 32767.0f : v;
+        v = v < -32767.0f ? -32767.0f : v;
+        output[i] = (int16_t)((int32_t)(v + 32768.5f) - 32768);
+    }
+}
+
+void convert_to_pcm16(const float* input, int16_t* output, uint32_t count, float scale,
+                      uint32_t* dither_state) {
+    float dither_block[OUTPUT_BLOCK_FRAMES];
+    
+    for (uint32_t pos = 0; pos < count; pos += OUTPUT_BLOCK_FRAMES) {
+        uint32_t frames = count - pos;
+        if (frames > OUTPUT_BLOCK_FRAMES) frames = OUTPUT_BLOCK_FRAMES;
+        
+        if (dither_state) {
+            fill_tpdf_dither(dither_block, (int)frames, dither_state);
+        }
+        convert_block_to_pcm16(input + pos, dither_state ? dither_block : NULL,
+                               output + pos, (int)frames, scale);
+    }
+}
+
+// Scale, dither, clamp and round a block to integers in [-limit, limit],
+// rounding to nearest; SSE2 handles four samples per iteration. limit is a
+// float so 32-bit output can stop at the largest float below 2^31.
+static void convert_block_to_s32(const float* restrict input, const float* restrict dither,
+                                 int32_t* restrict output, int count, float gain, float limit) {
+    int i = 0;
+    
+#ifdef __SSE2__
+    const __m128 v_gain = _mm_set1_ps(gain);
+    const __m128 v_max = _mm_set1_ps(limit);
+    const __m128 v_min = _mm_set1_ps(-limit);
+    
+    for (; i + 4 <= count; i += 4) {
+        __m128 v = _mm_mul_ps(_mm_loadu_ps(input + i), v_gain);
+        if (dither) {
+            v = _mm_add_ps(v, _mm_loadu_ps(dither + i));
+        }
+        v = _mm_max_ps(_mm_min_ps(v, v_max), v_min);
+        _mm_storeu_si128((__m128i*)(output + i), _mm_cvtps_epi32(v));
+    }
+#endif
+    
+    for (; i < count; i++) {
+        float v = input[i] * gain + (dither ? dither[i] : 0.0f);
+        v = v > limit ? limit : v;
+        v = v < -limit ? -limit : v;
+        output[i] = (int32_t)lrintf(v);
+    }
+}
+
+// Scale float samples for float output; no clamping or dither is needed
+static void convert_block_to_f32(const float* restrict input, float* restrict output,
+                                 int count, float scale) {
+    int i = 0;
+    
+#ifdef __SSE2__
+    const __m128 v_scale = _mm_set1_ps(scale);
+    for (; i + 4 <= count; i += 4) {
+        _mm_storeu_ps(output + i, _mm_mul_ps(_mm_loadu_ps(input + i), v_scale));
+    }
+#endif
+    
+    for (; i < count; i++) {
+        output[i] = input[i] * scale;
+    }
+}
+
+// Keep the low three bytes of each 32-bit sample
+static void pack_s24(const int32_t* restrict input, uint8_t* restrict output, int count) {
+    int i = 0;
+    
+#ifdef __SSSE3__
+    const __m128i v_shuffle = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    // Each store writes 16 bytes for 12 bytes of samples, so stop early enough
+    for (; i + 6 <= count; i += 4) {
+        __m128i x = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(input + i)), v_shuffle);
+        _mm_storeu_si128((__m128i*)(output + 3 * i), x);
+    }
+#endif
+    
+    for (; i < count; i++) {
+        uint32_t bits = (uint32_t)input[i];
+        output[3 * i] = (uint8_t)bits;
+        output[3 * i + 1] = (uint8_t)(bits >> 8);
+        output[3 * i + 2] = (uint8_t)(bits >> 16);
+    }
+}
+
+int sample_format_bytes(int sample_format) {
+    switch (sample_format) {
+        case SAMPLE_FORMAT_S24: return 3;
+        case SAMPLE_FORMAT_S32: return 4;
+        case SAMPLE_FORMAT_F32: return 4;
+        default: return 2;
+    }
+}
+
+const char* sample_format_name(int sample_format) {
+    switch (sample_format) {
+        case SAMPLE_FORMAT_S24: return "s24le";
+        case SAMPLE_FORMAT_S32: return "s32le";
+        case SAMPLE_FORMAT_F32: return "f32le";
+        default: return "s16le";
+    }
+}
+
+// Convert a run of float samples to the output sample format. Integer
+// formats are normalized, optionally dithered by +/-1 LSB and clamped;
+// float output is only normalized.
+void convert_samples(const float* input, uint8_t* output, uint32_t count, float scale,
+                     int sample_format, uint32_t* dither_state) {
+    if (sample_format == SAMPLE_FORMAT_S16) {
+        convert_to_pcm16(input, (int16_t*)output, count, scale, dither_state);
+        return;
+    }
+    if (sample_format == SAMPLE_FORMAT_F32) {
+        convert_block_to_f32(input, (float*)output, (int)count, scale);
+        return;
+    }
+    
+    float dither_block[OUTPUT_BLOCK_FRAMES];
+    int32_t wide_block[OUTPUT_BLOCK_FRAMES];
+    int packed = sample_format == SAMPLE_FORMAT_S24;
+    float gain = packed ? scale * 8388607.0f : scale * 2147483647.0f;
+    float limit = packed ? 8388607.0f : 2147483520.0f;
+    
+    for (uint32_t pos = 0; pos < count; pos += OUTPUT_BLOCK_FRAMES) {
+        uint32_t frames = count - pos;
+        if (frames > OUTPUT_BLOCK_FRAMES) frames = OUTPUT_BLOCK_FRAMES;
+        
+        if (dither_state) {
+            fill_tpdf_dither(dither_block, (int)frames, dither_state);
+        }
+        const float* dither = dither_state ? dither_block : NULL;
+        if (packed) {
+            convert_block_to_s32(input + pos, dither, wide_block, (int)frames, gain, limit);
+            pack_s24(wide_block, output + 3 * (size_t)pos, (int)frames);
+        } else {
+            convert_block_to_s32(input + pos, dither, (int32_t*)output + pos, (int)frames, gain, limit);
+        }
+    }
+}
+
+// Convert frames of planar float channels (plane_stride samples apart) to
+// interleaved samples. Each channel is converted as one run through scratch
+// (frames samples of the output format) and scattered, so mono output is
+// produced directly.
+void convert_planes(const float* input, size_t plane_stride, uint16_t channels, int sample_format,
+                    uint8_t* output, uint8_t* scratch, uint32_t frames, float scale,
+                    uint32_t* dither_state) {
+    if (channels <= 1) {
+        convert_samples(input, output, frames, scale, sample_format, dither_state);
+        return;
+    }
+    
+    size_t bytes = (size_t)sample_format_bytes(sample_format);
+    size_t stride = bytes * channels;
+    for (uint16_t c = 0; c < channels; c++) {
+        convert_samples(input + c * plane_stride, scratch, frames, scale, sample_format, dither_state);
+        uint8_t* out = output + c * bytes;
+        for (uint32_t i = 0; i < frames; i++) {
+            memcpy(out + i * stride, scratch + i * bytes, bytes);
+        }
+    }
+}
+
+static void fill_wav_header(WAVHeader* header, uint32_t sample_rate, uint16_t channels,
+                            int sample_format, uint32_t data_size, uint32_t file_size) {
+    uint32_t bytes_per_sample = (uint32_t)sample_format_bytes(sample_format);
+    
+    memcpy(header->riff, "RIFF", 4);
+    header->overall_size = file_size;
+    memcpy(header->wave, "WAVE", 4);
+    memcpy(header->fmt_chunk_marker, "fmt ", 4);
+    header->length_of_fmt = 16;
+    header->format_type = sample_format == SAMPLE_FORMAT_F32 ? WAV_FORMAT_IEEE_FLOAT : WAV_FORMAT_PCM;
+    header->channels = channels;
+    header->sample_rate = sample_rate;
+    header->byterate = sample_rate * channels * bytes_per_sample;
+    header->block_align = channels * bytes_per_sample;
+    header->bits_per_sample = (uint16_t)(8 * bytes_per_sample);
+    memcpy(header->data_chunk_header, "data", 4);
+    header->data_size = data_size;
+}
+
+// Write an RF64 header (EBU Tech 3306) for data_bytes of frames samples: the
+// WAV header with "RF64" in place of "RIFF", both sizes at 0xFFFFFFFF and a
+// ds64 chunk holding the real ones between "WAVE" and the fmt chunk
+static int write_rf64_header(FILE* file, uint32_t sample_rate, uint16_t channels, int sample_format,
+                             uint64_t data_bytes, uint64_t frames) {
+    WAVHeader header;
+    fill_wav_header(&header, sample_rate, channels, sample_format, 0xFFFFFFFFu, 0xFFFFFFFFu);
+    memcpy(header.riff, "RF64", 4);
+    
+    DS64Chunk ds64;
+    uint64_t riff_size = sizeof(WAVHeader) - 8 + 8 + sizeof(DS64Chunk) + data_bytes;
+    ds64.riff_size_low = (uint32_t)riff_size;
+    ds64.riff_size_high = (uint32_t)(riff_size >> 32);
+    ds64.data_size_low = (uint32_t)data_bytes;
+    ds64.data_size_high = (uint32_t)(data_bytes >> 32);
+    ds64.sample_count_low = (uint32_t)frames;
+    ds64.sample_count_high = (uint32_t)(frames >> 32);
+    ds64.table_length = 0;
+    uint32_t ds64_size = sizeof(DS64Chunk);
+    
+    size_t riff_bytes = offsetof(WAVHeader, fmt_chunk_marker);
+    const uint8_t* bytes = (const uint8_t*)&header;
+    if (fwrite(bytes, 1, riff_bytes, file) != riff_bytes ||
+        fwrite("ds64", 1, 4, file) != 4 ||
+        fwrite(&ds64_size, sizeof(uint32_t), 1, file) != 1 ||
+        fwrite(&ds64, sizeof(DS64Chunk), 1, file) != 1 ||
+        fwrite(bytes + riff_bytes, 1, sizeof(WAVHeader) - riff_bytes, file) != sizeof(WAVHeader) - riff_bytes) {
+        return DFTA_ERROR_FILE_WRITE;
+    }
+    return DFTA_SUCCESS;
+}
+
+// Whether data_bytes of samples no longer fit the 32-bit sizes of a WAV file
+static int needs_rf64(uint64_t data_bytes) {
+    return data_bytes > UINT32_MAX - sizeof(WAVHeader);
+}
+
+int write_wav_stream_header(FILE* file, uint32_t sample_rate, uint16_t channels, int sample_format,
+                            uint64_t frames) {
+    // Past 4 GB the real sizes go into an RF64 header; otherwise use the
+    // maximum sizes, as streaming WAV readers expect of a stream
+    uint64_t data_bytes = frames * (uint64_t)sample_format_bytes(sample_format) * channels;
+    int result = DFTA_SUCCESS;
+    if (needs_rf64(data_bytes)) {
+        result = write_rf64_header(file, sample_rate, channels, sample_format, data_bytes, frames);
+    } else {
+        WAVHeader header;
+        fill_wav_header(&header, sample_rate, channels, sample_format, 0xFFFFFFFFu, 0xFFFFFFFFu);
+        if (fwrite(&header, sizeof(WAVHeader), 1, file) != 1) result = DFTA_ERROR_FILE_WRITE;
+    }
+    
+    if (result != DFTA_SUCCESS) {
+        fprintf(stderr, "Error: Failed to write WAV stream header\n");
+    }
+    return result;
+}
+
+int write_wav_file(const char* filename, const AudioData* audio_data, int dither) {
     if (!filename || !audio_data || !audio_data->samples) {
         return DFTA_ERROR_FILE_WRITE;
     }
@@ -16,79 +317,82 @@ int write_wav_file(const char* filename, const AudioData* audio_data) {
         return DFTA_ERROR_FILE_WRITE;
     }
     
-    // Calculate sizes
-    uint32_t bytes_per_sample = audio_data->bits_per_sample / 8;
-    uint32_t data_size = audio_data->sample_count * bytes_per_sample * audio_data->channels;
-    uint32_t file_size = sizeof(WAVHeader) - 8 + data_size;
-    
-    // Create WAV header
-    WAVHeader header;
-    memcpy(header.riff, "RIFF", 4);
-    header.overall_size = file_size;
-    memcpy(header.wave, "WAVE", 4);
-    memcpy(header.fmt_chunk_marker, "fmt ", 4);
-    header.length_of_fmt = 16;
-    header.format_type = 1;  // PCM
-    header.channels = audio_data->channels;
-    header.sample_rate = audio_data->sample_rate;
-    header.byterate = audio_data->sample_rate * audio_data->channels * bytes_per_sample;
-    header.block_align = audio_data->channels * bytes_per_sample;
-    header.bits_per_sample = audio_data->bits_per_sample;
-    memcpy(header.data_chunk_header, "data", 4);
-    header.data_size = data_size;
+    // Calculate sizes; past the 4 GB WAV limit the file is written as RF64
+    uint32_t bytes_per_sample = (uint32_t)sample_format_bytes(audio_data->sample_format);
+    uint64_t data_bytes = audio_data->sample_count * bytes_per_sample * audio_data->channels;
+    int rf64 = needs_rf64(data_bytes);
     
     // Write header
-    if (fwrite(&header, sizeof(WAVHeader), 1, file) != 1) {
+    int result;
+    if (rf64) {
+        result = write_rf64_header(file, audio_data->sample_rate, audio_data->channels,
+                                   audio_data->sample_format, data_bytes, audio_data->sample_count);
+    } else {
+        uint32_t data_size = (uint32_t)data_bytes;
+        uint32_t file_size = sizeof(WAVHeader) - 8 + data_size;
+        WAVHeader header;
+        fill_wav_header(&header, audio_data->sample_rate, audio_data->channels,
+                        audio_data->sample_format, data_size, file_size);
+        result = fwrite(&header, sizeof(WAVHeader), 1, file) == 1 ? DFTA_SUCCESS : DFTA_ERROR_FILE_WRITE;
+    }
+    if (result != DFTA_SUCCESS) {
         fprintf(stderr, "Error: Failed to write WAV header\n");
         fclose(file);
         return DFTA_ERROR_FILE_WRITE;
     }
     
-    // Convert and write audio data
-    if (audio_data->bits_per_sample == 16) {
-        int16_t* temp_buffer = malloc(audio_data->sample_count * sizeof(int16_t) * audio_data->channels);
-        if (!temp_buffer) {
-            fclose(file);
-            return DFTA_ERROR_MEMORY;
-        }
-        
-        // Convert float samples to 16-bit integers
-        for (uint32_t i = 0; i < audio_data->sample_count; i++) {
-            // Clamp to [-1.0, 1.0] range
-            float sample = audio_data->samples[i];
-            if (sample > 1.0f) sample = 1.0f;
-            if (sample < -1.0f) sample = -1.0f;
-            
-            // Convert to 16-bit integer
-            int16_t sample_16 = (int16_t)(sample * 32767.0f);
-            
-            if (audio_data->channels == 1) {
-                temp_buffer[i] = sample_16;
-            } else {
-                // Duplicate mono to stereo
-                temp_buffer[i * 2] = sample_16;
-                temp_buffer[i * 2 + 1] = sample_16;
-            }
-        }
+    // Convert and write audio data one block at a time
+    float scale = 1.0f;
+    if (audio_data->peak_amplitude > 1.0f) {
+        scale = 0.95f / audio_data->peak_amplitude;  // Leave some headroom
+    }
+    
+    // Blocks are converted straight into the writer's buffers, which go to
+    // disk while the following blocks convert
+    size_t block_bytes = (size_t)OUTPUT_BLOCK_FRAMES * bytes_per_sample * audio_data->channels;
+    AsyncIO* output = async_writer_open(file, block_bytes);
+    uint8_t* scratch = malloc((size_t)OUTPUT_BLOCK_FRAMES * bytes_per_sample);
+    if (!output || !scratch) {
+        async_io_close(output);
+        free(scratch);
+        fclose(file);
+        return DFTA_ERROR_MEMORY;
+    }
+    
+    uint32_t dither_state = DFTA_DITHER_SEED;
+    for (uint64_t pos = 0; pos < audio_data->sample_count; pos += OUTPUT_BLOCK_FRAMES) {
+        uint64_t remaining = audio_data->sample_count - pos;
+        uint32_t frames = remaining < OUTPUT_BLOCK_FRAMES ? (uint32_t)remaining : OUTPUT_BLOCK_FRAMES;
         
-        size_t expected_bytes = audio_data->sample_count * sizeof(int16_t) * audio_data->channels;
-        if (fwrite(temp_buffer, 1, expected_bytes, file) != expected_bytes) {
-            fprintf(stderr, "Error: Failed to write audio data\n");
-            free(temp_buffer);
-            fclose(file);
-            return DFTA_ERROR_FILE_WRITE;
+        size_t expected_bytes = (size_t)frames * bytes_per_sample * audio_data->channels;
+        uint8_t* block = async_write_reserve(output, expected_bytes);
+        if (!block) {
+            result = DFTA_ERROR_FILE_WRITE;
+            break;
         }
-        
-        free(temp_buffer);
-    } else {
-        fprintf(stderr, "Error: Only 16-bit output is supported\n");
-        fclose(file);
-        return DFTA_ERROR_FORMAT;
+        convert_planes(audio_data->samples + pos, audio_data->sample_count, audio_data->channels,
+                       audio_data->sample_format, block, scratch, frames, scale,
+                       dither ? &dither_state : NULL);
+        async_write_commit(output, expected_bytes);
+    }
+    
+    if (async_io_close(output) != DFTA_SUCCESS) result = DFTA_ERROR_FILE_WRITE;
+    free(scratch);
+    if (fclose(file) != 0) result = DFTA_ERROR_FILE_WRITE;
+    if (result != DFTA_SUCCESS) {
+        fprintf(stderr, "Error: Failed to write audio data\n");
+        return DFTA_ERROR_FILE_WRITE;
     }
     
-    fclose(file);
-    printf("Successfully wrote WAV file: %u samples at %u Hz\n", 
-           audio_data->sample_count, audio_data->sample_rate);
+    dfta_progress("Successfully wrote %s file: %llu samples at %u Hz", rf64 ? "RF64" : "WAV",
+                  (unsigned long long)audio_data->sample_count, audio_data->sample_rate);
+    if (audio_data->sample_format != SAMPLE_FORMAT_S16) {
+        dfta_progress(", %s", sample_format_name(audio_data->sample_format));
+    }
+    if (audio_data->channels > 1) {
+        dfta_progress(", %u channels", audio_data->channels);
+    }
+    dfta_progress("\n");
     return DFTA_SUCCESS;
 }
 
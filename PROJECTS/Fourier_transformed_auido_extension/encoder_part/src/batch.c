@@ -0,0 +1,671 @@
+
+// clock_gettime/sysconf need POSIX declarations under -std=c99
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "dfta.h"
+
+// Windows per analysis task once a channel is split across workers: a few
+// seconds of audio at typical window sizes, enough FFT work per task that
+// scheduling costs nothing measurable
+#define BATCH_CHUNK_WINDOWS  256
+
+#define MANIFEST_LINE_MAX    8192
+
+// Work items. A file starts as one LOAD task, which plans the windows of
+// every channel and splits them into ANALYZE tasks; whichever task finishes
+// a channel's last chunk filters it, and whichever filters a file's last
+// channel writes the file.
+#define TASK_LOAD     0
+#define TASK_ANALYZE  1
+
+typedef struct BatchFile BatchFile;
+
+typedef struct {
+    int kind;
+    BatchFile* file;
+    int channel;
+    int chunk;                  // Covers windows from chunk * BATCH_CHUNK_WINDOWS
+} BatchTask;
+
+struct BatchFile {
+    char* input;
+    char* output;
+    AudioData audio;
+    uint32_t mid_side_pairs;
+    const FFTPlan* fft;         // Shared tables for the file's sample rate
+    const MaskingModel* masking;  // The same for masking, or NULL
+    AnalysisWindow* windows[DFTA_MAX_CHANNELS];
+    int window_count[DFTA_MAX_CHANNELS];
+    SineWaveQueue** chunks[DFTA_MAX_CHANNELS];  // Components of each chunk, joined in window order
+    int chunk_count[DFTA_MAX_CHANNELS];
+    SineWaveQueue* queues[DFTA_MAX_CHANNELS];
+    pthread_mutex_t lock;       // Guards chunks_left, channels_left, raw_count and result
+    int chunks_left[DFTA_MAX_CHANNELS];
+    int channels_left;
+    int raw_count;
+    int result;                 // First analysis or filtering error
+    double start;               // When the LOAD task began
+};
+
+// Double-ended task queue of one worker. The owner pushes and pops at the
+// bottom, so it finishes the chunks of the file it just loaded before taking
+// another; thieves take from the top, where the oldest and largest tasks
+// are: whole files first, then the earliest chunks of a long one.
+typedef struct {
+    pthread_mutex_t lock;
+    BatchTask* tasks;           // Ring buffer
+    int capacity;
+    int top;
+    int count;
+} TaskDeque;
+
+// FFT and masking tables for one sample rate, whose analysis window sizes
+// they cover; built by the first file at that rate
+typedef struct RateEntry {
+    uint32_t sample_rate;
+    FFTPlan fft;
+    MaskingModel masking;       // Empty when masking is off
+    struct RateEntry* next;
+} RateEntry;
+
+typedef struct BatchScheduler BatchScheduler;
+
+typedef struct {
+    BatchScheduler* scheduler;
+    int id;
+    TaskDeque deque;
+    double complex* fft_data;   // FFT_BUFFER_SIZE entries, this worker's scratch for every window
+    pthread_t thread;
+} BatchWorker;
+
+struct BatchScheduler {
+    BatchWorker workers[DFTA_MAX_THREADS];
+    int worker_count;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;        // A task was queued, or the last one finished
+    int outstanding;            // Tasks queued or running; the batch is done at zero
+    unsigned generation;        // Bumped by every push, so a worker that found nothing can tell whether to look again
+    EncodingConfig config;      // Adjusted for the compression level
+    RateEntry* rates;           // Under lock; entries are read only once built
+    
+    // Results, under report_lock
+    pthread_mutex_t report_lock;
+    int file_count;
+    int finished;
+    int failed;
+    int first_error;            // Code of the first file that failed
+    double audio_seconds;
+    double output_bytes;
+};
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int deque_push(TaskDeque* deque, const BatchTask* task) {
+    pthread_mutex_lock(&deque->lock);
+    if (deque->count == deque->capacity) {
+        int capacity = deque->capacity ? 2 * deque->capacity : 64;
+        BatchTask* tasks = malloc(capacity * sizeof(BatchTask));
+        if (!tasks) {
+            pthread_mutex_unlock(&deque->lock);
+            return 0;
+        }
+        for (int i = 0; i < deque->count; i++) {
+            tasks[i] = deque->tasks[(deque->top + i) % deque->capacity];
+        }
+        free(deque->tasks);
+        deque->tasks = tasks;
+        deque->capacity = capacity;
+        deque->top = 0;
+    }
+    deque->tasks[(deque->top + deque->count) % deque->capacity] = *task;
+    deque->count++;
+    pthread_mutex_unlock(&deque->lock);
+    return 1;
+}
+
+static int deque_pop(TaskDeque* deque, BatchTask* task) {
+    pthread_mutex_lock(&deque->lock);
+    int found = deque->count > 0;
+    if (found) {
+        deque->count--;
+        *task = deque->tasks[(deque->top + deque->count) % deque->capacity];
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+static int deque_steal(TaskDeque* deque, BatchTask* task) {
+    pthread_mutex_lock(&deque->lock);
+    int found = deque->count > 0;
+    if (found) {
+        *task = deque->tasks[deque->top];
+        deque->top = (deque->top + 1) % deque->capacity;
+        deque->count--;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+static void run_task(BatchWorker* worker, const BatchTask* task);
+
+// Queue a task on this worker's deque and wake an idle worker to steal it.
+// If the deque cannot grow, the task runs right here instead.
+static void schedule_task(BatchWorker* worker, const BatchTask* task) {
+    BatchScheduler* scheduler = worker->scheduler;
+    
+    pthread_mutex_lock(&scheduler->lock);
+    scheduler->outstanding++;
+    pthread_mutex_unlock(&scheduler->lock);
+    
+    if (!deque_push(&worker->deque, task)) {
+        run_task(worker, task);
+        pthread_mutex_lock(&scheduler->lock);
+        scheduler->outstanding--;
+        pthread_mutex_unlock(&scheduler->lock);
+        return;
+    }
+    
+    pthread_mutex_lock(&scheduler->lock);
+    scheduler->generation++;
+    pthread_cond_signal(&scheduler->wake);
+    pthread_mutex_unlock(&scheduler->lock);
+}
+
+static void rate_entry_free(RateEntry* entry) {
+    fft_plan_free(&entry->fft);
+    masking_model_free(&entry->masking);
+    free(entry);
+}
+
+// FFT and masking tables for a sample rate, shared by every file at that rate
+static const RateEntry* batch_rate_tables(BatchScheduler* scheduler, uint32_t sample_rate) {
+    pthread_mutex_lock(&scheduler->lock);
+    RateEntry* entry = scheduler->rates;
+    while (entry && entry->sample_rate != sample_rate) {
+        entry = entry->next;
+    }
+    if (!entry) {
+        int sizes[ANALYSIS_SIZES];
+        analysis_window_sizes(sample_rate, sizes);
+        entry = calloc(1, sizeof(RateEntry));
+        if (entry && (fft_plan_init(&entry->fft) != DFTA_SUCCESS ||
+                      fft_plan_prepare(&entry->fft, sizes, ANALYSIS_SIZES) != DFTA_SUCCESS ||
+                      (scheduler->config.masking &&
+                       masking_model_prepare(&entry->masking, sample_rate, sizes, ANALYSIS_SIZES) != DFTA_SUCCESS))) {
+            rate_entry_free(entry);
+            entry = NULL;
+        }
+        if (entry) {
+            entry->sample_rate = sample_rate;
+            entry->next = scheduler->rates;
+            scheduler->rates = entry;
+        }
+    }
+    pthread_mutex_unlock(&scheduler->lock);
+    return entry;
+}
+
+static const char* batch_error_text(int result) {
+    switch (result) {
+        case DFTA_ERROR_FILE_READ:  return "cannot read input";
+        case DFTA_ERROR_FILE_WRITE: return "cannot write output";
+        case DFTA_ERROR_MEMORY:     return "out of memory";
+        case DFTA_ERROR_FORMAT:     return "unsupported input";
+        default:                    return "unknown error";
+    }
+}
+
+// Release everything the file holds, then report it
+static void finish_file(BatchScheduler* scheduler, BatchFile* file, int result, long output_size) {
+    int components = 0;
+    int channels = file->audio.channels;
+    double audio_seconds = file->audio.sample_rate ? (double)file->audio.sample_count / file->audio.sample_rate : 0.0;
+    
+    for (int c = 0; c < DFTA_MAX_CHANNELS; c++) {
+        if (file->chunks[c]) {
+            for (int k = 0; k < file->chunk_count[c]; k++) {
+                free_sinewave_queue(file->chunks[c][k]);
+            }
+            free(file->chunks[c]);
+            file->chunks[c] = NULL;
+        }
+        free(file->windows[c]);
+        file->windows[c] = NULL;
+        if (file->queues[c]) {
+            components += file->queues[c]->count;
+            free_sinewave_queue(file->queues[c]);
+            file->queues[c] = NULL;
+        }
+    }
+    free_audio_data(&file->audio);
+    double seconds = now_seconds() - file->start;
+    
+    pthread_mutex_lock(&scheduler->report_lock);
+    scheduler->finished++;
+    if (result == DFTA_SUCCESS) {
+        scheduler->audio_seconds += audio_seconds;
+        scheduler->output_bytes += output_size;
+        printf("[%*d/%d] ok      %s -> %s: %.2f s, %d ch, %d of %d components, %ld bytes in %.3f s\n",
+               scheduler->file_count >= 1000 ? 5 : 3, scheduler->finished, scheduler->file_count,
+               file->input, file->output, audio_seconds, channels, components, file->raw_count,
+               output_size, seconds);
+    } else {
+        if (scheduler->failed++ == 0) scheduler->first_error = result;
+        printf("[%*d/%d] FAILED  %s -> %s: %s (error %d)\n",
+               scheduler->file_count >= 1000 ? 5 : 3, scheduler->finished, scheduler->file_count,
+               file->input, file->output, batch_error_text(result), result);
+    }
+    fflush(stdout);
+    pthread_mutex_unlock(&scheduler->report_lock);
+}
+
+static void write_file(BatchWorker* worker, BatchFile* file) {
+    BatchScheduler* scheduler = worker->scheduler;
+    long output_size = 0;
+    int result;
+    
+    FILE* output = fopen(file->output, "wb");
+    if (!output) {
+        fprintf(stderr, "Error: Cannot create output file %s\n", file->output);
+        result = DFTA_ERROR_FILE_WRITE;
+    } else {
+        result = write_ftae_stream(output, file->queues, file->mid_side_pairs, &file->audio, &scheduler->config);
+        output_size = ftell(output);
+        if (fclose(output) != 0 && result == DFTA_SUCCESS) {
+            result = DFTA_ERROR_FILE_WRITE;
+        }
+    }
+    finish_file(scheduler, file, result, output_size);
+}
+
+// Join the chunks of a channel in window order, which gives exactly the
+// queue a single-threaded analysis would have built, and filter it
+static void filter_channel(BatchWorker* worker, BatchFile* file, int channel) {
+    SineWaveQueue* queue = file->queues[channel];
+    
+    for (int k = 0; k < file->chunk_count[channel]; k++) {
+        append_sinewave_queue(queue, file->chunks[channel][k]);
+    }
+    int raw_count = queue->count;
+    int result = filter_components(queue, &worker->scheduler->config);
+    
+    pthread_mutex_lock(&file->lock);
+    file->raw_count += raw_count;
+    if (result != DFTA_SUCCESS && file->result == DFTA_SUCCESS) {
+        file->result = result;
+    }
+    int last = --file->channels_left == 0;
+    pthread_mutex_unlock(&file->lock);
+    
+    if (last && file->result != DFTA_SUCCESS) {
+        finish_file(worker->scheduler, file, file->result, 0);
+    } else if (last) {
+        write_file(worker, file);
+    }
+}
+
+static void analyze_chunk(BatchWorker* worker, BatchFile* file, int channel, int chunk) {
+    int first = chunk * BATCH_CHUNK_WINDOWS;
+    int count = file->window_count[channel] - first;
+    if (count > BATCH_CHUNK_WINDOWS) count = BATCH_CHUNK_WINDOWS;
+    
+    int result = analyze_windows(file->fft, worker->fft_data,
+                                 file->audio.samples + (size_t)channel * file->audio.sample_count,
+                                 file->audio.sample_count, file->audio.sample_rate,
+                                 file->windows[channel] + first, count, file->masking,
+                                 file->chunks[channel][chunk]);
+    
+    pthread_mutex_lock(&file->lock);
+    if (result != DFTA_SUCCESS && file->result == DFTA_SUCCESS) {
+        file->result = result;
+    }
+    int last = --file->chunks_left[channel] == 0;
+    pthread_mutex_unlock(&file->lock);
+    
+    if (last) {
+        filter_channel(worker, file, channel);
+    }
+}
+
+static void load_file(BatchWorker* worker, BatchFile* file) {
+    BatchScheduler* scheduler = worker->scheduler;
+    file->start = now_seconds();
+    
+    int result = read_wav_file(file->input, &file->audio);
+    if (result != DFTA_SUCCESS) {
+        finish_file(scheduler, file, result, 0);
+        return;
+    }
+    file->mid_side_pairs = prepare_channels(&file->audio, &scheduler->config);
+    const RateEntry* rate = batch_rate_tables(scheduler, file->audio.sample_rate);
+    if (!rate) {
+        finish_file(scheduler, file, DFTA_ERROR_MEMORY, 0);
+        return;
+    }
+    file->fft = &rate->fft;
+    file->masking = scheduler->config.masking ? &rate->masking : NULL;
+    
+    // Plan every channel and allocate every chunk before the first task is
+    // queued, since other workers may start on them at once
+    int channel_count = file->audio.channels;
+    for (int c = 0; c < channel_count; c++) {
+        const float* samples = file->audio.samples + (size_t)c * file->audio.sample_count;
+        WindowSkips skips;
+        file->window_count[c] = plan_analysis_windows(samples, file->audio.sample_count, file->audio.sample_rate,
+                                                      &scheduler->config, &file->windows[c], &skips);
+        file->queues[c] = create_sinewave_queue();
+        if (file->window_count[c] < 0 || !file->queues[c]) {
+            file->window_count[c] = 0;
+            finish_file(scheduler, file, DFTA_ERROR_MEMORY, 0);
+            return;
+        }
+        
+        int chunk_count = (file->window_count[c] + BATCH_CHUNK_WINDOWS - 1) / BATCH_CHUNK_WINDOWS;
+        file->chunks[c] = calloc(chunk_count + 1, sizeof(SineWaveQueue*));
+        if (!file->chunks[c]) {
+            finish_file(scheduler, file, DFTA_ERROR_MEMORY, 0);
+            return;
+        }
+        for (int k = 0; k < chunk_count; k++) {
+            file->chunks[c][k] = create_sinewave_queue();
+            file->chunk_count[c] = k + 1;
+            if (!file->chunks[c][k]) {
+                finish_file(scheduler, file, DFTA_ERROR_MEMORY, 0);
+                return;
+            }
+        }
+        file->chunks_left[c] = chunk_count;
+    }
+    file->channels_left = channel_count;
+    
+    for (int c = 0; c < channel_count; c++) {
+        for (int k = 0; k < file->chunk_count[c]; k++) {
+            BatchTask task = { TASK_ANALYZE, file, c, k };
+            schedule_task(worker, &task);
+        }
+    }
+    
+    // Channels too short for a single window have nothing to wait for. The
+    // last of them may write and release the file, so only chunk_count, which
+    // outlives that, is read here.
+    for (int c = 0; c < channel_count; c++) {
+        if (file->chunk_count[c] == 0) {
+            filter_channel(worker, file, c);
+        }
+    }
+}
+
+static void run_task(BatchWorker* worker, const BatchTask* task) {
+    switch (task->kind) {
+        case TASK_LOAD:
+            load_file(worker, task->file);
+            break;
+        case TASK_ANALYZE:
+            analyze_chunk(worker, task->file, task->channel, task->chunk);
+            break;
+    }
+}
+
+// Own tasks first, newest first; otherwise steal the oldest task of the
+// next worker that has one
+static int find_task(BatchWorker* worker, BatchTask* task) {
+    BatchScheduler* scheduler = worker->scheduler;
+    
+    if (deque_pop(&worker->deque, task)) return 1;
+    for (int n = 1; n < scheduler->worker_count; n++) {
+        BatchWorker* victim = &scheduler->workers[(worker->id + n) % scheduler->worker_count];
+        if (deque_steal(&victim->deque, task)) return 1;
+    }
+    return 0;
+}
+
+static void* batch_worker(void* arg) {
+    BatchWorker* worker = arg;
+    BatchScheduler* scheduler = worker->scheduler;
+    
+    for (;;) {
+        pthread_mutex_lock(&scheduler->lock);
+        unsigned generation = scheduler->generation;
+        int done = scheduler->outstanding == 0;
+        pthread_mutex_unlock(&scheduler->lock);
+        if (done) break;
+        
+        BatchTask task;
+        if (find_task(worker, &task)) {
+            run_task(worker, &task);
+            pthread_mutex_lock(&scheduler->lock);
+            if (--scheduler->outstanding == 0) {
+                pthread_cond_broadcast(&scheduler->wake);
+            }
+            pthread_mutex_unlock(&scheduler->lock);
+            continue;
+        }
+        
+        // Nothing anywhere: sleep until something is queued or all is done
+        pthread_mutex_lock(&scheduler->lock);
+        while (scheduler->outstanding > 0 && scheduler->generation == generation) {
+            pthread_cond_wait(&scheduler->wake, &scheduler->lock);
+        }
+        pthread_mutex_unlock(&scheduler->lock);
+    }
+    return NULL;
+}
+
+// Strip leading and trailing whitespace in place
+static char* trim(char* text) {
+    while (isspace((unsigned char)*text)) text++;
+    size_t length = strlen(text);
+    while (length > 0 && isspace((unsigned char)text[length - 1])) {
+        text[--length] = '\0';
+    }
+    return text;
+}
+
+// One "input output" pair per line. Fields are split at a tab when the line
+// has one, so paths may contain spaces, and at the last run of spaces
+// otherwise. Blank lines and lines starting with '#' are skipped. Returns
+// the number of files, or -1 if the manifest cannot be read.
+static int read_manifest(const char* manifest_file, BatchFile** files, int* bad_lines) {
+    FILE* manifest = fopen(manifest_file, "r");
+    if (!manifest) {
+        fprintf(stderr, "Error: Cannot open manifest %s\n", manifest_file);
+        return -1;
+    }
+    
+    char* line = malloc(MANIFEST_LINE_MAX);
+    BatchFile* list = NULL;
+    int count = 0;
+    int capacity = 0;
+    int line_number = 0;
+    *bad_lines = 0;
+    
+    while (line && fgets(line, MANIFEST_LINE_MAX, manifest)) {
+        line_number++;
+        char* text = trim(line);
+        if (*text == '\0' || *text == '#') continue;
+        
+        char* split = strchr(text, '\t');
+        if (!split) {
+            split = text + strlen(text);
+            while (split > text && !isspace((unsigned char)split[-1])) split--;
+            split = split > text ? split - 1 : NULL;
+        }
+        char* output = split ? trim(split + 1) : NULL;
+        if (split) *split = '\0';
+        char* input = trim(text);
+        if (!output || *input == '\0' || *output == '\0') {
+            fprintf(stderr, "Error: %s:%d: expected 'input.wav output.ftae'\n", manifest_file, line_number);
+            (*bad_lines)++;
+            continue;
+        }
+        
+        if (count == capacity) {
+            capacity = capacity ? 2 * capacity : 64;
+            BatchFile* grown = realloc(list, capacity * sizeof(BatchFile));
+            if (!grown) break;
+            list = grown;
+        }
+        BatchFile* file = &list[count];
+        memset(file, 0, sizeof(BatchFile));
+        file->input = malloc(strlen(input) + 1);
+        file->output = malloc(strlen(output) + 1);
+        if (!file->input || !file->output) {
+            free(file->input);
+            free(file->output);
+            break;
+        }
+        strcpy(file->input, input);
+        strcpy(file->output, output);
+        pthread_mutex_init(&file->lock, NULL);
+        count++;
+    }
+    
+    int failed = !line || ferror(manifest) || !feof(manifest);
+    fclose(manifest);
+    free(line);
+    if (failed) {
+        fprintf(stderr, "Error: Cannot read manifest %s\n", manifest_file);
+        for (int i = 0; i < count; i++) {
+            pthread_mutex_destroy(&list[i].lock);
+            free(list[i].input);
+            free(list[i].output);
+        }
+        free(list);
+        return -1;
+    }
+    
+    *files = list;
+    return count;
+}
+
+int encode_batch(const char* manifest_file, const EncodingConfig* config, int threads) {
+    BatchFile* files = NULL;
+    int bad_lines = 0;
+    int file_count = read_manifest(manifest_file, &files, &bad_lines);
+    if (file_count < 0) {
+        return DFTA_ERROR_FILE_READ;
+    }
+    if (file_count == 0) {
+        fprintf(stderr, "Error: Manifest %s lists no files\n", manifest_file);
+        free(files);
+        return DFTA_ERROR_FORMAT;
+    }
+    
+    if (threads <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (int)cpus : 1;
+    }
+    if (threads > DFTA_MAX_THREADS) threads = DFTA_MAX_THREADS;
+    
+    BatchScheduler* scheduler = calloc(1, sizeof(BatchScheduler));
+    if (!scheduler) {
+        for (int i = 0; i < file_count; i++) {
+            pthread_mutex_destroy(&files[i].lock);
+            free(files[i].input);
+            free(files[i].output);
+        }
+        free(files);
+        return DFTA_ERROR_MEMORY;
+    }
+    pthread_mutex_init(&scheduler->lock, NULL);
+    pthread_cond_init(&scheduler->wake, NULL);
+    pthread_mutex_init(&scheduler->report_lock, NULL);
+    scheduler->config = *config;
+    adjust_config_for_compression_level(&scheduler->config);
+    scheduler->file_count = file_count;
+    
+    int result = DFTA_SUCCESS;
+    for (int t = 0; t < threads; t++) {
+        BatchWorker* worker = &scheduler->workers[t];
+        worker->scheduler = scheduler;
+        worker->id = t;
+        pthread_mutex_init(&worker->deque.lock, NULL);
+        worker->fft_data = malloc(FFT_BUFFER_SIZE * sizeof(double complex));
+        scheduler->worker_count = t + 1;
+        if (!worker->fft_data) {
+            result = DFTA_ERROR_MEMORY;
+            break;
+        }
+    }
+    
+    // Deal the files out round-robin, last first, so each worker's own
+    // (bottom) end starts with its earliest file in manifest order
+    for (int i = file_count - 1; result == DFTA_SUCCESS && i >= 0; i--) {
+        BatchTask task = { TASK_LOAD, &files[i], 0, 0 };
+        if (!deque_push(&scheduler->workers[i % threads].deque, &task)) {
+            result = DFTA_ERROR_MEMORY;
+        }
+        scheduler->outstanding++;
+    }
+    
+    double start = now_seconds();
+    if (result == DFTA_SUCCESS) {
+        // Every file's progress goes through one line per file; the per-file
+        // messages of the single-file path would interleave
+        dfta_progress_enabled = 0;
+        
+        // The calling thread is worker 0; a worker that cannot be started
+        // leaves its deque to be stolen from
+        int started[DFTA_MAX_THREADS] = {0};
+        for (int t = 1; t < threads; t++) {
+            started[t] = pthread_create(&scheduler->workers[t].thread, NULL,
+                                        batch_worker, &scheduler->workers[t]) == 0;
+        }
+        batch_worker(&scheduler->workers[0]);
+        for (int t = 1; t < threads; t++) {
+            if (started[t]) pthread_join(scheduler->workers[t].thread, NULL);
+        }
+        dfta_progress_enabled = 1;
+    }
+    double wall = now_seconds() - start;
+    
+    if (result == DFTA_SUCCESS) {
+        int encoded = scheduler->finished - scheduler->failed;
+        printf("\nBatch complete: %d of %d files encoded", encoded, file_count);
+        if (scheduler->failed > 0) printf(", %d failed", scheduler->failed);
+        if (bad_lines > 0) printf(", %d manifest lines skipped", bad_lines);
+        printf("\n");
+        printf("  Wall time: %.2f s on %d threads\n", wall, threads);
+        printf("  Audio: %.1f s in, %.0f bytes out\n", scheduler->audio_seconds, scheduler->output_bytes);
+        printf("  Throughput: %.2f files/s, %.1fx realtime\n",
+               wall > 0 ? encoded / wall : 0.0, wall > 0 ? scheduler->audio_seconds / wall : 0.0);
+        if (scheduler->failed > 0) {
+            result = scheduler->first_error;
+        } else if (bad_lines > 0) {
+            result = DFTA_ERROR_FORMAT;
+        }
+    }
+    
+    for (int t = 0; t < scheduler->worker_count; t++) {
+        pthread_mutex_destroy(&scheduler->workers[t].deque.lock);
+        free(scheduler->workers[t].deque.tasks);
+        free(scheduler->workers[t].fft_data);
+    }
+    for (int i = 0; i < file_count; i++) {
+        pthread_mutex_destroy(&files[i].lock);
+        free(files[i].input);
+        free(files[i].output);
+    }
+    free(files);
+    while (scheduler->rates) {
+        RateEntry* next = scheduler->rates->next;
+        rate_entry_free(scheduler->rates);
+        scheduler->rates = next;
+    }
+    pthread_mutex_destroy(&scheduler->report_lock);
+    pthread_cond_destroy(&scheduler->wake);
+    pthread_mutex_destroy(&scheduler->lock);
+    free(scheduler);
+    return result;
+}
@@ -0,0 +1,71 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "dfta.h"
+
+void bitwriter_init(BitWriter* writer) {
+    memset(writer, 0, sizeof(BitWriter));
+}
+
+void bitwriter_reset(BitWriter* writer) {
+    writer->size = 0;
+    writer->accumulator = 0;
+    writer->bit_count = 0;
+}
+
+void bitwriter_free(BitWriter* writer) {
+    free(writer->data);
+    memset(writer, 0, sizeof(BitWriter));
+}
+
+static int bitwriter_reserve(BitWriter* writer, size_t extra) {
+    if (writer->size + extra <= writer->capacity) return 1;
+    
+    size_t capacity = writer->capacity ? writer->capacity * 2 : 256;
+    while (capacity < writer->size + extra) capacity *= 2;
+    
+    uint8_t* data = realloc(writer->data, capacity);
+    if (!data) {
+        writer->failed = 1;
+        return 0;
+    }
+    writer->data = data;
+    writer->capacity = capacity;
+    return 1;
+}
+
+void bitwriter_put(BitWriter* writer, uint32_t value, int bits) {
+    if (bits <= 0) return;
+    
+    // Bits are packed LSB-first into a 64-bit accumulator and spilled bytewise
+    writer->accumulator |= (uint64_t)(value & (uint32_t)((1ull << bits) - 1)) << writer->bit_count;
+    writer->bit_count += bits;
+    
+    while (writer->bit_count >= 8) {
+        if (!bitwriter_reserve(writer, 1)) return;
+        writer->data[writer->size++] = (uint8_t)writer->accumulator;
+        writer->accumulator >>= 8;
+        writer->bit_count -= 8;
+    }
+}
+
+void bitwriter_put_expgolomb(BitWriter* writer, uint32_t value) {
+    // Order-0 exp-Golomb: (n zero bits)(1)(n low bits of value + 1)
+    uint64_t coded = (uint64_t)value + 1;
+    int length = 0;
+    while ((coded >> (length + 1)) != 0) length++;
+    
+    bitwriter_put(writer, 0, length);
+    bitwriter_put(writer, 1, 1);
+    bitwriter_put(writer, (uint32_t)(coded & ((1ull << length) - 1)), length);
+}
+
+void bitwriter_flush(BitWriter* writer) {
+    if (writer->bit_count > 0) {
+        if (!bitwriter_reserve(writer, 1)) return;
+        writer->data[writer->size++] = (uint8_t)writer->accumulator;
+        writer->accumulator = 0;
+        writer->bit_count = 0;
+    }
+}
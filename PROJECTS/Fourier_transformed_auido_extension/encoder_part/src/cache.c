@@ -0,0 +1,305 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "dfta.h"
+
+// On-disk cache of analysed windows. Each entry holds the unfiltered
+// components of one window, keyed by a hash and a CRC32C of the window's
+// samples plus everything else analyze_window depends on: window size,
+// samples present, sample rate and masking. Start time is not part of the
+// key, so a window that moved in time after an edit is still found.
+//
+// The file is a header followed by entries, each an AnalysisKey, a
+// component count and that many CachedComponent records. Every encode reads
+// the old file's index, writes the entries it uses (hits and new windows)
+// to path.tmp and renames that over the old file, so the cache holds exactly
+// the windows of the last export.
+
+#define ANALYSIS_CACHE_VERSION 1    // Bump when analysis output changes
+
+typedef struct {
+    char magic[4];              // "FTAC"
+    uint32_t version;
+} CacheHeader;
+
+// Components are stored without start time and duration, which the window
+// position and planned length give back
+typedef struct {
+    int32_t phase;
+    int32_t amplitude;
+    int32_t frequency;
+} CachedComponent;
+
+typedef struct {
+    AnalysisKey key;
+    uint32_t count;             // Components
+    int in_output;              // Entry is in the new file rather than the old one
+    long offset;                // Of the first component
+    int used;                   // Slot holds an entry
+} CacheSlot;
+
+struct AnalysisCache {
+    char* path;
+    char* temp_path;
+    FILE* input;                // Previous cache, or NULL
+    FILE* output;               // Entries used by this encode
+    CacheSlot* slots;           // Open addressing on key.hash
+    uint32_t slot_count;        // Power of two
+    uint32_t entry_count;
+    CachedComponent* buffer;
+    uint32_t buffer_capacity;
+    int failed;                 // The new file is incomplete and must not replace the old one
+    pthread_mutex_t lock;
+};
+
+static int same_key(const AnalysisKey* a, const AnalysisKey* b) {
+    return a->hash == b->hash && a->crc == b->crc && a->sample_rate == b->sample_rate &&
+           a->window_size == b->window_size && a->available == b->available && a->masking == b->masking;
+}
+
+static CacheSlot* find_slot(AnalysisCache* cache, const AnalysisKey* key) {
+    uint32_t mask = cache->slot_count - 1;
+    for (uint32_t i = (uint32_t)key->hash & mask; ; i = (i + 1) & mask) {
+        CacheSlot* slot = &cache->slots[i];
+        if (!slot->used || same_key(&slot->key, key)) return slot;
+    }
+}
+
+// Insert or update an entry, keeping the table at most half full
+static int insert_slot(AnalysisCache* cache, const AnalysisKey* key, uint32_t count, int in_output, long offset) {
+    if (2 * (cache->entry_count + 1) > cache->slot_count) {
+        uint32_t slot_count = cache->slot_count ? cache->slot_count * 2 : 1024;
+        CacheSlot* slots = calloc(slot_count, sizeof(CacheSlot));
+        if (!slots) return DFTA_ERROR_MEMORY;
+        CacheSlot* old_slots = cache->slots;
+        uint32_t old_count = cache->slot_count;
+        cache->slots = slots;
+        cache->slot_count = slot_count;
+        for (uint32_t i = 0; i < old_count; i++) {
+            if (old_slots[i].used) *find_slot(cache, &old_slots[i].key) = old_slots[i];
+        }
+        free(old_slots);
+    }
+    
+    CacheSlot* slot = find_slot(cache, key);
+    if (!slot->used) cache->entry_count++;
+    slot->key = *key;
+    slot->count = count;
+    slot->in_output = in_output;
+    slot->offset = offset;
+    slot->used = 1;
+    return DFTA_SUCCESS;
+}
+
+static int reserve_buffer(AnalysisCache* cache, uint32_t count) {
+    if (count <= cache->buffer_capacity) return DFTA_SUCCESS;
+    CachedComponent* buffer = realloc(cache->buffer, count * sizeof(CachedComponent));
+    if (!buffer) return DFTA_ERROR_MEMORY;
+    cache->buffer = buffer;
+    cache->buffer_capacity = count;
+    return DFTA_SUCCESS;
+}
+
+// Index the entries of the previous cache; a damaged tail is ignored
+static int load_index(AnalysisCache* cache) {
+    CacheHeader header;
+    if (fread(&header, sizeof(CacheHeader), 1, cache->input) != 1 ||
+        memcmp(header.magic, "FTAC", 4) != 0 || header.version != ANALYSIS_CACHE_VERSION) {
+        fprintf(stderr, "Note: Analysis cache %s is from another encoder version, starting a new one\n",
+                cache->path);
+        fclose(cache->input);
+        cache->input = NULL;
+        return DFTA_SUCCESS;
+    }
+    
+    AnalysisKey key;
+    uint32_t count;
+    while (fread(&key, sizeof(AnalysisKey), 1, cache->input) == 1 &&
+           fread(&count, sizeof(count), 1, cache->input) == 1) {
+        long offset = ftell(cache->input);
+        if (offset < 0 || fseek(cache->input, (long)(count * sizeof(CachedComponent)), SEEK_CUR) != 0) break;
+        int result = insert_slot(cache, &key, count, 0, offset);
+        if (result != DFTA_SUCCESS) return result;
+    }
+    return DFTA_SUCCESS;
+}
+
+static void free_cache(AnalysisCache* cache) {
+    if (cache->input) fclose(cache->input);
+    if (cache->output) fclose(cache->output);
+    pthread_mutex_destroy(&cache->lock);
+    free(cache->path);
+    free(cache->temp_path);
+    free(cache->slots);
+    free(cache->buffer);
+    free(cache);
+}
+
+int analysis_cache_open(AnalysisCache** cache_out, const char* path) {
+    *cache_out = NULL;
+    AnalysisCache* cache = calloc(1, sizeof(AnalysisCache));
+    if (!cache) return DFTA_ERROR_MEMORY;
+    pthread_mutex_init(&cache->lock, NULL);
+    crc32c_init();
+    
+    size_t length = strlen(path);
+    cache->path = malloc(length + 1);
+    cache->temp_path = malloc(length + 5);
+    if (!cache->path || !cache->temp_path) {
+        free_cache(cache);
+        return DFTA_ERROR_MEMORY;
+    }
+    memcpy(cache->path, path, length + 1);
+    memcpy(cache->temp_path, path, length);
+    memcpy(cache->temp_path + length, ".tmp", 5);
+    
+    // A missing cache is simply empty
+    cache->input = fopen(path, "rb");
+    int result = cache->input ? load_index(cache) : DFTA_SUCCESS;
+    if (result != DFTA_SUCCESS) {
+        free_cache(cache);
+        return result;
+    }
+    
+    // Read back when a later window repeats one stored by this encode
+    cache->output = fopen(cache->temp_path, "w+b");
+    CacheHeader header;
+    memcpy(header.magic, "FTAC", 4);
+    header.version = ANALYSIS_CACHE_VERSION;
+    if (!cache->output || fwrite(&header, sizeof(CacheHeader), 1, cache->output) != 1) {
+        fprintf(stderr, "Error: Cannot create analysis cache %s\n", cache->temp_path);
+        free_cache(cache);
+        return DFTA_ERROR_FILE_WRITE;
+    }
+    
+    *cache_out = cache;
+    return DFTA_SUCCESS;
+}
+
+// Append an entry to the new file; returns the offset of its components or -1
+static long append_entry(AnalysisCache* cache, const AnalysisKey* key, const CachedComponent* components,
+                         uint32_t count) {
+    long offset = -1;
+    if (fseek(cache->output, 0, SEEK_END) == 0 &&
+        fwrite(key, sizeof(AnalysisKey), 1, cache->output) == 1 &&
+        fwrite(&count, sizeof(count), 1, cache->output) == 1) {
+        offset = ftell(cache->output);
+    }
+    if (offset < 0 || fwrite(components, sizeof(CachedComponent), count, cache->output) != count) {
+        cache->failed = 1;
+        return -1;
+    }
+    return offset;
+}
+
+void analysis_cache_key(AnalysisKey* key, const float* samples, int available, int window_size,
+                        uint32_t sample_rate, int masking) {
+    int count = available < window_size ? available : window_size;
+    if (count < 0) count = 0;
+    
+    // Word-at-a-time multiply-xorshift over the sample bits; the CRC32C is an
+    // independent second check against collisions
+    uint64_t hash = 0x9E3779B97F4A7C15ull ^ (uint64_t)count;
+    for (int i = 0; i < count; i++) {
+        uint32_t bits;
+        memcpy(&bits, &samples[i], sizeof(bits));
+        hash = (hash ^ bits) * 0xFF51AFD7ED558CCDull;
+        hash ^= hash >> 32;
+    }
+    
+    memset(key, 0, sizeof(AnalysisKey));
+    key->hash = hash;
+    key->crc = crc32c(0, samples, (size_t)count * sizeof(float));
+    key->sample_rate = sample_rate;
+    key->window_size = (uint32_t)window_size;
+    key->available = (uint32_t)count;
+    key->masking = masking != 0;
+}
+
+// Queue the cached components of a window starting at start_time and
+// lasting length samples; returns 1 on a hit and 0 if the window has to be
+// analysed
+int analysis_cache_lookup(AnalysisCache* cache, const AnalysisKey* key, double start_time, int length,
+                          SineWaveQueue* queue) {
+    pthread_mutex_lock(&cache->lock);
+    CacheSlot* slot = cache->slot_count ? find_slot(cache, key) : NULL;
+    if (!slot || !slot->used || reserve_buffer(cache, slot->count) != DFTA_SUCCESS) {
+        pthread_mutex_unlock(&cache->lock);
+        return 0;
+    }
+    
+    FILE* source = slot->in_output ? cache->output : cache->input;
+    uint32_t count = slot->count;
+    if (fseek(source, slot->offset, SEEK_SET) != 0 ||
+        fread(cache->buffer, sizeof(CachedComponent), count, source) != count) {
+        pthread_mutex_unlock(&cache->lock);
+        return 0;
+    }
+    
+    // Carry the entry over to the new file
+    if (!slot->in_output) {
+        long offset = append_entry(cache, key, cache->buffer, count);
+        if (offset >= 0) {
+            slot->in_output = 1;
+            slot->offset = offset;
+        }
+    }
+    
+    SineWave wave;
+    wave.start_time = start_time;
+    wave.duration = (double)length / key->sample_rate;
+    for (uint32_t i = 0; i < count; i++) {
+        wave.phase = cache->buffer[i].phase;
+        wave.amplitude = cache->buffer[i].amplitude;
+        wave.frequency = cache->buffer[i].frequency;
+        enqueue_sinewave(queue, &wave);
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return 1;
+}
+
+// Store the components of a freshly analysed window (all of queue)
+void analysis_cache_store(AnalysisCache* cache, const AnalysisKey* key, const SineWaveQueue* queue) {
+    pthread_mutex_lock(&cache->lock);
+    CacheSlot* slot = cache->slot_count ? find_slot(cache, key) : NULL;
+    if ((slot && slot->used) || reserve_buffer(cache, (uint32_t)queue->count) != DFTA_SUCCESS) {
+        pthread_mutex_unlock(&cache->lock);
+        return;
+    }
+    
+    uint32_t count = 0;
+    for (SineWaveNode* node = queue->head; node; node = node->next) {
+        cache->buffer[count].phase = node->wave.phase;
+        cache->buffer[count].amplitude = node->wave.amplitude;
+        cache->buffer[count].frequency = node->wave.frequency;
+        count++;
+    }
+    long offset = append_entry(cache, key, cache->buffer, count);
+    if (offset >= 0 && insert_slot(cache, key, count, 1, offset) != DFTA_SUCCESS) {
+        cache->failed = 1;
+    }
+    pthread_mutex_unlock(&cache->lock);
+}
+
+// Replace the old cache with the entries this encode used, or leave it
+// untouched when the encode failed. Cache trouble never fails the encode.
+void analysis_cache_close(AnalysisCache* cache, int commit) {
+    if (cache->input) {
+        fclose(cache->input);
+        cache->input = NULL;
+    }
+    int closed = fclose(cache->output);
+    cache->output = NULL;
+    
+    int replaced = commit && !cache->failed && closed == 0 && rename(cache->temp_path, cache->path) == 0;
+    if (!replaced) {
+        if (commit) {
+            fprintf(stderr, "Warning: Analysis cache %s could not be written and was left as it was\n",
+                    cache->path);
+        }
+        remove(cache->temp_path);
+    }
+    
+    free_cache(cache);
+}
@@ -1,8 +1,11 @@
- 
+
 #ifndef DFTA_H
 #define DFTA_H
 
+#include <stdio.h>
 #include <stdint.h>
+#include <stddef.h>
+#include "dfta_common.h"
 #include <complex.h>
 
 #ifndef M_PI
@@ -14,48 +17,142 @@
 #define COMPRESSION_MEDIUM 1
 #define COMPRESSION_HIGH   2
 
-// Error codes
-#define DFTA_SUCCESS           0
-#define DFTA_ERROR_FILE_READ   1
-#define DFTA_ERROR_FILE_WRITE  2
-#define DFTA_ERROR_MEMORY      3
-#define DFTA_ERROR_FORMAT      4
+// Output formats
+#define FTAE_FORMAT_RAW     0   // Version 2: time-sorted 20-byte component records + seek table
+#define FTAE_FORMAT_PACKED  1   // Version 4 or 5: checksummed per-window frames of quantized components
+
+// Entropy coding of packed frames
+#define ENTROPY_NONE        0   // Bit-packed fields
+#define ENTROPY_RANGE       1   // Range coder with static per-file context models
+#define ENTROPY_PROB_BITS   12  // Model frequencies sum to 1 << ENTROPY_PROB_BITS
+#define ENTROPY_MAX_SYMBOLS 256
+
+// Channel pair coding
+#define STEREO_CODING_AUTO  0   // Mid/side for pairs whose side signal is weak
+#define STEREO_CODING_LR    1   // Every channel coded on its own
+#define STEREO_CODING_MS    2   // Mid/side for every channel pair
+
+// Channels per FTAE file; pairs are (0,1), (2,3), ... in WAV channel order
+#define DFTA_MAX_CHANNELS   8
+
+// Largest analysis window; adaptive_window_size never picks more
+#define FFT_MAX_SIZE        4096
+
+// Entries of an FFT buffer: the window plus scratch for the mixed-radix
+// and Bluestein transforms (see fft.c)
+#define FFT_BUFFER_SIZE     (3 * FFT_MAX_SIZE)
+
+// Mixed-radix FFT stages: radices are primes up to FFT_MAX_RADIX, or 4
+#define FFT_MAX_RADIX       13
+#define FFT_MAX_FACTORS     16
+
+// Analysis window sizes per sample rate: about 10, 20 and 40 ms (see
+// analysis_window_sizes)
+#define ANALYSIS_SIZES      3
+
+// Psychoacoustic masking: half-Bark partitions (about 52 at 48 kHz) and one
+// table set per analysis window size
+#define MASKING_MAX_PARTITIONS  64
+
+// Progress messages. The command line encoder prints them; libdfta is built
+// with DFTA_LIBRARY and must not write to stdout.
+#ifdef DFTA_LIBRARY
+static inline void dfta_progress(const char* format, ...) { (void)format; }
+#else
+extern int dfta_progress_enabled;   // Cleared by batch mode, whose files run concurrently
+#define dfta_progress(...) do { if (dfta_progress_enabled) printf(__VA_ARGS__); } while (0)
+#endif
 
 // SineWave structure for storing frequency components
 typedef struct {
     int phase;           // Phase in degrees (0-359)
     int amplitude;       // Amplitude (scaled integer)
     int frequency;       // Frequency in Hz
-    float start_time;    // Start time in seconds
-    float duration;      // Duration in seconds
+    double start_time;   // Start time in seconds; a whole number of samples
+    double duration;     // Duration in seconds; a whole number of samples
 } SineWave;
 
-// WAV file header structure
+// WAV format tags
+#define WAV_FORMAT_PCM         0x0001
+#define WAV_FORMAT_IEEE_FLOAT  0x0003
+#define WAV_FORMAT_EXTENSIBLE  0xFFFE  // Real tag is the first two bytes of the sub-format GUID
+
+// RIFF chunk header
+typedef struct {
+    char id[4];
+    uint32_t size;
+} WAVChunk;
+
+// ds64 chunk of an RF64/BW64 file (EBU Tech 3306), holding the 64-bit
+// sizes that the RIFF and data chunk sizes (0xFFFFFFFF) stand in for. The
+// sizes are split into 32-bit halves so the struct has the on-disk layout.
+typedef struct {
+    uint32_t riff_size_low;
+    uint32_t riff_size_high;
+    uint32_t data_size_low;
+    uint32_t data_size_high;
+    uint32_t sample_count_low;
+    uint32_t sample_count_high;
+    uint32_t table_length;      // Further 64-bit chunk sizes, which the encoder does not need
+} DS64Chunk;
+
+// Leading fields of the 'fmt ' chunk
 typedef struct {
-    char riff[4];
-    uint32_t overall_size;
-    char wave[4];
-    char fmt_chunk_marker[4];
-    uint32_t length_of_fmt;
     uint16_t format_type;
     uint16_t channels;
     uint32_t sample_rate;
     uint32_t byterate;
     uint16_t block_align;
     uint16_t bits_per_sample;
-    char data_chunk_header[4];
-    uint32_t data_size;
-} WAVHeader;
+} WAVFormat;
 
-// Audio data structure
+// Audio data structure. Channels are stored one after another (planar):
+// channel c starts at samples + c * sample_count.
 typedef struct {
     float* samples;
-    uint32_t sample_count;
+    uint64_t sample_count;
     uint32_t sample_rate;
     uint16_t channels;
     uint16_t bits_per_sample;
 } AudioData;
 
+// WAV input read a block at a time from a file or a pipe, for the real-time
+// encoder. Streamed WAVs with no data size are read to the end.
+typedef struct {
+    FILE* file;
+    uint32_t sample_rate;
+    uint16_t channels;
+    uint16_t bits_per_sample;
+    int encoding;               // Sample encoding of the data chunk
+    uint32_t frame_bytes;
+    uint64_t remaining;         // Data bytes not read yet
+    uint32_t block_frames;      // Most frames one read returns
+    uint8_t* raw;
+    float* interleaved;
+} WAVStream;
+
+// WAV file read a block at a time behind an async reader, so the encoder
+// can analyse the start of a file while the rest is still being read. The
+// channel planes hold the frames from first to loaded: the caller discards
+// frames it is done with, so memory follows what it still reads rather than
+// the file length.
+typedef struct {
+    FILE* file;
+    AsyncIO* io;
+    AudioData* audio;           // Format and sample count; its samples stay NULL
+    int encoding;               // Sample encoding of the data chunk
+    uint16_t channels;          // Planes the data fills; audio may be downmixed to fewer
+    uint32_t frame_bytes;
+    long data_start;            // File offset of the first frame
+    int seekable;               // Can go back for another pass (not a pipe)
+    float* planes;              // Plane c holds frame first + i at planes[c * capacity + i]
+    uint64_t capacity;          // Frames each plane holds
+    uint64_t first;             // First frame still held
+    uint64_t loaded;            // Frames read so far
+    uint8_t* raw;               // One block as read; NULL for mono float, read in place
+    float* interleaved;         // One block converted, multichannel only
+} WAVInput;
+
 // Encoding configuration
 typedef struct {
     int compression_level;
@@ -64,8 +161,122 @@ typedef struct {
     float frequency_max;
     float phase_tolerance;
     float similarity_threshold;
+    int output_format;          // FTAE_FORMAT_* layout to write
+    int entropy_coding;         // ENTROPY_* coder for packed frames
+    int stereo_coding;          // STEREO_CODING_* for channel pairs
+    int masking;                // Drop components under the psychoacoustic masking threshold
+    int deduplicate;            // Store repeated frame groups as back-references (packed, not live)
+    int stationary;             // Skip silent windows and extend components over stationary ones
+    const char* analysis_cache; // Cache file of analysed windows, or NULL for none
 } EncodingConfig;
 
+// Tables for one window size that is not a power of two: mixed-radix
+// stages when its prime factors are small, Bluestein's algorithm otherwise
+typedef struct {
+    int n;
+    int factors[2 * FFT_MAX_FACTORS];  // Per stage: radix, then the size below it
+    int factor_count;           // 0 for Bluestein
+    double complex* twiddles;   // exp(-2 pi i j / n), mixed radix only
+    double complex* chirp;      // exp(-i pi j^2 / n), Bluestein only
+    double complex* filter;     // Transformed conjugate chirp over m points, scaled by 1 / m
+    int m;                      // Power-of-two convolution size, Bluestein only
+    float* window;              // Hann window of size n
+} FFTSizePlan;
+
+// Butterfly twiddles and Hann windows for every power-of-two size up to
+// FFT_MAX_SIZE, plus the sizes passed to fft_plan_prepare; computed once and
+// shared by all channels
+typedef struct {
+    double complex* twiddles;   // Stage of length len starts at twiddles[len / 2 - 1]
+    float* windows;             // Window of size n starts at windows[n - 2]
+    FFTSizePlan sizes[ANALYSIS_SIZES];
+    int size_count;
+} FFTPlan;
+
+// One analysis window. A channel's windows are planned before any FFT runs,
+// so ranges of them can be analysed on different threads.
+typedef struct {
+    int64_t position;           // First sample
+    int size;                   // Even, 64 to FFT_MAX_SIZE
+    int length;                 // Samples its components last: size, or more over stationary windows
+} AnalysisWindow;
+
+// Windows an analysis plan leaves out
+typedef struct {
+    int silent;                 // Nothing in them could pass the amplitude threshold
+    int stationary;             // Covered by extending the analysed windows before them
+} WindowSkips;
+
+// Masking tables for one sample rate (see masking.c). Bins of window size
+// sizes[s] start at bin_offset[s] in bin_partition and bin_quiet.
+typedef struct {
+    uint32_t sample_rate;       // 0 until prepared
+    int partition_count;
+    float* tonal_spread;        // [masker * MASKING_MAX_PARTITIONS + maskee], offset for tonal maskers included
+    float* noise_spread;        // The same for noise maskers
+    uint8_t* bin_partition;
+    float* bin_quiet;           // Absolute threshold of hearing as a squared FFT magnitude
+    int sizes[ANALYSIS_SIZES];
+    int size_count;
+    int bin_offset[ANALYSIS_SIZES];
+    float bin_share[ANALYSIS_SIZES][MASKING_MAX_PARTITIONS];  // 1 / bins in the partition
+} MaskingModel;
+
+// FTAE output written as frames are finished (see ftae_io.c)
+typedef struct FTAEWriter FTAEWriter;
+
+// Everything one window's analysis depends on except its position
+typedef struct {
+    uint64_t hash;              // Of the sample bits
+    uint32_t crc;               // CRC32C of the samples
+    uint32_t sample_rate;
+    uint32_t window_size;
+    uint32_t available;         // Samples present; the rest of the window is silence
+    uint32_t masking;
+} AnalysisKey;
+
+// On-disk cache of analysed windows (see cache.c)
+typedef struct AnalysisCache AnalysisCache;
+
+// Encoder state that outlives one file: FFT tables, masking tables for the
+// last sample rate, one window buffer per channel and optionally a worker
+// pool. libdfta keeps one per encoder handle.
+typedef struct {
+    FFTPlan fft;
+    MaskingModel masking;
+    double complex* window_buffers[DFTA_MAX_CHANNELS];  // FFT_BUFFER_SIZE entries each
+    WorkerPool* pool;           // NULL starts a thread per channel on every call
+} EncoderContext;
+
+// Growable LSB-first bit writer used for packed FTAE frames
+typedef struct {
+    uint8_t* data;
+    size_t size;                // Complete bytes in data
+    size_t capacity;
+    uint64_t accumulator;       // Pending bits not yet spilled into data
+    int bit_count;
+    int failed;                 // Set if a buffer allocation failed
+} BitWriter;
+
+// Symbol distribution of one component field, counted over the whole file
+// and normalized to 1 << ENTROPY_PROB_BITS
+typedef struct {
+    int symbol_count;
+    uint32_t counts[ENTROPY_MAX_SYMBOLS];
+    uint16_t freq[ENTROPY_MAX_SYMBOLS];
+    uint16_t start[ENTROPY_MAX_SYMBOLS];  // Cumulative frequency below each symbol
+} EntropyModel;
+
+// Range encoder writing one frame payload into a growable buffer
+typedef struct {
+    uint8_t* data;
+    size_t size;
+    size_t capacity;
+    uint32_t low;
+    uint32_t range;
+    int failed;                 // Set if a buffer allocation failed
+} RangeEncoder;
+
 // SineWave queue for managing frequency components
 typedef struct SineWaveNode {
     SineWave wave;
@@ -78,32 +289,134 @@ typedef struct {
     int count;
 } SineWaveQueue;
 
+// Earlier survivors a filter still compares new components with, oldest first
+typedef struct {
+    SineWave* waves;
+    uint32_t first;             // Oldest entry still needed
+    uint32_t count;             // Entries from first on
+    uint32_t capacity;
+} RecentWaves;
+
+// Component filter over a sliding window. Components are fed in start_time
+// order and each is decided on arrival: the phase and similarity filters only
+// compare it with the earlier survivors that are still close enough in time.
+typedef struct {
+    float frequency_min;
+    float frequency_max;
+    int amplitude_threshold;    // Scaled like SineWave.amplitude
+    float phase_tolerance;
+    float similarity_threshold;
+    int bounded;                // Similarity never reaches past FILTER_SIMILARITY_SECONDS
+    RecentWaves phase_recent;   // Survivors of the phase filter
+    RecentWaves similar_recent; // Survivors of every filter
+    int frequency_removed;
+    int amplitude_removed;
+    int phase_removed;
+    int similarity_removed;
+} ComponentFilter;
+
 // Function declarations - ENCODER ONLY
 int encode_audio_file(const char* input_file, const char* output_file, const EncodingConfig* config);
+int encode_audio(EncoderContext* context, AudioData* audio_data, FILE* output, const EncodingConfig* config);
+int encoder_context_init(EncoderContext* context, int threads);
+void encoder_context_free(EncoderContext* context);
+int encode_batch(const char* manifest_file, const EncodingConfig* config, int threads);
+int encode_realtime(FILE* input, FILE* output, const EncodingConfig* config, int window_size);
+void adjust_config_for_compression_level(EncodingConfig* config);
+uint32_t prepare_channels(AudioData* audio_data, const EncodingConfig* config);
 int read_wav_file(const char* filename, AudioData* audio_data);
-int write_ftae_file(const char* filename, SineWaveQueue* queue, const AudioData* original_audio, const EncodingConfig* config);
+int wav_input_open(WAVInput* input, const char* filename, AudioData* audio_data);
+int wav_input_load(WAVInput* input, uint64_t frames);
+void wav_input_discard(WAVInput* input, uint64_t frames);
+int wav_input_rewind(WAVInput* input);
+void wav_input_truncate(WAVInput* input);
+void wav_input_close(WAVInput* input);
+int wav_stream_open(WAVStream* stream, FILE* file, uint32_t block_frames);
+uint32_t wav_stream_read(WAVStream* stream, float* const* planes, uint32_t frames);
+void wav_stream_close(WAVStream* stream);
+int write_ftae_stream(FILE* file, SineWaveQueue* const* queues, uint32_t mid_side_pairs,
+                      const AudioData* original_audio, const EncodingConfig* config);
+int ftae_writer_open(FTAEWriter** writer, FILE* file, uint32_t sample_rate, uint16_t channels,
+                     uint32_t mid_side_pairs, uint64_t sample_count, const EncodingConfig* config, int live);
+int ftae_writer_add(FTAEWriter* writer, SineWaveQueue* const* queues);
+int ftae_writer_close(FTAEWriter* writer, uint64_t sample_count, uint64_t original_size, uint64_t* size);
+void ftae_writer_free(FTAEWriter* writer);
+int analysis_cache_open(AnalysisCache** cache, const char* path);
+void analysis_cache_key(AnalysisKey* key, const float* samples, int available, int window_size,
+                        uint32_t sample_rate, int masking);
+int analysis_cache_lookup(AnalysisCache* cache, const AnalysisKey* key, double start_time, int length,
+                          SineWaveQueue* queue);
+void analysis_cache_store(AnalysisCache* cache, const AnalysisKey* key, const SineWaveQueue* queue);
+void analysis_cache_close(AnalysisCache* cache, int commit);
 void free_audio_data(AudioData* audio_data);
 
 // FFT functions
+int fft_plan_init(FFTPlan* plan);
+int fft_plan_prepare(FFTPlan* plan, const int* sizes, int count);
+void fft_plan_free(FFTPlan* plan);
+const float* fft_window(const FFTPlan* plan, int n);
+void fft_forward(const FFTPlan* plan, double complex* data, int n);
 void fft_radix2(double complex* data, int n, int inverse);
+int fft_mixed_radix(double complex* data, int n, int inverse);
 int next_power_of_2(int n);
-int adaptive_window_size(const float* samples, int start, int max_size, int sample_rate);
+void analysis_window_sizes(uint32_t sample_rate, int* sizes);
+int adaptive_window_size(const float* samples, int start, int max_size, const int* sizes);
 
 // SineWave queue functions
 SineWaveQueue* create_sinewave_queue(void);
 void enqueue_sinewave(SineWaveQueue* queue, const SineWave* wave);
+void clear_sinewave_queue(SineWaveQueue* queue);
 void free_sinewave_queue(SineWaveQueue* queue);
+void append_sinewave_queue(SineWaveQueue* queue, SineWaveQueue* other);
+void sort_sinewave_queue_by_time(SineWaveQueue* queue);
+
+// Bit packing functions
+void bitwriter_init(BitWriter* writer);
+void bitwriter_reset(BitWriter* writer);
+void bitwriter_free(BitWriter* writer);
+void bitwriter_put(BitWriter* writer, uint32_t value, int bits);
+void bitwriter_put_expgolomb(BitWriter* writer, uint32_t value);
+void bitwriter_flush(BitWriter* writer);
+
+// Entropy coding functions
+void entropy_model_init(EntropyModel* model, int symbol_count);
+void entropy_model_count(EntropyModel* model, int symbol);
+void entropy_model_normalize(EntropyModel* model);
+double entropy_model_cost(const EntropyModel* model);
+void entropy_model_write(const EntropyModel* model, BitWriter* writer);
+void range_encoder_init(RangeEncoder* encoder);
+void range_encoder_reset(RangeEncoder* encoder);
+void range_encoder_free(RangeEncoder* encoder);
+void range_encode_symbol(RangeEncoder* encoder, const EntropyModel* model, int symbol);
+void range_encode_bits(RangeEncoder* encoder, uint32_t value, int bits);
+void range_encoder_flush(RangeEncoder* encoder);
+
+// Psychoacoustic masking functions
+int masking_model_prepare(MaskingModel* model, uint32_t sample_rate, const int* sizes, int count);
+void masking_model_free(MaskingModel* model);
+int apply_masking(const MaskingModel* model, double complex* fft_data, int fft_size);
 
 // Filtering and optimization functions
-void apply_frequency_filtering(SineWaveQueue* queue, float min_freq, float max_freq);
-void apply_amplitude_filtering(SineWaveQueue* queue, float threshold);
-void apply_phase_optimization(SineWaveQueue* queue, float tolerance);
-void apply_similarity_filtering(SineWaveQueue* queue, float threshold);
+void component_filter_init(ComponentFilter* filter, const EncodingConfig* config);
+void component_filter_free(ComponentFilter* filter);
+int component_filter_apply(ComponentFilter* filter, SineWaveQueue* input, SineWaveQueue* output);
+void component_filter_report(const ComponentFilter* filter);
 
 // Analysis functions
+int plan_analysis_windows(const float* samples, uint64_t sample_count, uint32_t sample_rate,
+                          const EncodingConfig* config, AnalysisWindow** windows, WindowSkips* skips);
+int window_is_silent(const float* samples, int count, const EncodingConfig* config);
+int analyze_window(const FFTPlan* fft, double complex* fft_data, const float* samples, int available,
+                   int window_size, int length, uint32_t sample_rate, double start_time,
+                   const MaskingModel* masking, SineWaveQueue* queue);
+int analyze_windows(const FFTPlan* fft, double complex* fft_data, const float* samples,
+                    uint64_t sample_count, uint32_t sample_rate,
+                    const AnalysisWindow* windows, int count, const MaskingModel* masking,
+                    SineWaveQueue* queue);
+int filter_components(SineWaveQueue* queue, const EncodingConfig* config);
 float calculate_signal_complexity(const float* samples, int window_size);
 void extract_sinewave_components(const double complex* fft_data, int fft_size, 
-                                float sample_rate, float start_time, float duration,
+                                float sample_rate, double start_time, double duration,
                                 SineWaveQueue* queue);
 
 #endif // DFTA_H
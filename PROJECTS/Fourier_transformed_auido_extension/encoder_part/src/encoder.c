@@ -2,10 +2,44 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 #include <math.h>
 #include <complex.h>
 #include "dfta.h"
 
+// Auto stereo coding uses mid/side when the side energy is this far below
+// the mid energy (about 5 dB)
+#define MID_SIDE_ENERGY_RATIO 0.3
+
+// Seconds of windows analysed per channel before their frames are written
+// and freed
+#define ENCODE_BLOCK_SECONDS 1.0f
+
+// Content-defined sync points: a window always starts right after a sample
+// where the rolling hash of the last 64 samples has its top SYNC_HASH_BITS
+// bits clear, at least SYNC_MIN_SAMPLES after the previous sync point (about
+// every 0.5 s at 44.1 kHz). The grid between sync points depends only on the
+// samples, so after an edit the windows downstream realign with the old ones
+// at the next common sync point and the analysis cache can serve them.
+#define SYNC_MIN_SAMPLES 8192
+#define SYNC_HASH_BITS   14
+
+// Stationary windows: a window whose mean energy, zero-crossing rate and
+// difference energy (a time-domain stand-in for the spectral centroid) all
+// stay this close to those of the window that started its run is not
+// analysed. The two analysed windows before it are extended over it instead,
+// so every sample stays covered by two windows' components as with 50% overlap.
+#define STATIONARY_ENERGY_TOLERANCE   0.1     // Relative, about 0.4 dB
+#define STATIONARY_CROSSING_TOLERANCE 0.05    // Relative, plus two crossings
+#define STATIONARY_CENTROID_TOLERANCE 0.02    // Relative
+// The features are measured over a span of this many window lengths
+// centred on the window
+#define STATIONARY_SPAN_WINDOWS       2
+// Longest an extended window's components last. Slow drifts are picked up
+// at least this often, and a decoder seeking into the file never has to
+// look further back for components still sounding.
+#define STATIONARY_MAX_SECONDS        0.5
+
 void adjust_config_for_compression_level(EncodingConfig* config) {
     switch (config->compression_level) {
         case COMPRESSION_LOW:
@@ -22,121 +56,858 @@ void adjust_config_for_compression_level(EncodingConfig* config) {
     }
 }
 
-int encode_audio_file(const char* input_file, const char* output_file, const EncodingConfig* config) {
-    AudioData audio_data = {0};
-    SineWaveQueue* wave_queue = NULL;
-    int result = DFTA_SUCCESS;
+// Per-sample step of the sync point hash (a gear hash: each sample's
+// contribution is shifted out after 64 more)
+static uint64_t sync_gear(float sample) {
+    uint32_t bits;
+    memcpy(&bits, &sample, sizeof(bits));
+    uint64_t mixed = bits * 0x9E3779B97F4A7C15ull;
+    return mixed ^ (mixed >> 29);
+}
+
+// Samples of the window at position that the input still holds; the rest
+// of a window reaching past the end is silence
+static int window_available(uint64_t sample_count, int64_t position) {
+    uint64_t available = sample_count - (uint64_t)position;
+    return available < INT_MAX ? (int)available : INT_MAX;
+}
+
+// Cheap features of the samples around a window for the stationarity check
+typedef struct {
+    double energy;              // Mean square
+    double crossings;           // Zero crossings per sample, counted as in calculate_signal_complexity
+    double centroid;            // Mean square of the first difference over the mean square: the
+                                // power-weighted mean of 4 sin^2(pi f / rate) over the spectrum
+} WindowFeatures;
+
+// Measure the features over a span of samples, weighted with a Hann taper.
+// A window rarely holds a whole number of periods of a low tone, and
+// measured over just the window, the part period at its edges moves them
+// by up to a third from one hop to the next (60 Hz hum in 20 or 40 ms).
+// Tapered at both ends over a span of two windows, they stay within the
+// stationary tolerances.
+static void measure_span(const float* samples, int count, WindowFeatures* features) {
+    double energy = 0.0;
+    double difference = 0.0;
+    double crossings = 0.0;
+    double weight = 0.0;
+    memset(features, 0, sizeof(WindowFeatures));
+    if (count <= 0) return;
     
-    // Read input WAV file
-    result = read_wav_file(input_file, &audio_data);
-    if (result != DFTA_SUCCESS) {
-        goto cleanup;
+    // cos(2 pi i / count) by rotation, rather than a cos() per sample
+    double rotate_cos = cos(2.0 * M_PI / count);
+    double rotate_sin = sin(2.0 * M_PI / count);
+    double phase_cos = 1.0;
+    double phase_sin = 0.0;
+    for (int i = 0; i < count; i++) {
+        double taper = 0.5 - 0.5 * phase_cos;
+        double next_cos = phase_cos * rotate_cos - phase_sin * rotate_sin;
+        phase_sin = phase_sin * rotate_cos + phase_cos * rotate_sin;
+        phase_cos = next_cos;
+        
+        weight += taper;
+        energy += taper * samples[i] * samples[i];
+        if (i > 0) {
+            double step = (double)samples[i] - samples[i - 1];
+            difference += taper * step * step;
+            if ((samples[i] >= 0) != (samples[i - 1] >= 0)) crossings += taper;
+        }
+    }
+    features->energy = weight > 0.0 ? energy / weight : 0.0;
+    features->crossings = weight > 0.0 ? crossings / weight : 0.0;
+    features->centroid = energy > 0.0 ? difference / energy : 0.0;
+}
+
+// Sum of absolute values, which no FFT bin of the window can exceed
+static double window_magnitude(const float* samples, int count) {
+    double magnitude = 0.0;
+    for (int i = 0; i < count; i++) {
+        magnitude += fabs(samples[i]);
     }
+    return magnitude;
+}
+
+// Whether no component of a window with this magnitude sum can be kept:
+// extraction drops bins under 0.001 and the filter amplitudes under the
+// threshold, and windowing and masking only lower bins
+static int magnitude_is_silent(double magnitude, const EncodingConfig* config) {
+    int threshold = (int)(config->amplitude_threshold * 1000);  // As the component filter scales it
+    double floor = threshold > 1 ? threshold : 1;
+    return magnitude * 1000.0 * (1.0 + 1e-6) < floor;
+}
+
+int window_is_silent(const float* samples, int count, const EncodingConfig* config) {
+    return magnitude_is_silent(window_magnitude(samples, count), config);
+}
+
+static int within_tolerance(double value, double reference, double tolerance, double slack) {
+    return fabs(value - reference) <= tolerance * reference + slack;
+}
+
+static int window_is_stationary(const WindowFeatures* features, const WindowFeatures* reference, int size) {
+    return within_tolerance(features->energy, reference->energy, STATIONARY_ENERGY_TOLERANCE, 0.0) &&
+           within_tolerance(features->crossings, reference->crossings, STATIONARY_CROSSING_TOLERANCE, 2.0 / size) &&
+           within_tolerance(features->centroid, reference->centroid, STATIONARY_CENTROID_TOLERANCE, 0.0);
+}
+
+// Window plan of one channel, extended as its samples arrive. Window sizes
+// depend only on the samples, never on FFT results, so a window is fixed as
+// soon as the samples it reads are present; its length is fixed once the
+// plan has moved STATIONARY_MAX_SECONDS past it.
+typedef struct {
+    AnalysisWindow* windows;
+    int count;
+    int capacity;
+    int sizes[ANALYSIS_SIZES];
+    int span;                   // Longest span the stationarity features are measured over
+    int64_t sample_pos;         // Start of the next window to plan
+    uint64_t sync_hash;
+    int64_t last_sync;
+    // Stationarity is judged against the first window of a run; runs restart
+    // at sync points so the plan after one depends only on the samples after it
+    WindowFeatures reference;
+    int run_analysed;           // Analysed windows in the current run, 0 for none
+    int64_t max_length;         // Longest a window's components last
+    int done;                   // Every sample is covered
+} WindowPlanner;
+
+static int window_planner_init(WindowPlanner* planner, uint32_t sample_rate) {
+    memset(planner, 0, sizeof(WindowPlanner));
+    planner->capacity = 256;
+    planner->windows = malloc(planner->capacity * sizeof(AnalysisWindow));
+    if (!planner->windows) return DFTA_ERROR_MEMORY;
+    analysis_window_sizes(sample_rate, planner->sizes);
+    planner->span = STATIONARY_SPAN_WINDOWS * planner->sizes[ANALYSIS_SIZES - 1];
+    planner->max_length = (int64_t)(STATIONARY_MAX_SECONDS * sample_rate);
+    return DFTA_SUCCESS;
+}
+
+// Samples past the end of a planned block that the plan has to see before
+// the block's windows and their lengths are final
+static uint64_t window_planner_margin(const WindowPlanner* planner) {
+    return (uint64_t)planner->max_length + planner->span;
+}
+
+// Plan the windows whose samples are among the first loaded of
+// sample_count; samples holds the input from sample offset on. Planning a
+// window reads at most a span from its start, so the plan stops short of
+// that until the whole input is there, and never more than a span before it.
+static int window_planner_run(WindowPlanner* planner, const float* samples, int64_t offset,
+                              uint64_t sample_count, uint64_t loaded, const EncodingConfig* config,
+                              WindowSkips* skips) {
+    const int* sizes = planner->sizes;
+    int64_t lookahead = planner->span;
     
-    // Create SineWave queue
-    wave_queue = create_sinewave_queue();
-    if (!wave_queue) {
-        result = DFTA_ERROR_MEMORY;
-        goto cleanup;
+    while (!planner->done) {
+        int64_t sample_pos = planner->sample_pos;
+        if (sample_pos >= (int64_t)sample_count) {
+            planner->done = 1;
+            break;
+        }
+        if (loaded < sample_count && sample_pos + lookahead > (int64_t)loaded) break;
+        
+        // Determine adaptive window size. The last window keeps its size and
+        // is zero-padded past the end, so every sample is analysed.
+        int64_t remaining_samples = (int64_t)sample_count - sample_pos;
+        int window_size = adaptive_window_size(samples + (sample_pos - offset), 0,
+                                               remaining_samples < INT_MAX ? (int)remaining_samples : INT_MAX,
+                                               sizes);
+        
+        AnalysisWindow* list = planner->windows;
+        int count = planner->count;
+        int analyse = 1;
+        if (config->stationary) {
+            int available = remaining_samples < window_size ? (int)remaining_samples : window_size;
+            int silent = magnitude_is_silent(window_magnitude(samples + (sample_pos - offset), available), config);
+            
+            // The span is centred on the window, but stays between the last
+            // sync point and the end
+            WindowFeatures features;
+            if (!silent) {
+                int64_t span = STATIONARY_SPAN_WINDOWS * window_size;
+                int64_t span_start = sample_pos + window_size / 2 - span / 2;
+                if (span_start > (int64_t)sample_count - span) {
+                    span_start = (int64_t)sample_count - span;
+                }
+                if (span_start < planner->last_sync) span_start = planner->last_sync;
+                int64_t span_end = span_start + span;
+                if (span_end > (int64_t)sample_count) span_end = (int64_t)sample_count;
+                measure_span(samples + (span_start - offset), (int)(span_end - span_start), &features);
+            }
+            
+            if (silent) {
+                analyse = 0;
+                planner->run_analysed = 0;
+                skips->silent++;
+            } else if (planner->run_analysed > 0 && available == window_size &&
+                       window_size == list[count - 1].size &&
+                       window_is_stationary(&features, &planner->reference, window_size)) {
+                if (planner->run_analysed == 1) {
+                    // The run needs a second, overlapping window to extend
+                    planner->run_analysed = 2;
+                } else {
+                    // Extend whichever of the run's two windows ends first
+                    AnalysisWindow* target = &list[count - 2];
+                    if (list[count - 1].position + list[count - 1].length < target->position + target->length) {
+                        target = &list[count - 1];
+                    }
+                    int64_t length = sample_pos + window_size - target->position;
+                    if (length <= planner->max_length) {
+                        target->length = (int)length;
+                        analyse = 0;
+                        skips->stationary++;
+                    } else {
+                        planner->reference = features;
+                        planner->run_analysed = 1;
+                    }
+                }
+            } else {
+                planner->reference = features;
+                planner->run_analysed = 1;
+            }
+        }
+        
+        if (analyse) {
+            if (count == planner->capacity) {
+                AnalysisWindow* grown = realloc(list, 2 * planner->capacity * sizeof(AnalysisWindow));
+                if (!grown) return DFTA_ERROR_MEMORY;
+                planner->windows = list = grown;
+                planner->capacity *= 2;
+            }
+            list[count].position = sample_pos;
+            list[count].size = window_size;
+            list[count].length = window_size;
+            planner->count++;
+        }
+        if (window_size >= remaining_samples) {
+            planner->done = 1;
+            break;
+        }
+        
+        // Move to next window with 50% overlap, or to a sync point before
+        // that. The hash covers every sample once, in order, so it only
+        // depends on the samples and not on where the windows fell.
+        int64_t next_pos = sample_pos + window_size / 2;
+        while (sample_pos < next_pos && sample_pos < (int64_t)sample_count) {
+            planner->sync_hash = (planner->sync_hash << 1) + sync_gear(samples[sample_pos - offset]);
+            sample_pos++;
+            if (sample_pos - planner->last_sync >= SYNC_MIN_SAMPLES &&
+                (planner->sync_hash >> (64 - SYNC_HASH_BITS)) == 0) {
+                planner->last_sync = sample_pos;
+                next_pos = sample_pos;
+                planner->run_analysed = 0;
+            }
+        }
+        planner->sample_pos = next_pos;
+    }
+    return DFTA_SUCCESS;
+}
+
+int plan_analysis_windows(const float* samples, uint64_t sample_count, uint32_t sample_rate,
+                          const EncodingConfig* config, AnalysisWindow** windows, WindowSkips* skips) {
+    WindowPlanner planner;
+    memset(skips, 0, sizeof(WindowSkips));
+    if (window_planner_init(&planner, sample_rate) != DFTA_SUCCESS ||
+        window_planner_run(&planner, samples, 0, sample_count, sample_count, config, skips) != DFTA_SUCCESS) {
+        free(planner.windows);
+        return -1;
+    }
+    *windows = planner.windows;
+    return planner.count;
+}
+
+// Analyse one window whose first available samples are present (the rest is
+// silence) and queue its components, lasting length samples
+int analyze_window(const FFTPlan* fft, double complex* fft_data, const float* samples, int available,
+                   int window_size, int length, uint32_t sample_rate, double start_time,
+                   const MaskingModel* masking, SineWaveQueue* queue) {
+    // Copy audio samples to the FFT buffer with a Hann window to reduce
+    // spectral leakage
+    const float* window = fft_window(fft, window_size);
+    for (int i = 0; i < window_size; i++) {
+        fft_data[i] = i < available ? samples[i] * window[i] : 0.0;
     }
     
-    // Make a copy of config to adjust for compression level
-    EncodingConfig working_config = *config;
-    adjust_config_for_compression_level(&working_config);
+    // Perform FFT
+    fft_forward(fft, fft_data, window_size);
     
-    printf("\nStarting FFT analysis with adaptive windowing...\n");
+    // Clear bins the rest of the window masks
+    if (masking) {
+        int result = apply_masking(masking, fft_data, window_size);
+        if (result != DFTA_SUCCESS) return result;
+    }
     
-    // Process audio in overlapping windows
-    int sample_pos = 0;
-    int window_count = 0;
-    const float overlap = 0.5f;  // 50% overlap
+    // Extract SineWave components
+    double duration = (double)length / sample_rate;
+    extract_sinewave_components(fft_data, window_size, (float)sample_rate,
+                              start_time, duration, queue);
+    return DFTA_SUCCESS;
+}
+
+int analyze_windows(const FFTPlan* fft, double complex* fft_data, const float* samples,
+                    uint64_t sample_count, uint32_t sample_rate,
+                    const AnalysisWindow* windows, int count, const MaskingModel* masking,
+                    SineWaveQueue* queue) {
+    for (int w = 0; w < count; w++) {
+        int64_t sample_pos = windows[w].position;
+        int result = analyze_window(fft, fft_data, samples + sample_pos, window_available(sample_count, sample_pos),
+                                    windows[w].size, windows[w].length, sample_rate,
+                                    (double)sample_pos / sample_rate, masking, queue);
+        if (result != DFTA_SUCCESS) return result;
+    }
+    return DFTA_SUCCESS;
+}
+
+int filter_components(SineWaveQueue* queue, const EncodingConfig* config) {
+    ComponentFilter filter;
+    component_filter_init(&filter, config);
     
-    while (sample_pos < (int)audio_data.sample_count) {
-        // Determine adaptive window size
-        int remaining_samples = audio_data.sample_count - sample_pos;
-        int window_size = adaptive_window_size(audio_data.samples, sample_pos, 
-                                             remaining_samples, audio_data.sample_rate);
-        
-        if (window_size < 64) break;  // Too small to process meaningfully
+    // Frequency and amplitude limits, opposite-phase pairs and similarity
+    // merges in one pass; the survivors go back into queue
+    SineWaveQueue input = *queue;
+    queue->head = NULL;
+    queue->tail = NULL;
+    queue->count = 0;
+    int result = component_filter_apply(&filter, &input, queue);
+    
+    component_filter_report(&filter);
+    component_filter_free(&filter);
+    return result;
+}
+
+// Analysis state for one channel; each block of windows is one worker task
+typedef struct {
+    const FFTPlan* fft;
+    const MaskingModel* masking;  // NULL keeps every component
+    const EncodingConfig* config; // Adjusted for the compression level
+    double complex* fft_data;   // FFT_MAX_SIZE entries, reused for every window
+    const float* samples;       // The channel's samples held, from offset on
+    int64_t offset;
+    uint64_t sample_count;
+    uint64_t loaded;            // Samples read and prepared so far
+    uint32_t sample_rate;
+    int channel;
+    int channel_count;
+    WindowPlanner plan;         // Extended by each block
+    int next_window;
+    double block_end;           // Windows starting before this belong to the current block
+    ComponentFilter filter;
+    SineWaveQueue* scratch;     // Components of the window being filtered
+    SineWaveQueue* queue;       // Filtered components of the current block
+    AnalysisCache* cache;       // NULL analyses every window
+    int raw_count;              // Components before filtering
+    int final_count;            // Components written
+    int cache_hits;             // Windows served from the cache
+    WindowSkips skips;          // Windows the plan left out
+    int result;
+} ChannelAnalysis;
+
+// Plan the windows the loaded samples allow, then analyse and filter the
+// ones that start before block_end
+static void* analyze_block(void* arg) {
+    ChannelAnalysis* analysis = arg;
+    
+    if (window_planner_run(&analysis->plan, analysis->samples, analysis->offset, analysis->sample_count,
+                           analysis->loaded, analysis->config, &analysis->skips) != DFTA_SUCCESS) {
+        analysis->result = DFTA_ERROR_MEMORY;
+        return NULL;
+    }
+    
+    while (analysis->result == DFTA_SUCCESS && analysis->next_window < analysis->plan.count) {
+        int64_t sample_pos = analysis->plan.windows[analysis->next_window].position;
+        double start_time = (double)sample_pos / analysis->sample_rate;
+        if (!(start_time < analysis->block_end)) break;
         
-        // Ensure window size is power of 2
-        window_size = next_power_of_2(window_size);
-        if (window_size > remaining_samples) {
-            window_size = next_power_of_2(remaining_samples / 2);
+        const float* samples = analysis->samples + (sample_pos - analysis->offset);
+        int available = window_available(analysis->sample_count, sample_pos);
+        int window_size = analysis->plan.windows[analysis->next_window].size;
+        int length = analysis->plan.windows[analysis->next_window].length;
+        AnalysisKey key;
+        if (analysis->cache) {
+            analysis_cache_key(&key, samples, available, window_size, analysis->sample_rate,
+                               analysis->masking != NULL);
+        }
+        if (analysis->cache && analysis_cache_lookup(analysis->cache, &key, start_time, length, analysis->scratch)) {
+            analysis->cache_hits++;
+        } else {
+            analysis->result = analyze_window(analysis->fft, analysis->fft_data, samples, available,
+                                              window_size, length, analysis->sample_rate, start_time,
+                                              analysis->masking, analysis->scratch);
+            if (analysis->result != DFTA_SUCCESS) break;
+            if (analysis->cache) {
+                analysis_cache_store(analysis->cache, &key, analysis->scratch);
+            }
         }
+        analysis->raw_count += analysis->scratch->count;
+        analysis->result = component_filter_apply(&analysis->filter, analysis->scratch, analysis->queue);
+        analysis->next_window++;
         
-        if (window_size < 64) break;
+        // Report every 100 windows
+        if (analysis->next_window % 100 == 0) {
+            if (analysis->channel_count > 1) {
+                dfta_progress("  Channel %d: processed %d windows, %d components so far\n",
+                              analysis->channel, analysis->next_window, analysis->raw_count);
+            } else {
+                dfta_progress("  Processed %d windows, %d components so far\n",
+                              analysis->next_window, analysis->raw_count);
+            }
+        }
+    }
+    return NULL;
+}
+
+// Add the mid and side energy of each channel pair over the samples from
+// (inclusive) to to (exclusive) of planes stride samples apart. Auto stereo
+// coding weighs whole channels, so this runs over every sample of the file.
+static void add_pair_energy(const float* samples, uint64_t stride, int channels, uint64_t from, uint64_t to,
+                            double* mid_energy, double* side_energy) {
+    for (int pair = 0; 2 * pair + 1 < channels; pair++) {
+        const float* left = samples + (size_t)(2 * pair) * stride;
+        const float* right = left + stride;
+        double mid_sum = mid_energy[pair];
+        double side_sum = side_energy[pair];
+        for (uint64_t i = from; i < to; i++) {
+            double mid = 0.5 * ((double)left[i] + right[i]);
+            double side = 0.5 * ((double)left[i] - right[i]);
+            mid_sum += mid * mid;
+            side_sum += side * side;
+        }
+        mid_energy[pair] = mid_sum;
+        side_energy[pair] = side_sum;
+    }
+}
+
+// Pick the channel pairs to code as mid = (l + r) / 2 and side = (l - r) / 2,
+// auto coding from the pairs' energies (see add_pair_energy). Returns the
+// mid/side pair bits for the file header.
+static uint32_t choose_mid_side(const double* mid_energy, const double* side_energy, int channels,
+                                int stereo_coding) {
+    uint32_t pairs = 0;
+    
+    for (int pair = 0; 2 * pair + 1 < channels; pair++) {
+        // Side energy well below mid energy means the pair is strongly
+        // correlated and the side channel will mostly fall under the
+        // amplitude threshold
+        int use_mid_side = stereo_coding == STEREO_CODING_MS ||
+                           (stereo_coding == STEREO_CODING_AUTO &&
+                            side_energy[pair] < MID_SIDE_ENERGY_RATIO * mid_energy[pair]);
+        if (!use_mid_side) continue;
         
-        // Prepare FFT input data
-        double complex* fft_data = calloc(window_size, sizeof(double complex));
-        if (!fft_data) {
+        pairs |= 1u << pair;
+        dfta_progress("Channels %d/%d: coded as mid/side\n", 2 * pair, 2 * pair + 1);
+    }
+    return pairs;
+}
+
+// Prepare samples from (inclusive) to to (exclusive) of planes stride
+// samples apart for analysis: average the source_channels planes into the
+// first when the raw layout dropped the channels to mono, and apply the
+// mid/side pairs
+static void transform_channels(float* samples, uint64_t stride, int channels, int source_channels,
+                               uint32_t pairs, uint64_t from, uint64_t to) {
+    if (channels < source_channels) {
+        // Average every channel into the first plane
+        for (uint64_t i = from; i < to; i++) {
+            float sum = 0.0f;
+            for (int c = 0; c < source_channels; c++) {
+                sum += samples[(size_t)c * stride + i];
+            }
+            samples[i] = sum / source_channels;
+        }
+    }
+    
+    for (int pair = 0; 2 * pair + 1 < channels; pair++) {
+        if (!((pairs >> pair) & 1)) continue;
+        float* left = samples + (size_t)(2 * pair) * stride;
+        float* right = left + stride;
+        for (uint64_t i = from; i < to; i++) {
+            float mid = 0.5f * (left[i] + right[i]);
+            float side = 0.5f * (left[i] - right[i]);
+            left[i] = mid;
+            right[i] = side;
+        }
+    }
+}
+
+// Raw records carry no channel, so that layout stays mono: drop audio_data
+// to one channel, which transform_channels then fills with the downmix. A
+// mono file has no pairs, so choose_mid_side never needs downmixed samples.
+static void choose_downmix(AudioData* audio_data, const EncodingConfig* config) {
+    if (config->output_format == FTAE_FORMAT_RAW && audio_data->channels > 1) {
+        dfta_progress("Note: Raw records are mono, downmixing %u channels\n", audio_data->channels);
+        audio_data->channels = 1;
+    }
+}
+
+// Downmix for the raw layout and apply stereo coding, in place. Returns the
+// mid/side pair bits for the file header.
+uint32_t prepare_channels(AudioData* audio_data, const EncodingConfig* config) {
+    int source_channels = audio_data->channels;
+    choose_downmix(audio_data, config);
+    uint64_t count = audio_data->sample_count;
+    double mid_energy[DFTA_MAX_CHANNELS / 2] = {0};
+    double side_energy[DFTA_MAX_CHANNELS / 2] = {0};
+    if (config->stereo_coding == STEREO_CODING_AUTO) {
+        add_pair_energy(audio_data->samples, count, audio_data->channels, 0, count, mid_energy, side_energy);
+    }
+    uint32_t pairs = choose_mid_side(mid_energy, side_energy, audio_data->channels, config->stereo_coding);
+    transform_channels(audio_data->samples, count, audio_data->channels, source_channels, pairs, 0, count);
+    return pairs;
+}
+
+int encoder_context_init(EncoderContext* context, int threads) {
+    memset(context, 0, sizeof(EncoderContext));
+    if (fft_plan_init(&context->fft) != DFTA_SUCCESS) {
+        return DFTA_ERROR_MEMORY;
+    }
+    if (threads > 0) {
+        context->pool = worker_pool_create(threads);
+        if (!context->pool) {
+            fft_plan_free(&context->fft);
+            return DFTA_ERROR_MEMORY;
+        }
+    }
+    return DFTA_SUCCESS;
+}
+
+void encoder_context_free(EncoderContext* context) {
+    if (!context) return;
+    worker_pool_destroy(context->pool);
+    fft_plan_free(&context->fft);
+    masking_model_free(&context->masking);
+    for (int c = 0; c < DFTA_MAX_CHANNELS; c++) {
+        free(context->window_buffers[c]);
+    }
+    memset(context, 0, sizeof(EncoderContext));
+}
+
+// Read the input's first frames; once analysis has started on them, data
+// ending early is an error
+static int read_input(WAVInput* input, uint64_t frames) {
+    int result = wav_input_load(input, frames);
+    if (result == DFTA_ERROR_FILE_READ) {
+        fprintf(stderr, "Error: WAV data ended early (%llu of %llu samples present)\n",
+                (unsigned long long)input->loaded, (unsigned long long)input->audio->sample_count);
+    }
+    return result;
+}
+
+// Channel planes as held now: all of audio_data, or the part of the input
+// not discarded yet. Plane c starts at samples + c * stride with sample
+// offset.
+static float* held_samples(AudioData* audio_data, WAVInput* input, uint64_t* stride, uint64_t* offset) {
+    *stride = input ? input->capacity : audio_data->sample_count;
+    *offset = input ? input->first : 0;
+    return input ? input->planes : audio_data->samples;
+}
+
+// Weigh the input's channel pairs for auto stereo coding in a first pass
+// over the data that holds one block at a time, then start the input over.
+// A pipe is held whole from the start and is weighed where it is.
+static int weigh_input_pairs(WAVInput* input, int channels, double* mid_energy, double* side_energy) {
+    uint64_t count = input->audio->sample_count;
+    uint64_t block = (uint64_t)ceil(ENCODE_BLOCK_SECONDS * input->audio->sample_rate);
+    
+    for (uint64_t from = 0; from < count; from += block) {
+        uint64_t to = count - from > block ? from + block : count;
+        int result = read_input(input, to);
+        if (result != DFTA_SUCCESS) return result;
+        add_pair_energy(input->planes, input->capacity, channels, from - input->first, to - input->first,
+                        mid_energy, side_energy);
+        if (input->seekable) wav_input_discard(input, to);
+    }
+    return wav_input_rewind(input);
+}
+
+// Read the input up to its first frames and prepare the new samples for
+// analysis. Samples already present without an input are prepared all at once.
+static int load_channels(AudioData* audio_data, WAVInput* input, int source_channels, uint32_t mid_side_pairs,
+                         uint64_t* loaded, uint64_t frames) {
+    uint64_t sample_count = audio_data->sample_count;
+    if (!input || frames > sample_count) frames = sample_count;
+    if (frames <= *loaded) return DFTA_SUCCESS;
+    
+    if (input) {
+        int result = read_input(input, frames);
+        if (result != DFTA_SUCCESS) return result;
+    }
+    uint64_t stride;
+    uint64_t offset;
+    float* samples = held_samples(audio_data, input, &stride, &offset);
+    transform_channels(samples, stride, audio_data->channels, source_channels, mid_side_pairs,
+                       *loaded - offset, frames - offset);
+    *loaded = frames;
+    return DFTA_SUCCESS;
+}
+
+// First sample any channel still reads: its next window to analyse, or a
+// span before where its plan goes on
+static uint64_t first_needed_sample(const ChannelAnalysis* analyses, int channel_count, uint64_t loaded) {
+    int64_t first = (int64_t)loaded;
+    for (int c = 0; c < channel_count; c++) {
+        const WindowPlanner* plan = &analyses[c].plan;
+        int64_t needed = plan->sample_pos - plan->span;
+        if (analyses[c].next_window < plan->count && plan->windows[analyses[c].next_window].position < needed) {
+            needed = plan->windows[analyses[c].next_window].position;
+        }
+        if (needed < first) first = needed;
+    }
+    return first > 0 ? (uint64_t)first : 0;
+}
+
+// Analyse, filter and write planar audio as FTAE. Mid/side coding and the
+// raw-format downmix rewrite audio_data in place. Channels are analysed one
+// block of windows at a time, in parallel, and each block's frames are
+// written and freed before the next, so component memory stays bounded by
+// the block length rather than the file length. With an input, each block's
+// samples are read just before it is analysed, and the async reader fetches
+// the next block's from disk meanwhile; samples no window or plan reads any
+// more are discarded, so the input holds about a block plus the planning
+// margin whatever the file length.
+static int encode_input(EncoderContext* context, AudioData* audio_data, WAVInput* input, FILE* output,
+                        const EncodingConfig* config) {
+    ChannelAnalysis analyses[DFTA_MAX_CHANNELS];
+    FTAEWriter* writer = NULL;
+    AnalysisCache* cache = NULL;
+    int result = DFTA_SUCCESS;
+    
+    int source_channels = audio_data->channels;
+    choose_downmix(audio_data, config);
+    int channel_count = audio_data->channels;
+    uint64_t loaded = 0;        // Samples read and prepared
+    
+    // Auto stereo coding weighs whole channels against each other, so an
+    // input with a pair to decide is read once for that first
+    double mid_energy[DFTA_MAX_CHANNELS / 2] = {0};
+    double side_energy[DFTA_MAX_CHANNELS / 2] = {0};
+    if (channel_count > 1 && config->stereo_coding == STEREO_CODING_AUTO) {
+        if (input) {
+            result = weigh_input_pairs(input, channel_count, mid_energy, side_energy);
+            if (result != DFTA_SUCCESS) return result;
+        } else {
+            add_pair_energy(audio_data->samples, audio_data->sample_count, channel_count, 0,
+                            audio_data->sample_count, mid_energy, side_energy);
+        }
+    }
+    uint32_t mid_side_pairs = choose_mid_side(mid_energy, side_energy, channel_count, config->stereo_coding);
+    
+    // Make a copy of config to adjust for compression level
+    EncodingConfig working_config = *config;
+    adjust_config_for_compression_level(&working_config);
+    
+    // One pair of SineWave queues per channel; window buffers stay with the
+    // context for the next call
+    memset(analyses, 0, sizeof(analyses));
+    for (int c = 0; c < channel_count; c++) {
+        ChannelAnalysis* analysis = &analyses[c];
+        if (!context->window_buffers[c]) {
+            context->window_buffers[c] = malloc(FFT_BUFFER_SIZE * sizeof(double complex));
+        }
+        analysis->fft = &context->fft;
+        analysis->masking = config->masking ? &context->masking : NULL;
+        analysis->config = &working_config;
+        analysis->fft_data = context->window_buffers[c];
+        analysis->sample_count = audio_data->sample_count;
+        analysis->sample_rate = audio_data->sample_rate;
+        analysis->channel = c;
+        analysis->channel_count = channel_count;
+        analysis->scratch = create_sinewave_queue();
+        analysis->queue = create_sinewave_queue();
+        analysis->result = window_planner_init(&analysis->plan, audio_data->sample_rate);
+        component_filter_init(&analysis->filter, &working_config);
+        if (!analysis->scratch || !analysis->queue || !context->window_buffers[c] ||
+            analysis->result != DFTA_SUCCESS) {
             result = DFTA_ERROR_MEMORY;
+        }
+    }
+    if (result != DFTA_SUCCESS) {
+        goto cleanup;
+    }
+    
+    // Window sizes, and with them the FFT and masking tables, depend on the
+    // sample rate; the context keeps them for the next file at the same rate
+    int sizes[ANALYSIS_SIZES];
+    analysis_window_sizes(audio_data->sample_rate, sizes);
+    if (fft_plan_prepare(&context->fft, sizes, ANALYSIS_SIZES) != DFTA_SUCCESS ||
+        (config->masking && masking_model_prepare(&context->masking, audio_data->sample_rate,
+                                                  sizes, ANALYSIS_SIZES) != DFTA_SUCCESS)) {
+        result = DFTA_ERROR_MEMORY;
+        goto cleanup;
+    }
+    
+    // Windows whose samples are unchanged since the last encode with this
+    // cache are read back instead of analysed
+    if (config->analysis_cache) {
+        result = analysis_cache_open(&cache, config->analysis_cache);
+        if (result != DFTA_SUCCESS) {
             goto cleanup;
         }
-        
-        // Copy audio samples to FFT buffer with windowing
-        for (int i = 0; i < window_size && (sample_pos + i) < (int)audio_data.sample_count; i++) {
-            // Apply Hann window to reduce spectral leakage
-            float window_func = 0.5f * (1.0f - cosf(2.0f * M_PI * i / (window_size - 1)));
-            fft_data[i] = audio_data.samples[sample_pos + i] * window_func;
+        for (int c = 0; c < channel_count; c++) {
+            analyses[c].cache = cache;
         }
+    }
+    
+    result = ftae_writer_open(&writer, output, audio_data->sample_rate, (uint16_t)channel_count,
+                              mid_side_pairs, audio_data->sample_count, &working_config, 0);
+    if (result != DFTA_SUCCESS) {
+        goto cleanup;
+    }
+    
+    dfta_progress("\nStarting FFT analysis with adaptive windowing%s...\n",
+                  channel_count > 1 ? " (one thread per channel)" : "");
+    
+    // Channels are analysed and filtered independently, one worker task each
+    // per block. A block's frames all start before the next block's, so
+    // writing block by block gives the same frame order as the whole file.
+    for (int block = 0; result == DFTA_SUCCESS; block++) {
+        // The plan fixes a block's windows once it has seen the samples a
+        // margin past the block's end
+        double block_end = (block + 1) * ENCODE_BLOCK_SECONDS;
+        result = load_channels(audio_data, input, source_channels, mid_side_pairs, &loaded,
+                               (uint64_t)ceil(block_end * audio_data->sample_rate) +
+                               window_planner_margin(&analyses[0].plan));
+        if (result != DFTA_SUCCESS) break;
         
-        // Perform FFT
-        fft_radix2(fft_data, window_size, 0);
-        
-        // Extract SineWave components
-        float start_time = (float)sample_pos / audio_data.sample_rate;
-        float duration = (float)window_size / audio_data.sample_rate;
-        
-        extract_sinewave_components(fft_data, window_size, (float)audio_data.sample_rate,
-                                  start_time, duration, wave_queue);
-        
-        free(fft_data);
+        // Loading may have moved the input's planes
+        uint64_t stride;
+        uint64_t offset;
+        float* samples = held_samples(audio_data, input, &stride, &offset);
+        int remaining = 0;
+        for (int c = 0; c < channel_count; c++) {
+            analyses[c].samples = samples + (size_t)c * stride;
+            analyses[c].offset = (int64_t)offset;
+            analyses[c].block_end = block_end;
+            analyses[c].loaded = loaded;
+            if (!analyses[c].plan.done || analyses[c].next_window < analyses[c].plan.count) {
+                remaining = 1;
+            }
+        }
+        if (!remaining) break;
         
-        // Move to next window with overlap
-        sample_pos += (int)(window_size * (1.0f - overlap));
-        window_count++;
+        worker_pool_run(context->pool, analyze_block, analyses, sizeof(ChannelAnalysis), channel_count);
         
-        if (window_count % 100 == 0) {
-            printf("  Processed %d windows, %d components so far\n", window_count, wave_queue->count);
+        SineWaveQueue* queues[DFTA_MAX_CHANNELS];
+        for (int c = 0; c < channel_count; c++) {
+            if (analyses[c].result != DFTA_SUCCESS) {
+                result = analyses[c].result;
+            }
+            queues[c] = analyses[c].queue;
+        }
+        if (result == DFTA_SUCCESS) {
+            result = ftae_writer_add(writer, queues);
+        }
+        for (int c = 0; c < channel_count; c++) {
+            analyses[c].final_count += queues[c]->count;
+            clear_sinewave_queue(queues[c]);
+        }
+        if (input) {
+            wav_input_discard(input, first_needed_sample(analyses, channel_count, loaded));
         }
     }
+    if (result != DFTA_SUCCESS) {
+        goto cleanup;
+    }
     
-    printf("FFT analysis complete. Generated %d raw components from %d windows\n", 
-           wave_queue->count, window_count);
-    
-    // Apply filtering and optimization
-    printf("\nApplying filters and optimizations...\n");
-    
-    int original_count = wave_queue->count;
+    int original_count = 0;
+    int final_count = 0;
+    int window_count = 0;
+    int cache_hits = 0;
+    for (int c = 0; c < channel_count; c++) {
+        if (channel_count > 1) {
+            dfta_progress("\nChannel %d: %d raw components from %d windows\n",
+                          c, analyses[c].raw_count, analyses[c].plan.count);
+        } else {
+            dfta_progress("FFT analysis complete. Generated %d raw components from %d windows\n",
+                          analyses[c].raw_count, analyses[c].plan.count);
+        }
+        if (analyses[c].skips.silent > 0 || analyses[c].skips.stationary > 0) {
+            dfta_progress("  Skipped %d silent and %d stationary windows (extended the windows before them)\n",
+                          analyses[c].skips.silent, analyses[c].skips.stationary);
+        }
+        component_filter_report(&analyses[c].filter);
+        original_count += analyses[c].raw_count;
+        final_count += analyses[c].final_count;
+        window_count += analyses[c].plan.count;
+        cache_hits += analyses[c].cache_hits;
+    }
     
-    // 1. Frequency filtering (human audible range)
-    apply_frequency_filtering(wave_queue, working_config.frequency_min, working_config.frequency_max);
+    dfta_progress("\nOptimization complete:\n");
+    dfta_progress("  Original components: %d\n", original_count);
+    dfta_progress("  Final components: %d\n", final_count);
+    if (channel_count > 1) {
+        for (int c = 0; c < channel_count; c++) {
+            dfta_progress("    Channel %d%s: %d\n", c,
+                          (mid_side_pairs >> (c / 2)) & 1 ? (c % 2 ? " (side)" : " (mid)") : "",
+                          analyses[c].final_count);
+        }
+    }
+    dfta_progress("  Reduction: %.1f%%\n",
+                  original_count > 0 ? ((float)(original_count - final_count) / original_count) * 100 : 0.0f);
+    if (cache) {
+        dfta_progress("  Analysis cache: %d of %d windows reused (%.1f%% hit rate)\n", cache_hits, window_count,
+                      window_count > 0 ? 100.0 * cache_hits / window_count : 0.0);
+    }
     
-    // 2. Amplitude filtering
-    apply_amplitude_filtering(wave_queue, working_config.amplitude_threshold);
+    // Frames are already out; what is left is the index and trailer, or the
+    // header and spooled body for layouts that need whole-file counts first
+    dfta_progress("\nFinishing compressed file...\n");
+    uint64_t original_size = (uint64_t)audio_data->sample_count * audio_data->channels * sizeof(float);
+    result = ftae_writer_close(writer, audio_data->sample_count, original_size, NULL);
+    writer = NULL;
     
-    // 3. Phase optimization
-    apply_phase_optimization(wave_queue, working_config.phase_tolerance);
+cleanup:
+    if (writer) {
+        ftae_writer_free(writer);
+    }
+    if (cache) {
+        analysis_cache_close(cache, result == DFTA_SUCCESS);
+    }
+    for (int c = 0; c < channel_count; c++) {
+        free_sinewave_queue(analyses[c].scratch);
+        free_sinewave_queue(analyses[c].queue);
+        component_filter_free(&analyses[c].filter);
+        free(analyses[c].plan.windows);
+    }
     
-    // 4. Similarity filtering
-    apply_similarity_filtering(wave_queue, working_config.similarity_threshold);
+    return result;
+}
+
+int encode_audio(EncoderContext* context, AudioData* audio_data, FILE* output, const EncodingConfig* config) {
+    return encode_input(context, audio_data, NULL, output, config);
+}
+
+int encode_audio_file(const char* input_file, const char* output_file, const EncodingConfig* config) {
+    AudioData audio_data = {0};
+    WAVInput input;
+    EncoderContext context;
     
-    printf("\nOptimization complete:\n");
-    printf("  Original components: %d\n", original_count);
-    printf("  Final components: %d\n", wave_queue->count);
-    printf("  Reduction: %.1f%%\n", ((float)(original_count - wave_queue->count) / original_count) * 100);
+    // Open the input WAV file; its samples are read as the blocks need them
+    int result = wav_input_open(&input, input_file, &audio_data);
+    if (result != DFTA_SUCCESS) {
+        return result;
+    }
     
-    // Write output FTAE file
-    printf("\nWriting compressed file...\n");
-    result = write_ftae_file(output_file, wave_queue, &audio_data, &working_config);
+    result = encoder_context_init(&context, 0);
+    if (result != DFTA_SUCCESS) {
+        wav_input_close(&input);
+        free_audio_data(&audio_data);
+        return result;
+    }
     
-cleanup:
-    if (wave_queue) {
-        free_sinewave_queue(wave_queue);
+    FILE* output = fopen(output_file, "wb");
+    if (!output) {
+        fprintf(stderr, "Error: Cannot create output file %s\n", output_file);
+        result = DFTA_ERROR_FILE_WRITE;
+    } else {
+        result = encode_input(&context, &audio_data, &input, output, config);
+        if (fclose(output) != 0 && result == DFTA_SUCCESS) {
+            result = DFTA_ERROR_FILE_WRITE;
+        }
     }
-    free_audio_data(&audio_data);
     
+    wav_input_close(&input);
+    encoder_context_free(&context);
+    free_audio_data(&audio_data);
     return result;
 }
 
@@ -161,7 +932,7 @@ float calculate_signal_complexity(const float* samples, int window_size) {
 }
 
 void extract_sinewave_components(const double complex* fft_data, int fft_size, 
-                                float sample_rate, float start_time, float duration,
+                                float sample_rate, double start_time, double duration,
                                 SineWaveQueue* queue) {
     if (!fft_data || !queue || fft_size <= 0) return;
     
@@ -0,0 +1,177 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include "dfta.h"
+
+// Carry-less range coder (Subbotin): bytes are emitted once the top byte of
+// the interval is settled; a small range is cut at the next RANGE_BOT boundary
+#define RANGE_TOP (1u << 24)
+#define RANGE_BOT (1u << 16)
+
+void entropy_model_init(EntropyModel* model, int symbol_count) {
+    memset(model, 0, sizeof(EntropyModel));
+    model->symbol_count = symbol_count > ENTROPY_MAX_SYMBOLS ? ENTROPY_MAX_SYMBOLS : symbol_count;
+}
+
+void entropy_model_count(EntropyModel* model, int symbol) {
+    if (symbol >= 0 && symbol < model->symbol_count) {
+        model->counts[symbol]++;
+    }
+}
+
+void entropy_model_normalize(EntropyModel* model) {
+    const uint32_t total_scale = 1u << ENTROPY_PROB_BITS;
+    uint64_t total = 0;
+    for (int s = 0; s < model->symbol_count; s++) {
+        total += model->counts[s];
+    }
+    
+    // An unused model still needs a valid table
+    if (total == 0) {
+        memset(model->freq, 0, sizeof(model->freq));
+        memset(model->start, 0, sizeof(model->start));
+        model->freq[0] = (uint16_t)total_scale;
+        return;
+    }
+    
+    // Scale counts to the probability range, keeping every seen symbol codable
+    int64_t assigned = 0;
+    int largest = 0;
+    for (int s = 0; s < model->symbol_count; s++) {
+        uint32_t freq = 0;
+        if (model->counts[s] > 0) {
+            freq = (uint32_t)((uint64_t)model->counts[s] * total_scale / total);
+            if (freq == 0) freq = 1;
+        }
+        model->freq[s] = (uint16_t)freq;
+        assigned += freq;
+        if (freq > model->freq[largest]) largest = s;
+    }
+    
+    // Rounding error goes to (or comes from) the most probable symbols
+    int64_t remainder = (int64_t)total_scale - assigned;
+    if (remainder > 0) {
+        model->freq[largest] += (uint16_t)remainder;
+    }
+    while (remainder < 0) {
+        int max_symbol = 0;
+        for (int s = 1; s < model->symbol_count; s++) {
+            if (model->freq[s] > model->freq[max_symbol]) max_symbol = s;
+        }
+        int64_t take = model->freq[max_symbol] - 1;
+        if (take > -remainder) take = -remainder;
+        model->freq[max_symbol] -= (uint16_t)take;
+        remainder += take;
+    }
+    
+    uint32_t start = 0;
+    for (int s = 0; s < model->symbol_count; s++) {
+        model->start[s] = (uint16_t)start;
+        start += model->freq[s];
+    }
+}
+
+double entropy_model_cost(const EntropyModel* model) {
+    // Bits needed to code the counted symbols with the normalized table
+    double bits = 0.0;
+    for (int s = 0; s < model->symbol_count; s++) {
+        if (model->counts[s] > 0) {
+            bits += model->counts[s] * (ENTROPY_PROB_BITS - log2((double)model->freq[s]));
+        }
+    }
+    return bits;
+}
+
+void entropy_model_write(const EntropyModel* model, BitWriter* writer) {
+    // Frequencies as exp-Golomb; a zero is followed by the count of further zeros
+    for (int s = 0; s < model->symbol_count;) {
+        bitwriter_put_expgolomb(writer, model->freq[s]);
+        if (model->freq[s] != 0) {
+            s++;
+            continue;
+        }
+        int run = 0;
+        while (s + 1 + run < model->symbol_count && model->freq[s + 1 + run] == 0) run++;
+        bitwriter_put_expgolomb(writer, (uint32_t)run);
+        s += 1 + run;
+    }
+}
+
+void range_encoder_init(RangeEncoder* encoder) {
+    memset(encoder, 0, sizeof(RangeEncoder));
+    range_encoder_reset(encoder);
+}
+
+void range_encoder_reset(RangeEncoder* encoder) {
+    encoder->size = 0;
+    encoder->low = 0;
+    encoder->range = 0xFFFFFFFFu;
+}
+
+void range_encoder_free(RangeEncoder* encoder) {
+    free(encoder->data);
+    memset(encoder, 0, sizeof(RangeEncoder));
+}
+
+static void range_put_byte(RangeEncoder* encoder, uint8_t byte) {
+    if (encoder->size == encoder->capacity) {
+        size_t capacity = encoder->capacity ? encoder->capacity * 2 : 256;
+        uint8_t* data = realloc(encoder->data, capacity);
+        if (!data) {
+            encoder->failed = 1;
+            return;
+        }
+        encoder->data = data;
+        encoder->capacity = capacity;
+    }
+    encoder->data[encoder->size++] = byte;
+}
+
+static void range_encode(RangeEncoder* encoder, uint32_t start, uint32_t freq, int total_bits) {
+    encoder->range >>= total_bits;
+    encoder->low += start * encoder->range;
+    encoder->range *= freq;
+    
+    for (;;) {
+        if ((encoder->low ^ (encoder->low + encoder->range)) >= RANGE_TOP) {
+            if (encoder->range >= RANGE_BOT) break;
+            encoder->range = (0u - encoder->low) & (RANGE_BOT - 1);
+        }
+        range_put_byte(encoder, (uint8_t)(encoder->low >> 24));
+        encoder->low <<= 8;
+        encoder->range <<= 8;
+    }
+}
+
+void range_encode_symbol(RangeEncoder* encoder, const EntropyModel* model, int symbol) {
+    range_encode(encoder, model->start[symbol], model->freq[symbol], ENTROPY_PROB_BITS);
+}
+
+void range_encode_bits(RangeEncoder* encoder, uint32_t value, int bits) {
+    // Raw bits are uniform symbols, coded 8 at a time, low chunk first
+    while (bits > 0) {
+        int chunk = bits > 8 ? 8 : bits;
+        range_encode(encoder, value & ((1u << chunk) - 1), 1, chunk);
+        value >>= chunk;
+        bits -= chunk;
+    }
+}
+
+void range_encoder_flush(RangeEncoder* encoder) {
+    // Emit the shortest prefix of a value inside [low, low + range): the
+    // decoder reads zeros past the end of the payload
+    uint64_t low = encoder->low;
+    uint64_t high = low + encoder->range;
+    for (int bytes = 1; bytes <= 4; bytes++) {
+        uint64_t mask = (1ull << (32 - 8 * bytes)) - 1;
+        uint64_t value = (low + mask) & ~mask;
+        if (value < high && value <= 0xFFFFFFFFu) {
+            for (int i = 0; i < bytes; i++) {
+                range_put_byte(encoder, (uint8_t)(value >> (24 - 8 * i)));
+            }
+            return;
+        }
+    }
+}
@@ -1,10 +1,15 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include <complex.h>
 #include "dfta.h"
 
+// Twiddles are planned up to the largest Bluestein convolution, the power of
+// two at or above 2 * FFT_MAX_SIZE - 1
+#define FFT_PLAN_MAX_SIZE (2 * FFT_MAX_SIZE)
+
 void fft_radix2(double complex* data, int n, int inverse) {
     if (n <= 1) return;
     
@@ -53,6 +58,411 @@ void fft_radix2(double complex* data, int n, int inverse) {
     }
 }
 
+// Hann window of size n, for the planned windows of every size
+static void hann_window(float* window, int n) {
+    for (int i = 0; i < n; i++) {
+        window[i] = 0.5f * (1.0f - cosf(2.0f * M_PI * i / (n - 1)));
+    }
+}
+
+int fft_plan_init(FFTPlan* plan) {
+    memset(plan, 0, sizeof(FFTPlan));
+    plan->twiddles = malloc((FFT_PLAN_MAX_SIZE - 1) * sizeof(double complex));
+    plan->windows = malloc((2 * FFT_MAX_SIZE - 2) * sizeof(float));
+    if (!plan->twiddles || !plan->windows) {
+        fft_plan_free(plan);
+        return DFTA_ERROR_MEMORY;
+    }
+    
+    // Twiddles follow the same recurrence fft_radix2 runs per block, so the
+    // planned transform gives bit-identical results
+    for (int len = 2; len <= FFT_PLAN_MAX_SIZE; len <<= 1) {
+        double angle = -2.0 * M_PI / len;
+        double complex wlen = cos(angle) + I * sin(angle);
+        double complex w = 1.0;
+        double complex* stage = plan->twiddles + len / 2 - 1;
+        for (int j = 0; j < len / 2; j++) {
+            stage[j] = w;
+            w *= wlen;
+        }
+    }
+    
+    for (int n = 2; n <= FFT_MAX_SIZE; n <<= 1) {
+        hann_window(plan->windows + n - 2, n);
+    }
+    return DFTA_SUCCESS;
+}
+
+// Split n into radices for the mixed-radix stages: fours first, then two,
+// three, five and other primes up to FFT_MAX_RADIX. Each stage stores its
+// radix and the size left below it. Returns the stage count, or 0 when n has
+// a larger prime factor and needs Bluestein's algorithm.
+static int factor_size(int n, int* factors) {
+    int count = 0;
+    int radix = 4;
+    while (n > 1) {
+        while (n % radix != 0) {
+            radix = radix == 4 ? 2 : radix == 2 ? 3 : radix + 2;
+            if (radix > FFT_MAX_RADIX) return 0;
+        }
+        n /= radix;
+        factors[2 * count] = radix;
+        factors[2 * count + 1] = n;
+        count++;
+    }
+    return count;
+}
+
+static void size_plan_free(FFTSizePlan* sized) {
+    free(sized->twiddles);
+    free(sized->chirp);
+    free(sized->filter);
+    free(sized->window);
+    memset(sized, 0, sizeof(FFTSizePlan));
+}
+
+// Tables for one size that is not a power of two. Bluestein's filter is
+// transformed with plan's power-of-two twiddles, or fft_radix2 without a plan.
+static int size_plan_init(FFTSizePlan* sized, const FFTPlan* plan, int n) {
+    memset(sized, 0, sizeof(FFTSizePlan));
+    sized->n = n;
+    sized->factor_count = factor_size(n, sized->factors);
+    sized->window = malloc(n * sizeof(float));
+    if (!sized->window) return DFTA_ERROR_MEMORY;
+    hann_window(sized->window, n);
+    
+    if (sized->factor_count > 0) {
+        sized->twiddles = malloc(n * sizeof(double complex));
+        if (!sized->twiddles) {
+            size_plan_free(sized);
+            return DFTA_ERROR_MEMORY;
+        }
+        for (int j = 0; j < n; j++) {
+            double angle = -2.0 * M_PI * j / n;
+            sized->twiddles[j] = cos(angle) + I * sin(angle);
+        }
+        return DFTA_SUCCESS;
+    }
+    
+    // Bluestein: X[k] = chirp[k] * sum x[j] chirp[j] conj(chirp[k - j]) with
+    // chirp[j] = exp(-i pi j^2 / n), a circular convolution of size m. The
+    // filter is transformed once, and holds the 1/m of the inverse transform.
+    sized->m = next_power_of_2(2 * n - 1);
+    sized->chirp = malloc(n * sizeof(double complex));
+    sized->filter = calloc(sized->m, sizeof(double complex));
+    if (!sized->chirp || !sized->filter) {
+        size_plan_free(sized);
+        return DFTA_ERROR_MEMORY;
+    }
+    for (int j = 0; j < n; j++) {
+        // j^2 mod 2n keeps the angle small and exact
+        double angle = -M_PI * (double)(((int64_t)j * j) % (2 * n)) / n;
+        sized->chirp[j] = cos(angle) + I * sin(angle);
+    }
+    sized->filter[0] = conj(sized->chirp[0]) / sized->m;
+    for (int j = 1; j < n; j++) {
+        sized->filter[j] = conj(sized->chirp[j]) / sized->m;
+        sized->filter[sized->m - j] = sized->filter[j];
+    }
+    fft_forward(plan, sized->filter, sized->m);
+    return DFTA_SUCCESS;
+}
+
+int fft_plan_prepare(FFTPlan* plan, const int* sizes, int count) {
+    // Nothing to do when the plan already holds exactly these sizes
+    int planned = 0;
+    int unchanged = 1;
+    for (int i = 0; i < count && unchanged; i++) {
+        if ((sizes[i] & (sizes[i] - 1)) == 0) continue;
+        unchanged = planned < plan->size_count && plan->sizes[planned].n == sizes[i];
+        planned++;
+    }
+    if (unchanged && planned == plan->size_count) return DFTA_SUCCESS;
+    
+    for (int i = 0; i < plan->size_count; i++) {
+        size_plan_free(&plan->sizes[i]);
+    }
+    plan->size_count = 0;
+    for (int i = 0; i < count && plan->size_count < ANALYSIS_SIZES; i++) {
+        if ((sizes[i] & (sizes[i] - 1)) == 0 || sizes[i] > FFT_MAX_SIZE) continue;
+        if (size_plan_init(&plan->sizes[plan->size_count], plan, sizes[i]) != DFTA_SUCCESS) {
+            return DFTA_ERROR_MEMORY;
+        }
+        plan->size_count++;
+    }
+    return DFTA_SUCCESS;
+}
+
+void fft_plan_free(FFTPlan* plan) {
+    free(plan->twiddles);
+    free(plan->windows);
+    plan->twiddles = NULL;
+    plan->windows = NULL;
+    for (int i = 0; i < plan->size_count; i++) {
+        size_plan_free(&plan->sizes[i]);
+    }
+    plan->size_count = 0;
+}
+
+const float* fft_window(const FFTPlan* plan, int n) {
+    if ((n & (n - 1)) == 0) {
+        return n >= 2 && n <= FFT_MAX_SIZE ? plan->windows + n - 2 : NULL;
+    }
+    for (int i = 0; i < plan->size_count; i++) {
+        if (plan->sizes[i].n == n) return plan->sizes[i].window;
+    }
+    return NULL;
+}
+
+// Mixed-radix butterflies, decimation in time. Each combines radix
+// sub-transforms of size m, m apart in out, whose twiddles are tw[k * stride].
+static void butterfly2(double complex* out, const double complex* tw, int stride, int m) {
+    for (int k = 0; k < m; k++) {
+        double complex t = out[k + m] * tw[k * stride];
+        out[k + m] = out[k] - t;
+        out[k] += t;
+    }
+}
+
+static void butterfly3(double complex* out, const double complex* tw, int stride, int m) {
+    const double sin_third = -0.86602540378443864676;  // Imaginary part of exp(-2 pi i / 3)
+    for (int k = 0; k < m; k++) {
+        double complex a1 = out[k + m] * tw[k * stride];
+        double complex a2 = out[k + 2 * m] * tw[2 * k * stride];
+        double complex sum = a1 + a2;
+        double complex difference = (a1 - a2) * sin_third;
+        double complex base = out[k] - 0.5 * sum;
+        out[k] += sum;
+        out[k + m] = base + I * difference;
+        out[k + 2 * m] = base - I * difference;
+    }
+}
+
+static void butterfly4(double complex* out, const double complex* tw, int stride, int m) {
+    for (int k = 0; k < m; k++) {
+        double complex a0 = out[k];
+        double complex a1 = out[k + m] * tw[k * stride];
+        double complex a2 = out[k + 2 * m] * tw[2 * k * stride];
+        double complex a3 = out[k + 3 * m] * tw[3 * k * stride];
+        double complex even_sum = a0 + a2;
+        double complex even_difference = a0 - a2;
+        double complex odd_sum = a1 + a3;
+        double complex odd_difference = -I * (a1 - a3);
+        out[k] = even_sum + odd_sum;
+        out[k + m] = even_difference + odd_difference;
+        out[k + 2 * m] = even_sum - odd_sum;
+        out[k + 3 * m] = even_difference - odd_difference;
+    }
+}
+
+static void butterfly5(double complex* out, const double complex* tw, int stride, int m) {
+    const double cos1 = 0.30901699437494742410;   // cos(2 pi / 5)
+    const double cos2 = -0.80901699437494742410;  // cos(4 pi / 5)
+    const double sin1 = 0.95105651629515357212;   // sin(2 pi / 5)
+    const double sin2 = 0.58778525229247312917;   // sin(4 pi / 5)
+    for (int k = 0; k < m; k++) {
+        double complex a0 = out[k];
+        double complex a1 = out[k + m] * tw[k * stride];
+        double complex a2 = out[k + 2 * m] * tw[2 * k * stride];
+        double complex a3 = out[k + 3 * m] * tw[3 * k * stride];
+        double complex a4 = out[k + 4 * m] * tw[4 * k * stride];
+        double complex sum14 = a1 + a4;
+        double complex sum23 = a2 + a3;
+        double complex difference14 = a1 - a4;
+        double complex difference23 = a2 - a3;
+        double complex real1 = a0 + cos1 * sum14 + cos2 * sum23;
+        double complex real2 = a0 + cos2 * sum14 + cos1 * sum23;
+        double complex imaginary1 = -I * (sin1 * difference14 + sin2 * difference23);
+        double complex imaginary2 = -I * (sin2 * difference14 - sin1 * difference23);
+        out[k] = a0 + sum14 + sum23;
+        out[k + m] = real1 + imaginary1;
+        out[k + 4 * m] = real1 - imaginary1;
+        out[k + 2 * m] = real2 + imaginary2;
+        out[k + 3 * m] = real2 - imaginary2;
+    }
+}
+
+// Any other odd prime radix, as a direct DFT of the twiddled inputs. Inputs
+// q and radix - q are paired as in butterfly5, so each pair of outputs j and
+// radix - j shares its cosine and sine sums.
+static void butterfly_odd(double complex* out, const double complex* tw, int stride, int m, int radix) {
+    double cosines[FFT_MAX_RADIX];
+    double sines[FFT_MAX_RADIX];
+    double complex sums[FFT_MAX_RADIX / 2 + 1];
+    double complex differences[FFT_MAX_RADIX / 2 + 1];
+    int half = radix / 2;
+    for (int q = 0; q < radix; q++) {
+        // tw[stride * m] is exp(-2 pi i / radix)
+        cosines[q] = creal(tw[q * stride * m]);
+        sines[q] = -cimag(tw[q * stride * m]);
+    }
+    
+    for (int k = 0; k < m; k++) {
+        double complex a0 = out[k];
+        double complex total = a0;
+        for (int q = 1; q <= half; q++) {
+            double complex low = out[k + q * m] * tw[q * k * stride];
+            double complex high = out[k + (radix - q) * m] * tw[(radix - q) * k * stride];
+            sums[q] = low + high;
+            differences[q] = low - high;
+            total += sums[q];
+        }
+        for (int j = 1; j <= half; j++) {
+            double complex real = a0;
+            double complex imaginary = 0.0;
+            int index = 0;
+            for (int q = 1; q <= half; q++) {
+                index += j;
+                if (index >= radix) index -= radix;
+                real += cosines[index] * sums[q];
+                imaginary += sines[index] * differences[q];
+            }
+            out[k + j * m] = real - I * imaginary;
+            out[k + (radix - j) * m] = real + I * imaginary;
+        }
+        out[k] = total;
+    }
+}
+
+// Transform the radix * m inputs in[0], in[stride], ... into out: each
+// residue class is transformed recursively, then the stage's butterflies
+// combine them
+static void mixed_radix_stage(const FFTSizePlan* sized, double complex* out, const double complex* in,
+                              int stride, const int* factors) {
+    int radix = factors[0];
+    int m = factors[1];
+    if (m == 1) {
+        for (int q = 0; q < radix; q++) {
+            out[q] = in[q * stride];
+        }
+    } else {
+        for (int q = 0; q < radix; q++) {
+            mixed_radix_stage(sized, out + q * m, in + q * stride, stride * radix, factors + 2);
+        }
+    }
+    
+    switch (radix) {
+        case 2: butterfly2(out, sized->twiddles, stride, m); break;
+        case 3: butterfly3(out, sized->twiddles, stride, m); break;
+        case 4: butterfly4(out, sized->twiddles, stride, m); break;
+        case 5: butterfly5(out, sized->twiddles, stride, m); break;
+        default: butterfly_odd(out, sized->twiddles, stride, m, radix); break;
+    }
+}
+
+// Forward transform of sized->n points in data, using the entries after them
+// as scratch (sized->n for mixed radix, sized->m for Bluestein)
+static void size_plan_forward(const FFTPlan* plan, const FFTSizePlan* sized, double complex* data) {
+    int n = sized->n;
+    double complex* scratch = data + n;
+    if (sized->factor_count > 0) {
+        memcpy(scratch, data, n * sizeof(double complex));
+        mixed_radix_stage(sized, data, scratch, 1, sized->factors);
+        return;
+    }
+    
+    // Convolve with the filter by the power-of-two transform; the inverse is
+    // the forward transform of the conjugate
+    int m = sized->m;
+    for (int j = 0; j < n; j++) {
+        scratch[j] = data[j] * sized->chirp[j];
+    }
+    memset(scratch + n, 0, (m - n) * sizeof(double complex));
+    fft_forward(plan, scratch, m);
+    for (int k = 0; k < m; k++) {
+        scratch[k] = conj(scratch[k] * sized->filter[k]);
+    }
+    fft_forward(plan, scratch, m);
+    for (int k = 0; k < n; k++) {
+        data[k] = conj(scratch[k]) * sized->chirp[k];
+    }
+}
+
+int fft_mixed_radix(double complex* data, int n, int inverse) {
+    if (n <= 1) return DFTA_SUCCESS;
+    if ((n & (n - 1)) == 0) {
+        fft_radix2(data, n, inverse);
+        return DFTA_SUCCESS;
+    }
+    
+    FFTSizePlan sized;
+    if (size_plan_init(&sized, NULL, n) != DFTA_SUCCESS) {
+        return DFTA_ERROR_MEMORY;
+    }
+    double complex* buffer = malloc((size_t)(n + (sized.m > n ? sized.m : n)) * sizeof(double complex));
+    if (!buffer) {
+        size_plan_free(&sized);
+        return DFTA_ERROR_MEMORY;
+    }
+    
+    // The inverse is the conjugate of the forward transform of the conjugate
+    for (int i = 0; i < n; i++) {
+        buffer[i] = inverse ? conj(data[i]) : data[i];
+    }
+    size_plan_forward(NULL, &sized, buffer);
+    for (int i = 0; i < n; i++) {
+        data[i] = inverse ? conj(buffer[i]) / n : buffer[i];
+    }
+    
+    free(buffer);
+    size_plan_free(&sized);
+    return DFTA_SUCCESS;
+}
+
+// Forward transform with the plan's tables. data holds FFT_BUFFER_SIZE
+// entries; those past n are scratch. Power-of-two sizes beyond the plan fall
+// back to fft_radix2, other sizes the plan lacks to fft_mixed_radix.
+void fft_forward(const FFTPlan* plan, double complex* data, int n) {
+    if ((n & (n - 1)) != 0) {
+        for (int i = 0; plan && i < plan->size_count; i++) {
+            if (plan->sizes[i].n == n) {
+                size_plan_forward(plan, &plan->sizes[i], data);
+                return;
+            }
+        }
+        if (fft_mixed_radix(data, n, 0) != DFTA_SUCCESS) {
+            fprintf(stderr, "Warning: Out of memory for a %d-point FFT, window left empty\n", n);
+            memset(data, 0, n * sizeof(double complex));
+        }
+        return;
+    }
+    if (!plan || !plan->twiddles || n > FFT_PLAN_MAX_SIZE) {
+        fft_radix2(data, n, 0);
+        return;
+    }
+    if (n <= 1) return;
+    
+    // Bit-reversal permutation
+    int j = 0;
+    for (int i = 1; i < n; i++) {
+        int bit = n >> 1;
+        while (j & bit) {
+            j ^= bit;
+            bit >>= 1;
+        }
+        j ^= bit;
+        
+        if (i < j) {
+            double complex temp = data[i];
+            data[i] = data[j];
+            data[j] = temp;
+        }
+    }
+    
+    for (int len = 2; len <= n; len <<= 1) {
+        const double complex* stage = plan->twiddles + len / 2 - 1;
+        int half = len / 2;
+        for (int i = 0; i < n; i += len) {
+            for (int k = 0; k < half; k++) {
+                double complex u = data[i + k];
+                double complex v = data[i + k + half] * stage[k];
+                data[i + k] = u + v;
+                data[i + k + half] = u - v;
+            }
+        }
+    }
+}
+
 int next_power_of_2(int n) {
     if (n <= 1) return 1;
     
@@ -63,35 +473,35 @@ int next_power_of_2(int n) {
     return power;
 }
 
-int adaptive_window_size(const float* samples, int start, int max_size, int sample_rate) {
-    (void)sample_rate; // Suppress unused parameter warning
-    
-    if (!samples || max_size <= 0) return 1024;  // Default size
-    
-    int base_size = 1024;
-    int min_size = 512;
-    int actual_max = (max_size < 4096) ? max_size : 4096;
-    
-    if (actual_max < base_size) return actual_max;
+// Analysis window sizes of about 10, 20 and 40 ms at sample_rate, even and
+// within 64 to FFT_MAX_SIZE, so hops of half a window are whole samples and
+// frame times do not drift from the nominal durations
+void analysis_window_sizes(uint32_t sample_rate, int* sizes) {
+    static const int milliseconds[ANALYSIS_SIZES] = {10, 20, 40};
+    for (int s = 0; s < ANALYSIS_SIZES; s++) {
+        int size = (int)((uint64_t)sample_rate * milliseconds[s] / 1000) & ~1;
+        if (size < 64) size = 64;
+        if (size > FFT_MAX_SIZE) size = FFT_MAX_SIZE;
+        sizes[s] = size;
+    }
+}
+
+// Pick one of the sizes from analysis_window_sizes. max_size is the samples
+// left, of which the complexity test reads at most the middle size.
+int adaptive_window_size(const float* samples, int start, int max_size, const int* sizes) {
+    int base_size = sizes[1];
+    if (!samples || max_size <= 0) return base_size;
     
     // Calculate signal complexity for a small window
-    int test_size = (base_size < actual_max) ? base_size : actual_max;
+    int test_size = (base_size < max_size) ? base_size : max_size;
     float complexity = calculate_signal_complexity(&samples[start], test_size);
     
-    // Adjust window size based on complexity
-    int adaptive_size;
     if (complexity > 0.5f) {
         // High complexity - use smaller window for better time resolution
-        adaptive_size = base_size / 2;
+        return sizes[0];
     } else if (complexity < 0.1f) {
         // Low complexity - use larger window for better frequency resolution
-        adaptive_size = base_size * 2;
-    } else {
-        adaptive_size = base_size;
+        return sizes[2];
     }
-    
-    // Ensure size is within bounds and power of 2
-    adaptive_size = (min_size > adaptive_size) ? min_size : adaptive_size;
-    adaptive_size = (adaptive_size > actual_max) ? actual_max : adaptive_size;
-    return next_power_of_2(adaptive_size);
+    return base_size;
 }
@@ -1,78 +1,1320 @@
-
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <math.h>
 #include "dfta.h"
+#include "ftae_format.h"
+
+// Packed files of at least this many samples (about 3 minutes at 44.1 kHz)
+// are written as v5: past it a float time in seconds no longer resolves
+// single samples. Shorter files stay v4, which older decoders read.
+#define FTAE_SAMPLED_MIN_SAMPLES (1u << 23)
+
+// Spacing of seek table entries in seconds
+#define FTAE_SEEK_INTERVAL     0.25f
+
+// Frames with fewer components than this are a single layer sorted by
+// frequency (see FTAE_FRAME_LAYERED)
+#define FTAE_LAYERED_MIN_COMPONENTS 16
+
+// Repeated material (loops, jingles) quantizes to the same frames each time
+// it comes back. A frame equal to an earlier coded frame of its channel
+// opens a run, which grows while the following frames equal that frame's
+// successors at the same time shift; runs of DEDUP_MIN_FRAMES or more are
+// written as one back-reference frame of at most DEDUP_MAX_FRAMES. Sources
+// are searched among the channel's last DEDUP_SEARCH_FRAMES frames, and the
+// history keeps twice that so a source is still known when its run closes.
+// Shifts are compared on the first sample the decoder renders, so a copy
+// starts and ends exactly where the frames it replaces did.
+#define DEDUP_SEARCH_FRAMES  2048
+#define DEDUP_HISTORY_FRAMES (2 * DEDUP_SEARCH_FRAMES)
+#define DEDUP_MIN_FRAMES     4
+#define DEDUP_MAX_FRAMES     64
+
+// A frame as the writer codes it, in samples at the file's rate; written
+// out as a v4 or v5 frame header
+typedef struct {
+    int64_t start;           // First sample
+    uint32_t length;         // Samples; longer than the analysis window once stationary windows extend it
+    uint16_t component_count;
+    uint16_t flags;          // FTAE_FRAME_* bits
+    uint32_t payload_size;
+    float seconds;           // v4 duration if not length samples (back-references), else 0
+} CodedFrame;
+
+// Appends checksummed frames to a v4 or v5 file and finishes it with the
+// index and trailer. The index is kept in v5 form and converted for v4.
+typedef struct {
+    FILE* file;
+    uint64_t offset;         // Byte offset of the next frame
+    FTAESampledIndexEntry* index;
+    uint32_t frame_count;
+    uint32_t index_capacity;
+    uint64_t wave_count;
+    uint32_t max_length;     // Longest frame in samples
+    float max_seconds;       // v4: longest frame duration as written
+    uint32_t sample_rate;
+    int sampled;             // v5 layout
+} FrameAppender;
+
+static int compare_by_frequency(const void* a, const void* b) {
+    const SineWave* wave_a = a;
+    const SineWave* wave_b = b;
+    return (wave_a->frequency > wave_b->frequency) - (wave_a->frequency < wave_b->frequency);
+}
+
+static uint32_t quantize_amplitude(int amplitude) {
+    if (amplitude <= 1) return 0;
+    long code = lrint(log2((double)amplitude) * FTAE_AMPLITUDE_STEPS);
+    long max_code = (1L << FTAE_AMPLITUDE_BITS) - 1;
+    return (uint32_t)(code > max_code ? max_code : code);
+}
+
+// FFT bin that the encoder's analysis maps to frequency, or -1 if the
+// frequency did not come from a bin of this window size
+static int frequency_to_bin(int frequency, float freq_resolution) {
+    int guess = (int)lrintf((float)frequency / freq_resolution);
+    for (int bin = guess - 1; bin <= guess + 1; bin++) {
+        if (bin >= 0 && (int)(bin * freq_resolution) == frequency) return bin;
+    }
+    return -1;
+}
+
+// Quantized fields of one component, in payload order
+typedef struct {
+    uint32_t frequency_code;    // Zigzag absolute value (first component of a layer) or delta
+    uint32_t amplitude_code;
+    uint32_t phase;
+} PackedComponent;
 
-// FTAE file format header
+// Layer layout of one frame; a frame that is not layered has one layer
 typedef struct {
-    char magic[4];           // "FTAE"
-    uint32_t version;        // Format version
-    uint32_t sample_rate;    // Original sample rate
-    uint32_t wave_count;     // Number of SineWave structs
-    uint32_t compression_level; // Compression level used
-    float amplitude_threshold;  // Amplitude threshold used
-    float duration;          // Total duration in seconds
-    uint32_t reserved[8];    // Reserved for future use
-} FTAEHeader;
-
-int write_ftae_file(const char* filename, SineWaveQueue* queue, 
-                   const AudioData* original_audio, const EncodingConfig* config) {
-    if (!filename || !queue || !original_audio || !config) {
+    int count;
+    uint32_t end[FTAE_LAYER_COUNT];
+    uint32_t energy_marker[FTAE_LAYER_COUNT - 1];
+} FrameLayers;
+
+// Static per-file models for range coded frames
+typedef struct {
+    EntropyModel frequency;
+    EntropyModel phase;
+    uint32_t amplitude_contexts;    // 1, or FTAE_AMPLITUDE_CONTEXTS_MAX when conditioning pays off
+    EntropyModel amplitude[FTAE_AMPLITUDE_CONTEXTS_MAX];
+} FTAEModels;
+
+// Deduplication state of one frame, by its position among its channel's frames.
+// The hash only finds candidates; a frame repeats one whose fields, layers
+// and packed components are all equal (see same_frame).
+typedef struct {
+    uint64_t hash;              // Of the quantized frame (see frame_hash)
+    int64_t start;              // First sample
+    uint32_t ordinal;           // Position among the channel's frames, telling a reused slot apart
+    uint32_t frame_number;      // Index position once written, UINT32_MAX until then
+    int source;                 // Written as a coded frame, so a later run may point at it
+    uint32_t length;            // The frame's fields other than its start and channel
+    uint16_t component_count;
+    uint16_t flags;
+    FrameLayers layers;
+    PackedComponent* packed;    // component_count components, kept when the slot is reused
+    uint32_t packed_capacity;
+} DedupRecord;
+
+enum {
+    PENDING_CODED,              // Written as it is
+    PENDING_HELD,               // Part of an open run
+    PENDING_REPEAT,             // First frame of a closed run, written as its back-reference
+    PENDING_DROPPED             // Rest of a closed run
+};
+
+// Quantized frame waiting behind an open run, so frames stay in start order
+typedef struct PendingFrame {
+    CodedFrame frame;
+    FrameLayers layers;
+    PackedComponent* packed;
+    uint32_t channel;
+    uint32_t ordinal;
+    int kind;                   // PENDING_*
+    uint32_t source_first;      // PENDING_REPEAT: ordinals of the group's first and last frames
+    uint32_t source_last;
+    int32_t shift;
+    struct PendingFrame* next;
+} PendingFrame;
+
+typedef struct {
+    DedupRecord* history;       // DEDUP_HISTORY_FRAMES records, by ordinal
+    uint32_t count;             // Frames seen
+    uint32_t run_length;        // Frames in the open run, 0 if none
+    uint32_t run_source;        // Ordinal of the frame the run's first frame repeats
+    int64_t run_shift;          // Samples from the source to the run
+    PendingFrame* run_first;    // The run's first frame
+} DedupChannel;
+
+// Body bytes held back until the header can be written: a temporary file,
+// or memory when no temporary file can be created. libdfta always spools to
+// memory: its output is an in-memory stream and it creates no files.
+typedef struct {
+    FILE* file;
+    uint8_t* data;
+    size_t size;
+    size_t capacity;
+    size_t position;            // Read position in data
+} Spool;
+
+// FTAE output written as frames are finished. Bit-packed v4/v5 frames go
+// straight to the file (and are flushed at once for live output). Range
+// coding needs models counted over the whole file, and the v2 header needs
+// the record count, so those bodies are spooled and written on close: range
+// coded frames as quantized components, v2 as records. With deduplication,
+// frames wait in pending while a run that may become a back-reference is open.
+struct FTAEWriter {
+    FILE* file;
+    FTAEHeader header;
+    int live;
+    int range_coded;
+    FrameAppender appender;     // v4/v5 frames written so far
+    BitWriter writer;
+    RangeEncoder encoder;
+    FTAEModels* models;         // Range coding only
+    Spool spool;
+    uint32_t spooled;           // Frames or records in the spool
+    uint32_t capacity;          // Components waves and packed can hold
+    SineWave* waves;
+    PackedComponent* packed;
+    FTAESeekEntry* seek_table;  // v2: entries recorded so far
+    uint32_t seek_count;
+    uint32_t seek_capacity;
+    float max_duration;         // v2: longest record
+    DedupChannel* dedup;        // One per channel, NULL without deduplication
+    PendingFrame* pending;      // Frames not written yet, in file order
+    PendingFrame* pending_tail;
+    uint32_t repeat_frames;     // Back-references written
+    uint32_t repeated_frames;   // Frames they stand for
+};
+
+// Strongest first; equal amplitudes keep frequency order
+static int compare_by_importance(const void* a, const void* b) {
+    const SineWave* wave_a = a;
+    const SineWave* wave_b = b;
+    if (wave_a->amplitude != wave_b->amplitude) {
+        return (wave_a->amplitude < wave_b->amplitude) - (wave_a->amplitude > wave_b->amplitude);
+    }
+    return compare_by_frequency(a, b);
+}
+
+// End of layer (rounded-up 1/8, 1/4, 1/2 and all of count)
+static uint32_t layer_end(uint32_t count, int layer) {
+    int shift = FTAE_LAYER_COUNT - 1 - layer;
+    return (count + (1u << shift) - 1) >> shift;
+}
+
+// Order the frame's components into layers: by importance across layers and
+// by frequency within each, with the energy share reached at each layer end
+static void order_frame_layers(SineWave* waves, uint32_t count, FrameLayers* layers) {
+    if (count < FTAE_LAYERED_MIN_COMPONENTS) {
+        qsort(waves, count, sizeof(SineWave), compare_by_frequency);
+        layers->count = 1;
+        layers->end[0] = count;
+        return;
+    }
+    
+    qsort(waves, count, sizeof(SineWave), compare_by_importance);
+    double total = 0.0;
+    for (uint32_t i = 0; i < count; i++) {
+        total += (double)waves[i].amplitude * waves[i].amplitude;
+    }
+    
+    layers->count = FTAE_LAYER_COUNT;
+    double energy = 0.0;
+    uint32_t begin = 0;
+    for (int layer = 0; layer < FTAE_LAYER_COUNT; layer++) {
+        uint32_t end = layer_end(count, layer);
+        for (uint32_t i = begin; i < end; i++) {
+            energy += (double)waves[i].amplitude * waves[i].amplitude;
+        }
+        if (layer < FTAE_LAYER_COUNT - 1) {
+            long marker = total > 0.0 ? lrint(FTAE_LAYER_MARKER_MAX * energy / total) : FTAE_LAYER_MARKER_MAX;
+            layers->energy_marker[layer] = (uint32_t)(marker > FTAE_LAYER_MARKER_MAX ? FTAE_LAYER_MARKER_MAX : marker);
+        }
+        qsort(waves + begin, end - begin, sizeof(SineWave), compare_by_frequency);
+        layers->end[layer] = end;
+        begin = end;
+    }
+}
+
+// Order one frame of components that share start_time and duration into its
+// layers and quantize their fields; length is the duration in samples.
+// Returns the frame flags. The format takes the frame length as the FFT size
+// bin indices refer to, as the decoder knows nothing else of the window. A
+// frame extended over stationary windows is longer than the window its
+// components came from; their frequencies only round-trip through its finer
+// resolution when the bins happen to line up, so most such frames are coded
+// in Hz, which is intended.
+static uint16_t quantize_frame(SineWave* waves, uint32_t count, uint32_t sample_rate, uint32_t length,
+                               PackedComponent* packed, FrameLayers* layers) {
+    order_frame_layers(waves, count, layers);
+    
+    // Window components come from FFT bins; store bin indices when every
+    // frequency round-trips through the frame length's bin resolution
+    float freq_resolution = length > 0 ? (float)sample_rate / length : 0.0f;
+    int use_bins = freq_resolution > 0.0f;
+    for (uint32_t i = 0; i < count && use_bins; i++) {
+        use_bins = frequency_to_bin(waves[i].frequency, freq_resolution) >= 0;
+    }
+    
+    int64_t previous = 0;
+    uint32_t layer_begin = 0;
+    int layer = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        int64_t value = use_bins ? frequency_to_bin(waves[i].frequency, freq_resolution)
+                                 : waves[i].frequency;
+        if (i == layers->end[layer]) {
+            layer_begin = i;
+            layer++;
+        }
+        if (i == layer_begin) {
+            // First value is absolute; zigzag keeps a (malformed) negative Hz value codable
+            packed[i].frequency_code = (uint32_t)(value >= 0 ? 2 * value : -2 * value - 1);
+        } else {
+            packed[i].frequency_code = (uint32_t)(value - previous);
+        }
+        previous = value;
+        
+        packed[i].amplitude_code = quantize_amplitude(waves[i].amplitude);
+        packed[i].phase = (uint32_t)(((waves[i].phase % 360) + 360) % 360);
+    }
+    
+    return (use_bins ? FTAE_FRAME_BIN_FREQUENCIES : 0) | FTAE_FRAME_COLUMNAR |
+           (layers->count > 1 ? FTAE_FRAME_LAYERED : 0);
+}
+
+static void pack_frame_bits(BitWriter* writer, const PackedComponent* packed, const FrameLayers* layers) {
+    bitwriter_reset(writer);
+    for (int layer = 0; layers->count > 1 && layer < layers->count - 1; layer++) {
+        bitwriter_put(writer, layers->energy_marker[layer], FTAE_LAYER_MARKER_BITS);
+    }
+    
+    // One column per field and layer so the decoder can unpack each with a
+    // tight loop and stop after any layer
+    uint32_t begin = 0;
+    for (int layer = 0; layer < layers->count; layer++) {
+        uint32_t end = layers->end[layer];
+        for (uint32_t i = begin; i < end; i++) {
+            bitwriter_put_expgolomb(writer, packed[i].frequency_code);
+        }
+        for (uint32_t i = begin; i < end; i++) {
+            bitwriter_put(writer, packed[i].amplitude_code, FTAE_AMPLITUDE_BITS);
+        }
+        for (uint32_t i = begin; i < end; i++) {
+            bitwriter_put(writer, packed[i].phase, FTAE_PHASE_BITS);
+        }
+        begin = end;
+    }
+    bitwriter_flush(writer);
+}
+
+// Context of component i from its predecessor in the same layer
+static int amplitude_context(const FTAEModels* models, const PackedComponent* packed, uint32_t i,
+                             uint32_t layer_begin) {
+    if (models->amplitude_contexts == 1 || i == layer_begin) return 0;
+    return 1 + (int)(packed[i - 1].amplitude_code >> FTAE_AMPLITUDE_CONTEXT_SHIFT);
+}
+
+// Exp-Golomb length class of a frequency code
+static int frequency_length(uint32_t code) {
+    uint64_t coded = (uint64_t)code + 1;
+    int length = 0;
+    while ((coded >> (length + 1)) != 0) length++;
+    return length;
+}
+
+// Split each field into its modelled symbol and raw low bits, one column at
+// a time per layer. With no encoder the symbols are only counted (first pass
+// over the file).
+static void code_frame_symbols(const PackedComponent* packed, const FrameLayers* layers,
+                               FTAEModels* models, RangeEncoder* encoder) {
+    uint32_t begin = 0;
+    if (!encoder) {
+        for (int layer = 0; layer < layers->count; layer++) {
+            uint32_t end = layers->end[layer];
+            for (uint32_t i = begin; i < end; i++) {
+                entropy_model_count(&models->frequency, frequency_length(packed[i].frequency_code));
+                entropy_model_count(&models->amplitude[amplitude_context(models, packed, i, begin)],
+                                    (int)(packed[i].amplitude_code >> FTAE_AMPLITUDE_RAW_BITS));
+                entropy_model_count(&models->phase, (int)(packed[i].phase >> FTAE_PHASE_RAW_BITS));
+            }
+            begin = end;
+        }
+        return;
+    }
+    
+    for (int layer = 0; layers->count > 1 && layer < layers->count - 1; layer++) {
+        range_encode_bits(encoder, layers->energy_marker[layer], FTAE_LAYER_MARKER_BITS);
+    }
+    
+    for (int layer = 0; layer < layers->count; layer++) {
+        uint32_t end = layers->end[layer];
+        
+        // Frequency: exp-Golomb length class, then the bits below the leading one
+        for (uint32_t i = begin; i < end; i++) {
+            int length = frequency_length(packed[i].frequency_code);
+            uint64_t coded = (uint64_t)packed[i].frequency_code + 1;
+            range_encode_symbol(encoder, &models->frequency, length);
+            range_encode_bits(encoder, (uint32_t)(coded - (1ull << length)), length);
+        }
+        for (uint32_t i = begin; i < end; i++) {
+            range_encode_symbol(encoder, &models->amplitude[amplitude_context(models, packed, i, begin)],
+                                (int)(packed[i].amplitude_code >> FTAE_AMPLITUDE_RAW_BITS));
+            range_encode_bits(encoder, packed[i].amplitude_code, FTAE_AMPLITUDE_RAW_BITS);
+        }
+        for (uint32_t i = begin; i < end; i++) {
+            range_encode_symbol(encoder, &models->phase, (int)(packed[i].phase >> FTAE_PHASE_RAW_BITS));
+            range_encode_bits(encoder, packed[i].phase, FTAE_PHASE_RAW_BITS);
+        }
+        begin = end;
+    }
+    range_encoder_flush(encoder);
+}
+
+// Normalize the counted models and serialize them. Amplitude contexts are
+// kept only if the bits they save outweigh their larger tables.
+static void finish_models(FTAEModels* models, BitWriter* writer) {
+    EntropyModel merged;
+    entropy_model_init(&merged, FTAE_AMPLITUDE_SYMBOLS);
+    for (int c = 0; c < FTAE_AMPLITUDE_CONTEXTS_MAX; c++) {
+        for (int s = 0; s < FTAE_AMPLITUDE_SYMBOLS; s++) {
+            merged.counts[s] += models->amplitude[c].counts[s];
+        }
+    }
+    entropy_model_normalize(&merged);
+    
+    BitWriter table;
+    bitwriter_init(&table);
+    double context_bits = 0.0;
+    for (int c = 0; c < FTAE_AMPLITUDE_CONTEXTS_MAX; c++) {
+        entropy_model_normalize(&models->amplitude[c]);
+        context_bits += entropy_model_cost(&models->amplitude[c]);
+        entropy_model_write(&models->amplitude[c], &table);
+    }
+    context_bits += 8.0 * table.size;
+    bitwriter_reset(&table);
+    entropy_model_write(&merged, &table);
+    double merged_bits = entropy_model_cost(&merged) + 8.0 * table.size;
+    bitwriter_free(&table);
+    
+    if (merged_bits <= context_bits) {
+        models->amplitude_contexts = 1;
+        models->amplitude[0] = merged;
+    }
+    
+    entropy_model_normalize(&models->frequency);
+    entropy_model_normalize(&models->phase);
+    
+    bitwriter_put_expgolomb(writer, models->amplitude_contexts);
+    entropy_model_write(&models->frequency, writer);
+    for (uint32_t c = 0; c < models->amplitude_contexts; c++) {
+        entropy_model_write(&models->amplitude[c], writer);
+    }
+    entropy_model_write(&models->phase, writer);
+    bitwriter_flush(writer);
+}
+
+// Channel whose next frame starts first (ties go to the lower channel), or
+// -1 once every channel is exhausted. Frames of all channels are interleaved
+// in start order so the frame index stays sorted for seeking.
+static int next_frame_channel(SineWaveNode* const* cursors, uint32_t channel_count) {
+    int channel = -1;
+    for (uint32_t c = 0; c < channel_count; c++) {
+        if (cursors[c] && (channel < 0 || cursors[c]->wave.start_time < cursors[channel]->wave.start_time)) {
+            channel = (int)c;
+        }
+    }
+    return channel;
+}
+
+// Gather the run of components from the same analysis window
+static uint32_t gather_frame(SineWaveNode** current, SineWave* waves) {
+    uint32_t count = 0;
+    double start_time = (*current)->wave.start_time;
+    double duration = (*current)->wave.duration;
+    while (*current && count < FTAE_FRAME_MAX_COMPONENTS &&
+           (*current)->wave.start_time == start_time && (*current)->wave.duration == duration) {
+        waves[count++] = (*current)->wave;
+        *current = (*current)->next;
+    }
+    return count;
+}
+
+// Samples at rate as v4 float seconds
+static float frame_seconds(int64_t samples, uint32_t rate) {
+    return (float)((double)samples / rate);
+}
+
+// Start a v4 or v5 file: the header and models go out before any frame,
+// with the counts left for the trailer
+static int frame_appender_open(FrameAppender* appender, FILE* file, const FTAEHeader* header,
+                               const uint8_t* models, size_t model_size) {
+    memset(appender, 0, sizeof(FrameAppender));
+    appender->file = file;
+    appender->offset = sizeof(FTAEHeader) + model_size;
+    appender->sample_rate = header->sample_rate;
+    appender->sampled = header->version == FTAE_VERSION_SAMPLED;
+    
+    if (fwrite(header, sizeof(FTAEHeader), 1, file) != 1 ||
+        (model_size > 0 && fwrite(models, 1, model_size, file) != model_size)) {
+        fprintf(stderr, "Error: Failed to write FTAE header\n");
+        return DFTA_ERROR_FILE_WRITE;
+    }
+    return DFTA_SUCCESS;
+}
+
+static int frame_appender_add(FrameAppender* appender, const CodedFrame* frame, const uint8_t* payload) {
+    size_t header_size = appender->sampled ? sizeof(FTAESampledFrameHeader) : sizeof(FTAECheckedFrameHeader);
+    if (!appender->sampled && appender->offset + header_size + frame->payload_size > UINT32_MAX) {
+        fprintf(stderr, "Error: Packed FTAE output exceeds 4 GB\n");
         return DFTA_ERROR_FILE_WRITE;
     }
+    if (appender->frame_count == appender->index_capacity) {
+        uint32_t capacity = appender->index_capacity ? appender->index_capacity * 2 : 256;
+        FTAESampledIndexEntry* index = realloc(appender->index, capacity * sizeof(FTAESampledIndexEntry));
+        if (!index) {
+            return DFTA_ERROR_MEMORY;
+        }
+        appender->index = index;
+        appender->index_capacity = capacity;
+    }
     
-    FILE* file = fopen(filename, "wb");
-    if (!file) {
-        fprintf(stderr, "Error: Cannot create output file %s\n", filename);
+    int written;
+    if (appender->sampled) {
+        FTAESampledFrameHeader sampled;
+        sampled.start_sample = (uint64_t)frame->start;
+        sampled.duration = frame->length;
+        sampled.component_count = frame->component_count;
+        sampled.flags = frame->flags;
+        sampled.payload_size = frame->payload_size;
+        sampled.crc = crc32c(crc32c(0, &sampled, offsetof(FTAESampledFrameHeader, crc)), payload, frame->payload_size);
+        written = fwrite(&sampled, sizeof(FTAESampledFrameHeader), 1, appender->file) == 1;
+    } else {
+        FTAECheckedFrameHeader checked;
+        checked.frame.start_time = frame_seconds(frame->start, appender->sample_rate);
+        checked.frame.duration = frame->seconds > 0.0f ? frame->seconds : frame_seconds(frame->length, appender->sample_rate);
+        checked.frame.component_count = frame->component_count;
+        checked.frame.flags = frame->flags;
+        checked.frame.payload_size = frame->payload_size;
+        checked.crc = crc32c(crc32c(0, &checked.frame, sizeof(FTAEFrameHeader)), payload, frame->payload_size);
+        written = fwrite(&checked, sizeof(FTAECheckedFrameHeader), 1, appender->file) == 1;
+    }
+    if (!written || fwrite(payload, 1, frame->payload_size, appender->file) != frame->payload_size) {
+        fprintf(stderr, "Error: Failed to write FTAE frame\n");
         return DFTA_ERROR_FILE_WRITE;
     }
     
-    // Write FTAE header
-    FTAEHeader header;
-    memcpy(header.magic, "FTAE", 4);
-    header.version = 1;
-    header.sample_rate = original_audio->sample_rate;
-    header.wave_count = queue->count;
-    header.compression_level = config->compression_level;
-    header.amplitude_threshold = config->amplitude_threshold;
-    header.duration = (float)original_audio->sample_count / original_audio->sample_rate;
-    memset(header.reserved, 0, sizeof(header.reserved));
-    
-    if (fwrite(&header, sizeof(FTAEHeader), 1, file) != 1) {
-        fprintf(stderr, "Error: Failed to write FTAE header\n");
-        fclose(file);
+    appender->index[appender->frame_count].start_sample = (uint64_t)frame->start;
+    appender->index[appender->frame_count].offset = appender->offset;
+    appender->frame_count++;
+    appender->wave_count += frame->component_count;
+    if (frame->length > appender->max_length) {
+        appender->max_length = frame->length;
+    }
+    if (!appender->sampled) {
+        float seconds = frame->seconds > 0.0f ? frame->seconds : frame_seconds(frame->length, appender->sample_rate);
+        if (seconds > appender->max_seconds) appender->max_seconds = seconds;
+    }
+    appender->offset += header_size + frame->payload_size;
+    return DFTA_SUCCESS;
+}
+
+// v4 index and trailer, from the v5 form the appender keeps
+static int write_float_trailer(FrameAppender* appender, uint64_t sample_count) {
+    FTAEFrameIndexEntry* index = malloc((appender->frame_count > 0 ? appender->frame_count : 1) *
+                                        sizeof(FTAEFrameIndexEntry));
+    if (!index) {
+        return DFTA_ERROR_MEMORY;
+    }
+    for (uint32_t f = 0; f < appender->frame_count; f++) {
+        index[f].start_time = frame_seconds((int64_t)appender->index[f].start_sample, appender->sample_rate);
+        index[f].offset = (uint32_t)appender->index[f].offset;
+    }
+    
+    FTAETrailer trailer;
+    trailer.frame_count = appender->frame_count;
+    trailer.wave_count = (uint32_t)appender->wave_count;
+    trailer.index_offset = (uint32_t)appender->offset;
+    trailer.index_crc = crc32c(0, index, (size_t)appender->frame_count * sizeof(FTAEFrameIndexEntry));
+    trailer.duration = (float)sample_count / appender->sample_rate;
+    trailer.max_duration = appender->max_seconds;
+    trailer.crc = crc32c(0, &trailer, offsetof(FTAETrailer, crc));
+    memcpy(trailer.magic, "FTAX", 4);
+    
+    int result = DFTA_SUCCESS;
+    if (fwrite(index, sizeof(FTAEFrameIndexEntry), appender->frame_count, appender->file) != appender->frame_count ||
+        fwrite(&trailer, sizeof(FTAETrailer), 1, appender->file) != 1) {
+        result = DFTA_ERROR_FILE_WRITE;
+    }
+    free(index);
+    return result;
+}
+
+// Write the frame index and trailer; the file stays valid without them up to
+// the last complete frame
+static int frame_appender_close(FrameAppender* appender, uint64_t sample_count) {
+    int result = DFTA_SUCCESS;
+    if (appender->sampled) {
+        FTAESampledTrailer trailer;
+        memset(&trailer, 0, sizeof(FTAESampledTrailer));
+        trailer.sample_count = sample_count;
+        trailer.wave_count = appender->wave_count;
+        trailer.index_offset = appender->offset;
+        trailer.frame_count = appender->frame_count;
+        trailer.index_crc = crc32c(0, appender->index, (size_t)appender->frame_count * sizeof(FTAESampledIndexEntry));
+        trailer.max_duration = appender->max_length;
+        trailer.crc = crc32c(0, &trailer, offsetof(FTAESampledTrailer, crc));
+        memcpy(trailer.magic, "FTAX", 4);
+        
+        if (fwrite(appender->index, sizeof(FTAESampledIndexEntry), appender->frame_count, appender->file) != appender->frame_count ||
+            fwrite(&trailer, sizeof(FTAESampledTrailer), 1, appender->file) != 1) {
+            result = DFTA_ERROR_FILE_WRITE;
+        }
+    } else {
+        result = write_float_trailer(appender, sample_count);
+    }
+    if (result == DFTA_ERROR_FILE_WRITE) {
+        fprintf(stderr, "Error: Failed to write FTAE frame index\n");
+    }
+    
+    free(appender->index);
+    appender->index = NULL;
+    return result;
+}
+
+// Header fields shared by every layout; the body writer sets the rest
+static void init_header(FTAEHeader* header, uint32_t version, uint32_t sample_rate, uint32_t channel_count,
+                        uint32_t mid_side_pairs, const EncodingConfig* config) {
+    memset(header, 0, sizeof(FTAEHeader));
+    memcpy(header->magic, "FTAE", 4);
+    header->version = version;
+    header->sample_rate = sample_rate;
+    header->compression_level = config->compression_level;
+    header->amplitude_threshold = config->amplitude_threshold;
+    header->channels = (uint16_t)channel_count;
+    header->mid_side_pairs = (uint16_t)mid_side_pairs;
+}
+
+static void spool_open(Spool* spool) {
+    memset(spool, 0, sizeof(Spool));
+#ifndef DFTA_LIBRARY
+    spool->file = tmpfile();
+#endif
+}
+
+static int spool_write(Spool* spool, const void* data, size_t size) {
+    if (spool->file) {
+        return fwrite(data, 1, size, spool->file) == size ? DFTA_SUCCESS : DFTA_ERROR_FILE_WRITE;
+    }
+    if (spool->size + size > spool->capacity) {
+        size_t capacity = spool->capacity ? spool->capacity : 65536;
+        while (capacity < spool->size + size) capacity *= 2;
+        uint8_t* grown = realloc(spool->data, capacity);
+        if (!grown) return DFTA_ERROR_MEMORY;
+        spool->data = grown;
+        spool->capacity = capacity;
+    }
+    memcpy(spool->data + spool->size, data, size);
+    spool->size += size;
+    return DFTA_SUCCESS;
+}
+
+static int spool_rewind(Spool* spool) {
+    spool->position = 0;
+    if (spool->file && fseek(spool->file, 0, SEEK_SET) != 0) {
+        return DFTA_ERROR_FILE_READ;
+    }
+    return DFTA_SUCCESS;
+}
+
+static int spool_read(Spool* spool, void* data, size_t size) {
+    if (spool->file) {
+        return fread(data, 1, size, spool->file) == size ? DFTA_SUCCESS : DFTA_ERROR_FILE_READ;
+    }
+    if (spool->position + size > spool->size) return DFTA_ERROR_FILE_READ;
+    memcpy(data, spool->data + spool->position, size);
+    spool->position += size;
+    return DFTA_SUCCESS;
+}
+
+static void spool_close(Spool* spool) {
+    if (spool->file) fclose(spool->file);
+    free(spool->data);
+    memset(spool, 0, sizeof(Spool));
+}
+
+// Grow the per-frame buffers to hold count components
+static int writer_reserve(FTAEWriter* writer, uint32_t count) {
+    if (count <= writer->capacity) return DFTA_SUCCESS;
+    SineWave* waves = realloc(writer->waves, count * sizeof(SineWave));
+    if (!waves) return DFTA_ERROR_MEMORY;
+    writer->waves = waves;
+    PackedComponent* packed = realloc(writer->packed, count * sizeof(PackedComponent));
+    if (!packed) return DFTA_ERROR_MEMORY;
+    writer->packed = packed;
+    writer->capacity = count;
+    return DFTA_SUCCESS;
+}
+
+// Free the writer without finishing the file
+void ftae_writer_free(FTAEWriter* writer) {
+    while (writer->pending) {
+        PendingFrame* next = writer->pending->next;
+        free(writer->pending->packed);
+        free(writer->pending);
+        writer->pending = next;
+    }
+    for (uint32_t c = 0; writer->dedup && c < writer->header.channels; c++) {
+        for (uint32_t r = 0; writer->dedup[c].history && r < DEDUP_HISTORY_FRAMES; r++) {
+            free(writer->dedup[c].history[r].packed);
+        }
+        free(writer->dedup[c].history);
+    }
+    free(writer->dedup);
+    free(writer->appender.index);
+    bitwriter_free(&writer->writer);
+    range_encoder_free(&writer->encoder);
+    spool_close(&writer->spool);
+    free(writer->models);
+    free(writer->waves);
+    free(writer->packed);
+    free(writer->seek_table);
+    free(writer);
+}
+
+// Start an FTAE file for the configured layout. Raw records carry no
+// channel, so that layout is always mono. sample_count picks v4 or v5 for
+// packed output and gives the header's duration; live output passes 0 and
+// is always v5, its length going into the trailer (decoders recover it from
+// the frames when there is none).
+int ftae_writer_open(FTAEWriter** writer_out, FILE* file, uint32_t sample_rate, uint16_t channels,
+                     uint32_t mid_side_pairs, uint64_t sample_count, const EncodingConfig* config, int live) {
+    *writer_out = NULL;
+    if (!file || !config || channels == 0 || channels > DFTA_MAX_CHANNELS) {
         return DFTA_ERROR_FILE_WRITE;
     }
+    FTAEWriter* writer = calloc(1, sizeof(FTAEWriter));
+    if (!writer) return DFTA_ERROR_MEMORY;
     
-    // Write SineWave data
-    SineWaveNode* current = queue->head;
-    uint32_t written_count = 0;
+    int packed = config->output_format == FTAE_FORMAT_PACKED;
+    writer->file = file;
+    writer->live = live;
+    writer->range_coded = packed && !live && config->entropy_coding == ENTROPY_RANGE;
+    bitwriter_init(&writer->writer);
+    range_encoder_init(&writer->encoder);
+    uint32_t version = FTAE_VERSION_SEEKABLE;
+    if (packed) {
+        version = live || sample_count >= FTAE_SAMPLED_MIN_SAMPLES ? FTAE_VERSION_SAMPLED : FTAE_VERSION_FRAMED;
+    }
+    init_header(&writer->header, version, sample_rate, packed ? channels : 1, packed ? mid_side_pairs : 0, config);
+    writer->header.duration = (float)sample_count / sample_rate;
     
-    while (current) {
-        if (fwrite(&current->wave, sizeof(SineWave), 1, file) != 1) {
+    int result = writer_reserve(writer, 256);
+    // Live frames go out as soon as they are coded, so they are never held
+    // back for a run
+    if (result == DFTA_SUCCESS && packed && !live && config->deduplicate) {
+        writer->dedup = calloc(channels, sizeof(DedupChannel));
+        for (uint32_t c = 0; writer->dedup && c < channels; c++) {
+            writer->dedup[c].history = calloc(DEDUP_HISTORY_FRAMES, sizeof(DedupRecord));
+            if (!writer->dedup[c].history) result = DFTA_ERROR_MEMORY;
+        }
+        if (!writer->dedup) result = DFTA_ERROR_MEMORY;
+    }
+    if (result == DFTA_SUCCESS && packed && !writer->range_coded) {
+        result = frame_appender_open(&writer->appender, file, &writer->header, NULL, 0);
+        if (result == DFTA_SUCCESS && live && fflush(file) != 0) {
+            result = DFTA_ERROR_FILE_WRITE;
+        }
+    } else if (result == DFTA_SUCCESS) {
+        spool_open(&writer->spool);
+    }
+    
+    // The models are static per file, so every symbol is counted as frames
+    // come in and the frames are coded once the models are known. Frames
+    // then stay independently decodable for seeking.
+    if (result == DFTA_SUCCESS && writer->range_coded) {
+        writer->models = calloc(1, sizeof(FTAEModels));
+        if (!writer->models) {
+            result = DFTA_ERROR_MEMORY;
+        } else {
+            entropy_model_init(&writer->models->frequency, FTAE_FREQUENCY_SYMBOLS);
+            entropy_model_init(&writer->models->phase, FTAE_PHASE_SYMBOLS);
+            writer->models->amplitude_contexts = FTAE_AMPLITUDE_CONTEXTS_MAX;
+            for (int c = 0; c < FTAE_AMPLITUDE_CONTEXTS_MAX; c++) {
+                entropy_model_init(&writer->models->amplitude[c], FTAE_AMPLITUDE_SYMBOLS);
+            }
+        }
+    }
+    if (result != DFTA_SUCCESS) {
+        ftae_writer_free(writer);
+        return result;
+    }
+    
+    *writer_out = writer;
+    return DFTA_SUCCESS;
+}
+
+// v2: append records, recording the first record at each seek point
+static int add_raw_records(FTAEWriter* writer, const SineWaveQueue* queue) {
+    for (SineWaveNode* node = queue->head; node; node = node->next) {
+        while (node->wave.start_time >= writer->seek_count * FTAE_SEEK_INTERVAL) {
+            if (writer->seek_count == writer->seek_capacity) {
+                uint32_t capacity = writer->seek_capacity ? writer->seek_capacity * 2 : 256;
+                FTAESeekEntry* table = realloc(writer->seek_table, capacity * sizeof(FTAESeekEntry));
+                if (!table) return DFTA_ERROR_MEMORY;
+                writer->seek_table = table;
+                writer->seek_capacity = capacity;
+            }
+            writer->seek_table[writer->seek_count].time = writer->seek_count * FTAE_SEEK_INTERVAL;
+            writer->seek_table[writer->seek_count].record_index = writer->spooled;
+            writer->seek_count++;
+        }
+        
+        FTAERecord record;
+        record.phase = node->wave.phase;
+        record.amplitude = node->wave.amplitude;
+        record.frequency = node->wave.frequency;
+        record.start_time = (float)node->wave.start_time;
+        record.duration = (float)node->wave.duration;
+        if (spool_write(&writer->spool, &record, sizeof(FTAERecord)) != DFTA_SUCCESS) {
             fprintf(stderr, "Error: Failed to write SineWave data\n");
-            fclose(file);
             return DFTA_ERROR_FILE_WRITE;
         }
-        written_count++;
-        current = current->next;
+        writer->spooled++;
+        if (record.duration > writer->max_duration) {
+            writer->max_duration = record.duration;
+        }
+    }
+    return DFTA_SUCCESS;
+}
+
+// Write one frame, or spool it when range coding. repeat is the payload of
+// a back-reference frame, NULL for coded frames.
+static int emit_frame(FTAEWriter* writer, CodedFrame* frame, const FrameLayers* layers,
+                      const PackedComponent* packed, const FTAERepeatPayload* repeat) {
+    int result;
+    if (writer->range_coded) {
+        result = spool_write(&writer->spool, frame, sizeof(CodedFrame));
+        if (repeat) {
+            if (result == DFTA_SUCCESS) result = spool_write(&writer->spool, repeat, sizeof(FTAERepeatPayload));
+        } else {
+            code_frame_symbols(packed, layers, writer->models, NULL);
+            if (result == DFTA_SUCCESS) result = spool_write(&writer->spool, layers, sizeof(FrameLayers));
+            if (result == DFTA_SUCCESS) {
+                result = spool_write(&writer->spool, packed, frame->component_count * sizeof(PackedComponent));
+            }
+        }
+        writer->spooled++;
+        return result;
     }
     
-    fclose(file);
+    if (repeat) {
+        frame->payload_size = sizeof(FTAERepeatPayload);
+        result = frame_appender_add(&writer->appender, frame, (const uint8_t*)repeat);
+    } else {
+        pack_frame_bits(&writer->writer, packed, layers);
+        if (writer->writer.failed) {
+            return DFTA_ERROR_MEMORY;
+        }
+        frame->payload_size = (uint32_t)writer->writer.size;
+        result = frame_appender_add(&writer->appender, frame, writer->writer.data);
+    }
+    if (result == DFTA_SUCCESS && writer->live && fflush(writer->file) != 0) {
+        fprintf(stderr, "Error: Failed to write FTAE frame\n");
+        result = DFTA_ERROR_FILE_WRITE;
+    }
+    return result;
+}
+
+// Frames written or spooled so far, i.e. the index position of the next one
+static uint32_t emitted_frames(const FTAEWriter* writer) {
+    return writer->range_coded ? writer->spooled : writer->appender.frame_count;
+}
+
+// Word-at-a-time multiply-xorshift, as for the analysis cache keys
+static uint64_t hash_word(uint64_t hash, uint32_t word) {
+    hash = (hash ^ word) * 0xFF51AFD7ED558CCDull;
+    return hash ^ (hash >> 32);
+}
+
+// Hash of everything a frame's payload and its sound depend on except its
+// start time and channel
+static uint64_t frame_hash(const CodedFrame* frame, const FrameLayers* layers, const PackedComponent* packed) {
+    uint64_t hash = hash_word(0x9E3779B97F4A7C15ull, frame->length);
+    hash = hash_word(hash, frame->flags & ((1u << FTAE_FRAME_CHANNEL_SHIFT) - 1));
+    hash = hash_word(hash, frame->component_count);
+    hash = hash_word(hash, (uint32_t)layers->count);
+    for (int layer = 0; layer < layers->count - 1; layer++) {
+        hash = hash_word(hash, layers->end[layer]);
+        hash = hash_word(hash, layers->energy_marker[layer]);
+    }
+    for (uint32_t i = 0; i < frame->component_count; i++) {
+        hash = hash_word(hash, packed[i].frequency_code);
+        hash = hash_word(hash, packed[i].amplitude_code | packed[i].phase << FTAE_AMPLITUDE_BITS);
+    }
+    return hash;
+}
+
+// Record of the channel's frame at ordinal, or NULL if it has left the history
+static DedupRecord* dedup_record(DedupChannel* state, uint32_t ordinal) {
+    DedupRecord* record = &state->history[ordinal % DEDUP_HISTORY_FRAMES];
+    return ordinal < state->count && record->ordinal == ordinal ? record : NULL;
+}
+
+// Keep the quantized frame in its history record
+static int record_frame(DedupRecord* record, const CodedFrame* frame, const FrameLayers* layers,
+                        const PackedComponent* packed) {
+    if (frame->component_count > record->packed_capacity) {
+        PackedComponent* grown = realloc(record->packed, frame->component_count * sizeof(PackedComponent));
+        if (!grown) return DFTA_ERROR_MEMORY;
+        record->packed = grown;
+        record->packed_capacity = frame->component_count;
+    }
+    memcpy(record->packed, packed, frame->component_count * sizeof(PackedComponent));
+    record->length = frame->length;
+    record->component_count = frame->component_count;
+    record->flags = frame->flags & ((1u << FTAE_FRAME_CHANNEL_SHIFT) - 1);
+    record->layers = *layers;
+    return DFTA_SUCCESS;
+}
+
+// Whether the recorded frame codes exactly what frame does (start and
+// channel aside): same length, flags, layers and packed components
+static int same_frame(const DedupRecord* record, const CodedFrame* frame, const FrameLayers* layers,
+                      const PackedComponent* packed) {
+    if (record->length != frame->length || record->component_count != frame->component_count ||
+        record->flags != (frame->flags & ((1u << FTAE_FRAME_CHANNEL_SHIFT) - 1)) ||
+        record->layers.count != layers->count) {
+        return 0;
+    }
+    for (int layer = 0; layer < layers->count - 1; layer++) {
+        if (record->layers.end[layer] != layers->end[layer] ||
+            record->layers.energy_marker[layer] != layers->energy_marker[layer]) {
+            return 0;
+        }
+    }
+    return memcmp(record->packed, packed, frame->component_count * sizeof(PackedComponent)) == 0;
+}
+
+// Queue a copy of the frame in writer->packed behind the pending frames
+static PendingFrame* hold_frame(FTAEWriter* writer, uint32_t channel, uint32_t ordinal,
+                                const CodedFrame* frame, const FrameLayers* layers, int kind) {
+    PendingFrame* entry = malloc(sizeof(PendingFrame));
+    if (!entry) return NULL;
+    entry->packed = malloc((frame->component_count > 0 ? frame->component_count : 1) * sizeof(PackedComponent));
+    if (!entry->packed) {
+        free(entry);
+        return NULL;
+    }
+    memcpy(entry->packed, writer->packed, frame->component_count * sizeof(PackedComponent));
+    entry->frame = *frame;
+    entry->layers = *layers;
+    entry->channel = channel;
+    entry->ordinal = ordinal;
+    entry->kind = kind;
+    entry->next = NULL;
+    if (writer->pending_tail) {
+        writer->pending_tail->next = entry;
+    } else {
+        writer->pending = entry;
+    }
+    writer->pending_tail = entry;
+    return entry;
+}
+
+// Write pending frames up to the first one still held by an open run
+static int flush_pending(FTAEWriter* writer) {
+    while (writer->pending && writer->pending->kind != PENDING_HELD) {
+        PendingFrame* entry = writer->pending;
+        DedupChannel* state = &writer->dedup[entry->channel];
+        uint32_t number = emitted_frames(writer);
+        int result = DFTA_SUCCESS;
+        
+        if (entry->kind == PENDING_CODED) {
+            result = emit_frame(writer, &entry->frame, &entry->layers, entry->packed, NULL);
+            DedupRecord* record = dedup_record(state, entry->ordinal);
+            if (record) record->frame_number = number;
+        } else if (entry->kind == PENDING_REPEAT) {
+            // The group's frames are ahead of this one in the queue, so they
+            // are already written
+            DedupRecord* first = dedup_record(state, entry->source_first);
+            DedupRecord* last = dedup_record(state, entry->source_last);
+            if (!first || !last || first->frame_number == UINT32_MAX || last->frame_number == UINT32_MAX) {
+                fprintf(stderr, "Error: Lost track of a repeated frame group\n");
+                return DFTA_ERROR_FORMAT;
+            }
+            FTAERepeatPayload repeat;
+            repeat.first_frame = first->frame_number;
+            repeat.end_frame = last->frame_number + 1;
+            repeat.shift = entry->shift;
+            result = emit_frame(writer, &entry->frame, NULL, NULL, &repeat);
+        }
+        if (result != DFTA_SUCCESS) return result;
+        
+        writer->pending = entry->next;
+        if (!writer->pending) writer->pending_tail = NULL;
+        free(entry->packed);
+        free(entry);
+    }
+    return DFTA_SUCCESS;
+}
+
+// End the channel's open run: long enough, its first frame becomes the
+// back-reference and the rest are dropped; otherwise every frame is written
+// as it is and may serve as a source itself
+static int close_run(FTAEWriter* writer, uint32_t channel) {
+    DedupChannel* state = &writer->dedup[channel];
+    uint32_t length = state->run_length;
+    PendingFrame* first = state->run_first;
+    int repeat = length >= DEDUP_MIN_FRAMES;
+    uint32_t rate = writer->header.sample_rate;
+    int64_t end = first->frame.start;
+    float end_seconds = frame_seconds(first->frame.start, rate);
     
-    // Calculate compression statistics
-    size_t original_size = original_audio->sample_count * sizeof(float);
-    size_t compressed_size = sizeof(FTAEHeader) + (written_count * sizeof(SineWave));
-    float compression_ratio = (float)original_size / compressed_size;
+    // The channel's frames after the run's first are the rest of the run
+    uint32_t seen = 0;
+    for (PendingFrame* entry = first; entry && seen < length; entry = entry->next) {
+        if (entry->channel != channel) continue;
+        int64_t frame_end = entry->frame.start + entry->frame.length;
+        if (frame_end > end) end = frame_end;
+        float frame_end_seconds = frame_seconds(entry->frame.start, rate) + frame_seconds(entry->frame.length, rate);
+        if (frame_end_seconds > end_seconds) end_seconds = frame_end_seconds;
+        if (repeat) {
+            entry->kind = entry == first ? PENDING_REPEAT : PENDING_DROPPED;
+        } else {
+            entry->kind = PENDING_CODED;
+            DedupRecord* record = dedup_record(state, entry->ordinal);
+            if (record) record->source = 1;
+        }
+        seen++;
+    }
     
-    printf("\nCompression Results:\n");
-    printf("  Original size: %zu bytes\n", original_size);
-    printf("  Compressed size: %zu bytes\n", compressed_size);
-    printf("  Compression ratio: %.2fx\n", compression_ratio);
-    printf("  SineWave components: %u\n", written_count);
-    printf("  Space savings: %.1f%%\n", ((float)(original_size - compressed_size) / original_size) * 100);
+    if (repeat) {
+        first->source_first = state->run_source;
+        first->source_last = state->run_source + length - 1;
+        first->shift = (int32_t)state->run_shift;
+        first->frame.length = (uint32_t)(end - first->frame.start);
+        // v4 has always stored the group's duration as a float difference,
+        // which decoders truncate to a sample or so less than length
+        first->frame.seconds = end_seconds - frame_seconds(first->frame.start, rate);
+        first->frame.component_count = 0;
+        first->frame.flags = FTAE_FRAME_REPEAT | (uint16_t)(channel << FTAE_FRAME_CHANNEL_SHIFT);
+        writer->repeat_frames++;
+        writer->repeated_frames += length;
+    }
+    state->run_length = 0;
+    state->run_first = NULL;
+    return flush_pending(writer);
+}
+
+// First sample the decoder renders for a frame starting at start: v4 stores
+// float seconds, which decoders truncate back to samples
+static int64_t rendered_start(const FTAEWriter* writer, int64_t start) {
+    if (writer->header.version == FTAE_VERSION_SAMPLED) return start;
+    uint32_t rate = writer->header.sample_rate;
+    return (int)(frame_seconds(start, rate) * rate);
+}
+
+// Deduplicating path of ftae_writer_add for the frame in writer->packed
+static int dedup_frame(FTAEWriter* writer, uint32_t channel, const CodedFrame* frame,
+                       const FrameLayers* layers) {
+    DedupChannel* state = &writer->dedup[channel];
+    uint64_t hash = frame_hash(frame, layers, writer->packed);
+    int64_t start = rendered_start(writer, frame->start);
+    uint32_t ordinal = state->count++;
+    DedupRecord* record = &state->history[ordinal % DEDUP_HISTORY_FRAMES];
+    record->hash = hash;
+    record->start = start;
+    record->ordinal = ordinal;
+    record->frame_number = UINT32_MAX;
+    record->source = 0;
+    if (record_frame(record, frame, layers, writer->packed) != DFTA_SUCCESS) {
+        return DFTA_ERROR_MEMORY;
+    }
     
-    return DFTA_SUCCESS;
+    // Extend the open run while the frame repeats the source's successor
+    if (state->run_length > 0) {
+        DedupRecord* source = dedup_record(state, state->run_source + state->run_length);
+        if (state->run_length < DEDUP_MAX_FRAMES && source && source->source && source->hash == hash &&
+            start - source->start == state->run_shift && same_frame(source, frame, layers, writer->packed)) {
+            state->run_length++;
+            return hold_frame(writer, channel, ordinal, frame, layers, PENDING_HELD) ? DFTA_SUCCESS
+                                                                                     : DFTA_ERROR_MEMORY;
+        }
+        int result = close_run(writer, channel);
+        if (result != DFTA_SUCCESS) return result;
+    }
+    
+    // Open a run at the latest coded copy of this frame
+    uint32_t oldest = ordinal > DEDUP_SEARCH_FRAMES ? ordinal - DEDUP_SEARCH_FRAMES : 0;
+    for (uint32_t o = ordinal; o-- > oldest;) {
+        DedupRecord* candidate = dedup_record(state, o);
+        if (!candidate || !candidate->source || candidate->hash != hash) continue;
+        if (start - candidate->start <= 0 || start - candidate->start > INT32_MAX) break;
+        if (!same_frame(candidate, frame, layers, writer->packed)) continue;
+        state->run_first = hold_frame(writer, channel, ordinal, frame, layers, PENDING_HELD);
+        if (!state->run_first) return DFTA_ERROR_MEMORY;
+        state->run_length = 1;
+        state->run_source = o;
+        state->run_shift = start - candidate->start;
+        return DFTA_SUCCESS;
+    }
+    
+    record->source = 1;
+    if (writer->pending) {
+        return hold_frame(writer, channel, ordinal, frame, layers, PENDING_CODED) ? DFTA_SUCCESS : DFTA_ERROR_MEMORY;
+    }
+    record->frame_number = emitted_frames(writer);
+    CodedFrame coded = *frame;
+    return emit_frame(writer, &coded, layers, writer->packed, NULL);
+}
+
+// Add the next components of every channel, each queue in start_time order
+// and starting no earlier than anything added before. Components sharing a
+// window become one frame; frames of all channels are interleaved in start
+// order. The queues are left as they are.
+int ftae_writer_add(FTAEWriter* writer, SineWaveQueue* const* queues) {
+    if (writer->header.version == FTAE_VERSION_SEEKABLE) {
+        return add_raw_records(writer, queues[0]);
+    }
+    
+    uint32_t channel_count = writer->header.channels;
+    SineWaveNode* cursors[DFTA_MAX_CHANNELS];
+    uint32_t longest = 1;
+    for (uint32_t c = 0; c < channel_count; c++) {
+        cursors[c] = queues[c]->head;
+        if ((uint32_t)queues[c]->count > longest) longest = (uint32_t)queues[c]->count;
+    }
+    int result = writer_reserve(writer, longest < FTAE_FRAME_MAX_COMPONENTS ? longest : FTAE_FRAME_MAX_COMPONENTS);
+    int channel;
+    
+    while (result == DFTA_SUCCESS && (channel = next_frame_channel(cursors, channel_count)) >= 0) {
+        uint32_t count = gather_frame(&cursors[channel], writer->waves);
+        
+        CodedFrame frame;
+        FrameLayers layers;
+        uint32_t rate = writer->header.sample_rate;
+        frame.start = llround(writer->waves[0].start_time * rate);
+        frame.length = (uint32_t)llround(writer->waves[0].duration * rate);
+        frame.component_count = (uint16_t)count;
+        frame.flags = quantize_frame(writer->waves, count, rate, frame.length, writer->packed, &layers) |
+                      (uint16_t)(channel << FTAE_FRAME_CHANNEL_SHIFT);
+        frame.payload_size = 0;
+        frame.seconds = 0.0f;
+        
+        if (writer->dedup) {
+            result = dedup_frame(writer, (uint32_t)channel, &frame, &layers);
+        } else {
+            result = emit_frame(writer, &frame, &layers, writer->packed, NULL);
+        }
+    }
+    return result;
+}
+
+// Range coded v4/v5: write the header and models, then code every spooled frame
+static int finish_range_coded(FTAEWriter* writer) {
+    finish_models(writer->models, &writer->writer);
+    writer->header.flags |= FTAE_FLAG_RANGE_CODED;
+    writer->header.model_size = (uint32_t)writer->writer.size;
+    
+    int result = frame_appender_open(&writer->appender, writer->file, &writer->header,
+                                     writer->writer.data, writer->writer.size);
+    if (result == DFTA_SUCCESS && spool_rewind(&writer->spool) != DFTA_SUCCESS) {
+        result = DFTA_ERROR_FILE_READ;
+    }
+    for (uint32_t f = 0; f < writer->spooled && result == DFTA_SUCCESS; f++) {
+        CodedFrame frame;
+        FrameLayers layers;
+        result = spool_read(&writer->spool, &frame, sizeof(CodedFrame));
+        if (result == DFTA_SUCCESS && (frame.flags & FTAE_FRAME_REPEAT)) {
+            // Back-references are stored as they are
+            FTAERepeatPayload repeat;
+            result = spool_read(&writer->spool, &repeat, sizeof(FTAERepeatPayload));
+            frame.payload_size = sizeof(FTAERepeatPayload);
+            if (result == DFTA_SUCCESS) result = frame_appender_add(&writer->appender, &frame, (const uint8_t*)&repeat);
+            continue;
+        }
+        if (result == DFTA_SUCCESS) result = spool_read(&writer->spool, &layers, sizeof(FrameLayers));
+        if (result == DFTA_SUCCESS) result = writer_reserve(writer, frame.component_count);
+        if (result == DFTA_SUCCESS) {
+            result = spool_read(&writer->spool, writer->packed, frame.component_count * sizeof(PackedComponent));
+        }
+        if (result != DFTA_SUCCESS) break;
+        
+        range_encoder_reset(&writer->encoder);
+        code_frame_symbols(writer->packed, &layers, writer->models, &writer->encoder);
+        if (writer->encoder.failed) {
+            result = DFTA_ERROR_MEMORY;
+            break;
+        }
+        frame.payload_size = (uint32_t)writer->encoder.size;
+        result = frame_appender_add(&writer->appender, &frame, writer->encoder.data);
+    }
+    return result;
+}
+
+// v2: the header with the final counts, the spooled records, then the seek
+// table. Seek points after the last component start point at the end of the
+// records.
+static int finish_raw_records(FTAEWriter* writer, uint64_t* body_size) {
+    FTAEHeader* header = &writer->header;
+    header->wave_count = writer->spooled;
+    header->max_duration = writer->max_duration;
+    header->seek_interval = FTAE_SEEK_INTERVAL;
+    header->seek_entry_count = (uint32_t)(header->duration / FTAE_SEEK_INTERVAL) + 1;
+    
+    FTAESeekEntry* seek_table = calloc(header->seek_entry_count, sizeof(FTAESeekEntry));
+    if (!seek_table) {
+        return DFTA_ERROR_MEMORY;
+    }
+    for (uint32_t i = 0; i < header->seek_entry_count; i++) {
+        if (i < writer->seek_count) {
+            seek_table[i] = writer->seek_table[i];
+        } else {
+            seek_table[i].time = i * header->seek_interval;
+            seek_table[i].record_index = writer->spooled;
+        }
+    }
+    
+    int result = DFTA_SUCCESS;
+    if (fwrite(header, sizeof(FTAEHeader), 1, writer->file) != 1) {
+        fprintf(stderr, "Error: Failed to write FTAE header\n");
+        result = DFTA_ERROR_FILE_WRITE;
+    } else if (spool_rewind(&writer->spool) != DFTA_SUCCESS) {
+        result = DFTA_ERROR_FILE_READ;
+    }
+    
+    // Copy the records across a block at a time
+    FTAERecord records[256];
+    for (uint32_t done = 0; done < writer->spooled && result == DFTA_SUCCESS; ) {
+        uint32_t count = writer->spooled - done < 256 ? writer->spooled - done : 256;
+        result = spool_read(&writer->spool, records, count * sizeof(FTAERecord));
+        if (result == DFTA_SUCCESS && fwrite(records, sizeof(FTAERecord), count, writer->file) != count) {
+            fprintf(stderr, "Error: Failed to write SineWave data\n");
+            result = DFTA_ERROR_FILE_WRITE;
+        }
+        done += count;
+    }
+    
+    if (result == DFTA_SUCCESS &&
+        fwrite(seek_table, sizeof(FTAESeekEntry), header->seek_entry_count, writer->file) != header->seek_entry_count) {
+        fprintf(stderr, "Error: Failed to write FTAE seek table\n");
+        result = DFTA_ERROR_FILE_WRITE;
+    }
+    
+    free(seek_table);
+    *body_size = (uint64_t)writer->spooled * sizeof(FTAERecord) +
+                 (uint64_t)header->seek_entry_count * sizeof(FTAESeekEntry);
+    return result;
+}
+
+// Finish the file and free the writer. original_size, the bytes of the
+// float input, turns on the compression report; size receives the total
+// bytes written.
+int ftae_writer_close(FTAEWriter* writer, uint64_t sample_count, uint64_t original_size, uint64_t* size) {
+    FTAEHeader* header = &writer->header;
+    int packed = header->version != FTAE_VERSION_SEEKABLE;
+    uint64_t wave_count = 0;
+    uint64_t body_size = 0;
+    int result = DFTA_SUCCESS;
+    
+    if (!packed) {
+        header->duration = (float)sample_count / header->sample_rate;
+        result = finish_raw_records(writer, &body_size);
+        wave_count = header->wave_count;
+    } else {
+        // Runs still open at the end are closed like any other
+        for (uint32_t c = 0; writer->dedup && c < header->channels && result == DFTA_SUCCESS; c++) {
+            if (writer->dedup[c].run_length > 0) {
+                result = close_run(writer, c);
+            }
+        }
+        if (result == DFTA_SUCCESS && writer->range_coded) {
+            result = finish_range_coded(writer);
+        }
+        if (result == DFTA_SUCCESS) {
+            // The on-disk header leaves the counts to the trailer; fill them
+            // in here for the statistics
+            wave_count = writer->appender.wave_count;
+            header->seek_entry_count = writer->appender.frame_count;
+            uint64_t end_size = writer->appender.sampled
+                ? (uint64_t)writer->appender.frame_count * sizeof(FTAESampledIndexEntry) + sizeof(FTAESampledTrailer)
+                : (uint64_t)writer->appender.frame_count * sizeof(FTAEFrameIndexEntry) + sizeof(FTAETrailer);
+            body_size = writer->appender.offset - sizeof(FTAEHeader) + end_size;
+            result = frame_appender_close(&writer->appender, sample_count);
+        }
+        if (result == DFTA_SUCCESS && writer->live && fflush(writer->file) != 0) {
+            result = DFTA_ERROR_FILE_WRITE;
+        }
+    }
+    
+    uint64_t compressed_size = sizeof(FTAEHeader) + body_size;
+    if (size) {
+        *size = compressed_size;
+    }
+    
+    if (result == DFTA_SUCCESS && original_size > 0) {
+        float compression_ratio = (float)original_size / compressed_size;
+        
+        dfta_progress("\nCompression Results:\n");
+        dfta_progress("  Original size: %llu bytes\n", (unsigned long long)original_size);
+        dfta_progress("  Compressed size: %llu bytes\n", (unsigned long long)compressed_size);
+        dfta_progress("  Compression ratio: %.2fx\n", compression_ratio);
+        dfta_progress("  SineWave components: %llu\n", (unsigned long long)wave_count);
+        if (header->channels > 1) {
+            dfta_progress("  Channels: %u (mid/side pairs: 0x%x)\n", header->channels, header->mid_side_pairs);
+        }
+        if (packed) {
+            dfta_progress("  Packed frames: %u%s (%.2f bytes per component, raw records use %zu)\n",
+                          header->seek_entry_count, (header->flags & FTAE_FLAG_RANGE_CODED) ? ", range coded" : "",
+                          wave_count > 0 ? (double)body_size / wave_count : 0.0, sizeof(FTAERecord));
+            if (writer->repeat_frames > 0) {
+                dfta_progress("  Repeated frames: %u, stored as %u back-references\n",
+                              writer->repeated_frames, writer->repeat_frames);
+            }
+        } else {
+            dfta_progress("  Seek table entries: %u (every %.2f s)\n", header->seek_entry_count, header->seek_interval);
+        }
+        dfta_progress("  Space savings: %.1f%%\n",
+                      ((float)((double)original_size - compressed_size) / original_size) * 100);
+    }
+    
+    ftae_writer_free(writer);
+    return result;
+}
+
+// Write whole per-channel queues in one go, as batch mode does
+int write_ftae_stream(FILE* file, SineWaveQueue* const* queues, uint32_t mid_side_pairs,
+                      const AudioData* original_audio, const EncodingConfig* config) {
+    if (!file || !queues || !original_audio || !config ||
+        original_audio->channels == 0 || original_audio->channels > DFTA_MAX_CHANNELS) {
+        return DFTA_ERROR_FILE_WRITE;
+    }
+    
+    // Records are stored in start_time order so the seek table can index them
+    // and so components of one window are adjacent for packing
+    uint32_t channel_count = config->output_format == FTAE_FORMAT_PACKED ? original_audio->channels : 1;
+    for (uint32_t c = 0; c < channel_count; c++) {
+        sort_sinewave_queue_by_time(queues[c]);
+    }
+    
+    FTAEWriter* writer;
+    int result = ftae_writer_open(&writer, file, original_audio->sample_rate, original_audio->channels,
+                                  mid_side_pairs, original_audio->sample_count, config, 0);
+    if (result != DFTA_SUCCESS) {
+        return result;
+    }
+    result = ftae_writer_add(writer, queues);
+    if (result != DFTA_SUCCESS) {
+        ftae_writer_free(writer);
+        return result;
+    }
+    
+    uint64_t original_size = (uint64_t)original_audio->sample_count * original_audio->channels * sizeof(float);
+    return ftae_writer_close(writer, original_audio->sample_count, original_size, NULL);
 }
@@ -1,20 +1,53 @@
 
+
+// dup/fdopen need POSIX declarations under -std=c99
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <getopt.h>
 #include <math.h>
+#include <unistd.h>
 #include "dfta.h"
 
+int dfta_progress_enabled = 1;
+
 void print_usage(const char* program_name) {
     printf("Dynamic Fourier Transform Audio Encoder (D-FTA)\n");
-    printf("Usage: %s input.wav output.ftae [OPTIONS]\n\n", program_name);
+    printf("Usage: %s input.wav output.ftae [OPTIONS]\n", program_name);
+    printf("       %s --batch manifest.txt [OPTIONS]\n", program_name);
+    printf("       %s input.wav|- output.ftae|- --realtime [OPTIONS]\n\n", program_name);
     printf("Options:\n");
     printf("  --compression-level LEVEL    Compression level: low, medium, high (default: medium)\n");
     printf("  --amplitude-threshold FLOAT  Minimum amplitude threshold (default: 0.01)\n");
+    printf("  --format FORMAT              Output layout: packed, raw (default: packed)\n");
+    printf("  --entropy CODER              Packed frame coding: range, none (default: range)\n");
+    printf("  --stereo MODE                Channel pair coding: auto, lr, ms (default: auto)\n");
+    printf("  --masking MODE               Psychoacoustic pruning: on, off (default: on)\n");
+    printf("  --dedup MODE                 Store repeated frame groups as back-references: on, off\n");
+    printf("                               (default: on; packed files, not real-time)\n");
+    printf("  --stationary MODE            Skip silent windows and extend components over windows\n");
+    printf("                               that have not changed: on, off (default: on)\n");
+    printf("  --threads N                  Batch worker threads (default: one per CPU)\n");
+    printf("  --cache FILE                 Reuse the analysis of windows unchanged since the last\n");
+    printf("                               encode with FILE, and update it (single-file mode)\n");
+    printf("  --realtime                   Encode live input window by window with bounded latency\n");
+    printf("  --window SAMPLES             Real-time analysis window, even, 64 to %d (default: 1024)\n",
+           FFT_MAX_SIZE);
     printf("  --help                       Show this help message\n\n");
     printf("Examples:\n");
     printf("  %s audio.wav compressed.ftae --compression-level high\n", program_name);
+    printf("  %s --batch clips.txt --threads 8\n", program_name);
+    printf("  arecord -f S16_LE -r 48000 -c 2 | %s - live.ftae --realtime --window 512\n\n", program_name);
+    printf("Batch mode:\n");
+    printf("  Each manifest line names an input WAV and an output FTAE file, separated\n");
+    printf("  by a tab or spaces; blank lines and lines starting with '#' are skipped.\n");
+    printf("  Files are encoded concurrently and a failed file does not stop the rest.\n\n");
+    printf("Real-time mode:\n");
+    printf("  Reads a WAV stream ('-' for standard input) and writes each window's\n");
+    printf("  frames as soon as it is analysed ('-' for standard output). Frames are\n");
+    printf("  bit-packed; the filters look back 0.1 s across windows as for files.\n");
 }
 
 int parse_compression_level(const char* level_str) {
@@ -24,14 +57,38 @@ int parse_compression_level(const char* level_str) {
     return -1;
 }
 
+int parse_output_format(const char* format_str) {
+    if (strcmp(format_str, "packed") == 0) return FTAE_FORMAT_PACKED;
+    if (strcmp(format_str, "raw") == 0) return FTAE_FORMAT_RAW;
+    return -1;
+}
+
+int parse_entropy_coding(const char* coder_str) {
+    if (strcmp(coder_str, "range") == 0) return ENTROPY_RANGE;
+    if (strcmp(coder_str, "none") == 0) return ENTROPY_NONE;
+    return -1;
+}
+
+int parse_stereo_coding(const char* mode_str) {
+    if (strcmp(mode_str, "auto") == 0) return STEREO_CODING_AUTO;
+    if (strcmp(mode_str, "lr") == 0) return STEREO_CODING_LR;
+    if (strcmp(mode_str, "ms") == 0) return STEREO_CODING_MS;
+    return -1;
+}
+
 int main(int argc, char* argv[]) {
     if (argc < 3) {
         print_usage(argv[0]);
         return 1;
     }
     
+    // dfta_encode --batch manifest.txt takes the place of the two file names
+    int batch = strcmp(argv[1], "--batch") == 0;
     const char* input_file = argv[1];
     const char* output_file = argv[2];
+    int threads = 0;
+    int realtime = 0;
+    int window_size = 1024;
     
     // Default settings
     EncodingConfig config = {
@@ -40,13 +97,30 @@ int main(int argc, char* argv[]) {
         .frequency_min = 20.0f,
         .frequency_max = 20000.0f,
         .phase_tolerance = 0.1f,
-        .similarity_threshold = 0.95f
+        .similarity_threshold = 0.95f,
+        .output_format = FTAE_FORMAT_PACKED,
+        .entropy_coding = ENTROPY_RANGE,
+        .stereo_coding = STEREO_CODING_AUTO,
+        .masking = 1,
+        .deduplicate = 1,
+        .stationary = 1,
+        .analysis_cache = NULL
     };
     
     // Parse command line options
     static struct option long_options[] = {
         {"compression-level", required_argument, 0, 'c'},
         {"amplitude-threshold", required_argument, 0, 'a'},
+        {"format", required_argument, 0, 'f'},
+        {"entropy", required_argument, 0, 'e'},
+        {"stereo", required_argument, 0, 's'},
+        {"masking", required_argument, 0, 'm'},
+        {"dedup", required_argument, 0, 'd'},
+        {"stationary", required_argument, 0, 'y'},
+        {"threads", required_argument, 0, 't'},
+        {"realtime", no_argument, 0, 'r'},
+        {"window", required_argument, 0, 'w'},
+        {"cache", required_argument, 0, 'k'},
         {"help", no_argument, 0, 'h'},
         {0, 0, 0, 0}
     };
@@ -54,7 +128,7 @@ int main(int argc, char* argv[]) {
     int opt;
     int option_index = 0;
     
-    while ((opt = getopt_long(argc - 2, argv + 2, "c:a:h", long_options, &option_index)) != -1) {
+    while ((opt = getopt_long(argc - 2, argv + 2, "c:a:f:e:s:m:d:y:t:rw:k:h", long_options, &option_index)) != -1) {
         switch (opt) {
             case 'c': {
                 int level = parse_compression_level(optarg);
@@ -72,6 +146,77 @@ int main(int argc, char* argv[]) {
                     return 1;
                 }
                 break;
+            case 'f':
+                config.output_format = parse_output_format(optarg);
+                if (config.output_format == -1) {
+                    fprintf(stderr, "Error: Invalid output format '%s'\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'e':
+                config.entropy_coding = parse_entropy_coding(optarg);
+                if (config.entropy_coding == -1) {
+                    fprintf(stderr, "Error: Invalid entropy coder '%s'\n", optarg);
+                    return 1;
+                }
+                break;
+            case 's':
+                config.stereo_coding = parse_stereo_coding(optarg);
+                if (config.stereo_coding == -1) {
+                    fprintf(stderr, "Error: Invalid stereo mode '%s'\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'm':
+                if (strcmp(optarg, "on") == 0) {
+                    config.masking = 1;
+                } else if (strcmp(optarg, "off") == 0) {
+                    config.masking = 0;
+                } else {
+                    fprintf(stderr, "Error: Invalid masking mode '%s'\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'd':
+                if (strcmp(optarg, "on") == 0) {
+                    config.deduplicate = 1;
+                } else if (strcmp(optarg, "off") == 0) {
+                    config.deduplicate = 0;
+                } else {
+                    fprintf(stderr, "Error: Invalid deduplication mode '%s'\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'y':
+                if (strcmp(optarg, "on") == 0) {
+                    config.stationary = 1;
+                } else if (strcmp(optarg, "off") == 0) {
+                    config.stationary = 0;
+                } else {
+                    fprintf(stderr, "Error: Invalid stationary mode '%s'\n", optarg);
+                    return 1;
+                }
+                break;
+            case 't':
+                threads = atoi(optarg);
+                if (threads <= 0 || threads > DFTA_MAX_THREADS) {
+                    fprintf(stderr, "Error: Thread count must be between 1 and %d\n", DFTA_MAX_THREADS);
+                    return 1;
+                }
+                break;
+            case 'r':
+                realtime = 1;
+                break;
+            case 'w':
+                window_size = atoi(optarg);
+                if (window_size < 64 || window_size > FFT_MAX_SIZE || window_size % 2 != 0) {
+                    fprintf(stderr, "Error: Window must be an even size from 64 to %d samples\n", FFT_MAX_SIZE);
+                    return 1;
+                }
+                break;
+            case 'k':
+                config.analysis_cache = optarg;
+                break;
             case 'h':
                 print_usage(argv[0]);
                 return 0;
@@ -81,6 +226,82 @@ int main(int argc, char* argv[]) {
         }
     }
     
+    if (config.analysis_cache && (batch || realtime)) {
+        fprintf(stderr, "Note: --cache applies to single-file encoding and is ignored here\n");
+        config.analysis_cache = NULL;
+    }
+    
+    if (realtime && !batch) {
+        // '-' names standard input and output; progress then goes to stderr
+        // so standard output carries only the FTAE stream
+        int to_stdout = strcmp(output_file, "-") == 0;
+        FILE* input = strcmp(input_file, "-") == 0 ? stdin : fopen(input_file, "rb");
+        if (!input) {
+            fprintf(stderr, "Error: Cannot open file %s\n", input_file);
+            return 1;
+        }
+        FILE* output = NULL;
+        if (to_stdout) {
+            fflush(stdout);
+            int stream_fd = dup(STDOUT_FILENO);
+            if (stream_fd >= 0 && dup2(STDERR_FILENO, STDOUT_FILENO) >= 0) {
+                output = fdopen(stream_fd, "wb");
+            }
+        } else {
+            output = fopen(output_file, "wb");
+        }
+        if (!output) {
+            fprintf(stderr, "Error: Cannot create output file %s\n", output_file);
+            if (input != stdin) fclose(input);
+            return 1;
+        }
+        
+        printf("D-FTA Encoder - Real-time mode\n");
+        printf("Input: %s\n", input == stdin ? "(standard input)" : input_file);
+        printf("Output: %s\n", to_stdout ? "(standard output)" : output_file);
+        printf("Compression Level: %s\n",
+               config.compression_level == COMPRESSION_LOW ? "Low" :
+               config.compression_level == COMPRESSION_MEDIUM ? "Medium" : "High");
+        printf("Psychoacoustic Masking: %s\n", config.masking ? "On" : "Off");
+        printf("Silent Window Skipping: %s\n", config.stationary ? "On" : "Off");
+        fflush(stdout);
+        
+        int result = encode_realtime(input, output, &config, window_size);
+        if (fclose(output) != 0 && result == DFTA_SUCCESS) {
+            result = DFTA_ERROR_FILE_WRITE;
+        }
+        if (input != stdin) fclose(input);
+        if (result != DFTA_SUCCESS) {
+            fprintf(stderr, "Encoding failed with error code: %d\n", result);
+            return 1;
+        }
+        return 0;
+    }
+    
+    if (batch) {
+        const char* manifest_file = argv[2];
+        printf("D-FTA Encoder - Batch mode\n");
+        printf("Manifest: %s\n", manifest_file);
+        printf("Compression Level: %s\n",
+               config.compression_level == COMPRESSION_LOW ? "Low" :
+               config.compression_level == COMPRESSION_MEDIUM ? "Medium" : "High");
+        printf("Output Format: %s\n", config.output_format == FTAE_FORMAT_RAW ? "Raw (v2)" :
+               config.entropy_coding == ENTROPY_RANGE ? "Packed (v4/v5, range coded)" : "Packed (v4/v5)");
+        printf("Psychoacoustic Masking: %s\n", config.masking ? "On" : "Off");
+        printf("Stationary Windows: %s\n", config.stationary ? "Skipped" : "Analysed");
+        if (config.output_format == FTAE_FORMAT_PACKED) {
+            printf("Frame Deduplication: %s\n", config.deduplicate ? "On" : "Off");
+        }
+        printf("\n");
+        
+        int result = encode_batch(manifest_file, &config, threads);
+        if (result != DFTA_SUCCESS) {
+            fprintf(stderr, "Batch encoding finished with errors (first error code: %d)\n", result);
+            return 1;
+        }
+        return 0;
+    }
+    
     printf("D-FTA Encoder - Starting compression...\n");
     printf("Input: %s\n", input_file);
     printf("Output: %s\n", output_file);
@@ -88,6 +309,16 @@ int main(int argc, char* argv[]) {
            config.compression_level == COMPRESSION_LOW ? "Low" :
            config.compression_level == COMPRESSION_MEDIUM ? "Medium" : "High");
     printf("Amplitude Threshold: %.4f\n", config.amplitude_threshold);
+    printf("Output Format: %s\n", config.output_format == FTAE_FORMAT_RAW ? "Raw (v2)" :
+           config.entropy_coding == ENTROPY_RANGE ? "Packed (v4/v5, range coded)" : "Packed (v4/v5)");
+    printf("Psychoacoustic Masking: %s\n", config.masking ? "On" : "Off");
+    printf("Stationary Windows: %s\n", config.stationary ? "Skipped" : "Analysed");
+    if (config.output_format == FTAE_FORMAT_PACKED) {
+        printf("Frame Deduplication: %s\n", config.deduplicate ? "On" : "Off");
+    }
+    if (config.analysis_cache) {
+        printf("Analysis Cache: %s\n", config.analysis_cache);
+    }
     
     // Perform encoding
     int result = encode_audio_file(input_file, output_file, &config);
@@ -0,0 +1,183 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "dfta.h"
+
+// Psychoacoustic masking, applied to every analysis window between the FFT
+// and component extraction. Bins are grouped into half-Bark partitions; each
+// partition's energy is split into tonal peaks and noise, spread over the
+// neighbouring partitions with the Schroeder spreading function, lowered by
+// the Johnston masking offsets and spread back over the partition's bins.
+// Bins below that threshold plus the absolute threshold of hearing are
+// cleared, so extraction never turns them into components.
+//
+// All per-bin work is straight-line loops over float arrays that the compiler
+// vectorizes; only the partition sums scatter. The partition-to-partition
+// spreading is a small matrix built once per sample rate.
+
+#define MASKING_PARTITION_BARK  0.5
+
+// A local maximum is tonal when it stands this far (7 dB) above the bins two
+// away on either side
+#define TONAL_PEAK_RATIO        5.0119f
+
+// Level of a full-scale sine, which places the absolute threshold of hearing
+#define FULL_SCALE_SPL          96.0
+
+// Critical band rate (Zwicker)
+static double hz_to_bark(double frequency) {
+    return 13.0 * atan(0.00076 * frequency) + 3.5 * atan((frequency / 7500.0) * (frequency / 7500.0));
+}
+
+// Absolute threshold of hearing in dB SPL (Terhardt)
+static double quiet_threshold_db(double frequency) {
+    double khz = (frequency < 20.0 ? 20.0 : frequency) / 1000.0;
+    double db = 3.64 * pow(khz, -0.8) - 6.5 * exp(-0.6 * (khz - 3.3) * (khz - 3.3)) + 1e-3 * pow(khz, 4.0);
+    return db < 160.0 ? db : 160.0;
+}
+
+// Schroeder spreading function in dB; dz is maskee minus masker in Bark
+static double spreading_db(double dz) {
+    return 15.81 + 7.5 * (dz + 0.474) - 17.5 * sqrt(1.0 + (dz + 0.474) * (dz + 0.474));
+}
+
+void masking_model_free(MaskingModel* model) {
+    if (!model) return;
+    free(model->tonal_spread);
+    free(model->noise_spread);
+    free(model->bin_partition);
+    free(model->bin_quiet);
+    memset(model, 0, sizeof(MaskingModel));
+}
+
+int masking_model_prepare(MaskingModel* model, uint32_t sample_rate, const int* sizes, int count) {
+    if (count > ANALYSIS_SIZES) count = ANALYSIS_SIZES;
+    if (model->sample_rate == sample_rate && model->size_count == count &&
+        memcmp(model->sizes, sizes, count * sizeof(int)) == 0) {
+        return DFTA_SUCCESS;
+    }
+    masking_model_free(model);
+    
+    int partitions = (int)(hz_to_bark(sample_rate / 2.0) / MASKING_PARTITION_BARK) + 1;
+    if (partitions > MASKING_MAX_PARTITIONS) partitions = MASKING_MAX_PARTITIONS;
+    
+    int total_bins = 0;
+    for (int s = 0; s < count; s++) {
+        model->sizes[s] = sizes[s];
+        model->bin_offset[s] = total_bins;
+        total_bins += sizes[s] / 2;
+    }
+    
+    size_t matrix = (size_t)MASKING_MAX_PARTITIONS * MASKING_MAX_PARTITIONS;
+    model->tonal_spread = calloc(matrix, sizeof(float));
+    model->noise_spread = calloc(matrix, sizeof(float));
+    model->bin_partition = malloc(total_bins);
+    model->bin_quiet = malloc(total_bins * sizeof(float));
+    if (!model->tonal_spread || !model->noise_spread || !model->bin_partition || !model->bin_quiet) {
+        masking_model_free(model);
+        return DFTA_ERROR_MEMORY;
+    }
+    
+    // Spreading normalized so a flat spectrum gets its own energy back, then
+    // lowered by the offset of the masker's kind: 14.5 + z dB for a tone
+    // masking noise, 5.5 dB for noise masking a tone
+    for (int i = 0; i < partitions; i++) {
+        double norm = 0.0;
+        for (int j = 0; j < partitions; j++) {
+            norm += pow(10.0, spreading_db((i - j) * MASKING_PARTITION_BARK) / 10.0);
+        }
+        for (int j = 0; j < partitions; j++) {
+            double spread = pow(10.0, spreading_db((i - j) * MASKING_PARTITION_BARK) / 10.0) / norm;
+            double bark = (j + 0.5) * MASKING_PARTITION_BARK;
+            model->tonal_spread[j * MASKING_MAX_PARTITIONS + i] = (float)(spread * pow(10.0, -(14.5 + bark) / 10.0));
+            model->noise_spread[j * MASKING_MAX_PARTITIONS + i] = (float)(spread * pow(10.0, -5.5 / 10.0));
+        }
+    }
+    
+    // Per window size: each bin's partition, the absolute threshold as a
+    // squared FFT magnitude (a full-scale sine under the Hann window peaks at
+    // size / 4), and each partition's share of its threshold per bin
+    for (int s = 0; s < count; s++) {
+        int size = sizes[s];
+        uint8_t* partition = model->bin_partition + model->bin_offset[s];
+        float* quiet = model->bin_quiet + model->bin_offset[s];
+        int counts[MASKING_MAX_PARTITIONS] = {0};
+        
+        for (int k = 0; k < size / 2; k++) {
+            double frequency = (double)k * sample_rate / size;
+            int p = (int)(hz_to_bark(frequency) / MASKING_PARTITION_BARK);
+            if (p >= partitions) p = partitions - 1;
+            partition[k] = (uint8_t)p;
+            counts[p]++;
+            quiet[k] = (float)((double)size * size / 16.0 *
+                               pow(10.0, (quiet_threshold_db(frequency) - FULL_SCALE_SPL) / 10.0));
+        }
+        for (int p = 0; p < MASKING_MAX_PARTITIONS; p++) {
+            model->bin_share[s][p] = counts[p] ? 1.0f / counts[p] : 0.0f;
+        }
+    }
+    
+    model->partition_count = partitions;
+    model->size_count = count;
+    model->sample_rate = sample_rate;
+    return DFTA_SUCCESS;
+}
+
+int apply_masking(const MaskingModel* model, double complex* fft_data, int fft_size) {
+    int s = 0;
+    while (s < model->size_count && model->sizes[s] != fft_size) s++;
+    if (s == model->size_count) {
+        fprintf(stderr, "Error: No masking tables for %d-sample windows\n", fft_size);
+        return DFTA_ERROR_FORMAT;
+    }
+    
+    int bins = fft_size / 2;
+    int partitions = model->partition_count;
+    const uint8_t* partition = model->bin_partition + model->bin_offset[s];
+    const float* quiet = model->bin_quiet + model->bin_offset[s];
+    float power[FFT_MAX_SIZE / 2];
+    float total[MASKING_MAX_PARTITIONS] = {0};
+    float tonal[MASKING_MAX_PARTITIONS] = {0};
+    float threshold[MASKING_MAX_PARTITIONS] = {0};
+    
+    for (int k = 0; k < bins; k++) {
+        double re = creal(fft_data[k]);
+        double im = cimag(fft_data[k]);
+        power[k] = (float)(re * re + im * im);
+    }
+    
+    for (int k = 0; k < bins; k++) {
+        total[partition[k]] += power[k];
+    }
+    
+    // Tonal peaks take their two neighbours along, which hold most of the
+    // rest of a Hann-windowed sine
+    for (int k = 2; k < bins - 2; k++) {
+        float p = power[k];
+        if (p > power[k - 1] && p >= power[k + 1] &&
+            p > TONAL_PEAK_RATIO * power[k - 2] && p > TONAL_PEAK_RATIO * power[k + 2]) {
+            tonal[partition[k]] += power[k - 1] + p + power[k + 1];
+        }
+    }
+    
+    for (int j = 0; j < partitions; j++) {
+        if (total[j] <= 0.0f) continue;
+        float tone = tonal[j] < total[j] ? tonal[j] : total[j];
+        float noise = total[j] - tone;
+        const float* tonal_row = model->tonal_spread + j * MASKING_MAX_PARTITIONS;
+        const float* noise_row = model->noise_spread + j * MASKING_MAX_PARTITIONS;
+        for (int i = 0; i < partitions; i++) {
+            threshold[i] += tone * tonal_row[i] + noise * noise_row[i];
+        }
+    }
+    for (int i = 0; i < partitions; i++) {
+        threshold[i] *= model->bin_share[s][i];
+    }
+    
+    for (int k = 0; k < bins; k++) {
+        if (power[k] < quiet[k] + threshold[partition[k]]) {
+            fft_data[k] = 0.0;
+        }
+    }
+    return DFTA_SUCCESS;
+}
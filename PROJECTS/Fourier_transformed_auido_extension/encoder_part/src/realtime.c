@@ -0,0 +1,252 @@
+
+// clock_gettime/sigaction need POSIX declarations under -std=c99
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include "dfta.h"
+
+// Real-time encoding for live input. PCM is read one hop (half a window) at
+// a time, and every hop completes one fixed-size analysis window per channel.
+// That window is analysed, filtered and written out as frames before the
+// next hop is read, so a component leaves the encoder one window after the
+// first sample it describes arrived, plus processing time.
+//
+// Everything that needs the whole signal is left out: adaptive window sizes
+// (they look ahead), automatic mid/side decisions and range coding models.
+// The filters only ever look 0.1 s back, so they run across windows just as
+// in file encoding.
+
+// Seconds of input between deadline reports
+#define REALTIME_REPORT_SECONDS 5.0
+
+// Deadline statistics for the windows since the last report and in total
+typedef struct {
+    uint32_t windows;
+    uint32_t late;              // Windows that took longer than one hop
+    double seconds;
+    double max_seconds;
+} DeadlineStats;
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void request_stop(int signal_number) {
+    (void)signal_number;
+    stop_requested = 1;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void deadline_add(DeadlineStats* stats, double seconds, double deadline) {
+    stats->windows++;
+    stats->seconds += seconds;
+    if (seconds > stats->max_seconds) stats->max_seconds = seconds;
+    if (seconds > deadline) stats->late++;
+}
+
+static void deadline_report(const char* label, const DeadlineStats* stats, double deadline) {
+    if (stats->windows == 0) return;
+    double average = stats->seconds / stats->windows;
+    fprintf(stderr, "%s: %u windows, %.3f ms average, %.3f ms max of %.3f ms deadline (%.1f%% load), %u late\n",
+            label, stats->windows, average * 1000.0, stats->max_seconds * 1000.0, deadline * 1000.0,
+            100.0 * average / deadline, stats->late);
+}
+
+int encode_realtime(FILE* input, FILE* output, const EncodingConfig* config, int window_size) {
+    int hop = window_size / 2;
+    WAVStream stream;
+    int result = wav_stream_open(&stream, input, (uint32_t)hop);
+    if (result != DFTA_SUCCESS) {
+        return result;
+    }
+    
+    uint32_t sample_rate = stream.sample_rate;
+    int channel_count = stream.channels;
+    double deadline = (double)hop / sample_rate;
+    fprintf(stderr, "Live input: %u Hz, %d channel%s, %u bits per sample\n", sample_rate, channel_count,
+            channel_count > 1 ? "s" : "", stream.bits_per_sample);
+    fprintf(stderr, "Window: %d samples (%.1f ms), hop %d samples (%.1f ms); "
+            "components leave %.1f ms after their first sample plus processing time\n",
+            window_size, 1000.0 * window_size / sample_rate, hop, 1000.0 * deadline,
+            1000.0 * window_size / sample_rate);
+    
+    // Deciding on mid/side from the signal needs all of it; live pairs are
+    // mid/side only when asked for
+    uint32_t mid_side_pairs = 0;
+    if (config->stereo_coding == STEREO_CODING_MS) {
+        mid_side_pairs = (1u << (channel_count / 2)) - 1;
+    } else if (config->stereo_coding == STEREO_CODING_AUTO && channel_count > 1) {
+        fprintf(stderr, "Note: Automatic stereo coding needs the whole signal; live channel pairs are coded L/R\n");
+    }
+    if (config->entropy_coding == ENTROPY_RANGE) {
+        fprintf(stderr, "Note: Range coding needs models counted over the whole file; live frames are bit-packed\n");
+    }
+    
+    EncodingConfig working_config = *config;
+    adjust_config_for_compression_level(&working_config);
+    EncodingConfig live_config = *config;
+    live_config.output_format = FTAE_FORMAT_PACKED;
+    live_config.entropy_coding = ENTROPY_NONE;
+    
+    FFTPlan fft;
+    MaskingModel masking;
+    memset(&masking, 0, sizeof(MaskingModel));
+    SineWaveQueue* queues[DFTA_MAX_CHANNELS] = {0};
+    ComponentFilter filters[DFTA_MAX_CHANNELS];
+    double complex* fft_data = malloc(FFT_BUFFER_SIZE * sizeof(double complex));
+    float* buffer = malloc((size_t)window_size * channel_count * sizeof(float));
+    SineWaveQueue* window_queue = create_sinewave_queue();
+    FTAEWriter* live = NULL;
+    
+    result = fft_plan_init(&fft);
+    if (result == DFTA_SUCCESS) {
+        result = fft_plan_prepare(&fft, &window_size, 1);
+    }
+    if (result != DFTA_SUCCESS || !fft_data || !buffer || !window_queue) {
+        fft_plan_free(&fft);
+        free(fft_data);
+        free(buffer);
+        free_sinewave_queue(window_queue);
+        wav_stream_close(&stream);
+        return DFTA_ERROR_MEMORY;
+    }
+    for (int c = 0; c < channel_count; c++) {
+        queues[c] = create_sinewave_queue();
+        component_filter_init(&filters[c], &working_config);
+        if (!queues[c]) result = DFTA_ERROR_MEMORY;
+    }
+    if (result == DFTA_SUCCESS && config->masking) {
+        result = masking_model_prepare(&masking, sample_rate, &window_size, 1);
+    }
+    if (result == DFTA_SUCCESS) {
+        result = ftae_writer_open(&live, output, sample_rate, (uint16_t)channel_count, mid_side_pairs,
+                                  0, &live_config, 1);
+    }
+    
+    // An interrupt ends the input like end of file, so the index and trailer
+    // are still written; reads are not restarted after it
+    struct sigaction action;
+    struct sigaction previous_int;
+    struct sigaction previous_term;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = request_stop;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, &previous_int);
+    sigaction(SIGTERM, &action, &previous_term);
+    
+    DeadlineStats interval = {0};
+    DeadlineStats total = {0};
+    uint64_t position = 0;      // First sample of the window being filled
+    uint64_t samples_read = 0;
+    uint32_t have = 0;          // Samples of that window read so far
+    int ended = 0;
+    double next_report = REALTIME_REPORT_SECONDS;
+    
+    while (result == DFTA_SUCCESS) {
+        // The first window needs a whole window of input, every later one a hop
+        float* planes[DFTA_MAX_CHANNELS];
+        for (int c = 0; c < channel_count; c++) {
+            planes[c] = buffer + (size_t)c * window_size + have;
+        }
+        uint32_t want = (uint32_t)window_size - have;
+        uint32_t got = 0;
+        while (!ended && got < want) {
+            float* block[DFTA_MAX_CHANNELS];
+            for (int c = 0; c < channel_count; c++) block[c] = planes[c] + got;
+            uint32_t step = wav_stream_read(&stream, block, want - got);
+            got += step;
+            if (step == 0 || stop_requested) ended = 1;
+        }
+        if (have + got == 0) break;
+        
+        double start = now_seconds();
+        for (int pair = 0; 2 * pair + 1 < channel_count; pair++) {
+            if (!((mid_side_pairs >> pair) & 1)) continue;
+            float* left = planes[2 * pair];
+            float* right = planes[2 * pair + 1];
+            for (uint32_t i = 0; i < got; i++) {
+                float mid = 0.5f * (left[i] + right[i]);
+                float side = 0.5f * (left[i] - right[i]);
+                left[i] = mid;
+                right[i] = side;
+            }
+        }
+        have += got;
+        samples_read += got;
+        
+        // Past the end of the input the window is padded with silence.
+        // Silent windows are skipped; extending components over stationary
+        // ones would need the windows after them, which live input has not
+        // delivered yet.
+        double start_time = (double)position / sample_rate;
+        for (int c = 0; c < channel_count && result == DFTA_SUCCESS; c++) {
+            const float* plane = buffer + (size_t)c * window_size;
+            if (config->stationary && window_is_silent(plane, (int)have, &working_config)) continue;
+            result = analyze_window(&fft, fft_data, plane, (int)have, window_size, window_size,
+                                    sample_rate, start_time, config->masking ? &masking : NULL, window_queue);
+            if (result == DFTA_SUCCESS) {
+                result = component_filter_apply(&filters[c], window_queue, queues[c]);
+            }
+        }
+        if (result == DFTA_SUCCESS) {
+            result = ftae_writer_add(live, queues);
+        }
+        for (int c = 0; c < channel_count; c++) {
+            clear_sinewave_queue(queues[c]);
+        }
+        double elapsed = now_seconds() - start;
+        deadline_add(&interval, elapsed, deadline);
+        deadline_add(&total, elapsed, deadline);
+        
+        double seconds = (double)samples_read / sample_rate;
+        if (seconds >= next_report) {
+            char label[32];
+            snprintf(label, sizeof(label), "%8.1f s", seconds);
+            deadline_report(label, &interval, deadline);
+            memset(&interval, 0, sizeof(interval));
+            next_report += REALTIME_REPORT_SECONDS;
+        }
+        
+        // Slide by one hop
+        for (int c = 0; c < channel_count; c++) {
+            float* plane = buffer + (size_t)c * window_size;
+            memmove(plane, plane + hop, (size_t)(window_size - hop) * sizeof(float));
+        }
+        have = have > (uint32_t)hop ? have - (uint32_t)hop : 0;
+        position += (uint64_t)hop;
+    }
+    
+    sigaction(SIGINT, &previous_int, NULL);
+    sigaction(SIGTERM, &previous_term, NULL);
+    
+    if (live) {
+        uint64_t size = 0;
+        int closed = ftae_writer_close(live, samples_read, 0, &size);
+        if (result == DFTA_SUCCESS) result = closed;
+        if (result == DFTA_SUCCESS) {
+            fprintf(stderr, "\nLive encoding %s after %.2f s of audio, %llu bytes written\n",
+                    stop_requested ? "interrupted" : "finished", (double)samples_read / sample_rate,
+                    (unsigned long long)size);
+            deadline_report("  Processing", &total, deadline);
+        }
+    }
+    
+    for (int c = 0; c < channel_count; c++) {
+        free_sinewave_queue(queues[c]);
+        component_filter_free(&filters[c]);
+    }
+    free_sinewave_queue(window_queue);
+    masking_model_free(&masking);
+    fft_plan_free(&fft);
+    free(fft_data);
+    free(buffer);
+    wav_stream_close(&stream);
+    return result;
+}
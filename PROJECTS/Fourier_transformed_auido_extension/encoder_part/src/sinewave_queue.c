@@ -1,6 +1,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include "dfta.h"
 
@@ -33,7 +34,8 @@ void enqueue_sinewave(SineWaveQueue* queue, const SineWave* wave) {
     queue->count++;
 }
 
-void free_sinewave_queue(SineWaveQueue* queue) {
+// Free every node, leaving the queue empty for reuse
+void clear_sinewave_queue(SineWaveQueue* queue) {
     if (!queue) return;
     
     SineWaveNode* current = queue->head;
@@ -43,172 +45,267 @@ void free_sinewave_queue(SineWaveQueue* queue) {
         current = next;
     }
     
-    free(queue);
+    queue->head = NULL;
+    queue->tail = NULL;
+    queue->count = 0;
 }
 
-void apply_frequency_filtering(SineWaveQueue* queue, float min_freq, float max_freq) {
+void free_sinewave_queue(SineWaveQueue* queue) {
     if (!queue) return;
+    clear_sinewave_queue(queue);
+    free(queue);
+}
+
+// Move every node of other to the end of queue, leaving other empty
+void append_sinewave_queue(SineWaveQueue* queue, SineWaveQueue* other) {
+    if (!queue || !other || !other->head) return;
     
-    SineWaveNode* current = queue->head;
-    SineWaveNode* prev = NULL;
-    int removed_count = 0;
+    if (queue->tail) {
+        queue->tail->next = other->head;
+    } else {
+        queue->head = other->head;
+    }
+    queue->tail = other->tail;
+    queue->count += other->count;
     
-    while (current) {
-        if (current->wave.frequency < min_freq || current->wave.frequency > max_freq) {
-            // Remove this node
-            if (prev) {
-                prev->next = current->next;
-            } else {
-                queue->head = current->next;
-            }
-            
-            if (current == queue->tail) {
-                queue->tail = prev;
-            }
-            
-            SineWaveNode* to_delete = current;
-            current = current->next;
-            free(to_delete);
-            removed_count++;
+    other->head = NULL;
+    other->tail = NULL;
+    other->count = 0;
+}
+
+// Merge two start_time-sorted node lists, keeping equal keys in list order
+static SineWaveNode* merge_by_start_time(SineWaveNode* a, SineWaveNode* b) {
+    SineWaveNode head;
+    SineWaveNode* tail = &head;
+    
+    while (a && b) {
+        if (b->wave.start_time < a->wave.start_time) {
+            tail->next = b;
+            b = b->next;
         } else {
-            prev = current;
-            current = current->next;
+            tail->next = a;
+            a = a->next;
         }
+        tail = tail->next;
     }
+    tail->next = a ? a : b;
     
-    queue->count -= removed_count;
-    printf("Frequency filtering: Removed %d components outside %g-%g Hz range\n", 
-           removed_count, min_freq, max_freq);
+    return head.next;
 }
 
-void apply_amplitude_filtering(SineWaveQueue* queue, float threshold) {
-    if (!queue) return;
+void sort_sinewave_queue_by_time(SineWaveQueue* queue) {
+    if (!queue || !queue->head) return;
     
-    int threshold_scaled = (int)(threshold * 1000);  // Match our amplitude scaling
-    SineWaveNode* current = queue->head;
-    SineWaveNode* prev = NULL;
-    int removed_count = 0;
+    // Components are produced window by window, so the list is normally
+    // already ordered; only fall back to a merge sort when it is not
+    int sorted = 1;
+    for (SineWaveNode* node = queue->head; node->next; node = node->next) {
+        if (node->next->wave.start_time < node->wave.start_time) {
+            sorted = 0;
+            break;
+        }
+    }
+    if (sorted) return;
     
-    while (current) {
-        if (current->wave.amplitude < threshold_scaled) {
-            // Remove this node
-            if (prev) {
-                prev->next = current->next;
+    // Bottom-up stable merge sort on the linked list
+    for (int run = 1; ; run <<= 1) {
+        SineWaveNode* remaining = queue->head;
+        SineWaveNode* merged_head = NULL;
+        SineWaveNode* merged_tail = NULL;
+        int merges = 0;
+        
+        while (remaining) {
+            SineWaveNode* left = remaining;
+            SineWaveNode* cut = left;
+            for (int i = 1; i < run && cut->next; i++) cut = cut->next;
+            SineWaveNode* right = cut->next;
+            cut->next = NULL;
+            
+            cut = right;
+            for (int i = 1; i < run && cut && cut->next; i++) cut = cut->next;
+            if (cut) {
+                remaining = cut->next;
+                cut->next = NULL;
             } else {
-                queue->head = current->next;
+                remaining = NULL;
             }
             
-            if (current == queue->tail) {
-                queue->tail = prev;
+            SineWaveNode* merged = merge_by_start_time(left, right);
+            if (merged_tail) {
+                merged_tail->next = merged;
+            } else {
+                merged_head = merged;
             }
-            
-            SineWaveNode* to_delete = current;
-            current = current->next;
-            free(to_delete);
-            removed_count++;
-        } else {
-            prev = current;
-            current = current->next;
+            while (merged->next) merged = merged->next;
+            merged_tail = merged;
+            merges++;
         }
+        
+        queue->head = merged_head;
+        queue->tail = merged_tail;
+        if (merges <= 1) break;
     }
-    
-    queue->count -= removed_count;
-    printf("Amplitude filtering: Removed %d low-amplitude components\n", removed_count);
 }
 
-void apply_phase_optimization(SineWaveQueue* queue, float tolerance) {
-    if (!queue) return;
-    
-    int removed_count = 0;
-    SineWaveNode* current = queue->head;
-    
-    while (current) {
-        SineWaveNode* compare = current->next;
-        SineWaveNode* prev_compare = current;
-        
-        while (compare) {
-            // Check for opposite phase waves at same frequency
-            if (current->wave.frequency == compare->wave.frequency &&
-                fabsf(current->wave.start_time - compare->wave.start_time) < 0.001f) {
-                
-                int phase_diff = abs(current->wave.phase - compare->wave.phase);
-                if (phase_diff > 180) phase_diff = 360 - phase_diff;
-                
-                // If phases are nearly opposite (around 180 degrees)
-                if (abs(phase_diff - 180) < (180 * tolerance)) {
-                    // Remove the weaker component
-                    if (current->wave.amplitude > compare->wave.amplitude) {
-                        // Remove compare node
-                        prev_compare->next = compare->next;
-                        if (compare == queue->tail) {
-                            queue->tail = prev_compare;
-                        }
-                        free(compare);
-                        compare = prev_compare->next;
-                        removed_count++;
-                        continue;
-                    }
-                }
-            }
+// Components this far apart in start time are never similar: the time term
+// drops to 0 and frequency and amplitude alone reach at most 2/3. Start times
+// are compared as float seconds, which still resolve them hours into a file.
+#define FILTER_SIMILARITY_SECONDS 0.1f
+#define FILTER_PHASE_SECONDS      0.001f
+
+void component_filter_init(ComponentFilter* filter, const EncodingConfig* config) {
+    memset(filter, 0, sizeof(ComponentFilter));
+    filter->frequency_min = config->frequency_min;
+    filter->frequency_max = config->frequency_max;
+    filter->amplitude_threshold = (int)(config->amplitude_threshold * 1000);  // Match our amplitude scaling
+    filter->phase_tolerance = config->phase_tolerance;
+    filter->similarity_threshold = config->similarity_threshold;
+    filter->bounded = config->similarity_threshold >= 2.0f / 3.0f;
+}
+
+void component_filter_free(ComponentFilter* filter) {
+    free(filter->phase_recent.waves);
+    free(filter->similar_recent.waves);
+    memset(filter, 0, sizeof(ComponentFilter));
+}
+
+// Forget entries that started at least horizon seconds before time
+static void recent_waves_expire(RecentWaves* recent, float time, float horizon) {
+    while (recent->count > 0 && time - (float)recent->waves[recent->first].start_time >= horizon) {
+        recent->first++;
+        recent->count--;
+    }
+}
+
+static int recent_waves_push(RecentWaves* recent, const SineWave* wave) {
+    // Slide the live entries back to the front before growing
+    if (recent->first + recent->count == recent->capacity && recent->first > 0) {
+        memmove(recent->waves, recent->waves + recent->first, recent->count * sizeof(SineWave));
+        recent->first = 0;
+    }
+    if (recent->count == recent->capacity) {
+        uint32_t capacity = recent->capacity ? recent->capacity * 2 : 256;
+        SineWave* waves = realloc(recent->waves, capacity * sizeof(SineWave));
+        if (!waves) return DFTA_ERROR_MEMORY;
+        recent->waves = waves;
+        recent->capacity = capacity;
+    }
+    recent->waves[recent->first + recent->count++] = *wave;
+    return DFTA_SUCCESS;
+}
+
+// Opposite-phase twin: an earlier, stronger component at the same frequency
+// and start time whose phase is nearly 180 degrees away
+static int has_opposite_phase(const ComponentFilter* filter, const SineWave* wave) {
+    const RecentWaves* recent = &filter->phase_recent;
+    for (uint32_t i = recent->first; i < recent->first + recent->count; i++) {
+        const SineWave* earlier = &recent->waves[i];
+        if (earlier->frequency == wave->frequency &&
+            fabsf((float)earlier->start_time - (float)wave->start_time) < FILTER_PHASE_SECONDS &&
+            earlier->amplitude > wave->amplitude) {
+            int phase_diff = abs(earlier->phase - wave->phase);
+            if (phase_diff > 180) phase_diff = 360 - phase_diff;
             
-            prev_compare = compare;
-            compare = compare->next;
+            // If phases are nearly opposite (around 180 degrees)
+            if (abs(phase_diff - 180) < (180 * filter->phase_tolerance)) return 1;
         }
-        current = current->next;
     }
-    
-    queue->count -= removed_count;
-    if (removed_count > 0) {
-        printf("Phase optimization: Removed %d opposite-phase components\n", removed_count);
+    return 0;
+}
+
+// An earlier kept component at least as strong and close enough in
+// frequency, amplitude and time
+static int has_similar(const ComponentFilter* filter, const SineWave* wave) {
+    const RecentWaves* recent = &filter->similar_recent;
+    for (uint32_t i = recent->first; i < recent->first + recent->count; i++) {
+        const SineWave* earlier = &recent->waves[i];
+        if (earlier->amplitude < wave->amplitude) continue;
+        
+        // Calculate similarity between waves
+        float freq_diff = fabsf((float)earlier->frequency - wave->frequency);
+        float amp_diff = fabsf((float)earlier->amplitude - wave->amplitude);
+        float time_diff = fabsf((float)earlier->start_time - (float)wave->start_time);
+        
+        // Normalize differences
+        float freq_sim = 1.0f - (freq_diff / fmaxf((float)earlier->frequency, (float)wave->frequency));
+        float amp_sim = 1.0f - (amp_diff / fmaxf((float)earlier->amplitude, (float)wave->amplitude));
+        float time_sim = time_diff < FILTER_SIMILARITY_SECONDS ? 1.0f : 0.0f;  // Must be very close in time
+        
+        float overall_similarity = (freq_sim + amp_sim + time_sim) / 3.0f;
+        if (overall_similarity > filter->similarity_threshold) return 1;
     }
+    return 0;
 }
 
-void apply_similarity_filtering(SineWaveQueue* queue, float threshold) {
-    if (!queue) return;
-    
-    int removed_count = 0;
-    SineWaveNode* current = queue->head;
+// Move the components of input that pass every filter to the end of output
+// and free the rest. Input must continue the start_time order of everything
+// the filter has seen, which window-by-window analysis guarantees; each
+// component is then only compared with the survivors of the last 0.1 s.
+int component_filter_apply(ComponentFilter* filter, SineWaveQueue* input, SineWaveQueue* output) {
+    int result = DFTA_SUCCESS;
+    SineWaveNode* current = input->head;
+    input->head = NULL;
+    input->tail = NULL;
+    input->count = 0;
     
     while (current) {
-        SineWaveNode* compare = current->next;
-        SineWaveNode* prev_compare = current;
+        SineWaveNode* next = current->next;
+        const SineWave* wave = &current->wave;
+        int keep = 0;
         
-        while (compare) {
-            // Calculate similarity between waves
-            float freq_diff = fabsf((float)current->wave.frequency - compare->wave.frequency);
-            float amp_diff = fabsf((float)current->wave.amplitude - compare->wave.amplitude);
-            float time_diff = fabsf(current->wave.start_time - compare->wave.start_time);
-            
-            // Normalize differences
-            float freq_sim = 1.0f - (freq_diff / fmaxf((float)current->wave.frequency, (float)compare->wave.frequency));
-            float amp_sim = 1.0f - (amp_diff / fmaxf((float)current->wave.amplitude, (float)compare->wave.amplitude));
-            float time_sim = time_diff < 0.1f ? 1.0f : 0.0f;  // Must be very close in time
-            
-            float overall_similarity = (freq_sim + amp_sim + time_sim) / 3.0f;
+        if (result != DFTA_SUCCESS) {
+            // Out of memory: drop the rest
+        } else if (wave->frequency < filter->frequency_min || wave->frequency > filter->frequency_max) {
+            filter->frequency_removed++;
+        } else if (wave->amplitude < filter->amplitude_threshold) {
+            filter->amplitude_removed++;
+        } else {
+            recent_waves_expire(&filter->phase_recent, (float)wave->start_time, FILTER_PHASE_SECONDS);
+            if (filter->bounded) {
+                recent_waves_expire(&filter->similar_recent, (float)wave->start_time, FILTER_SIMILARITY_SECONDS);
+            }
             
-            if (overall_similarity > threshold) {
-                // Merge or remove the weaker component
-                if (current->wave.amplitude >= compare->wave.amplitude) {
-                    // Remove compare node
-                    prev_compare->next = compare->next;
-                    if (compare == queue->tail) {
-                        queue->tail = prev_compare;
-                    }
-                    free(compare);
-                    compare = prev_compare->next;
-                    removed_count++;
-                    continue;
+            if (has_opposite_phase(filter, wave)) {
+                filter->phase_removed++;
+            } else {
+                result = recent_waves_push(&filter->phase_recent, wave);
+                if (result != DFTA_SUCCESS) {
+                    // Nothing to push onto
+                } else if (has_similar(filter, wave)) {
+                    filter->similarity_removed++;
+                } else {
+                    result = recent_waves_push(&filter->similar_recent, wave);
+                    keep = result == DFTA_SUCCESS;
                 }
             }
-            
-            prev_compare = compare;
-            compare = compare->next;
         }
-        current = current->next;
+        
+        if (keep) {
+            current->next = NULL;
+            if (output->tail) {
+                output->tail->next = current;
+            } else {
+                output->head = current;
+            }
+            output->tail = current;
+            output->count++;
+        } else {
+            free(current);
+        }
+        current = next;
     }
     
-    queue->count -= removed_count;
-    if (removed_count > 0) {
-        printf("Similarity filtering: Merged %d similar components\n", removed_count);
+    return result;
+}
+
+void component_filter_report(const ComponentFilter* filter) {
+    dfta_progress("Frequency filtering: Removed %d components outside %g-%g Hz range\n",
+                  filter->frequency_removed, filter->frequency_min, filter->frequency_max);
+    dfta_progress("Amplitude filtering: Removed %d low-amplitude components\n", filter->amplitude_removed);
+    if (filter->phase_removed > 0) {
+        dfta_progress("Phase optimization: Removed %d opposite-phase components\n", filter->phase_removed);
+    }
+    if (filter->similarity_removed > 0) {
+        dfta_progress("Similarity filtering: Merged %d similar components\n", filter->similarity_removed);
     }
 }
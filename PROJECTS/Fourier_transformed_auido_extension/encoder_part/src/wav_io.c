@@ -1,99 +1,537 @@
-
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
 #include "dfta.h"
 
-int read_wav_file(const char* filename, AudioData* audio_data) {
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __SSSE3__
+#include <tmmintrin.h>
+#endif
+
+// Frames read and converted per block; the block buffers are reused for the whole file
+#define INPUT_BLOCK_FRAMES 16384
+
+// Sample encodings wav_input_open understands
+#define WAV_SAMPLES_S16  0
+#define WAV_SAMPLES_S24  1
+#define WAV_SAMPLES_S32  2
+#define WAV_SAMPLES_F32  3
+
+// Signed 16-bit to float in [-1, 1); SSE2 widens eight samples per iteration
+static void convert_s16_to_float(const uint8_t* restrict input, float* restrict output, size_t count) {
+    size_t i = 0;
+    
+#ifdef __SSE2__
+    const __m128 v_scale = _mm_set1_ps(1.0f / 32768.0f);
+    for (; i + 8 <= count; i += 8) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(input + 2 * i));
+        __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+        __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+        _mm_storeu_ps(output + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), v_scale));
+        _mm_storeu_ps(output + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), v_scale));
+    }
+#endif
+    
+    for (; i < count; i++) {
+        int16_t sample = (int16_t)(input[2 * i] | input[2 * i + 1] << 8);
+        output[i] = sample / 32768.0f;
+    }
+}
+
+// Signed 32-bit to float. 24-bit samples are converted as the top three
+// bytes of a 32-bit value, which gives the same floats as dividing by 2^23.
+static void convert_s32_to_float(const uint8_t* restrict input, float* restrict output, size_t count) {
+    size_t i = 0;
+    
+#ifdef __SSE2__
+    const __m128 v_scale = _mm_set1_ps(1.0f / 2147483648.0f);
+    for (; i + 4 <= count; i += 4) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(input + 4 * i));
+        _mm_storeu_ps(output + i, _mm_mul_ps(_mm_cvtepi32_ps(x), v_scale));
+    }
+#endif
+    
+    for (; i < count; i++) {
+        uint32_t bits = (uint32_t)input[4 * i] | (uint32_t)input[4 * i + 1] << 8 |
+                        (uint32_t)input[4 * i + 2] << 16 | (uint32_t)input[4 * i + 3] << 24;
+        output[i] = (float)(int32_t)bits / 2147483648.0f;
+    }
+}
+
+// 24-bit sample at p in the top three bytes of a 32-bit value
+static inline int32_t load_s24_high(const uint8_t* p) {
+    return (int32_t)((uint32_t)p[0] << 8 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 24);
+}
+
+// Packed 24-bit to float, converted as the top of a 32-bit value. SSSE3
+// shuffles four samples into place per iteration; SSE2 gathers them.
+static void convert_s24_to_float(const uint8_t* restrict input, float* restrict output, size_t count) {
+    size_t i = 0;
+    
+#if defined(__SSSE3__)
+    const __m128 v_scale = _mm_set1_ps(1.0f / 2147483648.0f);
+    const __m128i v_shuffle = _mm_setr_epi8(-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11);
+    // Each load reads 16 bytes for 12 bytes of samples, so stop early enough
+    for (; i + 6 <= count; i += 4) {
+        __m128i x = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(input + 3 * i)), v_shuffle);
+        _mm_storeu_ps(output + i, _mm_mul_ps(_mm_cvtepi32_ps(x), v_scale));
+    }
+#elif defined(__SSE2__)
+    const __m128 v_scale = _mm_set1_ps(1.0f / 2147483648.0f);
+    for (; i + 4 <= count; i += 4) {
+        const uint8_t* p = input + 3 * i;
+        __m128i x = _mm_setr_epi32(load_s24_high(p), load_s24_high(p + 3),
+                                   load_s24_high(p + 6), load_s24_high(p + 9));
+        _mm_storeu_ps(output + i, _mm_mul_ps(_mm_cvtepi32_ps(x), v_scale));
+    }
+#endif
+    
+    for (; i < count; i++) {
+        output[i] = (float)load_s24_high(input + 3 * i) / 2147483648.0f;
+    }
+}
+
+static void convert_to_float(int encoding, const uint8_t* input, float* output, size_t count) {
+    switch (encoding) {
+        case WAV_SAMPLES_S16: convert_s16_to_float(input, output, count); break;
+        case WAV_SAMPLES_S24: convert_s24_to_float(input, output, count); break;
+        case WAV_SAMPLES_S32: convert_s32_to_float(input, output, count); break;
+        default: memcpy(output, input, count * sizeof(float)); break;
+    }
+}
+
+// Map the 'fmt ' chunk to a sample encoding, or -1 if it is not supported
+static int sample_encoding(const WAVFormat* format, const uint8_t* extension, uint32_t extension_size) {
+    uint16_t tag = format->format_type;
+    if (tag == WAV_FORMAT_EXTENSIBLE) {
+        // cbSize, valid bits and channel mask come before the sub-format GUID
+        if (extension_size < 24) return -1;
+        tag = (uint16_t)(extension[8] | extension[9] << 8);
+    }
+    
+    if (tag == WAV_FORMAT_PCM) {
+        if (format->bits_per_sample == 16) return WAV_SAMPLES_S16;
+        if (format->bits_per_sample == 24) return WAV_SAMPLES_S24;
+        if (format->bits_per_sample == 32) return WAV_SAMPLES_S32;
+    } else if (tag == WAV_FORMAT_IEEE_FLOAT && format->bits_per_sample == 32) {
+        return WAV_SAMPLES_F32;
+    }
+    return -1;
+}
+
+// Skip bytes of the input; a pipe cannot seek, so read them instead
+static int skip_bytes(FILE* file, uint32_t count) {
+    if (fseek(file, (long)count, SEEK_CUR) == 0) return 1;
+    uint8_t buffer[256];
+    while (count > 0) {
+        size_t step = count < sizeof(buffer) ? count : sizeof(buffer);
+        if (fread(buffer, 1, step, file) != step) return 0;
+        count -= (uint32_t)step;
+    }
+    return 1;
+}
+
+// Walk the RIFF chunks up to 'data', reading 'fmt ' on the way. Leaves the
+// file at the first sample and returns the size of the data chunk, or
+// UINT64_MAX when a streamed WAV leaves it open. RF64 and BW64 files (EBU
+// Tech 3306/3306-2) mark sizes past 4 GB as 0xFFFFFFFF and give them in
+// the ds64 chunk ahead of the others.
+static int read_wav_chunks(FILE* file, WAVFormat* format, int* encoding, uint64_t* data_size) {
+    char riff[12];
+    if (fread(riff, 1, sizeof(riff), file) != sizeof(riff) ||
+        (strncmp(riff, "RIFF", 4) != 0 && strncmp(riff, "RF64", 4) != 0 && strncmp(riff, "BW64", 4) != 0) ||
+        strncmp(riff + 8, "WAVE", 4) != 0) {
+        fprintf(stderr, "Error: Invalid WAV file format\n");
+        return DFTA_ERROR_FORMAT;
+    }
+    int extended = strncmp(riff, "RIFF", 4) != 0;
+    
+    int have_format = 0;
+    int have_ds64 = 0;
+    uint64_t ds64_data_size = 0;
+    WAVChunk chunk;
+    while (fread(&chunk, sizeof(WAVChunk), 1, file) == 1) {
+        if (strncmp(chunk.id, "data", 4) == 0) {
+            if (!have_format) break;
+            if (chunk.size != 0xFFFFFFFFu) {
+                *data_size = chunk.size;
+            } else {
+                *data_size = have_ds64 ? ds64_data_size : UINT64_MAX;
+            }
+            if (*data_size == 0 && !extended) *data_size = UINT64_MAX;
+            return DFTA_SUCCESS;
+        }
+        
+        if (strncmp(chunk.id, "ds64", 4) == 0 && extended && chunk.size >= sizeof(DS64Chunk)) {
+            DS64Chunk ds64;
+            if (fread(&ds64, sizeof(DS64Chunk), 1, file) != 1) break;
+            ds64_data_size = (uint64_t)ds64.data_size_high << 32 | ds64.data_size_low;
+            have_ds64 = 1;
+            uint32_t rest = chunk.size - (uint32_t)sizeof(DS64Chunk);
+            if (!skip_bytes(file, rest + (rest & 1))) break;
+            continue;
+        }
+        
+        if (strncmp(chunk.id, "fmt ", 4) == 0 && chunk.size >= sizeof(WAVFormat) && chunk.size <= 64) {
+            uint8_t body[64];
+            if (fread(body, 1, chunk.size, file) != chunk.size) break;
+            memcpy(format, body, sizeof(WAVFormat));
+            *encoding = sample_encoding(format, body + sizeof(WAVFormat),
+                                        chunk.size - (uint32_t)sizeof(WAVFormat));
+            have_format = 1;
+            if ((chunk.size & 1) && !skip_bytes(file, 1)) break;
+            continue;
+        }
+        
+        // Skip chunks we do not use (LIST, fact, ...); chunks are word aligned
+        if (chunk.size > UINT32_MAX - 1 || !skip_bytes(file, chunk.size + (chunk.size & 1))) break;
+    }
+    
+    fprintf(stderr, "Error: WAV file has no %s chunk\n", have_format ? "data" : "format");
+    return DFTA_ERROR_FORMAT;
+}
+
+// Read the chunks and check the format is one the encoder handles
+static int read_wav_header(FILE* file, WAVFormat* format, int* encoding, uint64_t* data_size) {
+    *encoding = -1;
+    *data_size = 0;
+    int result = read_wav_chunks(file, format, encoding, data_size);
+    if (result != DFTA_SUCCESS) {
+        return result;
+    }
+    
+    if (*encoding < 0) {
+        fprintf(stderr, "Error: Unsupported WAV encoding (format tag 0x%04x, %u bits); "
+                "16/24/32-bit PCM and 32-bit float are supported\n",
+                format->format_type, format->bits_per_sample);
+        return DFTA_ERROR_FORMAT;
+    }
+    
+    if (format->channels == 0 || format->channels > DFTA_MAX_CHANNELS) {
+        fprintf(stderr, "Error: Unsupported channel count %u (1 to %d supported)\n",
+                format->channels, DFTA_MAX_CHANNELS);
+        return DFTA_ERROR_FORMAT;
+    }
+    return DFTA_SUCCESS;
+}
+
+int wav_input_open(WAVInput* input, const char* filename, AudioData* audio_data) {
+    memset(input, 0, sizeof(WAVInput));
     FILE* file = fopen(filename, "rb");
     if (!file) {
         fprintf(stderr, "Error: Cannot open file %s\n", filename);
         return DFTA_ERROR_FILE_READ;
     }
     
-    WAVHeader header;
-    size_t read_count = fread(&header, sizeof(WAVHeader), 1, file);
-    if (read_count != 1) {
-        fprintf(stderr, "Error: Cannot read WAV header\n");
+    WAVFormat format;
+    int encoding;
+    uint64_t data_size;
+    int result = read_wav_header(file, &format, &encoding, &data_size);
+    if (result != DFTA_SUCCESS) {
         fclose(file);
-        return DFTA_ERROR_FILE_READ;
+        return result;
     }
     
-    // Validate WAV format
-    if (strncmp(header.riff, "RIFF", 4) != 0 || 
-        strncmp(header.wave, "WAVE", 4) != 0) {
-        fprintf(stderr, "Error: Invalid WAV file format\n");
-        fclose(file);
-        return DFTA_ERROR_FORMAT;
+    // The end of a file that can seek bounds the data up front, so the
+    // sample count is final before any sample is read. Streamed WAVs leave
+    // the data size open; read those to the end.
+    long data_start = ftell(file);
+    int seekable = 0;
+    uint64_t file_bytes = 0;    // Bytes from the first sample to the end of the file
+    if (data_start >= 0 && fseek(file, 0, SEEK_END) == 0) {
+        long end = ftell(file);
+        seekable = end >= 0 && fseek(file, data_start, SEEK_SET) == 0;
+        file_bytes = end > data_start ? (uint64_t)(end - data_start) : 0;
+    }
+    if (data_size == UINT64_MAX) {
+        data_size = seekable ? file_bytes : 0;
     }
     
-    // Only support PCM format for now
-    if (header.format_type != 1) {
-        fprintf(stderr, "Error: Only PCM WAV files are supported\n");
+    dfta_progress("WAV File Info:\n");
+    dfta_progress("  Sample Rate: %u Hz\n", format.sample_rate);
+    dfta_progress("  Channels: %u\n", format.channels);
+    dfta_progress("  Bits per Sample: %u%s\n", format.bits_per_sample,
+                  encoding == WAV_SAMPLES_F32 ? " (float)" : "");
+    dfta_progress("  Data Size: %llu bytes\n", (unsigned long long)data_size);
+    
+    // Calculate number of samples
+    uint32_t channels = format.channels;
+    uint32_t bytes_per_sample = format.bits_per_sample / 8;
+    uint32_t frame_bytes = bytes_per_sample * channels;
+    uint64_t total_samples = data_size / frame_bytes;
+    if (seekable && file_bytes / frame_bytes < total_samples) {
+        uint64_t present = file_bytes / frame_bytes;
+        fprintf(stderr, "Warning: WAV data is truncated (%llu of %llu samples present)\n",
+                (unsigned long long)present, (unsigned long long)total_samples);
+        total_samples = present;
+    }
+    if (total_samples > SIZE_MAX / sizeof(float) / channels) {
+        fprintf(stderr, "Error: WAV data does not fit in memory\n");
         fclose(file);
-        return DFTA_ERROR_FORMAT;
+        return DFTA_ERROR_MEMORY;
     }
     
-    printf("WAV File Info:\n");
-    printf("  Sample Rate: %u Hz\n", header.sample_rate);
-    printf("  Channels: %u\n", header.channels);
-    printf("  Bits per Sample: %u\n", header.bits_per_sample);
-    printf("  Data Size: %u bytes\n", header.data_size);
+    // The samples go into the input's planes as they are loaded
+    audio_data->samples = NULL;
+    audio_data->sample_count = total_samples;
+    audio_data->sample_rate = format.sample_rate;
+    audio_data->channels = format.channels;
+    audio_data->bits_per_sample = format.bits_per_sample;
     
-    // Calculate number of samples
-    uint32_t bytes_per_sample = header.bits_per_sample / 8;
-    uint32_t total_samples = header.data_size / (bytes_per_sample * header.channels);
+    input->file = file;
+    input->audio = audio_data;
+    input->encoding = encoding;
+    input->channels = format.channels;
+    input->frame_bytes = frame_bytes;
+    input->data_start = data_start;
+    input->seekable = seekable;
     
-    // Allocate memory for samples
-    audio_data->samples = malloc(total_samples * sizeof(float));
-    if (!audio_data->samples) {
-        fprintf(stderr, "Error: Memory allocation failed\n");
-        fclose(file);
+    // The data is read ahead in large buffers while earlier blocks convert.
+    // Mono float is already what analysis reads and is loaded straight into
+    // place; other blocks are converted interleaved and then scattered into
+    // the channel planes.
+    input->io = async_reader_open(file, total_samples * frame_bytes);
+    if (encoding != WAV_SAMPLES_F32 || channels > 1) {
+        input->raw = malloc((size_t)INPUT_BLOCK_FRAMES * frame_bytes);
+        input->interleaved = channels > 1 ? malloc((size_t)INPUT_BLOCK_FRAMES * channels * sizeof(float)) : NULL;
+    }
+    if (!input->io || ((encoding != WAV_SAMPLES_F32 || channels > 1) && !input->raw) ||
+        (channels > 1 && !input->interleaved)) {
+        wav_input_close(input);
         return DFTA_ERROR_MEMORY;
     }
     
-    // Read and convert samples to float
-    if (header.bits_per_sample == 16) {
-        int16_t* temp_buffer = malloc(header.data_size);
-        if (!temp_buffer) {
-            free(audio_data->samples);
-            fclose(file);
-            return DFTA_ERROR_MEMORY;
+    // A pipe's data may still end early; read it all now so the count holds
+    if (!seekable) {
+        result = wav_input_load(input, total_samples);
+        if (result == DFTA_ERROR_MEMORY) {
+            wav_input_close(input);
+            return result;
         }
-        
-        fread(temp_buffer, 1, header.data_size, file);
-        
-        // Convert 16-bit samples to float and mix channels if stereo
-        for (uint32_t i = 0; i < total_samples; i++) {
-            if (header.channels == 1) {
-                audio_data->samples[i] = temp_buffer[i] / 32768.0f;
+        if (result != DFTA_SUCCESS) {
+            wav_input_truncate(input);
+        }
+    }
+    return DFTA_SUCCESS;
+}
+
+// Make room in the planes for the frames up to end. They at least double
+// when they grow, but never past the frames left in the file, so planes
+// that end up holding a whole file are exactly its length.
+static int reserve_planes(WAVInput* input, uint64_t end) {
+    uint64_t needed = end - input->first;
+    if (needed <= input->capacity) return DFTA_SUCCESS;
+    
+    uint64_t capacity = 2 * input->capacity;
+    if (capacity < needed) capacity = needed;
+    if (capacity > input->audio->sample_count - input->first) {
+        capacity = input->audio->sample_count - input->first;
+    }
+    float* planes = realloc(input->planes, (size_t)capacity * input->channels * sizeof(float));
+    if (!planes) {
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        return DFTA_ERROR_MEMORY;
+    }
+    
+    // Move the planes up to their new places, the last first so none lands
+    // on one still to move
+    uint64_t held = input->loaded - input->first;
+    for (uint32_t c = input->channels; c-- > 1;) {
+        memmove(planes + (size_t)c * capacity, planes + (size_t)c * input->capacity, (size_t)held * sizeof(float));
+    }
+    input->planes = planes;
+    input->capacity = capacity;
+    return DFTA_SUCCESS;
+}
+
+// Read and convert frames until the first frames are in the planes, or the
+// data ends. Returns DFTA_ERROR_FILE_READ if it ends before the sample count.
+int wav_input_load(WAVInput* input, uint64_t frames) {
+    uint64_t total_samples = input->audio->sample_count;
+    if (frames > total_samples) frames = total_samples;
+    if (frames <= input->loaded) return DFTA_SUCCESS;
+    
+    int result = reserve_planes(input, frames);
+    if (result != DFTA_SUCCESS) return result;
+    
+    while (input->loaded < frames) {
+        uint64_t held = input->loaded - input->first;
+        uint64_t count = frames - input->loaded;
+        if (!input->raw) {
+            count = async_read(input->io, input->planes + held, (size_t)count * sizeof(float)) / sizeof(float);
+        } else {
+            if (count > INPUT_BLOCK_FRAMES) count = INPUT_BLOCK_FRAMES;
+            count = async_read(input->io, input->raw, (size_t)count * input->frame_bytes) / input->frame_bytes;
+            
+            uint32_t channels = input->channels;
+            if (channels == 1) {
+                convert_to_float(input->encoding, input->raw, input->planes + held, (size_t)count);
             } else {
-                // Mix stereo to mono
-                float left = temp_buffer[i * 2] / 32768.0f;
-                float right = temp_buffer[i * 2 + 1] / 32768.0f;
-                audio_data->samples[i] = (left + right) / 2.0f;
+                convert_to_float(input->encoding, input->raw, input->interleaved, (size_t)count * channels);
+                for (uint32_t c = 0; c < channels; c++) {
+                    float* plane = input->planes + (size_t)c * input->capacity + held;
+                    for (uint64_t i = 0; i < count; i++) {
+                        plane[i] = input->interleaved[(size_t)i * channels + c];
+                    }
+                }
             }
         }
-        
-        free(temp_buffer);
-    } else {
-        fprintf(stderr, "Error: Only 16-bit WAV files are supported\n");
-        free(audio_data->samples);
-        fclose(file);
-        return DFTA_ERROR_FORMAT;
+        if (count == 0) return DFTA_ERROR_FILE_READ;
+        input->loaded += count;
     }
+    return DFTA_SUCCESS;
+}
+
+// Drop the frames before the given one from the planes, once nothing reads
+// them any more. The frames still held move to the start of each plane.
+void wav_input_discard(WAVInput* input, uint64_t frames) {
+    if (frames > input->loaded) frames = input->loaded;
+    if (frames <= input->first) return;
     
-    audio_data->sample_count = total_samples;
-    audio_data->sample_rate = header.sample_rate;
-    audio_data->channels = header.channels;
-    audio_data->bits_per_sample = header.bits_per_sample;
+    uint64_t dropped = frames - input->first;
+    uint64_t held = input->loaded - frames;
+    for (uint32_t c = 0; c < input->channels; c++) {
+        float* plane = input->planes + (size_t)c * input->capacity;
+        memmove(plane, plane + dropped, (size_t)held * sizeof(float));
+    }
+    input->first = frames;
+}
+
+// Start reading again from the first frame, for another pass over the
+// data. Only a file that can seek can go back past discarded frames.
+int wav_input_rewind(WAVInput* input) {
+    if (input->first == 0) return DFTA_SUCCESS;
+    if (!input->seekable) return DFTA_ERROR_FILE_READ;
     
-    fclose(file);
-    printf("Successfully loaded %u samples\n", total_samples);
+    int result = async_io_close(input->io);
+    input->io = NULL;
+    if (result != DFTA_SUCCESS || fseek(input->file, input->data_start, SEEK_SET) != 0) {
+        fprintf(stderr, "Error: Cannot read the WAV data again\n");
+        return DFTA_ERROR_FILE_READ;
+    }
+    input->io = async_reader_open(input->file, input->audio->sample_count * input->frame_bytes);
+    if (!input->io) return DFTA_ERROR_MEMORY;
+    input->first = 0;
+    input->loaded = 0;
+    return DFTA_SUCCESS;
+}
+
+// Cut the audio down to the frames loaded when the data ended early. Only
+// called with every frame from the first still held; the planes are closed
+// up to the new length.
+void wav_input_truncate(WAVInput* input) {
+    AudioData* audio_data = input->audio;
+    uint64_t loaded = input->loaded;
+    if (loaded >= audio_data->sample_count) return;
+    
+    fprintf(stderr, "Warning: WAV data is truncated (%llu of %llu samples present)\n",
+            (unsigned long long)loaded, (unsigned long long)audio_data->sample_count);
+    for (uint32_t c = 1; c < input->channels; c++) {
+        memmove(input->planes + (size_t)c * loaded,
+                input->planes + (size_t)c * input->capacity, (size_t)loaded * sizeof(float));
+    }
+    if (input->capacity > loaded) input->capacity = loaded;
+    audio_data->sample_count = loaded;
+}
+
+void wav_input_close(WAVInput* input) {
+    if (input->io && async_io_close(input->io) != DFTA_SUCCESS) {
+        fprintf(stderr, "Warning: Read error in WAV data\n");
+    }
+    if (input->file) {
+        fclose(input->file);
+    }
+    free(input->planes);
+    free(input->raw);
+    free(input->interleaved);
+    memset(input, 0, sizeof(WAVInput));
+}
+
+int read_wav_file(const char* filename, AudioData* audio_data) {
+    WAVInput input;
+    int result = wav_input_open(&input, filename, audio_data);
+    if (result != DFTA_SUCCESS) {
+        return result;
+    }
+    
+    // Held whole, the planes are the file's length apart and become the
+    // audio data's samples
+    result = wav_input_load(&input, audio_data->sample_count);
+    if (result == DFTA_ERROR_FILE_READ) {
+        wav_input_truncate(&input);
+        result = DFTA_SUCCESS;
+    }
+    if (result == DFTA_SUCCESS && !input.planes) {
+        input.planes = malloc(input.channels * sizeof(float));
+        if (!input.planes) result = DFTA_ERROR_MEMORY;
+    }
+    if (result != DFTA_SUCCESS) {
+        wav_input_close(&input);
+        return result;
+    }
+    audio_data->samples = input.planes;
+    input.planes = NULL;
+    wav_input_close(&input);
+    dfta_progress("Successfully loaded %llu samples\n", (unsigned long long)audio_data->sample_count);
+    return DFTA_SUCCESS;
+}
+
+int wav_stream_open(WAVStream* stream, FILE* file, uint32_t block_frames) {
+    memset(stream, 0, sizeof(WAVStream));
+    
+    WAVFormat format;
+    uint64_t data_size;
+    int result = read_wav_header(file, &format, &stream->encoding, &data_size);
+    if (result != DFTA_SUCCESS) {
+        return result;
+    }
+    
+    stream->file = file;
+    stream->sample_rate = format.sample_rate;
+    stream->channels = format.channels;
+    stream->bits_per_sample = format.bits_per_sample;
+    stream->frame_bytes = (uint32_t)format.bits_per_sample / 8 * format.channels;
+    stream->remaining = data_size;
+    stream->block_frames = block_frames;
+    stream->raw = malloc((size_t)block_frames * stream->frame_bytes);
+    stream->interleaved = malloc((size_t)block_frames * stream->channels * sizeof(float));
+    if (!stream->raw || !stream->interleaved) {
+        wav_stream_close(stream);
+        return DFTA_ERROR_MEMORY;
+    }
     return DFTA_SUCCESS;
 }
 
+// Read up to frames (at most block_frames) into the channel planes. Fewer
+// come back only at the end of the data or when the read is interrupted.
+uint32_t wav_stream_read(WAVStream* stream, float* const* planes, uint32_t frames) {
+    if (frames > stream->block_frames) frames = stream->block_frames;
+    if ((uint64_t)frames * stream->frame_bytes > stream->remaining) {
+        frames = (uint32_t)(stream->remaining / stream->frame_bytes);
+    }
+    
+    uint32_t got = (uint32_t)fread(stream->raw, stream->frame_bytes, frames, stream->file);
+    stream->remaining -= (uint64_t)got * stream->frame_bytes;
+    
+    convert_to_float(stream->encoding, stream->raw, stream->interleaved, (size_t)got * stream->channels);
+    for (uint32_t c = 0; c < stream->channels; c++) {
+        for (uint32_t i = 0; i < got; i++) {
+            planes[c][i] = stream->interleaved[(size_t)i * stream->channels + c];
+        }
+    }
+    return got;
+}
+
+void wav_stream_close(WAVStream* stream) {
+    free(stream->raw);
+    free(stream->interleaved);
+    stream->raw = NULL;
+    stream->interleaved = NULL;
+}
+
 void free_audio_data(AudioData* audio_data) {
     if (audio_data && audio_data->samples) {
         free(audio_data->samples);
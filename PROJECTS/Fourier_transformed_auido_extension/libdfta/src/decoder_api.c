@@ -0,0 +1,156 @@
+
+// fmemopen/sysconf need POSIX declarations under -std=c99
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "dfta.h"
+#include "libdfta.h"
+
+// Frames converted to interleaved float per pass
+#define OUTPUT_BLOCK_FRAMES 4096
+
+struct DftaDecoder {
+    DecodingConfig config;
+    WorkerPool* pool;
+    float* output;              // Interleaved samples of the last call, grown as needed
+    size_t output_capacity;     // Samples output can hold
+    uint8_t* scratch;           // One plane of a block, for interleaving
+};
+
+void dfta_decoder_default_options(DftaDecoderOptions* options) {
+    options->synthesis_mode = DFTA_SYNTHESIS_ACCURATE;
+    options->threads = 0;
+    options->max_components_per_frame = 0;
+    options->cpu_budget = 0.0f;
+    options->output_rate = 0;
+    options->time_scale = 1.0f;
+    options->pitch_scale = 1.0f;
+}
+
+// Time and pitch scales: 0 leaves the signal unchanged, like 1
+static int valid_scale(float scale) {
+    return scale == 0.0f || (scale >= 0.25f && scale <= 4.0f);
+}
+
+DftaDecoder* dfta_decoder_create(const DftaDecoderOptions* options) {
+    DftaDecoderOptions defaults;
+    if (!options) {
+        dfta_decoder_default_options(&defaults);
+        options = &defaults;
+    }
+    if (options->synthesis_mode < DFTA_SYNTHESIS_ACCURATE ||
+        options->synthesis_mode > DFTA_SYNTHESIS_FAST_NOINTERP ||
+        options->threads < 0 || options->threads > DFTA_MAX_THREADS ||
+        options->max_components_per_frame < 0 || !(options->cpu_budget >= 0.0f && options->cpu_budget <= 1.0f) ||
+        (options->output_rate != 0 && (options->output_rate < 1000 || options->output_rate > 768000)) ||
+        !valid_scale(options->time_scale) || !valid_scale(options->pitch_scale)) {
+        return NULL;
+    }
+    
+    DftaDecoder* decoder = calloc(1, sizeof(DftaDecoder));
+    if (!decoder) return NULL;
+    
+    int threads = options->threads;
+    if (threads == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (int)cpus : 1;
+    }
+    decoder->pool = worker_pool_create(threads);
+    decoder->scratch = malloc(OUTPUT_BLOCK_FRAMES * sizeof(float));
+    if (!decoder->pool || !decoder->scratch) {
+        dfta_decoder_destroy(decoder);
+        return NULL;
+    }
+    crc32c_init();
+    
+    decoder->config.start_time = 0.0f;
+    decoder->config.end_time = -1.0f;
+    decoder->config.synthesis_mode = options->synthesis_mode;
+    decoder->config.dither = 0;
+    decoder->config.sample_format = SAMPLE_FORMAT_F32;
+    decoder->config.threads = threads;
+    decoder->config.max_components_per_frame = (uint32_t)options->max_components_per_frame;
+    decoder->config.cpu_budget = options->cpu_budget;
+    decoder->config.output_rate = (uint32_t)options->output_rate;
+    decoder->config.time_scale = options->time_scale;
+    decoder->config.pitch_scale = options->pitch_scale;
+    decoder->config.pool = decoder->pool;
+    return decoder;
+}
+
+void dfta_decoder_destroy(DftaDecoder* decoder) {
+    if (!decoder) return;
+    worker_pool_destroy(decoder->pool);
+    free(decoder->output);
+    free(decoder->scratch);
+    free(decoder);
+}
+
+int dfta_decode_range(DftaDecoder* decoder, const uint8_t* ftae, size_t ftae_size,
+                      float start_time, float end_time, DftaAudio* audio) {
+    if (!decoder || !ftae || ftae_size == 0 || !audio || start_time < 0.0f ||
+        (end_time > 0.0f && end_time <= start_time)) {
+        return DFTA_ERROR_FORMAT;
+    }
+    memset(audio, 0, sizeof(DftaAudio));
+    
+    // The reader seeks and reads; fmemopen serves it straight from the
+    // caller's buffer, which is only read
+    FILE* input = fmemopen((void*)ftae, ftae_size, "rb");
+    if (!input) return DFTA_ERROR_MEMORY;
+    
+    DecodingConfig config = decoder->config;
+    config.start_time = start_time;
+    config.end_time = end_time > 0.0f ? end_time : -1.0f;
+    
+    ChannelComponents components = {0};
+    AudioData audio_data = {0};
+    int result = read_ftae_stream(input, &components, &audio_data, &config);
+    fclose(input);
+    if (result == DFTA_SUCCESS) {
+        result = synthesize_audio_channels(&components, &audio_data, config.synthesis_mode, decoder->pool);
+    }
+    free_channel_components(&components);
+    
+    size_t total = (size_t)audio_data.sample_count * audio_data.channels;
+    if (result == DFTA_SUCCESS && total > decoder->output_capacity) {
+        float* output = realloc(decoder->output, total * sizeof(float));
+        if (output) {
+            decoder->output = output;
+            decoder->output_capacity = total;
+        } else {
+            result = DFTA_ERROR_MEMORY;
+        }
+    }
+    if (result != DFTA_SUCCESS) {
+        free_audio_data(&audio_data);
+        return result;
+    }
+    
+    // Same normalization and interleaving as the decoder's float WAV output
+    float scale = 1.0f;
+    if (audio_data.peak_amplitude > 1.0f) {
+        scale = 0.95f / audio_data.peak_amplitude;
+    }
+    for (uint32_t pos = 0; pos < audio_data.sample_count; pos += OUTPUT_BLOCK_FRAMES) {
+        uint32_t frames = (uint32_t)(audio_data.sample_count - pos);
+        if (frames > OUTPUT_BLOCK_FRAMES) frames = OUTPUT_BLOCK_FRAMES;
+        convert_planes(audio_data.samples + pos, audio_data.sample_count, audio_data.channels,
+                       SAMPLE_FORMAT_F32, (uint8_t*)(decoder->output + (size_t)pos * audio_data.channels),
+                       decoder->scratch, frames, scale, NULL);
+    }
+    
+    audio->samples = decoder->output;
+    audio->frames = (uint32_t)audio_data.sample_count;
+    audio->channels = audio_data.channels;
+    audio->sample_rate = audio_data.sample_rate;
+    free_audio_data(&audio_data);
+    return DFTA_SUCCESS;
+}
+
+int dfta_decode(DftaDecoder* decoder, const uint8_t* ftae, size_t ftae_size, DftaAudio* audio) {
+    return dfta_decode_range(decoder, ftae, ftae_size, 0.0f, -1.0f, audio);
+}
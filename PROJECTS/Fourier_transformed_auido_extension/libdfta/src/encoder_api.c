@@ -0,0 +1,137 @@
+
+// open_memstream/sysconf need POSIX declarations under -std=c99
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "dfta.h"
+#include "libdfta.h"
+
+struct DftaEncoder {
+    EncoderContext context;
+    EncodingConfig config;
+    float* planes;              // Deinterleaved input, grown as needed
+    size_t plane_capacity;      // Samples planes can hold
+    char* output;               // FTAE image of the last call
+};
+
+void dfta_encoder_default_options(DftaEncoderOptions* options) {
+    options->compression_level = DFTA_COMPRESSION_MEDIUM;
+    options->amplitude_threshold = 0.01f;
+    options->frequency_min = 20.0f;
+    options->frequency_max = 20000.0f;
+    options->range_coding = 1;
+    options->stereo_coding = DFTA_STEREO_AUTO;
+    options->masking = 1;
+    options->stationary = 1;
+    options->threads = 0;
+}
+
+DftaEncoder* dfta_encoder_create(const DftaEncoderOptions* options) {
+    DftaEncoderOptions defaults;
+    if (!options) {
+        dfta_encoder_default_options(&defaults);
+        options = &defaults;
+    }
+    if (options->compression_level < DFTA_COMPRESSION_LOW || options->compression_level > DFTA_COMPRESSION_HIGH ||
+        options->stereo_coding < DFTA_STEREO_AUTO || options->stereo_coding > DFTA_STEREO_MS ||
+        !(options->amplitude_threshold > 0.0f) || options->frequency_min >= options->frequency_max) {
+        return NULL;
+    }
+    
+    DftaEncoder* encoder = calloc(1, sizeof(DftaEncoder));
+    if (!encoder) return NULL;
+    
+    // Channels are the unit of parallel work, so more threads than channels
+    // would only sit idle
+    int threads = options->threads;
+    if (threads <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (int)cpus : 1;
+    }
+    if (threads > DFTA_MAX_CHANNELS) threads = DFTA_MAX_CHANNELS;
+    if (encoder_context_init(&encoder->context, threads) != DFTA_SUCCESS) {
+        free(encoder);
+        return NULL;
+    }
+    
+    encoder->config.compression_level = options->compression_level;
+    encoder->config.amplitude_threshold = options->amplitude_threshold;
+    encoder->config.frequency_min = options->frequency_min;
+    encoder->config.frequency_max = options->frequency_max;
+    encoder->config.phase_tolerance = 0.1f;
+    encoder->config.similarity_threshold = 0.95f;
+    encoder->config.output_format = FTAE_FORMAT_PACKED;
+    encoder->config.entropy_coding = options->range_coding ? ENTROPY_RANGE : ENTROPY_NONE;
+    encoder->config.stereo_coding = options->stereo_coding;
+    encoder->config.masking = options->masking != 0;
+    encoder->config.deduplicate = 1;
+    encoder->config.stationary = options->stationary != 0;
+    return encoder;
+}
+
+void dfta_encoder_destroy(DftaEncoder* encoder) {
+    if (!encoder) return;
+    encoder_context_free(&encoder->context);
+    free(encoder->planes);
+    free(encoder->output);
+    free(encoder);
+}
+
+int dfta_encode(DftaEncoder* encoder, const DftaAudio* audio, const uint8_t** ftae, size_t* ftae_size) {
+    if (!encoder || !audio || !audio->samples || !ftae || !ftae_size ||
+        audio->channels == 0 || audio->channels > DFTA_MAX_CHANNELS ||
+        audio->frames == 0 || audio->sample_rate == 0) {
+        return DFTA_ERROR_FORMAT;
+    }
+    *ftae = NULL;
+    *ftae_size = 0;
+    free(encoder->output);
+    encoder->output = NULL;
+    
+    // Analysis works on one plane per channel, and mid/side coding rewrites
+    // them, so the input is deinterleaved into the handle's buffer
+    size_t total = (size_t)audio->frames * audio->channels;
+    if (total > encoder->plane_capacity) {
+        float* planes = realloc(encoder->planes, total * sizeof(float));
+        if (!planes) return DFTA_ERROR_MEMORY;
+        encoder->planes = planes;
+        encoder->plane_capacity = total;
+    }
+    for (uint16_t c = 0; c < audio->channels; c++) {
+        float* plane = encoder->planes + (size_t)c * audio->frames;
+        const float* input = audio->samples + c;
+        for (uint32_t i = 0; i < audio->frames; i++) {
+            plane[i] = input[(size_t)i * audio->channels];
+        }
+    }
+    
+    AudioData audio_data;
+    audio_data.samples = encoder->planes;
+    audio_data.sample_count = audio->frames;
+    audio_data.sample_rate = audio->sample_rate;
+    audio_data.channels = audio->channels;
+    audio_data.bits_per_sample = 32;
+    
+    // The FTAE writer only appends, so a memory stream stands in for the file
+    char* buffer = NULL;
+    size_t size = 0;
+    FILE* output = open_memstream(&buffer, &size);
+    if (!output) return DFTA_ERROR_MEMORY;
+    
+    int result = encode_audio(&encoder->context, &audio_data, output, &encoder->config);
+    if (fclose(output) != 0 && result == DFTA_SUCCESS) {
+        result = DFTA_ERROR_MEMORY;
+    }
+    if (result != DFTA_SUCCESS) {
+        free(buffer);
+        return result;
+    }
+    
+    encoder->output = buffer;
+    *ftae = (const uint8_t*)buffer;
+    *ftae_size = size;
+    return DFTA_SUCCESS;
+}
@@ -0,0 +1,103 @@
+
+#ifndef LIBDFTA_H
+#define LIBDFTA_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// libdfta: in-memory D-FTA encoding and decoding.
+//
+// Encoder and decoder handles keep their FFT tables, scratch buffers and
+// worker threads between calls, so one handle can serve many requests. A
+// handle must not be used by two threads at once; give each thread its own.
+// The library never writes to stdout. Errors are returned as DFTA_* codes,
+// with a diagnostic on stderr where the command line tools print one.
+
+// Error codes (same values as the command line tools)
+#define DFTA_SUCCESS           0
+#define DFTA_ERROR_FILE_READ   1   // Input buffer truncated or unreadable
+#define DFTA_ERROR_FILE_WRITE  2   // Output could not be produced
+#define DFTA_ERROR_MEMORY      3
+#define DFTA_ERROR_FORMAT      4   // Invalid input or options
+
+// Encoder settings
+#define DFTA_COMPRESSION_LOW     0
+#define DFTA_COMPRESSION_MEDIUM  1
+#define DFTA_COMPRESSION_HIGH    2
+
+#define DFTA_STEREO_AUTO         0   // Mid/side for pairs whose side signal is weak
+#define DFTA_STEREO_LR           1   // Every channel coded on its own
+#define DFTA_STEREO_MS           2   // Mid/side for every channel pair
+
+// Decoder settings
+#define DFTA_SYNTHESIS_ACCURATE       0
+#define DFTA_SYNTHESIS_FAST           1
+#define DFTA_SYNTHESIS_FAST_NOINTERP  2
+
+// Interleaved float PCM: frames * channels samples, nominally in [-1, 1]
+typedef struct {
+    const float* samples;
+    uint32_t frames;
+    uint16_t channels;          // 1 to 8
+    uint32_t sample_rate;
+} DftaAudio;
+
+typedef struct {
+    int compression_level;      // DFTA_COMPRESSION_*
+    float amplitude_threshold;  // Components weaker than this are dropped
+    float frequency_min;        // Hz
+    float frequency_max;        // Hz
+    int range_coding;           // Range code frames (1) or bit-pack them (0)
+    int stereo_coding;          // DFTA_STEREO_*
+    int masking;                // Drop components the psychoacoustic model finds inaudible (1) or keep them (0)
+    int stationary;             // Skip silent windows and extend components over stationary ones (1) or analyse all (0)
+    int threads;                // Analysis threads kept by the handle (0 = one per CPU, at most 8)
+} DftaEncoderOptions;
+
+typedef struct {
+    int synthesis_mode;         // DFTA_SYNTHESIS_*
+    int threads;                // Unpack and synthesis threads kept by the handle (0 = one per CPU)
+    int max_components_per_frame;   // Strongest components synthesized per frame (0 = all)
+    float cpu_budget;           // Share of each frame's components synthesized, 0..1 (0 = all)
+    int output_rate;            // Sample rate of the decoded audio, 1000..768000 Hz (0 = the file's rate)
+    float time_scale;           // Output duration over the original, 0.25..4 (0 or 1 = unchanged)
+    float pitch_scale;          // Frequency factor, 0.25..4 (0 or 1 = unchanged)
+} DftaDecoderOptions;
+
+typedef struct DftaEncoder DftaEncoder;
+typedef struct DftaDecoder DftaDecoder;
+
+// Defaults match the command line tools
+void dfta_encoder_default_options(DftaEncoderOptions* options);
+void dfta_decoder_default_options(DftaDecoderOptions* options);
+
+// options may be NULL for the defaults. Returns NULL on allocation failure
+// or invalid options.
+DftaEncoder* dfta_encoder_create(const DftaEncoderOptions* options);
+void dfta_encoder_destroy(DftaEncoder* encoder);
+
+// Encode audio into a version 4 FTAE image. *ftae points into the handle and
+// stays valid until the next dfta_encode call on it or its destruction.
+int dfta_encode(DftaEncoder* encoder, const DftaAudio* audio, const uint8_t** ftae, size_t* ftae_size);
+
+DftaDecoder* dfta_decoder_create(const DftaDecoderOptions* options);
+void dfta_decoder_destroy(DftaDecoder* decoder);
+
+// Decode an FTAE image (any version). audio->samples points into the handle
+// and stays valid until the next decode call on it or its destruction.
+// Samples are scaled exactly as the decoder's float WAV output.
+int dfta_decode(DftaDecoder* decoder, const uint8_t* ftae, size_t ftae_size, DftaAudio* audio);
+
+// Decode only [start_time, end_time) seconds; end_time <= 0 means the end
+int dfta_decode_range(DftaDecoder* decoder, const uint8_t* ftae, size_t ftae_size,
+                      float start_time, float end_time, DftaAudio* audio);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LIBDFTA_H